@@ -0,0 +1,200 @@
+#include "../tftp_common/details/coroutine.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace tftp_common;
+using namespace tftp_common::async;
+
+using Clock = Executor::Clock;
+
+namespace {
+
+constexpr std::size_t TransfersCount = 32;
+constexpr std::size_t FileSize = 4 * 1024 * 1024;
+constexpr std::size_t BlockSize = 1428;
+
+sockaddr_in makeLoopback() {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return Address;
+}
+
+sockaddr_in getLocalAddress(int Descriptor) {
+    sockaddr_in Local{};
+    socklen_t Length = sizeof(Local);
+    ::getsockname(Descriptor, reinterpret_cast<sockaddr *>(&Local), &Length);
+    return Local;
+}
+
+int makeSocket(bool NonBlocking) {
+    auto Descriptor = ::socket(AF_INET, SOCK_DGRAM | (NonBlocking ? SOCK_NONBLOCK : 0), 0);
+    auto Local = makeLoopback();
+    ::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Local), sizeof(Local));
+    return Descriptor;
+}
+
+std::size_t readBlock(const std::vector<std::uint8_t> &Contents, std::uint64_t Offset, std::uint8_t *Buffer,
+                      std::size_t Size) {
+    auto Count = std::min<std::size_t>(Size, Contents.size() - Offset);
+    std::copy_n(Contents.begin() + Offset, Count, Buffer);
+    return Count;
+}
+
+/// Lock-step client acknowledging every block, it waits for the first block on the socket it was given
+void download(int Descriptor) {
+    std::vector<std::uint8_t> Buffer(BlockSize + 4);
+    while (true) {
+        sockaddr_in From{};
+        socklen_t Length = sizeof(From);
+        auto Size = ::recvfrom(Descriptor, Buffer.data(), Buffer.size(), 0, reinterpret_cast<sockaddr *>(&From),
+                               &Length);
+        if (Size < 4) {
+            continue;
+        }
+        std::uint8_t Acknowledgment[4] = {0, packets::types::AcknowledgmentPacket, Buffer[2], Buffer[3]};
+        ::sendto(Descriptor, Acknowledgment, sizeof(Acknowledgment), 0, reinterpret_cast<const sockaddr *>(&From),
+                 Length);
+        if (static_cast<std::size_t>(Size) - 4 < BlockSize) {
+            return;
+        }
+    }
+}
+
+/// Transfer served by the hand-written reactor: the state that the coroutine keeps on its frame
+struct Transfer {
+    int Descriptor;
+    sockaddr_in Client;
+    std::uint16_t Block = 0;
+    std::uint64_t Offset = 0;
+    std::size_t Size = 0;
+    std::vector<std::uint8_t> Packet;
+    Clock::time_point Deadline;
+    bool Done = false;
+};
+
+void sendBlock(Transfer &State, const std::vector<std::uint8_t> &Contents) {
+    ++State.Block;
+    State.Packet.resize(BlockSize + 4);
+    State.Size = readBlock(Contents, State.Offset, State.Packet.data() + 4, BlockSize);
+    State.Packet.resize(State.Size + 4);
+    State.Packet[0] = 0;
+    State.Packet[1] = packets::types::DataPacket;
+    State.Packet[2] = static_cast<std::uint8_t>(State.Block >> 8);
+    State.Packet[3] = static_cast<std::uint8_t>(State.Block);
+    ::sendto(State.Descriptor, State.Packet.data(), State.Packet.size(), 0,
+             reinterpret_cast<const sockaddr *>(&State.Client), sizeof(State.Client));
+    State.Deadline = Clock::now() + std::chrono::seconds(1);
+}
+
+/// Serve all transfers with a level-triggered epoll loop and explicit per-transfer state machines
+void serveReactor(std::vector<Transfer> &Transfers, const std::vector<std::uint8_t> &Contents) {
+    auto Descriptor = ::epoll_create1(0);
+    for (auto &State : Transfers) {
+        epoll_event Event{};
+        Event.events = EPOLLIN;
+        Event.data.ptr = &State;
+        ::epoll_ctl(Descriptor, EPOLL_CTL_ADD, State.Descriptor, &Event);
+        sendBlock(State, Contents);
+    }
+    std::size_t Remaining = Transfers.size();
+    std::array<epoll_event, 64> Events;
+    std::uint8_t Buffer[516];
+    while (Remaining != 0) {
+        auto Count = ::epoll_wait(Descriptor, Events.data(), static_cast<int>(Events.size()), 100);
+        for (int Idx = 0; Idx < Count; ++Idx) {
+            auto &State = *static_cast<Transfer *>(Events[Idx].data.ptr);
+            auto Size = ::recv(State.Descriptor, Buffer, sizeof(Buffer), 0);
+            if (Size < 4 || State.Done || Buffer[1] != packets::types::AcknowledgmentPacket ||
+                static_cast<std::uint16_t>(Buffer[2] << 8 | Buffer[3]) != State.Block) {
+                continue;
+            }
+            State.Offset += State.Size;
+            if (State.Size < BlockSize) {
+                State.Done = true;
+                --Remaining;
+                continue;
+            }
+            sendBlock(State, Contents);
+        }
+        auto Now = Clock::now();
+        for (auto &State : Transfers) {
+            if (!State.Done && State.Deadline < Now) {
+                ::sendto(State.Descriptor, State.Packet.data(), State.Packet.size(), 0,
+                         reinterpret_cast<const sockaddr *>(&State.Client), sizeof(State.Client));
+                State.Deadline = Now + std::chrono::seconds(1);
+            }
+        }
+    }
+    ::close(Descriptor);
+}
+
+/// Serve all transfers with serveRead coroutines on the executor
+void serveCoroutines(const std::vector<int> &Clients, const std::vector<std::uint8_t> &Contents) {
+    Executor Loop;
+    std::vector<std::unique_ptr<UdpSocket>> Sockets;
+    auto Read = [&Contents](std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Size) {
+        return readBlock(Contents, Offset, Buffer, Size);
+    };
+    for (auto Client : Clients) {
+        Sockets.push_back(std::make_unique<UdpSocket>(Loop, makeLoopback()));
+        TransferOptions Options;
+        Options.BlockSize = BlockSize;
+        Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, decltype(Read) Read, TransferOptions Options) -> Task<> {
+            co_await serveRead(Socket, Client, Read, Options);
+        }(*Sockets.back(), getLocalAddress(Client), Read, Options));
+    }
+    Loop.run();
+}
+
+template <class Server> void measure(const char *Name, Server &&Serve) {
+    std::vector<int> Clients;
+    for (std::size_t Idx = 0; Idx != TransfersCount; ++Idx) {
+        Clients.push_back(makeSocket(false));
+    }
+    auto Begin = Clock::now();
+    std::vector<std::thread> Threads;
+    for (auto Client : Clients) {
+        Threads.emplace_back(download, Client);
+    }
+    Serve(Clients);
+    for (auto &Thread : Threads) {
+        Thread.join();
+    }
+    auto Seconds = std::chrono::duration<double>(Clock::now() - Begin).count();
+    std::printf("%-12s %8.1f MiB/s (%zu transfers, %zu blocks each)\n", Name,
+                TransfersCount * FileSize / Seconds / (1024 * 1024), TransfersCount, FileSize / BlockSize + 1);
+    for (auto Client : Clients) {
+        ::close(Client);
+    }
+}
+
+} // namespace
+
+/// Serve concurrent lock-step RRQ transfers over loopback, first by the hand-written epoll reactor and then by the
+/// coroutines, so that the overhead of the coroutine layer can be compared
+int main() {
+    std::vector<std::uint8_t> Contents(FileSize);
+    for (std::size_t Idx = 0; Idx != Contents.size(); ++Idx) {
+        Contents[Idx] = static_cast<std::uint8_t>(Idx * 31);
+    }
+
+    measure("reactor", [&Contents](const std::vector<int> &Clients) {
+        std::vector<Transfer> Transfers;
+        for (auto Client : Clients) {
+            Transfers.push_back(
+                Transfer{makeSocket(true), getLocalAddress(Client), 0, 0, 0, {}, Clock::time_point{}, false});
+        }
+        serveReactor(Transfers, Contents);
+        for (auto &State : Transfers) {
+            ::close(State.Descriptor);
+        }
+    });
+    measure("coroutines", [&Contents](const std::vector<int> &Clients) { serveCoroutines(Clients, Contents); });
+    return 0;
+}
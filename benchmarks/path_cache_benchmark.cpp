@@ -0,0 +1,104 @@
+#include "../tftp_common/details/path_cache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tftp_common::transfer;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Filenames requested by a PXELINUX client while booting: the configuration is looked up by the UUID, the MAC
+/// address and the IP address in hexadecimal shortened digit by digit, before the default one is found
+std::vector<std::string> makeProbes(unsigned Client) {
+    char Buffer[64];
+    std::vector<std::string> Probes = {"pxelinux.0"};
+    std::snprintf(Buffer, sizeof(Buffer), "pxelinux.cfg/564d%04x-0000-0000-0000-000000000000", Client);
+    Probes.emplace_back(Buffer);
+    std::snprintf(Buffer, sizeof(Buffer), "pxelinux.cfg/01-52-54-00-00-%02x-%02x", Client >> 8 & 0xff, Client & 0xff);
+    Probes.emplace_back(Buffer);
+    std::snprintf(Buffer, sizeof(Buffer), "%08X", 0x0a000000 | Client);
+    for (std::size_t Length = 8; Length != 0; --Length) {
+        Probes.push_back("pxelinux.cfg/" + std::string(Buffer, Length));
+    }
+    Probes.emplace_back("pxelinux.cfg/default");
+    return Probes;
+}
+
+/// Resolve the probes of all clients by several threads at once
+/// @return Nanoseconds per request
+template <class Resolve> double measure(const std::vector<std::vector<std::string>> &Clients, Resolve &&Handle) {
+    constexpr unsigned ThreadsCount = 4;
+    std::vector<std::thread> Threads;
+    auto Begin = Clock::now();
+    for (unsigned Thread = 0; Thread != ThreadsCount; ++Thread) {
+        Threads.emplace_back([&, Thread] {
+            for (std::size_t Client = Thread; Client < Clients.size(); Client += ThreadsCount) {
+                for (const auto &Filename : Clients[Client]) {
+                    Handle(Filename);
+                }
+            }
+        });
+    }
+    for (auto &Thread : Threads) {
+        Thread.join();
+    }
+    std::size_t Requests = 0;
+    for (const auto &Probes : Clients) {
+        Requests += Probes.size();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - Begin).count() / static_cast<double>(Requests);
+}
+
+} // namespace
+
+/// Boot storm: 20k PXE clients probing 12 configuration paths each (most of them missing), resolved with
+/// open/fstat per request and with PathCache
+int main() {
+    char Template[] = "/tmp/tftp_path_cache_benchmark_XXXXXX";
+    std::string Root = ::mkdtemp(Template);
+    std::system(("mkdir -p " + Root + "/pxelinux.cfg && head -c 42000 /dev/zero > " + Root +
+                 "/pxelinux.0 && echo 'default linux' > " + Root + "/pxelinux.cfg/default")
+                    .c_str());
+
+    std::vector<std::vector<std::string>> Clients;
+    for (unsigned Client = 0; Client != 20000; ++Client) {
+        // Clients of one rack share the configuration by the IP address prefix
+        Clients.push_back(makeProbes(Client % 256));
+    }
+
+    int RootDescriptor = ::open(Root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    auto Uncached = measure(Clients, [&](const std::string &Filename) {
+        auto Path = sanitizeFilename(Filename);
+        int Descriptor = ::openat(RootDescriptor, Path->c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (Descriptor != -1) {
+            struct stat Status;
+            ::fstat(Descriptor, &Status);
+            ::close(Descriptor);
+        } else {
+            auto Error = makeFileError(std::error_code(errno, std::generic_category()));
+            std::vector<std::uint8_t> Bytes;
+            Error.serialize(std::back_inserter(Bytes));
+        }
+    });
+    ::close(RootDescriptor);
+    std::printf("open/fstat: %7.1f ns/request\n", Uncached);
+
+    PathCache Cache;
+    if (auto Error = Cache.open(Root)) {
+        std::printf("PathCache can't be opened: %s\n", Error.message().c_str());
+        return 1;
+    }
+    auto Cached = measure(Clients, [&](const std::string &Filename) { Cache.resolve(Filename); });
+    std::printf("PathCache:  %7.1f ns/request, %llu of %llu requests went to the file system\n", Cached,
+                static_cast<unsigned long long>(Cache.getLookups()),
+                static_cast<unsigned long long>(Cache.getLookups() + Cache.getHits() + Cache.getNegativeHits()));
+
+    std::system(("rm -rf " + Root).c_str());
+    return 0;
+}
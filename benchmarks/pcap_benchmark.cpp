@@ -0,0 +1,478 @@
+#include "../tftp_common/details/coroutine.hpp"
+#include "../tftp_common/details/options.hpp"
+#include "../tftp_common/details/parsers.hpp"
+#include "../tftp_common/details/pcap.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace tftp_common;
+using namespace tftp_common::async;
+using namespace tftp_common::capture;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Bytes = std::vector<std::uint8_t>;
+
+transfer::TransferID makeEndpoint(std::uint32_t Address, std::uint16_t Port) {
+    std::uint8_t Octets[4] = {static_cast<std::uint8_t>(Address >> 24), static_cast<std::uint8_t>(Address >> 16),
+                              static_cast<std::uint8_t>(Address >> 8), static_cast<std::uint8_t>(Address)};
+    return capture::details::makeIPv4Endpoint(Octets, Port);
+}
+
+template <class Packet> Bytes serialize(const Packet &Value) {
+    Bytes Serialized;
+    Value.serialize(std::back_inserter(Serialized));
+    return Serialized;
+}
+
+/// Synthetic boot storm: every client fetches the bootloader with options, probes the PXELINUX configuration files
+/// (which are missing) and fetches the default configuration
+CaptureWriter makeBootStorm(unsigned Clients) {
+    CaptureWriter Writer;
+    auto Server = makeEndpoint(0x0a000001, 69);
+    for (unsigned Client = 0; Client != Clients; ++Client) {
+        std::uint64_t Time = 1700000000000000000ull + Client * 10000000ull;
+        auto Endpoint = makeEndpoint(0x0a010000 + Client, static_cast<std::uint16_t>(2000 + Client % 1000));
+        auto Transfer = makeEndpoint(0x0a000001, static_cast<std::uint16_t>(50000 + Client % 10000));
+        auto write = [&](const transfer::TransferID &Source, const transfer::TransferID &Destination,
+                         const Bytes &Payload) {
+            Writer.write(Time, Source, Destination, Payload.data(), Payload.size());
+            Time += 50000;
+        };
+        auto fetch = [&](const std::string &Filename, std::size_t Size, bool Options) {
+            std::size_t BlockSize = Options ? 1408 : 512;
+            if (Options) {
+                write(Endpoint, Server,
+                      serialize(packets::Request(packets::types::ReadRequest, Filename, std::string_view("octet"),
+                                                 {"blksize", "tsize"}, {"1408", "0"})));
+                write(Transfer, Endpoint,
+                      serialize(packets::OptionAcknowledgment({{"blksize", "1408"}, {"tsize", std::to_string(Size)}})));
+                write(Endpoint, Transfer, serialize(packets::Acknowledgment(0)));
+            } else {
+                write(Endpoint, Server,
+                      serialize(packets::Request(packets::types::ReadRequest, Filename, std::string_view("octet"))));
+            }
+            for (std::uint16_t Block = 1;; ++Block) {
+                auto Offset = (Block - 1u) * BlockSize;
+                auto DataSize = std::min(BlockSize, Size - Offset);
+                write(Transfer, Endpoint, serialize(packets::Data(Block, Bytes(DataSize, 0))));
+                write(Endpoint, Transfer, serialize(packets::Acknowledgment(Block)));
+                if (DataSize < BlockSize) {
+                    break;
+                }
+            }
+        };
+        auto probe = [&](const std::string &Filename) {
+            write(Endpoint, Server,
+                  serialize(packets::Request(packets::types::ReadRequest, Filename, std::string_view("octet"))));
+            write(Transfer, Endpoint,
+                  serialize(packets::Error(packets::errors::FileNotFound, std::string_view("File not found"))));
+        };
+
+        fetch("pxelinux.0", 42000, true);
+        char Name[64];
+        std::snprintf(Name, sizeof(Name), "pxelinux.cfg/01-52-54-00-00-%02x-%02x", Client >> 8 & 0xff, Client & 0xff);
+        probe(Name);
+        std::snprintf(Name, sizeof(Name), "%08X", 0x0a010000 + Client);
+        for (std::size_t Length = 8; Length != 0; --Length) {
+            probe("pxelinux.cfg/" + std::string(Name, Length));
+        }
+        fetch("pxelinux.cfg/default", 300, false);
+    }
+    return Writer;
+}
+
+std::vector<capture::Datagram> readTftp(const Bytes &Capture) {
+    CaptureReader Reader;
+    if (Reader.open(Capture.data(), Capture.size())) {
+        return {};
+    }
+    TftpFilter Filter;
+    std::vector<capture::Datagram> Datagrams;
+    while (auto Next = Reader.next()) {
+        if (Filter.accept(*Next)) {
+            Datagrams.push_back(*Next);
+        }
+    }
+    return Datagrams;
+}
+
+/// Parse the payloads of one packet type over and over for at least a fifth of a second
+template <class Packet> void measureParser(const char *Name, const std::vector<const capture::Datagram *> &Payloads) {
+    if (Payloads.empty()) {
+        return;
+    }
+    std::size_t Parsed = 0;
+    std::size_t Failed = 0;
+    std::size_t Bytes_ = 0;
+    auto Begin = Clock::now();
+    do {
+        for (const auto *Captured : Payloads) {
+            auto Result = packets::Parser<Packet>::parse(Captured->Payload, Captured->Size);
+            Failed += !Result.isSuccess();
+            Bytes_ += Captured->Size;
+        }
+        Parsed += Payloads.size();
+    } while (Clock::now() - Begin < std::chrono::milliseconds(200));
+    auto Seconds = std::chrono::duration<double>(Clock::now() - Begin).count();
+    std::printf(" %-22s %8zu packets %8.1f ns/packet %8.1f MiB/s%s\n", Name, Payloads.size(),
+                Seconds * 1e9 / static_cast<double>(Parsed), static_cast<double>(Bytes_) / Seconds / (1 << 20),
+                Failed != 0 ? " (malformed packets)" : "");
+}
+
+void runParse(const std::vector<capture::Datagram> &Datagrams) {
+    std::map<std::uint16_t, std::vector<const capture::Datagram *>> ByType;
+    for (const auto &Captured : Datagrams) {
+        if (Captured.Size >= 2) {
+            ByType[static_cast<std::uint16_t>(Captured.Payload[0] << 8 | Captured.Payload[1])].push_back(&Captured);
+        }
+    }
+    std::printf("Parsing %zu TFTP datagrams\n", Datagrams.size());
+    auto Requests = ByType[packets::types::ReadRequest];
+    Requests.insert(Requests.end(), ByType[packets::types::WriteRequest].begin(),
+                    ByType[packets::types::WriteRequest].end());
+    measureParser<packets::Request>("Request", Requests);
+    measureParser<packets::Data>("Data", ByType[packets::types::DataPacket]);
+    measureParser<packets::Acknowledgment>("Acknowledgment", ByType[packets::types::AcknowledgmentPacket]);
+    measureParser<packets::Error>("Error", ByType[packets::types::ErrorPacket]);
+    measureParser<packets::OptionAcknowledgment>("OptionAcknowledgment",
+                                                 ByType[packets::types::OptionAcknowledgmentPacket]);
+}
+
+/// Transfer started by a captured request
+struct Session {
+    /// Time of the request since the start of the capture
+    std::chrono::nanoseconds Offset;
+    Bytes Request;
+    bool Write;
+    /// Size of the transferred file as far as it can be told from the captured Data packets
+    std::uint64_t Size = 0;
+    std::size_t BlockSize = 0;
+    std::uint64_t LastBlock = 0;
+    std::size_t LastSize = 0;
+};
+
+std::vector<Session> extractSessions(const std::vector<capture::Datagram> &Datagrams,
+                                     std::unordered_map<std::string, std::uint64_t> &Files) {
+    struct EndpointHash {
+        std::size_t operator()(const transfer::TransferID &ID) const noexcept {
+            return static_cast<std::size_t>(ID.hash());
+        }
+    };
+    std::vector<Session> Sessions;
+    std::unordered_map<transfer::TransferID, std::size_t, EndpointHash> ByClient;
+    std::vector<std::string> Filenames;
+    for (const auto &Captured : Datagrams) {
+        if (Captured.Size < 4) {
+            continue;
+        }
+        auto Type_ = Captured.Payload[0] << 8 | Captured.Payload[1];
+        if (Captured.Destination.Port == 69 &&
+            (Type_ == packets::types::ReadRequest || Type_ == packets::types::WriteRequest)) {
+            auto Parsed = packets::Parser<packets::Request>::parse(Captured.Payload, Captured.Size);
+            if (!Parsed.isSuccess()) {
+                continue;
+            }
+            Session Started;
+            Started.Offset = std::chrono::nanoseconds(Captured.Timestamp - Datagrams.front().Timestamp);
+            Started.Request.assign(Captured.Payload, Captured.Payload + Captured.Size);
+            Started.Write = Type_ == packets::types::WriteRequest;
+            ByClient[Captured.Source] = Sessions.size();
+            Sessions.push_back(std::move(Started));
+            Filenames.emplace_back(Parsed.get().Packet.getFilename());
+            continue;
+        }
+        if (Type_ != packets::types::DataPacket) {
+            continue;
+        }
+        auto It = ByClient.find(Captured.Destination);
+        if (It == ByClient.end()) {
+            It = ByClient.find(Captured.Source);
+        }
+        if (It == ByClient.end()) {
+            continue;
+        }
+        auto &Transferred = Sessions[It->second];
+        auto Block = static_cast<std::uint64_t>(Captured.Payload[2] << 8 | Captured.Payload[3]);
+        Transferred.BlockSize = std::max(Transferred.BlockSize, Captured.Size - 4);
+        if (Block >= Transferred.LastBlock) {
+            Transferred.LastBlock = Block;
+            Transferred.LastSize = Captured.Size - 4;
+        }
+    }
+    for (std::size_t Idx = 0; Idx != Sessions.size(); ++Idx) {
+        auto &Transferred = Sessions[Idx];
+        if (Transferred.LastBlock == 0) {
+            continue;
+        }
+        Transferred.Size = (Transferred.LastBlock - 1) * Transferred.BlockSize + Transferred.LastSize;
+        if (!Transferred.Write) {
+            Files[Filenames[Idx]] = std::max(Files[Filenames[Idx]], Transferred.Size);
+        }
+    }
+    return Sessions;
+}
+
+sockaddr_in makeLoopback(std::uint16_t Port) {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = htons(Port);
+    return Address;
+}
+
+/// Server engine: read requests of the files seen in the capture are served with the negotiated block size (the
+/// coroutine transfers are lock-step, so the window size isn't acknowledged), write requests are discarded
+struct Server {
+    Executor Engine;
+    UdpSocket Listener{Engine, makeLoopback(0)};
+    const std::unordered_map<std::string, std::uint64_t> &Files;
+    std::atomic<bool> Stopping{false};
+
+    explicit Server(const std::unordered_map<std::string, std::uint64_t> &Files) : Files(Files) {}
+
+    Task<void> serve(packets::Request Request, sockaddr_in Client) {
+        UdpSocket Socket(Engine, makeLoopback(0));
+        if (Request.getType() == packets::types::WriteRequest) {
+            co_await serveWrite(Socket, Client, [](std::uint16_t, const std::uint8_t *, std::size_t) {
+                return std::error_code{};
+            });
+            co_return;
+        }
+        auto It = Files.find(std::string(Request.getFilename()));
+        if (It == Files.end()) {
+            auto Reply = serialize(packets::Error(packets::errors::FileNotFound, std::string_view("File not found")));
+            co_await Socket.send(Reply.data(), Reply.size(), Client);
+            co_return;
+        }
+        auto Size = It->second;
+        auto Negotiated = options::negotiate(Request, Size, packets::Data::MaxBlockSize, 1);
+        TransferOptions Settings;
+        Settings.BlockSize = Negotiated.BlockSize;
+        if (!Negotiated.Acknowledged.empty()) {
+            auto Reply = serialize(packets::OptionAcknowledgment(Negotiated.Acknowledged));
+            Bytes Incoming(516);
+            bool Acknowledged = false;
+            for (int Attempt = 0; Attempt != 5 && !Acknowledged; ++Attempt) {
+                co_await Socket.send(Reply.data(), Reply.size(), Client);
+                auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), std::chrono::seconds(1));
+                Acknowledged = Received && Received->Size >= 4 &&
+                               Incoming[1] == packets::types::AcknowledgmentPacket && Incoming[2] == 0 &&
+                               Incoming[3] == 0;
+            }
+            if (!Acknowledged) {
+                co_return;
+            }
+        }
+        co_await serveRead(
+            Socket, Client,
+            [Size](std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Count) {
+                auto Read = static_cast<std::size_t>(std::min<std::uint64_t>(Count, Size - Offset));
+                std::memset(Buffer, 0, Read);
+                return Read;
+            },
+            Settings);
+    }
+
+    Task<void> listen() {
+        Bytes Incoming(65536);
+        while (!Stopping) {
+            auto Received =
+                co_await Listener.receive(Incoming.data(), Incoming.size(), std::chrono::milliseconds(100));
+            if (!Received || Received->Size == 0) {
+                continue;
+            }
+            auto Parsed = packets::Parser<packets::Request>::parse(Incoming.data(), Received->Size);
+            if (Parsed.isSuccess()) {
+                Engine.spawn(serve(Parsed.get().Packet, Received->From));
+            }
+        }
+    }
+};
+
+struct ReplayStatistics {
+    std::size_t Completed = 0;
+    std::size_t Errors = 0;
+    std::size_t Timeouts = 0;
+    std::uint64_t Bytes = 0;
+    std::size_t InFlight = 0;
+    /// Time from the request to the first reply
+    std::vector<double> Latencies;
+};
+
+/// Replay the request of the session and drive the transfer it starts in lock-step
+Task<void> replaySession(Executor &Engine, const Session &Replayed, sockaddr_in Listener,
+                         ReplayStatistics &Statistics) {
+    ++Statistics.InFlight;
+    UdpSocket Socket(Engine, makeLoopback(0));
+    Bytes Incoming(65536 + 4);
+    Bytes Outgoing = Replayed.Request;
+    auto Destination = Listener;
+    auto Sent = Clock::now();
+    bool First = true;
+    std::size_t BlockSize = 512;
+    std::uint16_t Expected = Replayed.Write ? 0 : 1;
+    std::uint64_t Remaining = Replayed.Size;
+    unsigned Retries = 0;
+    while (true) {
+        co_await Socket.send(Outgoing.data(), Outgoing.size(), Destination);
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), std::chrono::seconds(1));
+        if (!Received) {
+            if (++Retries > 5) {
+                ++Statistics.Timeouts;
+                break;
+            }
+            continue;
+        }
+        Retries = 0;
+        if (First) {
+            First = false;
+            Statistics.Latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - Sent).count());
+            Destination = Received->From;
+        }
+        auto Type_ = Received->Size >= 4 ? Incoming[0] << 8 | Incoming[1] : 0;
+        if (Type_ == packets::types::ErrorPacket) {
+            ++Statistics.Errors;
+            break;
+        }
+        if (Type_ == packets::types::OptionAcknowledgmentPacket || Received->Size < 4) {
+            auto Parsed = packets::Parser<packets::OptionAcknowledgment>::parse(Incoming.data(), Received->Size);
+            if (Parsed.isSuccess()) {
+                for (const auto &[Name, Value] : Parsed.get().Packet) {
+                    if (Name == options::names::BlockSize) {
+                        BlockSize = std::stoul(Value);
+                    }
+                }
+            }
+            Outgoing = serialize(packets::Acknowledgment(0));
+            continue;
+        }
+        auto Block = static_cast<std::uint16_t>(Incoming[2] << 8 | Incoming[3]);
+        if (!Replayed.Write && Type_ == packets::types::DataPacket) {
+            Outgoing = serialize(packets::Acknowledgment(Block));
+            if (Block != Expected) {
+                continue;
+            }
+            ++Expected;
+            Statistics.Bytes += Received->Size - 4;
+            if (Received->Size - 4 < BlockSize) {
+                ++Statistics.Completed;
+                co_await Socket.send(Outgoing.data(), Outgoing.size(), Destination);
+                break;
+            }
+        } else if (Replayed.Write && Type_ == packets::types::AcknowledgmentPacket && Block == Expected) {
+            if (Block != 0 && Outgoing.size() - 4 < BlockSize) {
+                ++Statistics.Completed;
+                break;
+            }
+            auto Size = static_cast<std::size_t>(std::min<std::uint64_t>(BlockSize, Remaining));
+            Remaining -= Size;
+            Statistics.Bytes += Size;
+            Outgoing = serialize(packets::Data(++Expected, Bytes(Size, 0)));
+        }
+    }
+    --Statistics.InFlight;
+}
+
+/// Start the sessions at their captured times divided by \p Speed (all at once if it's zero), keeping at most 512
+/// of them in flight
+Task<void> launch(Executor &Engine, const std::vector<Session> &Sessions, double Speed, sockaddr_in Listener,
+                  ReplayStatistics &Statistics) {
+    UdpSocket Sleeper(Engine, makeLoopback(0));
+    std::uint8_t Nothing;
+    auto Start = Clock::now();
+    for (const auto &Replayed : Sessions) {
+        auto Due = Start;
+        if (Speed > 0) {
+            Due += std::chrono::duration_cast<Clock::duration>(Replayed.Offset / Speed);
+        }
+        while (Clock::now() < Due || Statistics.InFlight >= 512) {
+            auto Delay = std::max<Clock::duration>(Due - Clock::now(), std::chrono::milliseconds(1));
+            co_await Sleeper.receive(&Nothing, 1, Delay);
+        }
+        Engine.spawn(replaySession(Engine, Replayed, Listener, Statistics));
+    }
+}
+
+void runReplay(const std::vector<capture::Datagram> &Datagrams, double Speed) {
+    std::unordered_map<std::string, std::uint64_t> Files;
+    auto Sessions = extractSessions(Datagrams, Files);
+    if (Sessions.empty()) {
+        std::printf("No requests in the capture\n");
+        return;
+    }
+    Server Replier(Files);
+    Replier.Engine.spawn(Replier.listen());
+    std::thread ServerThread([&] { Replier.Engine.run(); });
+
+    Executor Clients;
+    ReplayStatistics Statistics;
+    auto Begin = Clock::now();
+    Clients.spawn(launch(Clients, Sessions, Speed, Replier.Listener.getLocalAddress(), Statistics));
+    Clients.run();
+    auto Seconds = std::chrono::duration<double>(Clock::now() - Begin).count();
+    Replier.Stopping = true;
+    ServerThread.join();
+
+    std::sort(Statistics.Latencies.begin(), Statistics.Latencies.end());
+    auto percentile = [&](double Rank) {
+        return Statistics.Latencies.empty()
+                   ? 0.0
+                   : Statistics.Latencies[static_cast<std::size_t>(Rank * (Statistics.Latencies.size() - 1))];
+    };
+    char Pace[32] = "full speed";
+    if (Speed > 0) {
+        std::snprintf(Pace, sizeof(Pace), "%gx speed", Speed);
+    }
+    std::printf("Replayed %zu sessions (%zu files) at %s in %.2f s\n", Sessions.size(), Files.size(), Pace, Seconds);
+    std::printf(" completed %zu, errors %zu, timeouts %zu\n", Statistics.Completed, Statistics.Errors,
+                Statistics.Timeouts);
+    std::printf(" %.0f sessions/s, %.1f MiB/s, first reply latency p50 %.0f us, p99 %.0f us\n",
+                static_cast<double>(Sessions.size()) / Seconds,
+                static_cast<double>(Statistics.Bytes) / Seconds / (1 << 20), percentile(0.5), percentile(0.99));
+}
+
+} // namespace
+
+/// Benchmark on captured traffic: `pcap_benchmark parse|replay [capture] [speed]`
+/// @n `parse` runs every TFTP payload of the capture through the parsers and reports the throughput per packet type,
+/// `replay` replays the client requests against the coroutine server over loopback at the captured times divided by
+/// the speed (1 keeps the original timing, 0 sends as fast as possible) and drives the transfers they start. Without a
+/// capture (or with `-`) a synthetic boot storm of 500 PXE clients is used.
+int main(int argc, char **argv) {
+    std::string Mode = argc > 1 ? argv[1] : "parse";
+    Bytes Capture;
+    if (argc > 2 && std::string_view(argv[2]) != "-") {
+        if (auto Error = loadCapture(argv[2], Capture)) {
+            std::printf("%s can't be read: %s\n", argv[2], Error.message().c_str());
+            return 1;
+        }
+    } else {
+        Capture = makeBootStorm(500).getBuffer();
+    }
+    auto Datagrams = readTftp(Capture);
+    if (Datagrams.empty()) {
+        std::printf("No TFTP datagrams in the capture\n");
+        return 1;
+    }
+    if (Mode == "parse") {
+        runParse(Datagrams);
+    } else if (Mode == "replay") {
+        runReplay(Datagrams, argc > 3 ? std::stod(argv[3]) : 0);
+    } else {
+        std::printf("Usage: %s parse|replay [capture] [speed]\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "../tftp_common/details/parsers.hpp"
+#include "../tftp_common/details/reuseport.hpp"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <list>
+#include <memory>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace tftp_common;
+using namespace tftp_common::reuseport;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned WorkersCount = 4;
+constexpr unsigned SubnetsCount = 8;
+constexpr unsigned HostsCount = 32;
+constexpr unsigned FilesCount = 4;
+constexpr std::size_t FileSize = 1024 * 1024;
+/// Files a worker keeps in memory: half of all the files
+constexpr std::size_t CachedFiles = SubnetsCount * FilesCount / 2;
+constexpr unsigned RequestsCount = 1500;
+
+/// Worker serving read requests with the first block of the file from its own least recently used file cache
+class Worker {
+  public:
+    Worker(int Descriptor, std::string Root) : Descriptor(Descriptor), Root(std::move(Root)) {
+        timeval Timeout{0, 50000};
+        ::setsockopt(Descriptor, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    }
+
+    void run(const std::atomic<bool> &Stopping) {
+        std::vector<std::uint8_t> Buffer(516);
+        while (!Stopping) {
+            sockaddr_in From{};
+            socklen_t Length = sizeof(From);
+            auto Size = ::recvfrom(Descriptor, Buffer.data(), Buffer.size(), 0, reinterpret_cast<sockaddr *>(&From),
+                                   &Length);
+            if (Size <= 0) {
+                continue;
+            }
+            auto Parsed = packets::Parser<packets::Request>::parse(Buffer.data(), static_cast<std::size_t>(Size));
+            if (!Parsed.isSuccess()) {
+                continue;
+            }
+            ++Clients[From.sin_addr.s_addr];
+            const auto &Contents = lookup(std::string(Parsed.get().Packet.getFilename()));
+            std::uint8_t Packet[516] = {0, packets::types::DataPacket, 0, 1};
+            std::copy_n(Contents.begin(), 512, Packet + 4);
+            ::sendto(Descriptor, Packet, sizeof(Packet), 0, reinterpret_cast<const sockaddr *>(&From), Length);
+        }
+    }
+
+    std::size_t Hits = 0;
+    std::size_t Misses = 0;
+    /// Requests of every client, as a stand-in for the per-client state (e.g. retransmission timeout estimates)
+    std::unordered_map<std::uint32_t, std::size_t> Clients;
+
+  private:
+    const std::vector<std::uint8_t> &lookup(const std::string &Filename) {
+        auto Found = Files.find(Filename);
+        if (Found != Files.end()) {
+            ++Hits;
+            Recent.splice(Recent.begin(), Recent, Found->second);
+            return Found->second->second;
+        }
+        ++Misses;
+        if (Files.size() == CachedFiles) {
+            Files.erase(Recent.back().first);
+            Recent.pop_back();
+        }
+        std::vector<std::uint8_t> Contents(FileSize);
+        auto File = ::open((Root + '/' + Filename).c_str(), O_RDONLY | O_CLOEXEC);
+        if (::pread(File, Contents.data(), Contents.size(), 0) != static_cast<ssize_t>(Contents.size())) {
+            std::abort();
+        }
+        ::close(File);
+        Recent.emplace_front(Filename, std::move(Contents));
+        Files[Filename] = Recent.begin();
+        return Recent.front().second;
+    }
+
+    int Descriptor;
+    std::string Root;
+    std::list<std::pair<std::string, std::vector<std::uint8_t>>> Recent;
+    std::unordered_map<std::string, decltype(Recent)::iterator> Files;
+};
+
+/// Hosts of one subnet booting the images of the subnet, every request comes from a new port
+void boot(unsigned Subnet, sockaddr_in Server) {
+    std::mt19937 Random{Subnet};
+    std::uint8_t Buffer[516];
+    for (unsigned Request = 0; Request != RequestsCount; ++Request) {
+        sockaddr_in Local{};
+        Local.sin_family = AF_INET;
+        Local.sin_addr.s_addr = htonl(0x7f000000u | (Subnet + 1) << 8 | (Request % HostsCount + 1));
+        auto Descriptor = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        ::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Local), sizeof(Local));
+        auto Filename = "subnet" + std::to_string(Subnet) + "-image" + std::to_string(Random() % FilesCount);
+        auto Packet = packets::Request(packets::types::ReadRequest, std::string_view(Filename),
+                                       std::string_view("octet"));
+        std::vector<std::uint8_t> Serialized;
+        Packet.serialize(std::back_inserter(Serialized));
+        pollfd Reply{Descriptor, POLLIN, 0};
+        do {
+            ::sendto(Descriptor, Serialized.data(), Serialized.size(), 0, reinterpret_cast<const sockaddr *>(&Server),
+                     sizeof(Server));
+        } while (::poll(&Reply, 1, 200) <= 0);
+        ::recv(Descriptor, Buffer, sizeof(Buffer), 0);
+        ::close(Descriptor);
+    }
+}
+
+/// Run the workers on the sockets and the booting subnets until all requests are answered
+void measure(const char *Name, const std::vector<int> &Sockets, sockaddr_in Server, const std::string &Root) {
+    std::vector<std::unique_ptr<Worker>> Workers;
+    std::vector<std::thread> Threads;
+    std::atomic<bool> Stopping = false;
+    for (auto Descriptor : Sockets) {
+        Workers.push_back(std::make_unique<Worker>(Descriptor, Root));
+        Threads.emplace_back([&Stopping, &Served = *Workers.back()] { Served.run(Stopping); });
+    }
+    auto Begin = Clock::now();
+    std::vector<std::thread> Subnets;
+    for (unsigned Subnet = 0; Subnet != SubnetsCount; ++Subnet) {
+        Subnets.emplace_back(boot, Subnet, Server);
+    }
+    for (auto &Thread : Subnets) {
+        Thread.join();
+    }
+    auto Seconds = std::chrono::duration<double>(Clock::now() - Begin).count();
+    Stopping = true;
+    for (auto &Thread : Threads) {
+        Thread.join();
+    }
+
+    std::size_t Hits = 0, Misses = 0, Clients = 0;
+    for (const auto &Served : Workers) {
+        Hits += Served->Hits;
+        Misses += Served->Misses;
+        Clients += Served->Clients.size();
+    }
+    std::printf("%-16s %9.0f requests/s, file cache hits %5.1f%%, client state on %4.2f workers per client\n", Name,
+                (Hits + Misses) / Seconds, 100.0 * Hits / (Hits + Misses),
+                static_cast<double>(Clients) / (SubnetsCount * HostsCount));
+}
+
+sockaddr_in makeLoopback() {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return Address;
+}
+
+} // namespace
+
+/// Subnets of hosts booting their own images from 4 workers sharing the server port with SO_REUSEPORT, every worker
+/// caching half of the images: datagrams spread by the kernel hash of the 4-tuple, then steered by the client address
+/// and by the client subnet (/24)
+int main() {
+    char Template[] = "/tmp/tftp_reuseport_benchmark_XXXXXX";
+    std::string Root = ::mkdtemp(Template);
+    std::vector<std::uint8_t> Contents(FileSize, 0x5a);
+    for (unsigned Subnet = 0; Subnet != SubnetsCount; ++Subnet) {
+        for (unsigned Image = 0; Image != FilesCount; ++Image) {
+            auto Path = Root + "/subnet" + std::to_string(Subnet) + "-image" + std::to_string(Image);
+            auto File = ::open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (::write(File, Contents.data(), Contents.size()) != static_cast<ssize_t>(Contents.size())) {
+                std::abort();
+            }
+            ::close(File);
+        }
+    }
+
+    {
+        std::vector<int> Sockets;
+        auto Server = makeLoopback();
+        for (unsigned Idx = 0; Idx != WorkersCount; ++Idx) {
+            auto Descriptor = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            int Enable = 1;
+            ::setsockopt(Descriptor, SOL_SOCKET, SO_REUSEPORT, &Enable, sizeof(Enable));
+            ::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Server), sizeof(Server));
+            socklen_t Length = sizeof(Server);
+            ::getsockname(Descriptor, reinterpret_cast<sockaddr *>(&Server), &Length);
+            Sockets.push_back(Descriptor);
+        }
+        measure("kernel hash", Sockets, Server, Root);
+        for (auto Descriptor : Sockets) {
+            ::close(Descriptor);
+        }
+    }
+
+    for (unsigned PrefixLength : {32u, 24u}) {
+        SteeringConfig Config;
+        Config.PrefixLength = PrefixLength;
+        SteeringGroup Group(makeLoopback(), Config);
+        for (unsigned Idx = 0; Idx != WorkersCount; ++Idx) {
+            int Descriptor = -1;
+            if (auto Error = Group.addWorker(Descriptor)) {
+                std::printf("steering program can't be attached: %s\n", Error.message().c_str());
+                return 1;
+            }
+        }
+        measure(PrefixLength == 32 ? "client address" : "client subnet", Group.getSockets(), Group.getAddress(),
+                Root);
+    }
+    std::system(("rm -rf " + Root).c_str());
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "../tftp_common/details/session_store.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Session as a straightforward server keeps it: the request, the negotiated options and the window of Data packets
+/// kept for retransmissions, in a node based map
+struct NaiveSession {
+    TimerNode Timer;
+    packets::Request Request;
+    options::Negotiation Negotiated;
+    std::vector<std::uint8_t> Window;
+    std::uint32_t Acknowledged = 0;
+    std::uint32_t LastBlock = 1;
+    Clock::time_point Started;
+};
+
+struct TransferIDHash {
+    std::size_t operator()(const TransferID &ID) const noexcept { return static_cast<std::size_t>(ID.hash()); }
+};
+
+/// @return Resident set size of the process in bytes
+std::size_t getResidentSize() {
+    auto *File = std::fopen("/proc/self/statm", "r");
+    if (File == nullptr) {
+        return 0;
+    }
+    unsigned long Total = 0, Resident = 0;
+    if (std::fscanf(File, "%lu %lu", &Total, &Resident) != 2) {
+        Resident = 0;
+    }
+    std::fclose(File);
+    return static_cast<std::size_t>(Resident) * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+TransferID makeClient(std::size_t Idx) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(static_cast<std::uint32_t>(0x0a000000 + Idx / 50000));
+    Endpoint.sin_port = htons(static_cast<std::uint16_t>(1024 + Idx % 50000));
+    return TransferID::fromIPv4(Endpoint);
+}
+
+options::Negotiation makeNegotiation() {
+    options::Negotiation Negotiated;
+    Negotiated.BlockSize = 1428;
+    Negotiated.WindowSize = 8;
+    Negotiated.Timeout = std::chrono::seconds(2);
+    return Negotiated;
+}
+
+} // namespace
+
+/// Keep 1M idle read sessions (blksize 1428, windowsize 8) in SessionStore and measure the memory taken and the time
+/// to process acknowledgments in random order, then compare the memory with 100k naive sessions buffering their
+/// windows
+int main() {
+    constexpr std::size_t Sessions = 1000000;
+    auto Negotiated = makeNegotiation();
+    char Filename[32];
+
+    auto Before = getResidentSize();
+    auto Begin = Clock::now();
+    SessionStore Store{Sessions};
+    for (std::size_t Idx = 0; Idx != Sessions; ++Idx) {
+        std::snprintf(Filename, sizeof(Filename), "images/node%zu.img", Idx % 1000);
+        Store.emplace(makeClient(Idx), static_cast<std::uint32_t>(Idx % 1000), Filename, 64 * 1024 * 1024,
+                      Negotiated);
+    }
+    auto Elapsed = std::chrono::duration<double, std::nano>(Clock::now() - Begin).count();
+    auto Resident = getResidentSize() - Before;
+    std::printf("SessionStore, %zu sessions\n", Sessions);
+    std::printf(" inserting:        %6.1f ns/session\n", Elapsed / Sessions);
+    std::printf(" allocated:        %6.1f MiB (%.1f bytes/session)\n", Store.getMemoryUsage() / 1048576.0,
+                static_cast<double>(Store.getMemoryUsage()) / Sessions);
+    std::printf(" resident:         %6.1f MiB\n", Resident / 1048576.0);
+
+    // Every acknowledgment looks up its session and moves the window
+    std::mt19937 Random{1};
+    std::uniform_int_distribution<std::size_t> Pick{0, Sessions - 1};
+    std::vector<TransferID> Packets;
+    for (std::size_t Idx = 0; Idx != 5000000; ++Idx) {
+        Packets.push_back(makeClient(Pick(Random)));
+    }
+    std::uint64_t Acknowledged = 0;
+    Begin = Clock::now();
+    for (const auto &Client : Packets) {
+        auto &Session = Store.hot(*Store.find(Client));
+        Acknowledged += Session.acknowledge(static_cast<std::uint16_t>(Session.getWindowEnd()));
+    }
+    Elapsed = std::chrono::duration<double, std::nano>(Clock::now() - Begin).count();
+    std::printf(" acknowledgments:  %6.1f ns/packet (%llu windows)\n", Elapsed / Packets.size(),
+                static_cast<unsigned long long>(Acknowledged));
+
+    constexpr std::size_t NaiveSessions = 100000;
+    Before = getResidentSize();
+    {
+        std::unordered_map<TransferID, std::unique_ptr<NaiveSession>, TransferIDHash> Naive;
+        Naive.reserve(NaiveSessions);
+        for (std::size_t Idx = 0; Idx != NaiveSessions; ++Idx) {
+            std::snprintf(Filename, sizeof(Filename), "images/node%zu.img", Idx % 1000);
+            auto Session = std::make_unique<NaiveSession>();
+            Session->Request = packets::Request(packets::types::ReadRequest, std::string_view(Filename),
+                                                std::string_view("octet"), {"blksize", "timeout", "windowsize"},
+                                                {"1428", "2", "8"});
+            Session->Negotiated = Negotiated;
+            Session->Window.resize((Negotiated.BlockSize + 4) * Negotiated.WindowSize);
+            Naive.emplace(makeClient(Idx), std::move(Session));
+        }
+        Resident = getResidentSize() - Before;
+        std::printf("Buffering sessions, %zu sessions\n", NaiveSessions);
+        std::printf(" resident:         %6.1f MiB (%.1f bytes/session, %.0f MiB for %zu sessions)\n",
+                    Resident / 1048576.0, static_cast<double>(Resident) / NaiveSessions,
+                    static_cast<double>(Resident) / NaiveSessions * Sessions / 1048576.0, Sessions);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "../tftp_common/details/session_table.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace tftp_common::transfer;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Session {
+    std::uint16_t Block = 0;
+    std::uint64_t Payload[6] = {};
+};
+
+struct TransferIDHash {
+    std::size_t operator()(const TransferID &ID) const noexcept { return static_cast<std::size_t>(ID.hash()); }
+};
+
+std::vector<TransferID> makeIDs(std::size_t Count, std::mt19937 &Random) {
+    std::vector<TransferID> IDs;
+    std::uniform_int_distribution<std::uint32_t> Address;
+    std::uniform_int_distribution<std::uint16_t> Port{1024, 65535};
+    for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+        sockaddr_in Endpoint{};
+        Endpoint.sin_addr.s_addr = Address(Random);
+        Endpoint.sin_port = htons(Port(Random));
+        IDs.push_back(TransferID::fromIPv4(Endpoint));
+    }
+    return IDs;
+}
+
+template <class Lookup> double measure(const std::vector<TransferID> &Packets, Lookup &&Find) {
+    std::uint64_t Checksum = 0;
+    auto Begin = Clock::now();
+    for (const auto &ID : Packets) {
+        Checksum += Find(ID);
+    }
+    auto Elapsed = std::chrono::duration<double, std::nano>(Clock::now() - Begin).count();
+    // Keep the lookups from being optimized away
+    static volatile std::uint64_t Sink;
+    Sink = Sink + Checksum;
+    return Elapsed / static_cast<double>(Packets.size());
+}
+
+} // namespace
+
+/// Look up the session of every "incoming datagram" in tables of 100k to 1M sessions and compare with
+/// std::unordered_map
+int main() {
+    std::mt19937 Random{1};
+    for (std::size_t Sessions : {100000u, 1000000u}) {
+        auto IDs = makeIDs(Sessions, Random);
+        std::vector<TransferID> Packets;
+        std::uniform_int_distribution<std::size_t> Pick{0, Sessions - 1};
+        for (std::size_t Idx = 0; Idx != 5000000; ++Idx) {
+            Packets.push_back(IDs[Pick(Random)]);
+        }
+
+        SessionTable<Session> Table{Sessions};
+        std::unordered_map<TransferID, Session, TransferIDHash> Map;
+        for (const auto &ID : IDs) {
+            Table.emplace(ID);
+            Map.emplace(ID, Session{});
+        }
+
+        std::printf("%zu sessions\n", Sessions);
+        auto TableTime = measure(Packets, [&](const TransferID &ID) { return Table.find(ID)->Block + 1; });
+        std::printf(" SessionTable:       %6.1f ns/lookup\n", TableTime);
+        auto MapTime = measure(Packets, [&](const TransferID &ID) { return Map.find(ID)->second.Block + 1; });
+        std::printf(" std::unordered_map: %6.1f ns/lookup\n", MapTime);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "../tftp_common/details/timer_wheel.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace tftp_common::transfer;
+using namespace std::chrono_literals;
+
+using Clock = TimerWheel::Clock;
+
+namespace {
+
+struct RetransmitTimer : TimerNode {};
+struct IdleTimer : TimerNode {};
+
+/// Transfer session stub embedding a retransmission and an idle timer
+struct Session : RetransmitTimer, IdleTimer {};
+
+double nanosecondsPerOperation(Clock::time_point Begin, std::size_t Operations) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - Begin).count() / static_cast<double>(Operations);
+}
+
+} // namespace
+
+/// Arm 500k retransmission and idle timers, then keep re-arming them like ACKs arriving would do while the clock
+/// advances, reporting the average cost of each operation
+/// @n Each round only a tenth of the sessions get an ACK, the retransmission timers of the others keep running and
+/// expire as the clock passes their deadlines
+int main() {
+    constexpr std::size_t SessionsCount = 500000;
+    constexpr std::size_t Rounds = 100;
+    constexpr std::size_t AcknowledgedCount = SessionsCount / 10;
+
+    auto Start = Clock::now();
+    TimerWheel Wheel{1ms, Start};
+    auto Sessions = std::make_unique<Session[]>(SessionsCount);
+    std::mt19937 Random{42};
+    std::uniform_int_distribution<int> Retransmit{5, 1000};
+
+    auto Begin = Clock::now();
+    for (std::size_t Idx = 0; Idx != SessionsCount; ++Idx) {
+        Wheel.arm(static_cast<RetransmitTimer &>(Sessions[Idx]), Start + std::chrono::milliseconds(Retransmit(Random)));
+        Wheel.arm(static_cast<IdleTimer &>(Sessions[Idx]), Start + 30s);
+    }
+    std::printf("arm:     %6.1f ns/op (%zu timers)\n", nanosecondsPerOperation(Begin, SessionsCount * 2),
+                Wheel.size());
+
+    std::size_t Expired = 0;
+    std::size_t Next = 0;
+    auto Now = Start;
+    Begin = Clock::now();
+    for (std::size_t Round = 0; Round != Rounds; ++Round) {
+        for (std::size_t Count = 0; Count != AcknowledgedCount; ++Count, Next = (Next + 1) % SessionsCount) {
+            auto Deadline = Now + std::chrono::milliseconds(Retransmit(Random));
+            Wheel.arm(static_cast<RetransmitTimer &>(Sessions[Next]), Deadline);
+            Wheel.arm(static_cast<IdleTimer &>(Sessions[Next]), Now + 30s);
+        }
+        Now += 10ms;
+        Expired += Wheel.advance(Now, [&](TimerNode &Node) { Wheel.arm(Node, Now + 500ms); });
+    }
+    std::printf("re-arm:  %6.1f ns/op (%zu expired)\n",
+                nanosecondsPerOperation(Begin, AcknowledgedCount * Rounds * 2 + Expired), Expired);
+
+    Begin = Clock::now();
+    Expired = Wheel.advance(Now + 1s, [](TimerNode &) {});
+    std::printf("expire:  %6.1f ns/op (%zu expired)\n", nanosecondsPerOperation(Begin, Expired), Expired);
+
+    Begin = Clock::now();
+    for (std::size_t Idx = 0; Idx != SessionsCount; ++Idx) {
+        Wheel.cancel(static_cast<RetransmitTimer &>(Sessions[Idx]));
+        Wheel.cancel(static_cast<IdleTimer &>(Sessions[Idx]));
+    }
+    std::printf("cancel:  %6.1f ns/op\n", nanosecondsPerOperation(Begin, SessionsCount * 2));
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "../tftp_common/details/window_sender.hpp"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <unistd.h>
+
+using namespace tftp_common::transfer;
+
+namespace {
+
+constexpr std::size_t WindowsCount = 20000;
+
+double getThreadTime() {
+    timespec Time;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+    return static_cast<double>(Time.tv_sec) + static_cast<double>(Time.tv_nsec) / 1e9;
+}
+
+enum class Mode { SendTo, MultipleMessages, Segmentation };
+
+/// Send windows of Data packets to the loopback receiver, reporting CPU time of the sending thread per packet
+void measure(Mode How, std::size_t BlockSize, std::size_t WindowSize) {
+    auto Receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(Receiver, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address));
+    socklen_t Length = sizeof(Address);
+    ::getsockname(Receiver, reinterpret_cast<sockaddr *>(&Address), &Length);
+    timeval Timeout{0, 100000};
+    ::setsockopt(Receiver, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+
+    // The receiver only drains the socket, packets dropped by it don't affect the sender
+    std::atomic<bool> Done{false};
+    std::size_t Received = 0;
+    std::thread Drain([&] {
+        std::vector<std::uint8_t> Buffer(65536);
+        while (!Done.load(std::memory_order_relaxed)) {
+            if (::recv(Receiver, Buffer.data(), Buffer.size(), 0) > 0) {
+                ++Received;
+            }
+        }
+    });
+
+    auto Sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+    auto To = reinterpret_cast<const sockaddr *>(&Address);
+    WindowSender Window(BlockSize, WindowSize);
+    Window.setSegmentation(How == Mode::Segmentation);
+    std::vector<std::uint8_t> Packet(BlockSize + 4);
+
+    auto Begin = getThreadTime();
+    std::uint16_t Block = 1;
+    for (std::size_t Idx = 0; Idx != WindowsCount; ++Idx) {
+        if (How == Mode::SendTo) {
+            for (std::size_t Packets = 0; Packets != WindowSize; ++Packets, ++Block) {
+                Packet[2] = static_cast<std::uint8_t>(Block >> 8);
+                Packet[3] = static_cast<std::uint8_t>(Block);
+                ::sendto(Sender, Packet.data(), Packet.size(), 0, To, sizeof(Address));
+            }
+            continue;
+        }
+        Window.clear();
+        for (std::size_t Packets = 0; Packets != WindowSize; ++Packets, ++Block) {
+            Window.append(Block, BlockSize);
+        }
+        Window.send(Sender, To, sizeof(Address));
+    }
+    auto Elapsed = getThreadTime() - Begin;
+
+    Done = true;
+    Drain.join();
+    ::close(Sender);
+    ::close(Receiver);
+
+    static const char *Names[] = {"sendto", "sendmmsg", "UDP_SEGMENT"};
+    std::printf("%-12s block %5zu, window %2zu: %7.0f ns/packet CPU (%zu system calls, %.0f%% received)\n",
+                Names[static_cast<int>(How)], BlockSize, WindowSize,
+                Elapsed * 1e9 / static_cast<double>(WindowsCount * WindowSize),
+                How == Mode::SendTo ? WindowsCount * WindowSize : Window.getSystemCallsCount(),
+                100.0 * static_cast<double>(Received) / static_cast<double>(WindowsCount * WindowSize));
+}
+
+} // namespace
+
+/// Send big-block, big-window pushes over loopback one datagram per system call, with sendmmsg and with UDP
+/// generic segmentation offload, comparing CPU time of the sending thread
+int main() {
+    for (auto [BlockSize, WindowSize] : {std::pair<std::size_t, std::size_t>{1428, 16}, {1428, 32}, {8192, 8}}) {
+        for (auto How : {Mode::SendTo, Mode::MultipleMessages, Mode::Segmentation}) {
+            measure(How, BlockSize, WindowSize);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "../tftp_common/details/client.hpp"
+#include "loopback_server.hpp"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+using namespace tftp_common;
+using namespace tftp_common::async;
+using namespace tftp_common::tests;
+
+namespace {
+
+/// Windowed sender (RFC 7440) losing the given block once
+Task<void> serveWindowed(Executor &Engine, UdpSocket &Listener, const std::string &Contents,
+                         std::uint64_t LostBlock) {
+    std::vector<std::uint8_t> Incoming(65536);
+    auto Request = co_await Listener.receive(Incoming.data(), Incoming.size());
+    auto Parsed = packets::Parser<packets::Request>::parse(Incoming.data(), Request->Size);
+    auto Negotiated = options::negotiate(Parsed.get().Packet, Contents.size(), 512, 4);
+    auto Client = Request->From;
+
+    UdpSocket Socket(Engine, makeLoopback());
+    auto Reply = details::serialize(packets::OptionAcknowledgment(Negotiated.Acknowledged));
+    co_await Socket.send(Reply.data(), Reply.size(), Client);
+    co_await Socket.receive(Incoming.data(), Incoming.size());
+
+    auto BlockSize = Negotiated.BlockSize;
+    auto LastBlock = Contents.size() / BlockSize + 1;
+    std::uint64_t Acknowledged = 0;
+    std::vector<std::uint8_t> Outgoing(BlockSize + 4);
+    while (Acknowledged != LastBlock) {
+        for (auto Block = Acknowledged + 1; Block <= std::min(Acknowledged + Negotiated.WindowSize, LastBlock);
+             ++Block) {
+            if (Block == LostBlock) {
+                LostBlock = 0;
+                continue;
+            }
+            auto Offset = (Block - 1) * BlockSize;
+            auto Size = std::min(BlockSize, Contents.size() - Offset);
+            details::setHeader(Outgoing.data(), packets::types::DataPacket, static_cast<std::uint16_t>(Block));
+            std::memcpy(Outgoing.data() + 4, Contents.data() + Offset, Size);
+            co_await Socket.send(Outgoing.data(), Size + 4, Client);
+        }
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), std::chrono::seconds(1));
+        if (Received) {
+            Acknowledged += static_cast<std::uint16_t>(details::getBlock(Incoming.data()) -
+                                                       static_cast<std::uint16_t>(Acknowledged));
+        }
+    }
+}
+
+/// Sender whose first acknowledgment of the options is lost: it retransmits the option acknowledgment and expects
+/// the acknowledgment 0 again before the retry timeout of the client, then sends a single block
+/// @param[Repeated] Set if the acknowledgment 0 has been received again
+Task<void> serveLostAcknowledgment(Executor &Engine, UdpSocket &Listener, const std::string &Contents,
+                                   bool &Repeated) {
+    std::vector<std::uint8_t> Incoming(65536);
+    auto Request = co_await Listener.receive(Incoming.data(), Incoming.size());
+    auto Parsed = packets::Parser<packets::Request>::parse(Incoming.data(), Request->Size);
+    auto Negotiated = options::negotiate(Parsed.get().Packet, Contents.size(), 512, 1);
+    auto Client = Request->From;
+
+    UdpSocket Socket(Engine, makeLoopback());
+    auto Reply = details::serialize(packets::OptionAcknowledgment(Negotiated.Acknowledged));
+    co_await Socket.send(Reply.data(), Reply.size(), Client);
+    co_await Socket.receive(Incoming.data(), Incoming.size());
+    co_await Socket.send(Reply.data(), Reply.size(), Client);
+    auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), std::chrono::milliseconds(100));
+    Repeated = Received && details::getType(Incoming.data(), Received->Size) == packets::types::AcknowledgmentPacket &&
+               details::getBlock(Incoming.data()) == 0;
+
+    std::vector<std::uint8_t> Outgoing(Contents.size() + 4);
+    details::setHeader(Outgoing.data(), packets::types::DataPacket, 1);
+    std::memcpy(Outgoing.data() + 4, Contents.data(), Contents.size());
+    co_await Socket.send(Outgoing.data(), Outgoing.size(), Client);
+    co_await Socket.receive(Incoming.data(), Incoming.size(), std::chrono::seconds(1));
+}
+
+} // namespace
+
+/// Test that files are fetched concurrently, so that the total time approaches the time of the slowest transfer
+TEST(ClientEngine, Parallel) {
+    std::map<std::string, std::string> Files;
+    std::vector<std::size_t> Sizes = {0, 1, 1428, 2856, 5000, 70000, 100000, 300000};
+    for (std::size_t Idx = 0; Idx != Sizes.size(); ++Idx) {
+        Files["file" + std::to_string(Idx)] = makeContents(Sizes[Idx], static_cast<unsigned>(Idx));
+    }
+    LoopbackServer Server(Files, std::chrono::milliseconds(100));
+    TemporaryDirectory Local;
+
+    auto fetch = [&](std::size_t MaxConcurrent) {
+        std::vector<FileTransfer> Transfers;
+        for (const auto &[Name, Contents] : Files) {
+            Transfers.push_back({packets::types::ReadRequest, Name, Local.Root + "/" + Name});
+        }
+        auto Begin = std::chrono::steady_clock::now();
+        auto Results = transferFiles(Server.getAddress(), Transfers, MaxConcurrent);
+        auto Elapsed = std::chrono::steady_clock::now() - Begin;
+
+        std::size_t Idx = 0;
+        for (const auto &[Name, Contents] : Files) {
+            const auto &Result = Results[Idx++];
+            EXPECT_FALSE(Result.Error) << Name << ": " << Result.Error.message();
+            EXPECT_EQ(Result.BlockSize, 1428);
+            EXPECT_EQ(Result.WindowSize, 1);
+            EXPECT_EQ(Result.TransferSize, Contents.size());
+            EXPECT_EQ(Result.Bytes, Contents.size());
+            EXPECT_EQ(readLocal(Local.Root + "/" + Name), Contents) << Name;
+        }
+        return Elapsed;
+    };
+
+    auto Sequential = fetch(1);
+    auto Parallel = fetch(8);
+    ASSERT_GE(Sequential, std::chrono::milliseconds(800));
+    ASSERT_LT(Parallel, std::chrono::milliseconds(400));
+}
+
+/// Test that windows are acknowledged as a whole, lost blocks are requested again and block numbers wrap around
+TEST(ClientEngine, Window) {
+    auto Contents = makeContents(70000 * 8 + 3, 42);
+    Executor Engine;
+    UdpSocket Listener(Engine, makeLoopback());
+    UdpSocket Socket(Engine, makeLoopback());
+    Engine.spawn(serveWindowed(Engine, Listener, Contents, 6));
+
+    std::string Fetched;
+    TransferResult Result;
+    ClientOptions Options;
+    Options.BlockSize = 8;
+    Options.WindowSize = 16;
+    Options.RetryTimeout = std::chrono::milliseconds(200);
+    Engine.spawn([](UdpSocket &Socket, sockaddr_in Server, ClientOptions Options, std::string &Fetched,
+                    TransferResult &Result) -> Task<void> {
+        Result = co_await readFile(
+            Socket, Server, "windowed",
+            [&](std::uint64_t Offset, const std::uint8_t *Buffer, std::size_t Size) {
+                EXPECT_EQ(Offset, Fetched.size());
+                Fetched.append(reinterpret_cast<const char *>(Buffer), Size);
+                return std::error_code{};
+            },
+            Options);
+    }(Socket, Listener.getLocalAddress(), Options, Fetched, Result));
+    Engine.run();
+
+    ASSERT_FALSE(Result.Error);
+    ASSERT_EQ(Result.BlockSize, 8);
+    ASSERT_EQ(Result.WindowSize, 4);
+    ASSERT_EQ(Result.Bytes, Contents.size());
+    ASSERT_TRUE(Fetched == Contents);
+}
+
+/// Test that the acknowledgment 0 is sent again when the server retransmits its option acknowledgment
+TEST(ClientEngine, LostOptionAcknowledgment) {
+    auto Contents = makeContents(100, 7);
+    Executor Engine;
+    UdpSocket Listener(Engine, makeLoopback());
+    UdpSocket Socket(Engine, makeLoopback());
+    bool Repeated = false;
+    Engine.spawn(serveLostAcknowledgment(Engine, Listener, Contents, Repeated));
+
+    std::string Fetched;
+    TransferResult Result;
+    ClientOptions Options;
+    Options.RetryTimeout = std::chrono::seconds(1);
+    Engine.spawn([](UdpSocket &Socket, sockaddr_in Server, ClientOptions Options, std::string &Fetched,
+                    TransferResult &Result) -> Task<void> {
+        Result = co_await readFile(
+            Socket, Server, "lost",
+            [&](std::uint64_t, const std::uint8_t *Buffer, std::size_t Size) {
+                Fetched.append(reinterpret_cast<const char *>(Buffer), Size);
+                return std::error_code{};
+            },
+            Options);
+    }(Socket, Listener.getLocalAddress(), Options, Fetched, Result));
+    Engine.run();
+
+    ASSERT_TRUE(Repeated);
+    ASSERT_FALSE(Result.Error);
+    ASSERT_EQ(Fetched, Contents);
+}
+
+/// Test that local files are uploaded and errors reported by the server fail the transfer
+TEST(ClientEngine, UploadAndErrors) {
+    LoopbackServer Server({}, std::chrono::milliseconds(0));
+    TemporaryDirectory Local;
+    auto Contents = makeContents(10000, 7);
+    {
+        std::ofstream File(Local.Root + "/upload", std::ios::binary);
+        File << Contents;
+    }
+
+    Executor Engine;
+    ClientEngine Client(Engine, Server.getAddress(), 2);
+    auto Upload = Client.add({packets::types::WriteRequest, "uploaded", Local.Root + "/upload"});
+    auto Missing = Client.add({packets::types::ReadRequest, "missing", Local.Root + "/missing"});
+    auto Unreadable = Client.add({packets::types::WriteRequest, "unreadable", Local.Root + "/nonexistent"});
+    Client.start();
+    ASSERT_EQ(Client.getPending(), 3);
+    Engine.run();
+    ASSERT_EQ(Client.getPending(), 0);
+
+    ASSERT_FALSE(Client.getResult(Upload).Error);
+    ASSERT_EQ(Client.getResult(Upload).Bytes, Contents.size());
+    ASSERT_EQ(Client.getResult(Upload).BlockSize, 1428);
+    ASSERT_EQ(Server.waitFile("uploaded"), Contents);
+
+    ASSERT_EQ(Client.getResult(Missing).Error, std::errc::no_such_file_or_directory);
+    ASSERT_EQ(Client.getResult(Missing).Message, "File not found");
+    ASSERT_NE(::access((Local.Root + "/missing").c_str(), F_OK), 0);
+
+    ASSERT_EQ(Client.getResult(Unreadable).Error, std::errc::no_such_file_or_directory);
+    ASSERT_TRUE(Client.getResult(Unreadable).Message.empty());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,384 @@
+#include "../tftp_common/details/coroutine.hpp"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <random>
+#include <stdexcept>
+
+using namespace tftp_common;
+using namespace tftp_common::async;
+
+namespace {
+
+sockaddr_in makeLoopback() {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return Address;
+}
+
+std::vector<std::uint8_t> makeContents(std::size_t Size) {
+    std::vector<std::uint8_t> Contents(Size);
+    std::mt19937 Random{static_cast<unsigned>(Size)};
+    for (auto &Byte : Contents) {
+        Byte = static_cast<std::uint8_t>(Random());
+    }
+    return Contents;
+}
+
+template <class Packet> std::vector<std::uint8_t> serialize(const Packet &Value) {
+    std::vector<std::uint8_t> Buffer;
+    Value.serialize(std::back_inserter(Buffer));
+    return Buffer;
+}
+
+/// Options with a short retransmission timeout, so that the lost packets don't slow down the tests
+TransferOptions makeOptions(std::size_t BlockSize) {
+    TransferOptions Options;
+    Options.BlockSize = BlockSize;
+    Options.Seed = transfer::RetransmissionTimer::Estimate{std::chrono::milliseconds(1), std::chrono::milliseconds(1)};
+    return Options;
+}
+
+/// Receive the file acknowledging every block, the first transmission of \p DroppedBlock is ignored
+Task<std::error_code> download(UdpSocket &Socket, sockaddr_in Server, std::vector<std::uint8_t> &Contents,
+                               std::size_t BlockSize, std::uint16_t DroppedBlock = 0) {
+    std::vector<std::uint8_t> Buffer(BlockSize + 4);
+    std::uint16_t Expected = 1;
+    bool Dropped = false;
+    while (true) {
+        auto Received = co_await Socket.receive(Buffer.data(), Buffer.size(), std::chrono::seconds(5));
+        if (!Received) {
+            co_return std::make_error_code(std::errc::timed_out);
+        }
+        auto Block = static_cast<std::uint16_t>(Buffer[2] << 8 | Buffer[3]);
+        if (Block == DroppedBlock && !Dropped) {
+            Dropped = true;
+            continue;
+        }
+        if (Block == Expected) {
+            Contents.insert(Contents.end(), Buffer.begin() + 4, Buffer.begin() + Received->Size);
+            ++Expected;
+        }
+        auto Acknowledgment = serialize(packets::Acknowledgment{Block});
+        co_await Socket.send(Acknowledgment.data(), Acknowledgment.size(), Server);
+        if (Block == Expected - 1 && Received->Size - 4 < BlockSize) {
+            co_return std::error_code{};
+        }
+    }
+}
+
+/// Send the file block by block waiting for the acknowledgments, every block is sent twice
+/// @n The server completes the transfer once it has the final block, so the duplicate of it stays unacknowledged
+Task<std::error_code> upload(UdpSocket &Socket, sockaddr_in Server, const std::vector<std::uint8_t> &Contents,
+                             std::size_t BlockSize) {
+    std::vector<std::uint8_t> Buffer(516);
+    auto Received = co_await Socket.receive(Buffer.data(), Buffer.size(), std::chrono::seconds(5));
+    if (!Received || Buffer[1] != packets::types::AcknowledgmentPacket) {
+        co_return std::make_error_code(std::errc::protocol_error);
+    }
+    for (std::size_t Offset = 0, Block = 1;; Offset += BlockSize, ++Block) {
+        auto Size = std::min(BlockSize, Contents.size() - Offset);
+        std::vector<std::uint8_t> Payload(Contents.begin() + Offset, Contents.begin() + Offset + Size);
+        auto Packet = serialize(packets::Data{static_cast<std::uint16_t>(Block), std::move(Payload)});
+        co_await Socket.send(Packet.data(), Packet.size(), Server);
+        co_await Socket.send(Packet.data(), Packet.size(), Server);
+        for (int Acknowledgments = 0; Acknowledgments != (Size < BlockSize ? 1 : 2); ++Acknowledgments) {
+            Received = co_await Socket.receive(Buffer.data(), Buffer.size(), std::chrono::seconds(5));
+            if (!Received || Buffer[1] != packets::types::AcknowledgmentPacket ||
+                (Buffer[2] << 8 | Buffer[3]) != static_cast<int>(Block & 0xffff)) {
+                co_return std::make_error_code(std::errc::protocol_error);
+            }
+        }
+        if (Size < BlockSize) {
+            co_return std::error_code{};
+        }
+    }
+}
+
+Task<int> add(int Lhs, int Rhs) { co_return Lhs + Rhs; }
+
+Task<int> sum(int Count) {
+    int Result = 0;
+    for (int Idx = 0; Idx != Count; ++Idx) {
+        Result += co_await add(Idx, 1);
+    }
+    co_return Result;
+}
+
+Task<int> fail() {
+    throw std::runtime_error("failure");
+    co_return 0;
+}
+
+} // namespace
+
+/// Test that tasks return values and propagate exceptions to the awaiting coroutine
+TEST(Coroutine, Task) {
+    Executor Loop;
+    int Result = 0;
+    bool Caught = false;
+    Loop.spawn([](int &Result, bool &Caught) -> Task<> {
+        Result = co_await sum(1000);
+        try {
+            co_await fail();
+        } catch (const std::runtime_error &) {
+            Caught = true;
+        }
+    }(Result, Caught));
+    Loop.run();
+    ASSERT_EQ(Result, 1000 * 999 / 2 + 1000);
+    ASSERT_TRUE(Caught);
+}
+
+/// Test that coroutine frames are recycled by the frame pool
+TEST(Coroutine, FramePool) {
+    Executor Loop;
+    Loop.spawn([]() -> Task<> { co_await sum(10); }());
+    Loop.run();
+    auto Allocations = FramePool::getAllocations();
+    Loop.spawn([]() -> Task<> { co_await sum(1000); }());
+    Loop.run();
+    ASSERT_EQ(FramePool::getAllocations(), Allocations);
+}
+
+/// Test that reception resumes the coroutine once the timeout expires
+TEST(Coroutine, ReceiveTimeout) {
+    Executor Loop;
+    UdpSocket Socket(Loop, makeLoopback());
+    bool TimedOut = false;
+    auto Start = Executor::Clock::now();
+    Loop.spawn([](UdpSocket &Socket, bool &TimedOut) -> Task<> {
+        std::uint8_t Buffer[16];
+        auto Received = co_await Socket.receive(Buffer, sizeof(Buffer), std::chrono::milliseconds(20));
+        TimedOut = !Received.has_value();
+    }(Socket, TimedOut));
+    Loop.run();
+    ASSERT_TRUE(TimedOut);
+    ASSERT_GE(Executor::Clock::now() - Start, std::chrono::milliseconds(20));
+}
+
+/// Test that the interrupted reception resumes without a datagram and without waiting for its timeout
+TEST(Coroutine, Interrupt) {
+    Executor Loop;
+    UdpSocket Socket(Loop, makeLoopback());
+    bool Interrupted = false;
+    auto Start = Executor::Clock::now();
+    Loop.spawn([](UdpSocket &Socket, bool &Interrupted) -> Task<> {
+        std::uint8_t Buffer[16];
+        auto Received = co_await Socket.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5));
+        Interrupted = !Received.has_value();
+    }(Socket, Interrupted));
+    Loop.spawn([](UdpSocket &Socket) -> Task<> {
+        Socket.interrupt();
+        co_return;
+    }(Socket));
+    Loop.run();
+    ASSERT_TRUE(Interrupted);
+    ASSERT_LT(Executor::Clock::now() - Start, std::chrono::seconds(1));
+}
+
+/// Test that the file is sent to the client and the lost block is retransmitted
+TEST(Coroutine, ReadTransfer) {
+    for (std::size_t Size : {0, 511, 512, 1024, 100000}) {
+        auto Contents = makeContents(Size);
+        std::vector<std::uint8_t> Received;
+        std::error_code ServerError, ClientError;
+
+        Executor Loop;
+        UdpSocket Server(Loop, makeLoopback());
+        UdpSocket Client(Loop, makeLoopback());
+        auto Read = [&Contents](std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Size) {
+            auto Count = std::min<std::size_t>(Size, Contents.size() - Offset);
+            std::copy_n(Contents.begin() + Offset, Count, Buffer);
+            return Count;
+        };
+        Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, decltype(Read) Read, std::error_code &Error) -> Task<> {
+            Error = co_await serveRead(Socket, Client, Read, makeOptions(512));
+        }(Server, Client.getLocalAddress(), Read, ServerError));
+        Loop.spawn([](UdpSocket &Socket, sockaddr_in Server, std::vector<std::uint8_t> &Received,
+                      std::error_code &Error) -> Task<> {
+            Error = co_await download(Socket, Server, Received, 512, 2);
+        }(Client, Server.getLocalAddress(), Received, ClientError));
+        Loop.run();
+
+        ASSERT_FALSE(ServerError) << ServerError.message();
+        ASSERT_FALSE(ClientError) << ClientError.message();
+        ASSERT_EQ(Received, Contents);
+    }
+}
+
+/// Test that the acknowledgment arriving after the retransmission isn't sampled: the first Data packet is ignored and
+/// the acknowledgment is sent late, so it can't be told whether it acknowledges the first transmission or the second
+TEST(Coroutine, KarnRetransmission) {
+    Executor Loop;
+    UdpSocket Server(Loop, makeLoopback());
+    UdpSocket Client(Loop, makeLoopback());
+    transfer::RetransmissionTimer Timer;
+    Timer.setBounds(std::chrono::milliseconds(20), std::chrono::seconds(1));
+    Timer.seed({std::chrono::milliseconds(1), std::chrono::milliseconds(1)});
+    auto Packet = serialize(packets::Data{1, std::vector<std::uint8_t>(10, 'x')});
+    std::vector<std::uint8_t> Incoming(516);
+    std::error_code ServerError;
+    int Transmissions = 0;
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, const std::vector<std::uint8_t> &Packet,
+                  transfer::RetransmissionTimer &Timer, std::vector<std::uint8_t> &Incoming,
+                  std::error_code &Error) -> Task<> {
+        Error = co_await details::sendUntilAcknowledged(Socket, Client, Packet.data(), Packet.size(), 1, Timer,
+                                                        Incoming, 5);
+    }(Server, Client.getLocalAddress(), Packet, Timer, Incoming, ServerError));
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Server, int &Transmissions) -> Task<> {
+        std::uint8_t Buffer[516];
+        while (Transmissions != 2) {
+            if (!co_await Socket.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5))) {
+                co_return;
+            }
+            ++Transmissions;
+        }
+        auto Acknowledgment = serialize(packets::Acknowledgment{1});
+        co_await Socket.send(Acknowledgment.data(), Acknowledgment.size(), Server);
+    }(Client, Server.getLocalAddress(), Transmissions));
+    Loop.run();
+
+    ASSERT_FALSE(ServerError) << ServerError.message();
+    ASSERT_EQ(Transmissions, 2);
+    // Without a sample the backoff stays in place and the estimate is still the seed
+    ASSERT_EQ(Timer.getBackoffCount(), 1);
+    ASSERT_EQ(Timer.getTimeout(), std::chrono::milliseconds(40));
+    ASSERT_EQ(Timer.getEstimate()->SmoothedRTT, std::chrono::milliseconds(1));
+}
+
+/// Test that the file is received from the client and duplicate blocks are written once
+TEST(Coroutine, WriteTransfer) {
+    for (std::size_t Size : {0, 1000, 1024, 70000}) {
+        auto Contents = makeContents(Size);
+        std::vector<std::uint8_t> Written;
+        std::error_code ServerError, ClientError;
+
+        Executor Loop;
+        UdpSocket Server(Loop, makeLoopback());
+        UdpSocket Client(Loop, makeLoopback());
+        auto Write = [&Written](std::uint16_t, const std::uint8_t *Buffer, std::size_t Size) {
+            Written.insert(Written.end(), Buffer, Buffer + Size);
+            return std::error_code{};
+        };
+        Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, decltype(Write) Write, std::error_code &Error) -> Task<> {
+            Error = co_await serveWrite(Socket, Client, Write, makeOptions(1024));
+        }(Server, Client.getLocalAddress(), Write, ServerError));
+        Loop.spawn([](UdpSocket &Socket, sockaddr_in Server, const std::vector<std::uint8_t> &Contents,
+                      std::error_code &Error) -> Task<> {
+            Error = co_await upload(Socket, Server, Contents, 1024);
+        }(Client, Server.getLocalAddress(), Contents, ClientError));
+        Loop.run();
+
+        ASSERT_FALSE(ServerError) << ServerError.message();
+        ASSERT_FALSE(ClientError) << ClientError.message();
+        ASSERT_EQ(Written, Contents);
+    }
+}
+
+/// Test that the option acknowledgment opening the write transfer is retransmitted in place of the acknowledgment of
+/// block 0, so that the client keeps the negotiated block size
+TEST(Coroutine, WriteNegotiation) {
+    auto Contents = makeContents(1500);
+    std::vector<std::uint8_t> Written;
+    std::vector<std::uint16_t> Opening;
+    std::error_code ServerError;
+
+    Executor Loop;
+    UdpSocket Server(Loop, makeLoopback());
+    UdpSocket Client(Loop, makeLoopback());
+    auto Write = [&Written](std::uint16_t, const std::uint8_t *Buffer, std::size_t Size) {
+        Written.insert(Written.end(), Buffer, Buffer + Size);
+        return std::error_code{};
+    };
+    auto Options = makeOptions(1024);
+    Options.Acknowledged = {{"blksize", "1024"}};
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, decltype(Write) Write, TransferOptions Options,
+                  std::error_code &Error) -> Task<> {
+        Error = co_await serveWrite(Socket, Client, Write, Options);
+    }(Server, Client.getLocalAddress(), Write, Options, ServerError));
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Server, const std::vector<std::uint8_t> &Contents,
+                  std::vector<std::uint16_t> &Opening) -> Task<> {
+        // The first option acknowledgment is lost
+        std::uint8_t Buffer[516];
+        for (int Idx = 0; Idx != 2; ++Idx) {
+            auto Received = co_await Socket.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5));
+            if (!Received) {
+                co_return;
+            }
+            Opening.push_back(static_cast<std::uint16_t>(Buffer[0] << 8 | Buffer[1]));
+        }
+        for (std::uint16_t Block = 1; Block <= 2; ++Block) {
+            auto Offset = (Block - 1) * std::size_t(1024);
+            std::vector<std::uint8_t> Payload(Contents.begin() + Offset,
+                                              Contents.begin() + std::min<std::size_t>(Offset + 1024, Contents.size()));
+            auto Packet = serialize(packets::Data{Block, std::move(Payload)});
+            co_await Socket.send(Packet.data(), Packet.size(), Server);
+            co_await Socket.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5));
+        }
+    }(Client, Server.getLocalAddress(), Contents, Opening));
+    Loop.run();
+
+    ASSERT_FALSE(ServerError) << ServerError.message();
+    ASSERT_EQ(Opening, (std::vector<std::uint16_t>{packets::types::OptionAcknowledgmentPacket,
+                                                   packets::types::OptionAcknowledgmentPacket}));
+    ASSERT_EQ(Written, Contents);
+}
+
+/// Test that the transfer is abandoned once the client stops responding
+TEST(Coroutine, Abandoned) {
+    Executor Loop;
+    UdpSocket Server(Loop, makeLoopback());
+    UdpSocket Client(Loop, makeLoopback());
+    auto Options = makeOptions(512);
+    Options.MaxRetries = 1;
+    std::error_code Error;
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, TransferOptions Options, std::error_code &Error) -> Task<> {
+        Error = co_await serveRead(
+            Socket, Client, [](std::uint64_t, std::uint8_t *, std::size_t) { return std::size_t(0); }, Options);
+    }(Server, Client.getLocalAddress(), Options, Error));
+    Loop.run();
+    ASSERT_EQ(Error, std::errc::timed_out);
+}
+
+/// Test that packets from other transfer identifiers are answered with an error and don't disturb the transfer
+TEST(Coroutine, UnknownTransferID) {
+    Executor Loop;
+    UdpSocket Server(Loop, makeLoopback());
+    UdpSocket Client(Loop, makeLoopback());
+    UdpSocket Stranger(Loop, makeLoopback());
+    std::vector<std::uint8_t> Written;
+    std::optional<std::uint16_t> ErrorCode;
+    std::error_code ServerError;
+    auto Write = [&Written](std::uint16_t, const std::uint8_t *Buffer, std::size_t Size) {
+        Written.insert(Written.end(), Buffer, Buffer + Size);
+        return std::error_code{};
+    };
+    Loop.spawn([](UdpSocket &Socket, sockaddr_in Client, decltype(Write) Write, std::error_code &Error) -> Task<> {
+        Error = co_await serveWrite(Socket, Client, Write, makeOptions(512));
+    }(Server, Client.getLocalAddress(), Write, ServerError));
+    Loop.spawn([](UdpSocket &Stranger, UdpSocket &Client, sockaddr_in Server,
+                  std::optional<std::uint16_t> &ErrorCode) -> Task<> {
+        std::uint8_t Buffer[516];
+        co_await Client.receive(Buffer, sizeof(Buffer));
+        auto Packet = serialize(packets::Data{1, std::vector<std::uint8_t>(10, 'x')});
+        co_await Stranger.send(Packet.data(), Packet.size(), Server);
+        auto Received = co_await Stranger.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5));
+        if (Received && Buffer[1] == packets::types::ErrorPacket) {
+            ErrorCode = static_cast<std::uint16_t>(Buffer[2] << 8 | Buffer[3]);
+        }
+        co_await Client.send(Packet.data(), Packet.size(), Server);
+        co_await Client.receive(Buffer, sizeof(Buffer), std::chrono::seconds(5));
+    }(Stranger, Client, Server.getLocalAddress(), ErrorCode));
+    Loop.run();
+    ASSERT_FALSE(ServerError);
+    ASSERT_EQ(ErrorCode, packets::errors::UnknownTransferID);
+    ASSERT_EQ(Written, std::vector<std::uint8_t>(10, 'x'));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#include "../tftp_common/details/file_sink.hpp"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+std::vector<std::uint8_t> makeContents(std::size_t Size) {
+    std::vector<std::uint8_t> Contents(Size);
+    std::mt19937 Random{static_cast<unsigned>(Size)};
+    for (auto &Byte : Contents) {
+        Byte = static_cast<std::uint8_t>(Random());
+    }
+    return Contents;
+}
+
+std::vector<std::uint8_t> readFile(const std::string &Path) {
+    std::ifstream Stream(Path, std::ios::binary);
+    return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(Stream), std::istreambuf_iterator<char>());
+}
+
+std::string makePath(const char *Name) {
+    return (testing::TempDir() + "/tftp_common_") + Name + std::to_string(::getpid());
+}
+
+/// Upload the contents block by block, blocks of every window are delivered in a random order
+void upload(FileBlockSink &Sink, const std::vector<std::uint8_t> &Contents, std::size_t BlockSize,
+            std::size_t WindowSize) {
+    auto BlocksCount = Contents.size() / BlockSize + 1;
+    std::mt19937 Random{42};
+    for (std::size_t First = 1; First <= BlocksCount; First += WindowSize) {
+        std::vector<std::size_t> Window;
+        for (auto Block = First; Block != std::min(First + WindowSize, BlocksCount + 1); ++Block) {
+            Window.push_back(Block);
+        }
+        std::shuffle(Window.begin(), Window.end(), Random);
+        // Every window is delivered twice, duplicates must be ignored
+        for (std::size_t Repeat = 0; Repeat != 2; ++Repeat) {
+            for (auto Block : Window) {
+                auto Offset = (Block - 1) * BlockSize;
+                auto Size = std::min(BlockSize, Contents.size() - Offset);
+                ASSERT_FALSE(Sink.write(static_cast<std::uint16_t>(Block), Contents.data() + Offset, Size));
+            }
+        }
+        ASSERT_EQ(Sink.getLastConsecutive(), static_cast<std::uint16_t>(First + Window.size() - 1));
+    }
+}
+
+} // namespace
+
+/// Test that the uploaded file is written out intact for various block and buffer sizes
+TEST(FileBlockSink, Write) {
+    struct Case {
+        std::size_t BlockSize;
+        std::size_t FileSize;
+        std::size_t WindowSize;
+        bool DirectIO;
+    };
+    for (auto [BlockSize, FileSize, WindowSize, DirectIO] : {Case{512, 100 * 512 + 17, 1, false},
+                                                              Case{512, 64 * 512, 8, false},
+                                                              Case{1428, 200 * 1428 + 1000, 16, false},
+                                                              Case{1428, 200 * 1428 + 1000, 16, true}}) {
+        auto Path = makePath("sink");
+        auto Contents = makeContents(FileSize);
+        {
+            FileBlockSink Sink{BlockSize, 8192, 4, DirectIO};
+            ASSERT_FALSE(Sink.open(Path));
+            upload(Sink, Contents, BlockSize, WindowSize);
+            ASSERT_TRUE(Sink.isComplete());
+            ASSERT_FALSE(Sink.finish());
+        }
+        ASSERT_EQ(readFile(Path), Contents);
+        std::remove(Path.c_str());
+    }
+}
+
+/// Test that block numbers wrapping around in long transfers are resolved correctly
+TEST(FileBlockSink, WrapAround) {
+    auto Path = makePath("wrap");
+    auto Contents = makeContents(70000 * 8 + 3);
+    {
+        FileBlockSink Sink{8, 4096, 2};
+        ASSERT_FALSE(Sink.open(Path));
+        upload(Sink, Contents, 8, 4);
+        ASSERT_TRUE(Sink.isComplete());
+        ASSERT_FALSE(Sink.finish(false));
+    }
+    ASSERT_EQ(readFile(Path), Contents);
+    std::remove(Path.c_str());
+}
+
+/// Test that blocks beyond the buffered range are rejected and the sink doesn't complete with missing blocks
+TEST(FileBlockSink, OutOfRange) {
+    auto Path = makePath("range");
+    std::vector<std::uint8_t> Block(512, 0xAB);
+    {
+        FileBlockSink Sink{512, 4096, 2};
+        ASSERT_FALSE(Sink.open(Path));
+        // Two buffers of 8 blocks each
+        ASSERT_EQ(Sink.write(17, Block.data(), Block.size()), std::errc::result_out_of_range);
+        ASSERT_FALSE(Sink.write(16, Block.data(), Block.size()));
+        ASSERT_FALSE(Sink.write(packets::Data{16, Block}));
+        ASSERT_FALSE(Sink.write(packets::Data{2, std::vector<std::uint8_t>(100, 0xCD)}));
+        ASSERT_EQ(Sink.getLastConsecutive(), 0);
+        ASSERT_FALSE(Sink.isComplete());
+    }
+    std::remove(Path.c_str());
+}
+
+/// Test that file system errors are reported with the corresponding TFTP error codes
+TEST(FileBlockSink, Errors) {
+    FileBlockSink Sink;
+    auto Error = Sink.open(testing::TempDir() + "/tftp_common_missing/directory/file");
+    ASSERT_TRUE(Error);
+    ASSERT_EQ(makeFileError(Error).getErrorCode(), packets::errors::FileNotFound);
+    ASSERT_EQ(makeFileError(std::make_error_code(std::errc::no_space_on_device)).getErrorCode(),
+              packets::errors::DiskFull);
+    ASSERT_EQ(makeFileError(std::make_error_code(std::errc::permission_denied)).getErrorCode(),
+              packets::errors::AccessViolation);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "../tftp_common/details/client.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+
+/// Scaffolding of the tests running transfers against a server on the loopback interface
+namespace tftp_common::tests {
+
+inline sockaddr_in makeLoopback(std::uint16_t Port = 0) {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Address.sin_port = htons(Port);
+    return Address;
+}
+
+inline std::string makeContents(std::size_t Size, unsigned Seed) {
+    std::mt19937 Generator(Seed);
+    std::string Contents(Size, '\0');
+    for (auto &Char : Contents) {
+        Char = static_cast<char>(Generator());
+    }
+    return Contents;
+}
+
+inline std::string readLocal(const std::string &Path) {
+    std::ifstream File(Path, std::ios::binary);
+    std::stringstream Contents;
+    Contents << File.rdbuf();
+    return Contents.str();
+}
+
+/// Temporary directory, removed with its contents
+class TemporaryDirectory {
+  public:
+    TemporaryDirectory() {
+        char Template[] = "/tmp/tftp_test_XXXXXX";
+        Root = ::mkdtemp(Template);
+    }
+    ~TemporaryDirectory() { std::system(("rm -rf " + Root).c_str()); }
+
+    std::string Root;
+};
+
+/// Server serving files from memory on its own thread, each transfer starts after \p StartDelay and each block is
+/// sent after \p BlockDelay (the server thread is blocked meanwhile, like by a slow link)
+/// @n It's lock-step: the window size is acknowledged as 1, written files are stored in memory too
+class LoopbackServer {
+  public:
+    LoopbackServer(std::map<std::string, std::string> Files, std::chrono::milliseconds StartDelay,
+                   std::chrono::microseconds BlockDelay = std::chrono::microseconds(0))
+        : Files(std::move(Files)), StartDelay(StartDelay), BlockDelay(BlockDelay) {
+        Engine.spawn(listen());
+        Thread = std::thread([this] { Engine.run(); });
+    }
+    LoopbackServer(const LoopbackServer &) = delete;
+    LoopbackServer &operator=(const LoopbackServer &) = delete;
+    ~LoopbackServer() {
+        Stopping = true;
+        Thread.join();
+    }
+
+    sockaddr_in getAddress() const noexcept { return Listener.getLocalAddress(); }
+
+    std::string getFile(const std::string &Name) const {
+        std::lock_guard Lock(Mutex);
+        auto It = Files.find(Name);
+        return It == Files.end() ? std::string() : It->second;
+    }
+
+    void setFile(const std::string &Name, std::string Contents) {
+        std::lock_guard Lock(Mutex);
+        Files[Name] = std::move(Contents);
+    }
+
+    /// Wait for an upload to be stored: the server may still be finishing the transfer after the client has received
+    /// the last acknowledgment
+    std::string waitFile(const std::string &Name) const {
+        auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        auto Contents = getFile(Name);
+        while (Contents.empty() && std::chrono::steady_clock::now() < Deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            Contents = getFile(Name);
+        }
+        return Contents;
+    }
+
+    /// @return Number of requests of the file
+    std::size_t getRequests(const std::string &Name) const {
+        std::lock_guard Lock(Mutex);
+        auto It = Requests.find(Name);
+        return It == Requests.end() ? 0 : It->second;
+    }
+
+    /// @return Number of completed reads of the file
+    std::size_t getTransfers(const std::string &Name) const {
+        std::lock_guard Lock(Mutex);
+        auto It = Transfers.find(Name);
+        return It == Transfers.end() ? 0 : It->second;
+    }
+
+    /// @return Moment the last read has completed
+    std::chrono::steady_clock::time_point getLastCompletion() const {
+        std::lock_guard Lock(Mutex);
+        return LastCompletion;
+    }
+
+  private:
+    async::Task<void> serve(packets::Request Request, sockaddr_in Client) {
+        async::UdpSocket Socket(Engine, makeLoopback());
+        std::vector<std::uint8_t> Incoming(65536);
+        if (StartDelay.count() != 0) {
+            co_await Socket.receive(Incoming.data(), Incoming.size(), StartDelay);
+        }
+
+        std::string Contents;
+        std::optional<std::uint64_t> Size;
+        auto Filename = std::string(Request.getFilename());
+        auto Reading = Request.getType() == packets::types::ReadRequest;
+        {
+            std::lock_guard Lock(Mutex);
+            ++Requests[Filename];
+            auto It = Files.find(Filename);
+            if (Reading && It != Files.end()) {
+                Contents = It->second;
+                Size = Contents.size();
+            }
+        }
+        if (Reading && !Size) {
+            auto Reply = async::details::serialize(
+                packets::Error(packets::errors::FileNotFound, std::string_view("File not found")));
+            co_await Socket.send(Reply.data(), Reply.size(), Client);
+            co_return;
+        }
+        auto Negotiated = options::negotiate(Request, Size, packets::Data::MaxBlockSize, 1);
+        async::TransferOptions Settings;
+        Settings.BlockSize = Negotiated.BlockSize;
+        Settings.Acknowledged = std::move(Negotiated.Acknowledged);
+        if (Reading) {
+            auto Error = co_await async::serveRead(
+                Socket, Client,
+                [this, &Contents](std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Count) {
+                    if (BlockDelay.count() != 0) {
+                        std::this_thread::sleep_for(BlockDelay);
+                    }
+                    auto Read = std::min<std::size_t>(Count, Contents.size() - Offset);
+                    std::memcpy(Buffer, Contents.data() + Offset, Read);
+                    return Read;
+                },
+                Settings);
+            if (!Error) {
+                std::lock_guard Lock(Mutex);
+                ++Transfers[Filename];
+                LastCompletion = std::chrono::steady_clock::now();
+            }
+            co_return;
+        }
+        auto Error = co_await async::serveWrite(
+            Socket, Client,
+            [&Contents](std::uint16_t, const std::uint8_t *Buffer, std::size_t Count) {
+                Contents.append(reinterpret_cast<const char *>(Buffer), Count);
+                return std::error_code{};
+            },
+            Settings);
+        if (!Error) {
+            std::lock_guard Lock(Mutex);
+            Files[Filename] = Contents;
+        }
+    }
+
+    async::Task<void> listen() {
+        std::vector<std::uint8_t> Incoming(65536);
+        while (!Stopping) {
+            auto Received =
+                co_await Listener.receive(Incoming.data(), Incoming.size(), std::chrono::milliseconds(20));
+            if (!Received) {
+                continue;
+            }
+            auto Parsed = packets::Parser<packets::Request>::parse(Incoming.data(), Received->Size);
+            if (Parsed.isSuccess()) {
+                Engine.spawn(serve(Parsed.get().Packet, Received->From));
+            }
+        }
+    }
+
+    std::map<std::string, std::string> Files;
+    std::map<std::string, std::size_t> Requests;
+    std::map<std::string, std::size_t> Transfers;
+    std::chrono::steady_clock::time_point LastCompletion;
+    std::chrono::milliseconds StartDelay;
+    std::chrono::microseconds BlockDelay;
+    mutable std::mutex Mutex;
+    async::Executor Engine;
+    async::UdpSocket Listener{Engine, makeLoopback()};
+    std::atomic<bool> Stopping{false};
+    std::thread Thread;
+};
+
+} // namespace tftp_common::tests
@@ -0,0 +1,301 @@
+#include "../tftp_common/details/multicast.hpp"
+#include "../tftp_common/details/parsers.hpp"
+#include <gtest/gtest.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tftp_common;
+using namespace tftp_common::packets;
+using namespace tftp_common::transfer;
+
+namespace {
+
+TransferID makeID(std::uint16_t Port) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Endpoint.sin_port = htons(Port);
+    return TransferID::fromIPv4(Endpoint);
+}
+
+} // namespace
+
+/// Test that multicast option values are parsed and formatted according to RFC 2090
+TEST(Multicast, Option) {
+    auto Option = options::parseMulticast("224.100.100.100,1758,1");
+    ASSERT_TRUE(Option.has_value());
+    ASSERT_EQ(Option->Address, "224.100.100.100");
+    ASSERT_EQ(Option->Port, 1758);
+    ASSERT_TRUE(Option->MasterClient);
+    ASSERT_EQ(options::formatMulticast(*Option), "224.100.100.100,1758,1");
+
+    auto Promotion = options::parseMulticast(",,1");
+    ASSERT_TRUE(Promotion.has_value());
+    ASSERT_TRUE(Promotion->Address.empty());
+    ASSERT_FALSE(Promotion->Port.has_value());
+
+    ASSERT_FALSE(options::parseMulticast("224.100.100.100,1758").has_value());
+    ASSERT_FALSE(options::parseMulticast("224.100.100.100,0,1").has_value());
+    ASSERT_FALSE(options::parseMulticast("224.100.100.100,1758,2").has_value());
+
+    ASSERT_TRUE(options::requestsMulticast(Request{types::ReadRequest, "boot.img", "octet", {"multicast"}, {""}}));
+    ASSERT_FALSE(options::requestsMulticast(Request{types::WriteRequest, "boot.img", "octet", {"multicast"}, {""}}));
+    ASSERT_FALSE(options::requestsMulticast(
+        Request{types::ReadRequest, std::string_view("boot.img"), std::string_view("octet")}));
+}
+
+/// Test that the first client becomes master and the next one is promoted once the master has the whole file
+TEST(Multicast, Election) {
+    MulticastSender Sender{"239.255.0.1", 1758, 4, 2};
+    auto First = makeID(1000), Second = makeID(1001);
+
+    auto Acknowledgment = Sender.addClient(First, {{"blksize", "512"}});
+    ASSERT_TRUE(options::getMulticast(Acknowledgment)->MasterClient);
+    ASSERT_EQ(Acknowledgment.getOptionValue("blksize"), "512");
+    ASSERT_FALSE(options::getMulticast(Sender.addClient(Second))->MasterClient);
+
+    // Acknowledgments of non-master clients are ignored
+    ASSERT_EQ(Sender.onAcknowledgment(Second, 0).BlocksCount, 0);
+
+    auto Step = Sender.onAcknowledgment(First, 0);
+    ASSERT_EQ(Step.FirstBlock, 1);
+    ASSERT_EQ(Step.BlocksCount, 2);
+    Step = Sender.onAcknowledgment(First, 2);
+    ASSERT_EQ(Step.FirstBlock, 3);
+    ASSERT_EQ(Step.BlocksCount, 2);
+    ASSERT_EQ(Sender.getBlocksSent(), 4u);
+
+    Step = Sender.onAcknowledgment(First, 4);
+    ASSERT_EQ(Step.BlocksCount, 0);
+    ASSERT_TRUE(Step.Promotion.has_value());
+    ASSERT_EQ(Step.Promotion->first, Second);
+    auto Promotion = options::getMulticast(Step.Promotion->second);
+    ASSERT_TRUE(Promotion->MasterClient);
+    ASSERT_TRUE(Promotion->Address.empty());
+
+    // The new master has missed the second block
+    Step = Sender.onAcknowledgment(Second, 1);
+    ASSERT_EQ(Step.FirstBlock, 2);
+    ASSERT_EQ(Step.BlocksCount, 2);
+    ASSERT_EQ(Sender.getBlocksResent(), 2u);
+    ASSERT_FALSE(Sender.onAcknowledgment(Second, 4).Promotion.has_value());
+    ASSERT_EQ(Sender.getClientsCount(), 0u);
+}
+
+/// Test that a silent master client is replaced once it runs out of retries
+TEST(Multicast, MasterTimeout) {
+    MulticastSender Sender{"239.255.0.1", 1758, 10, 1, 2};
+    auto First = makeID(1000), Second = makeID(1001);
+    Sender.addClient(First);
+    Sender.addClient(Second);
+    Sender.onAcknowledgment(First, 0);
+
+    ASSERT_EQ(Sender.onTimeout().FirstBlock, 1);
+    ASSERT_EQ(Sender.onTimeout().FirstBlock, 1);
+    auto Step = Sender.onTimeout();
+    ASSERT_TRUE(Step.Promotion.has_value());
+    ASSERT_EQ(Sender.getMaster(), Second);
+}
+
+/// Test that the receiver acknowledges the last consecutively received block
+TEST(Multicast, Receiver) {
+    MulticastReceiver Receiver{512};
+    ASSERT_TRUE(Receiver.onOptionAcknowledgment(*options::parseMulticast("239.255.0.1,1758,0")));
+    ASSERT_FALSE(Receiver.getAcknowledgment().has_value());
+
+    ASSERT_TRUE(Receiver.onData(1, 512));
+    ASSERT_TRUE(Receiver.onData(3, 100));
+    ASSERT_FALSE(Receiver.onData(3, 100));
+    ASSERT_FALSE(Receiver.onData(4, 0));
+    ASSERT_FALSE(Receiver.isComplete());
+
+    ASSERT_TRUE(Receiver.onOptionAcknowledgment(*options::parseMulticast(",,1")));
+    ASSERT_EQ(Receiver.getAcknowledgment()->getBlock(), 1);
+    ASSERT_TRUE(Receiver.onData(2, 512));
+    ASSERT_EQ(Receiver.getAcknowledgment()->getBlock(), 3);
+    ASSERT_TRUE(Receiver.isComplete());
+
+    ASSERT_FALSE(Receiver.onOptionAcknowledgment(*options::parseMulticast("239.255.0.2,1758,1")));
+}
+
+/// Test the whole multicast transfer over loopback: one server and three clients, one of which misses a block
+TEST(Multicast, Loopback) {
+    constexpr char Group[] = "239.255.42.69";
+    constexpr std::size_t FileSize = 9 * 512 + 100;
+    constexpr std::size_t ClientsCount = 3;
+    std::vector<std::uint8_t> File(FileSize);
+    for (std::size_t Idx = 0; Idx != FileSize; ++Idx) {
+        File[Idx] = static_cast<std::uint8_t>(Idx * 31);
+    }
+
+    auto makeSocket = [](std::uint16_t Port, bool Reuse) {
+        int Socket = socket(AF_INET, SOCK_DGRAM, 0);
+        int One = 1;
+        if (Reuse) {
+            setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+        }
+        sockaddr_in Address{};
+        Address.sin_family = AF_INET;
+        Address.sin_addr.s_addr = Reuse ? htonl(INADDR_ANY) : htonl(INADDR_LOOPBACK);
+        Address.sin_port = htons(Port);
+        bind(Socket, reinterpret_cast<sockaddr *>(&Address), sizeof(Address));
+        return Socket;
+    };
+    auto localAddress = [](int Socket) {
+        sockaddr_in Address{};
+        socklen_t Length = sizeof(Address);
+        getsockname(Socket, reinterpret_cast<sockaddr *>(&Address), &Length);
+        return Address;
+    };
+    auto sendPacket = [](int Socket, const auto &Packet, const sockaddr_in &To) {
+        std::vector<std::uint8_t> Buffer;
+        Packet.serialize(std::back_inserter(Buffer));
+        sendto(Socket, Buffer.data(), Buffer.size(), 0, reinterpret_cast<const sockaddr *>(&To), sizeof(To));
+    };
+
+    int Server = makeSocket(0, false);
+    auto ServerAddress = localAddress(Server);
+    int Multicast = makeSocket(0, false);
+    in_addr Loopback{htonl(INADDR_LOOPBACK)};
+    if (setsockopt(Multicast, IPPROTO_IP, IP_MULTICAST_IF, &Loopback, sizeof(Loopback)) != 0) {
+        GTEST_SKIP() << "multicast isn't available";
+    }
+    int One = 1;
+    setsockopt(Multicast, IPPROTO_IP, IP_MULTICAST_LOOP, &One, sizeof(One));
+    // The group port is any port that happens to be free
+    int Probe = makeSocket(0, false);
+    auto GroupPort = ntohs(localAddress(Probe).sin_port);
+    close(Probe);
+    sockaddr_in GroupAddress{};
+    GroupAddress.sin_family = AF_INET;
+    GroupAddress.sin_port = htons(GroupPort);
+    inet_pton(AF_INET, Group, &GroupAddress.sin_addr);
+
+    struct Client {
+        int Unicast;
+        int Group;
+        MulticastReceiver Receiver;
+        std::vector<std::uint8_t> File;
+        bool Dropped = false;
+    };
+    std::vector<Client> Clients;
+    for (std::size_t Idx = 0; Idx != ClientsCount; ++Idx) {
+        Client Joined{makeSocket(0, false), makeSocket(GroupPort, true), MulticastReceiver{512}, {}};
+        ip_mreq Membership{};
+        Membership.imr_multiaddr = GroupAddress.sin_addr;
+        Membership.imr_interface = Loopback;
+        if (setsockopt(Joined.Group, IPPROTO_IP, IP_ADD_MEMBERSHIP, &Membership, sizeof(Membership)) != 0) {
+            GTEST_SKIP() << "multicast group can't be joined";
+        }
+        Joined.File.resize(FileSize);
+        Clients.push_back(std::move(Joined));
+    }
+
+    MulticastSender Sender{Group, GroupPort, static_cast<std::uint16_t>(FileSize / 512 + 1)};
+    for (auto &Joined : Clients) {
+        sendPacket(Joined.Unicast, Request{types::ReadRequest, "boot.img", "octet", {"multicast"}, {""}},
+                   ServerAddress);
+    }
+
+    auto multicastBlocks = [&](const MulticastSender::Step &Step) {
+        for (std::uint16_t Block = Step.FirstBlock; Block != Step.FirstBlock + Step.BlocksCount; ++Block) {
+            auto Begin = File.begin() + (Block - 1) * 512;
+            auto End = std::min(Begin + 512, File.end());
+            sendPacket(Multicast, Data{Block, std::vector<std::uint8_t>(Begin, End)}, GroupAddress);
+        }
+        if (Step.Promotion) {
+            for (auto &Joined : Clients) {
+                auto Address = localAddress(Joined.Unicast);
+                if (TransferID::fromIPv4(Address) == Step.Promotion->first) {
+                    sendPacket(Server, Step.Promotion->second, Address);
+                }
+            }
+        }
+    };
+
+    std::uint8_t Buffer[2048];
+    for (std::size_t Iteration = 0; Iteration != 200; ++Iteration) {
+        bool Done = true;
+        for (auto &Joined : Clients) {
+            Done = Done && Joined.Receiver.isComplete();
+        }
+        if (Done) {
+            break;
+        }
+
+        std::vector<pollfd> Descriptors = {{Server, POLLIN, 0}};
+        for (auto &Joined : Clients) {
+            Descriptors.push_back({Joined.Unicast, POLLIN, 0});
+            Descriptors.push_back({Joined.Group, POLLIN, 0});
+        }
+        if (poll(Descriptors.data(), Descriptors.size(), 100) == 0) {
+            multicastBlocks(Sender.onTimeout());
+            continue;
+        }
+
+        if (Descriptors[0].revents & POLLIN) {
+            sockaddr_in From{};
+            socklen_t Length = sizeof(From);
+            auto Size = recvfrom(Server, Buffer, sizeof(Buffer), 0, reinterpret_cast<sockaddr *>(&From), &Length);
+            if (auto Parsed = Parser<Request>::parse(Buffer, Size); Parsed.isSuccess()) {
+                ASSERT_TRUE(options::requestsMulticast(Parsed.get().Packet));
+                sendPacket(Server, Sender.addClient(TransferID::fromIPv4(From)), From);
+            } else if (auto Acknowledged = Parser<Acknowledgment>::parse(Buffer, Size); Acknowledged.isSuccess()) {
+                multicastBlocks(Sender.onAcknowledgment(TransferID::fromIPv4(From),
+                                                        Acknowledged.get().Packet.getBlock()));
+            }
+        }
+
+        for (std::size_t Idx = 0; Idx != Clients.size(); ++Idx) {
+            auto &Joined = Clients[Idx];
+            if (Descriptors[1 + Idx * 2].revents & POLLIN) {
+                auto Size = recv(Joined.Unicast, Buffer, sizeof(Buffer), 0);
+                auto Parsed = Parser<OptionAcknowledgment>::parse(Buffer, Size);
+                ASSERT_TRUE(Parsed.isSuccess());
+                auto Option = options::getMulticast(Parsed.get().Packet);
+                ASSERT_TRUE(Option.has_value());
+                ASSERT_TRUE(Joined.Receiver.onOptionAcknowledgment(*Option));
+                if (auto Reply = Joined.Receiver.getAcknowledgment()) {
+                    sendPacket(Joined.Unicast, *Reply, ServerAddress);
+                }
+            }
+            if (Descriptors[2 + Idx * 2].revents & POLLIN) {
+                auto Size = recv(Joined.Group, Buffer, sizeof(Buffer), 0);
+                auto Parsed = Parser<Data>::parse(Buffer, Size);
+                ASSERT_TRUE(Parsed.isSuccess());
+                const auto &Packet = Parsed.get().Packet;
+                // The last client misses the third block the first time it's multicast
+                if (Idx == ClientsCount - 1 && Packet.getBlock() == 3 && !Joined.Dropped) {
+                    Joined.Dropped = true;
+                    continue;
+                }
+                if (Joined.Receiver.onData(Packet.getBlock(), Packet.getData().size())) {
+                    std::copy(Packet.getData().begin(), Packet.getData().end(),
+                              Joined.File.begin() + (Packet.getBlock() - 1) * 512);
+                }
+                if (auto Reply = Joined.Receiver.getAcknowledgment()) {
+                    sendPacket(Joined.Unicast, *Reply, ServerAddress);
+                }
+            }
+        }
+    }
+
+    for (auto &Joined : Clients) {
+        ASSERT_TRUE(Joined.Receiver.isComplete());
+        ASSERT_EQ(Joined.File, File);
+        close(Joined.Unicast);
+        close(Joined.Group);
+    }
+    // Every block went out once, only the block missed by the last client was sent again
+    ASSERT_EQ(Sender.getBlocksSent(), FileSize / 512 + 1);
+    ASSERT_EQ(Sender.getBlocksResent(), 1u);
+    close(Server);
+    close(Multicast);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,83 @@
+#include "../tftp_common/details/options.hpp"
+#include <gtest/gtest.h>
+
+using namespace tftp_common;
+using namespace tftp_common::packets;
+
+/// Test that options are looked up by their names ignoring case
+TEST(Options, Find) {
+    auto Packet = Request{types::ReadRequest, "pxelinux.0", "octet", {"TimeOut", "blksize"}, {"5", "1428"}};
+
+    ASSERT_EQ(options::find(Packet, "timeout"), "5");
+    ASSERT_EQ(options::find(Packet, "BLKSIZE"), "1428");
+    ASSERT_EQ(options::find(Packet, "tsize"), std::nullopt);
+
+    auto Acknowledgment = OptionAcknowledgment{{{"Timeout", "5"}}};
+    ASSERT_EQ(options::find(Acknowledgment, "timeout"), "5");
+    ASSERT_EQ(options::find(Acknowledgment, "blksize"), std::nullopt);
+}
+
+/// Test that timeout interval option values are validated according to RFC 2349
+TEST(Options, ParseTimeout) {
+    ASSERT_EQ(options::parseTimeout("1"), std::chrono::seconds(1));
+    ASSERT_EQ(options::parseTimeout("255"), std::chrono::seconds(255));
+    ASSERT_EQ(options::parseTimeout("0"), std::nullopt);
+    ASSERT_EQ(options::parseTimeout("256"), std::nullopt);
+    ASSERT_EQ(options::parseTimeout(""), std::nullopt);
+    ASSERT_EQ(options::parseTimeout("5s"), std::nullopt);
+    ASSERT_EQ(options::parseTimeout("99999999999999999999999"), std::nullopt);
+}
+
+/// Test that block size, window size and transfer size option values are validated
+TEST(Options, ParseSizes) {
+    ASSERT_EQ(options::parseBlockSize("8"), 8);
+    ASSERT_EQ(options::parseBlockSize("65464"), 65464);
+    ASSERT_EQ(options::parseBlockSize("7"), std::nullopt);
+    ASSERT_EQ(options::parseBlockSize("65465"), std::nullopt);
+    ASSERT_EQ(options::parseWindowSize("1"), 1);
+    ASSERT_EQ(options::parseWindowSize("65535"), 65535);
+    ASSERT_EQ(options::parseWindowSize("0"), std::nullopt);
+    ASSERT_EQ(options::parseWindowSize("65536"), std::nullopt);
+    ASSERT_EQ(options::parseTransferSize("0"), 0);
+    ASSERT_EQ(options::parseTransferSize("10000000000"), 10000000000);
+    ASSERT_EQ(options::parseTransferSize("-1"), std::nullopt);
+    ASSERT_EQ(options::parseTransferSize("18446744073709551615"), UINT64_MAX);
+    ASSERT_EQ(options::parseTransferSize("18446744073709551616"), std::nullopt);
+    ASSERT_EQ(options::parseTransferSize("184467440737095516150"), std::nullopt);
+}
+
+/// Test that the transfer size is acknowledged only if the size of the requested file is known
+TEST(Options, Negotiate) {
+    auto Packet = Request{types::ReadRequest, "menu.cfg", "octet", {"blksize", "windowsize", "tsize", "timeout", "x"},
+                          {"9000", "16", "0", "3", "y"}};
+    auto Unknown = options::negotiate(Packet, std::nullopt, 1428, 8);
+    ASSERT_EQ(Unknown.BlockSize, 1428);
+    ASSERT_EQ(Unknown.WindowSize, 8);
+    ASSERT_EQ(Unknown.Timeout, std::chrono::seconds(3));
+    ASSERT_EQ(Unknown.TransferSize, std::nullopt);
+    ASSERT_EQ(Unknown.Acknowledged.size(), 3);
+    ASSERT_EQ(Unknown.Acknowledged.count("tsize"), 0);
+    ASSERT_EQ(Unknown.Acknowledged.at("blksize"), "1428");
+
+    auto Known = options::negotiate(Packet, 123456);
+    ASSERT_EQ(Known.BlockSize, 9000);
+    ASSERT_EQ(Known.WindowSize, 16);
+    ASSERT_EQ(Known.TransferSize, 123456);
+    ASSERT_EQ(Known.Acknowledged.at("tsize"), "123456");
+
+    auto Invalid = Request{types::ReadRequest, "menu.cfg", "octet", {"blksize", "windowsize"}, {"70000", "0"}};
+    ASSERT_EQ(options::negotiate(Invalid).BlockSize, 512);
+    ASSERT_TRUE(options::negotiate(Invalid).Acknowledged.empty());
+
+    auto Write = Request{types::WriteRequest, "upload.bin", "octet", {"tsize"}, {"4096"}};
+    ASSERT_EQ(options::negotiate(Write).TransferSize, 4096);
+    ASSERT_EQ(options::negotiate(Write).Acknowledged.at("tsize"), "4096");
+
+    auto Plain = Request{types::ReadRequest, std::string_view("file"), std::string_view("octet")};
+    ASSERT_TRUE(options::negotiate(Plain, 10).Acknowledged.empty());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
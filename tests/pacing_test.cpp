@@ -0,0 +1,495 @@
+#include "../tftp_common/details/pacing.hpp"
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+using Clock = TokenBucket::Clock;
+
+Clock::time_point at(std::int64_t Nanoseconds) { return Clock::time_point(std::chrono::nanoseconds(Nanoseconds)); }
+
+TransferID makeClient(std::uint32_t Address, std::uint16_t Port = 50000) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(Address);
+    Endpoint.sin_port = htons(Port);
+    return TransferID::fromIPv4(Endpoint);
+}
+
+double getFairness(const std::vector<double> &Shares) {
+    double Sum = 0, Squares = 0;
+    for (auto Share : Shares) {
+        Sum += Share;
+        Squares += Share * Share;
+    }
+    return Sum * Sum / (static_cast<double>(Shares.size()) * Squares);
+}
+
+/// Outcome of the simulated transfers
+struct Outcome {
+    /// Bytes of the blocks delivered in order to each client per second
+    std::vector<double> Goodput;
+    std::size_t Drops = 0;
+
+    double getTotal() const {
+        double Total = 0;
+        for (auto Bytes : Goodput) {
+            Total += Bytes;
+        }
+        return Total;
+    }
+};
+
+/// Discrete event simulation of windowed (RFC 7440) transfers sharing a bottleneck link in virtual time
+/// @n The link has a drop-tail buffer and loses Data packets at random, acknowledgments are never lost. A receiver
+/// acknowledges a complete window and the last block before a gap, the sender sends the next window when it's
+/// acknowledged and the whole window again after a timeout. Unpaced senders put their windows on the link at once,
+/// paced ones go through the pacer.
+class Simulation {
+  public:
+    static constexpr std::int64_t Second = 1000000000;
+    static constexpr std::uint64_t LinkRate = 5000000;
+    static constexpr std::uint64_t LinkBuffer = 32 * 1024;
+    static constexpr std::int64_t Delay = Second / 1000;
+    static constexpr std::int64_t Timeout = 20 * Second / 1000;
+    static constexpr std::size_t PacketSize = 1024 + 4;
+
+    Simulation(std::vector<std::uint16_t> Windows, double Loss, bool Paced)
+        : Windows(std::move(Windows)), Loss(Loss), Paced(Paced), Scheduler([] {
+              PacingLimits Settings;
+              Settings.GlobalRate = LinkRate * 95 / 100;
+              Settings.GlobalBurst = 4 * PacketSize;
+              return Settings;
+          }()),
+          Senders(this->Windows.size()), Receivers(this->Windows.size()) {
+        for (std::size_t Idx = 0; Idx != this->Windows.size(); ++Idx) {
+            Senders[Idx].Flow = Scheduler.addFlow(makeClient(0x0a000001 + static_cast<std::uint32_t>(Idx)));
+        }
+    }
+
+    Outcome run(std::int64_t Duration) {
+        for (std::size_t Idx = 0; Idx != Windows.size(); ++Idx) {
+            sendWindow(Idx);
+        }
+        while (!Events.empty() && Events.top().Time < Duration) {
+            auto Current = Events.top();
+            Events.pop();
+            Now = Current.Time;
+            switch (Current.Type) {
+            case Event::Data:
+                onData(Current.Flow, Current.Block);
+                break;
+            case Event::Acknowledgment:
+                onAcknowledgment(Current.Flow, Current.Block);
+                break;
+            case Event::Timeout:
+                if (Current.Generation == Senders[Current.Flow].Generation) {
+                    sendWindow(Current.Flow);
+                }
+                break;
+            case Event::Wake:
+                wake();
+                break;
+            }
+        }
+        Outcome Result;
+        Result.Drops = Drops;
+        for (const auto &Receiving : Receivers) {
+            Result.Goodput.push_back(static_cast<double>(Receiving.Expected - 1) * 1024 * Second / Duration);
+        }
+        return Result;
+    }
+
+  private:
+    struct Event {
+        enum Kind { Data, Acknowledgment, Timeout, Wake };
+
+        std::int64_t Time;
+        std::uint64_t Sequence;
+        Kind Type;
+        std::size_t Flow;
+        std::uint64_t Block;
+        std::uint64_t Generation;
+
+        bool operator>(const Event &Other) const {
+            return Time != Other.Time ? Time > Other.Time : Sequence > Other.Sequence;
+        }
+    };
+
+    struct Sender {
+        Pacer::FlowID Flow;
+        std::uint64_t Base = 1;
+        std::uint64_t Generation = 0;
+        /// Blocks queued by the pacer
+        std::deque<std::uint64_t> Queued;
+    };
+
+    struct Receiver {
+        std::uint64_t Expected = 1;
+        std::uint64_t Acknowledged = 0;
+        std::uint64_t GapAcknowledged = 0;
+    };
+
+    void post(std::int64_t Time, Event::Kind Type, std::size_t Flow = 0, std::uint64_t Block = 0,
+              std::uint64_t Generation = 0) {
+        Events.push(Event{Time, Sequence++, Type, Flow, Block, Generation});
+    }
+
+    void sendWindow(std::size_t Flow) {
+        auto &Sending = Senders[Flow];
+        ++Sending.Generation;
+        if (!Paced) {
+            for (std::uint16_t Idx = 0; Idx != Windows[Flow]; ++Idx) {
+                transmit(Flow, Sending.Base + Idx);
+            }
+            arm(Flow);
+            return;
+        }
+        Scheduler.clear(Sending.Flow);
+        Sending.Queued.clear();
+        for (std::uint16_t Idx = 0; Idx != Windows[Flow]; ++Idx) {
+            Scheduler.enqueue(Sending.Flow, PacketSize);
+            Sending.Queued.push_back(Sending.Base + Idx);
+        }
+        wake();
+    }
+
+    /// Start the timer once the last packet of the window is sent, the jitter keeps the senders from synchronizing
+    void arm(std::size_t Flow) {
+        post(Now + Timeout + Jitter(Random), Event::Timeout, Flow, 0, Senders[Flow].Generation);
+    }
+
+    void wake() {
+        Granted.clear();
+        Scheduler.schedule(at(Now), Granted, 16);
+        for (const auto &Grant : Granted) {
+            auto Flow = Grant.Flow;
+            transmit(Flow, Senders[Flow].Queued.front());
+            Senders[Flow].Queued.pop_front();
+            if (Senders[Flow].Queued.empty()) {
+                arm(Flow);
+            }
+        }
+        if (auto Deadline = Scheduler.getNextDeadline(at(Now))) {
+            auto Time = std::chrono::duration_cast<std::chrono::nanoseconds>(Deadline->time_since_epoch()).count();
+            if (Time != Wakeup || Time == Now) {
+                Wakeup = Time;
+                post(Time, Event::Wake);
+            }
+        }
+    }
+
+    /// Put the packet on the link, it's dropped if the buffer is full
+    void transmit(std::size_t Flow, std::uint64_t Block) {
+        auto Backlog = static_cast<std::uint64_t>(std::max<std::int64_t>(0, LinkFree - Now)) * LinkRate / Second;
+        if (Backlog + PacketSize > LinkBuffer) {
+            ++Drops;
+            return;
+        }
+        LinkFree = std::max(LinkFree, Now) + static_cast<std::int64_t>(PacketSize * Second / LinkRate);
+        if (Lost(Random)) {
+            return;
+        }
+        post(LinkFree + Delay, Event::Data, Flow, Block);
+    }
+
+    void onData(std::size_t Flow, std::uint64_t Block) {
+        auto &Receiving = Receivers[Flow];
+        if (Block == Receiving.Expected) {
+            ++Receiving.Expected;
+            if (Receiving.Expected - 1 - Receiving.Acknowledged == Windows[Flow]) {
+                acknowledge(Flow);
+            }
+        } else if (Block > Receiving.Expected && Receiving.GapAcknowledged != Receiving.Expected) {
+            Receiving.GapAcknowledged = Receiving.Expected;
+            acknowledge(Flow);
+        }
+    }
+
+    void acknowledge(std::size_t Flow) {
+        auto &Receiving = Receivers[Flow];
+        Receiving.Acknowledged = Receiving.Expected - 1;
+        post(Now + Delay, Event::Acknowledgment, Flow, Receiving.Acknowledged);
+    }
+
+    void onAcknowledgment(std::size_t Flow, std::uint64_t Block) {
+        auto &Sending = Senders[Flow];
+        if (Block + 1 < Sending.Base) {
+            return;
+        }
+        Sending.Base = Block + 1;
+        sendWindow(Flow);
+    }
+
+    std::vector<std::uint16_t> Windows;
+    double Loss;
+    bool Paced;
+    Pacer Scheduler;
+    std::vector<Sender> Senders;
+    std::vector<Receiver> Receivers;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> Events;
+    std::vector<Pacer::Grant> Granted;
+    std::uint64_t Sequence = 0;
+    std::int64_t Now = 0;
+    std::int64_t Wakeup = -1;
+    std::int64_t LinkFree = 0;
+    std::size_t Drops = 0;
+    std::mt19937 Random{35};
+    std::bernoulli_distribution Lost{Loss};
+    std::uniform_int_distribution<std::int64_t> Jitter{0, Timeout / 10};
+};
+
+/// Sum of the granted bytes per flow
+std::vector<std::size_t> countBytes(const std::vector<Pacer::Grant> &Granted, std::size_t Flows) {
+    std::vector<std::size_t> Bytes(Flows);
+    for (const auto &Grant : Granted) {
+        Bytes[Grant.Flow] += Grant.Bytes;
+    }
+    return Bytes;
+}
+
+} // namespace
+
+/// Test that the bucket lets the burst through at once and then spaces packets by their transmission time
+TEST(TokenBucket, Conformance) {
+    TokenBucket Bucket(1000, 100);
+    ASSERT_TRUE(Bucket.tryConsume(100, at(0)));
+    ASSERT_FALSE(Bucket.tryConsume(1, at(0)));
+    ASSERT_EQ(Bucket.getAvailableAt(1, at(0)), at(1000000));
+    ASSERT_EQ(Bucket.getAvailableAt(10, at(0)), at(10000000));
+    ASSERT_TRUE(Bucket.tryConsume(10, at(10000000)));
+    // The burst is regained after idling
+    ASSERT_TRUE(Bucket.tryConsume(100, at(1000000000)));
+
+    // Nanosecond resolution
+    TokenBucket Fast(1000000000, 0);
+    ASSERT_TRUE(Fast.tryConsume(0, at(0)));
+    Fast.consume(1500, at(0));
+    ASSERT_EQ(Fast.getAvailableAt(1, at(0)), at(1501));
+
+    TokenBucket Unlimited;
+    for (int Idx = 0; Idx != 1000; ++Idx) {
+        ASSERT_TRUE(Unlimited.tryConsume(65535, at(0)));
+    }
+}
+
+/// Test that the rate changed at runtime applies to the following packets
+TEST(TokenBucket, SetRate) {
+    TokenBucket Bucket(1000, 0);
+    Bucket.consume(100, at(0));
+    ASSERT_EQ(Bucket.getAvailableAt(100, at(0)), at(200000000));
+    Bucket.setRate(10000, 0);
+    ASSERT_EQ(Bucket.getAvailableAt(100, at(0)), at(110000000));
+    Bucket.consume(100, at(110000000));
+    ASSERT_EQ(Bucket.getAvailableAt(100, at(110000000)), at(130000000));
+    Bucket.setRate(0, 0);
+    ASSERT_TRUE(Bucket.conforms(65535, at(100000000)));
+}
+
+/// Test that backlogged flows get equal shares of bytes regardless of their packet sizes
+TEST(Pacer, DeficitRoundRobin) {
+    PacingLimits Settings;
+    Settings.Quantum = 1500;
+    Pacer Scheduler(Settings);
+    auto Small = Scheduler.addFlow(makeClient(0x0a000001));
+    auto Large = Scheduler.addFlow(makeClient(0x0a000002));
+    for (int Idx = 0; Idx != 3000; ++Idx) {
+        Scheduler.enqueue(Small, 100);
+    }
+    for (int Idx = 0; Idx != 200; ++Idx) {
+        Scheduler.enqueue(Large, 1500);
+    }
+    std::vector<Pacer::Grant> Granted;
+    while (Granted.size() < 1000) {
+        ASSERT_GT(Scheduler.schedule(at(0), Granted, 64), 0);
+    }
+    auto Bytes = countBytes(Granted, 2);
+    auto Ratio = static_cast<double>(Bytes[Small]) / static_cast<double>(Bytes[Large]);
+    ASSERT_NEAR(Ratio, 1.0, 0.05);
+    ASSERT_EQ(Scheduler.getNextDeadline(at(0)), at(0));
+
+    // A flow which runs out of packets leaves the round
+    Scheduler.clear(Large);
+    Granted.clear();
+    Scheduler.schedule(at(0), Granted, 64);
+    ASSERT_EQ(countBytes(Granted, 2)[Large], 0);
+    ASSERT_EQ(Granted.size(), 64);
+}
+
+/// Test that the global bucket limits the batch and reports when the next packet may go
+TEST(Pacer, Global) {
+    PacingLimits Settings;
+    Settings.GlobalRate = 1000000;
+    Settings.GlobalBurst = 10 * 1000;
+    Settings.Quantum = 1000;
+    Pacer Scheduler(Settings);
+    auto Flow = Scheduler.addFlow(makeClient(0x0a000001));
+    ASSERT_EQ(Scheduler.getNextDeadline(at(0)), std::nullopt);
+    for (int Idx = 0; Idx != 100; ++Idx) {
+        Scheduler.enqueue(Flow, 1000);
+    }
+    std::vector<Pacer::Grant> Granted;
+    ASSERT_EQ(Scheduler.schedule(at(0), Granted, 64), 10);
+    ASSERT_EQ(Scheduler.getNextDeadline(at(0)), at(1000000));
+    ASSERT_EQ(Scheduler.schedule(at(999999), Granted, 64), 0);
+    ASSERT_EQ(Scheduler.schedule(at(5000000), Granted, 64), 5);
+    ASSERT_EQ(Scheduler.schedule(at(1000000000), Granted, 4), 4);
+
+    // The debt of the bucket is kept, following packets are spaced by the new rate
+    Scheduler.setGlobalRate(2000000, 10 * 1000);
+    Granted.clear();
+    ASSERT_EQ(Scheduler.schedule(at(1000000000), Granted, 64), 2);
+    ASSERT_EQ(Scheduler.getNextDeadline(at(1000000000)), at(1000500000));
+    ASSERT_EQ(Scheduler.getQueued(Flow), 79);
+}
+
+/// Test that flows of one client and of one subnet share their buckets, a flow held back by them doesn't delay the
+/// others
+TEST(Pacer, ClientAndSubnet) {
+    PacingLimits Settings;
+    Settings.ClientRate = 1000000;
+    Settings.ClientBurst = 2000;
+    Settings.SubnetRate = 1000000;
+    Settings.SubnetBurst = 3000;
+    Settings.Quantum = 1000;
+    Pacer Scheduler(Settings);
+    auto First = Scheduler.addFlow(makeClient(0x0a000001, 1000));
+    auto Second = Scheduler.addFlow(makeClient(0x0a000001, 1001));
+    auto Neighbour = Scheduler.addFlow(makeClient(0x0a0000fe));
+    auto Remote = Scheduler.addFlow(makeClient(0x0a000101));
+    for (auto Flow : {First, Second, Neighbour, Remote}) {
+        for (int Idx = 0; Idx != 10; ++Idx) {
+            Scheduler.enqueue(Flow, 1000);
+        }
+    }
+    std::vector<Pacer::Grant> Granted;
+    Scheduler.schedule(at(0), Granted, 64);
+    auto Bytes = countBytes(Granted, 4);
+    // Two packets for the client, the third one for the subnet
+    ASSERT_EQ(Bytes[First] + Bytes[Second], 2000);
+    ASSERT_EQ(Bytes[Neighbour], 1000);
+    ASSERT_EQ(Bytes[Remote], 2000);
+
+    // Clients are limited, not their subnets
+    Scheduler.setSubnetRate(0, 0);
+    Scheduler.setClientRate(0, 0);
+    Granted.clear();
+    Scheduler.schedule(at(0), Granted, 64);
+    Bytes = countBytes(Granted, 4);
+    ASSERT_EQ(Bytes[First] + Bytes[Second], 18000);
+    ASSERT_EQ(Bytes[Neighbour], 9000);
+    ASSERT_EQ(Bytes[Remote], 8000);
+
+    // The removed flow releases the shared buckets, the flow is reused
+    Scheduler.removeFlow(Neighbour);
+    ASSERT_EQ(Scheduler.addFlow(makeClient(0x0a000002)), Neighbour);
+    ASSERT_EQ(Scheduler.getQueued(Neighbour), 0);
+}
+
+/// Test that over a lossy bottleneck link with a small buffer pacing delivers more bytes in total and shares them
+/// fairly between clients with large and small windows, while unpaced windows overflow the buffer
+TEST(Pacer, LossyLink) {
+    std::vector<std::uint16_t> Windows = {64, 64, 8, 8, 8, 8, 8, 8};
+    auto Duration = 5 * Simulation::Second;
+    auto Unpaced = Simulation(Windows, 0.01, false).run(Duration);
+    auto Paced = Simulation(Windows, 0.01, true).run(Duration);
+    ASSERT_EQ(Paced.Drops, 0);
+    ASSERT_GT(Unpaced.Drops, 0);
+    ASSERT_GT(Paced.getTotal(), Unpaced.getTotal() * 1.1);
+    ASSERT_GT(getFairness(Paced.Goodput), getFairness(Unpaced.Goodput));
+    ASSERT_GT(getFairness(Paced.Goodput), 0.9);
+}
+
+/// Test that datagrams sent over loopback in the granted batches with sendmmsg keep to the rates
+TEST(Pacer, Loopback) {
+    int Sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+    int Receiver = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(Receiver, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address));
+    socklen_t Length = sizeof(Address);
+    ::getsockname(Receiver, reinterpret_cast<sockaddr *>(&Address), &Length);
+    int BufferSize = 8 * 1024 * 1024;
+    ::setsockopt(Receiver, SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+
+    // Three flows to one client and one flow to another, each client gets half of the global rate
+    PacingLimits Settings;
+    Settings.GlobalRate = 4000000;
+    Settings.GlobalBurst = 16 * 1024;
+    Settings.ClientRate = 2000000;
+    Settings.ClientBurst = 8 * 1024;
+    Pacer Scheduler(Settings);
+    std::vector<Pacer::FlowID> Flows = {Scheduler.addFlow(makeClient(0x0a000001, 1)),
+                                        Scheduler.addFlow(makeClient(0x0a000001, 2)),
+                                        Scheduler.addFlow(makeClient(0x0a000001, 3)),
+                                        Scheduler.addFlow(makeClient(0x0a000002))};
+    constexpr std::size_t PacketSize = 1024 + 4;
+    std::vector<std::uint8_t> Packets(64 * PacketSize);
+    std::vector<iovec> Vectors(64);
+    std::vector<mmsghdr> Messages(64);
+    std::vector<std::size_t> Received(Flows.size());
+    std::vector<std::uint8_t> Buffer(65536);
+    std::vector<Pacer::Grant> Granted;
+    auto Drain = [&] {
+        for (;;) {
+            auto Size = ::recv(Receiver, Buffer.data(), Buffer.size(), 0);
+            if (Size <= 0) {
+                break;
+            }
+            Received[Buffer[4]] += static_cast<std::size_t>(Size);
+        }
+    };
+
+    auto Start = Clock::now();
+    auto Duration = std::chrono::milliseconds(500);
+    for (auto Now = Start; Now < Start + Duration; Now = Clock::now()) {
+        for (auto Flow : Flows) {
+            while (Scheduler.getQueued(Flow) < 8) {
+                Scheduler.enqueue(Flow, PacketSize);
+            }
+        }
+        Granted.clear();
+        auto Count = Scheduler.schedule(Now, Granted, Messages.size());
+        for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+            auto *Packet = Packets.data() + Idx * PacketSize;
+            Packet[4] = static_cast<std::uint8_t>(Granted[Idx].Flow);
+            Vectors[Idx] = iovec{Packet, Granted[Idx].Bytes};
+            Messages[Idx] = mmsghdr{};
+            Messages[Idx].msg_hdr.msg_name = &Address;
+            Messages[Idx].msg_hdr.msg_namelen = sizeof(Address);
+            Messages[Idx].msg_hdr.msg_iov = &Vectors[Idx];
+            Messages[Idx].msg_hdr.msg_iovlen = 1;
+        }
+        if (Count != 0) {
+            ASSERT_EQ(::sendmmsg(Sender, Messages.data(), static_cast<unsigned>(Count), 0), Count);
+        }
+        Drain();
+        std::this_thread::sleep_until(std::min(*Scheduler.getNextDeadline(Now), Start + Duration));
+    }
+    Drain();
+    ::close(Sender);
+    ::close(Receiver);
+
+    auto Seconds = std::chrono::duration<double>(Clock::now() - Start).count();
+    auto First = static_cast<double>(Received[0] + Received[1] + Received[2]);
+    auto Second = static_cast<double>(Received[3]);
+    // The sleeps may overshoot, so only the upper bound is strict
+    ASSERT_LE(First, 2000000 * Seconds + 8 * 1024 + PacketSize);
+    ASSERT_LE(Second, 2000000 * Seconds + 8 * 1024 + PacketSize);
+    ASSERT_GT(First + Second, 4000000 * Seconds * 0.5);
+    ASSERT_NEAR(First / Second, 1.0, 0.2);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
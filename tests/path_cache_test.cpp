@@ -0,0 +1,258 @@
+#include "../tftp_common/details/path_cache.hpp"
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+/// Temporary directory served by the cache, removed with its contents
+class ServedTree {
+  public:
+    ServedTree() {
+        char Template[] = "/tmp/tftp_path_cache_XXXXXX";
+        Root = ::mkdtemp(Template);
+    }
+    ~ServedTree() { std::system(("rm -rf " + Root).c_str()); }
+
+    void write(const std::string &Path, const std::string &Contents) {
+        auto *File = std::fopen((Root + "/" + Path).c_str(), "wb");
+        std::fwrite(Contents.data(), 1, Contents.size(), File);
+        std::fclose(File);
+    }
+
+    void makeDirectory(const std::string &Path) { ::mkdir((Root + "/" + Path).c_str(), 0755); }
+
+    std::string Root;
+};
+
+std::string read(const CachedFile &File) {
+    std::string Contents(File.getSize(), '\0');
+    auto Size = ::pread(File.getDescriptor(), Contents.data(), Contents.size(), 0);
+    Contents.resize(static_cast<std::size_t>(std::max<ssize_t>(Size, 0)));
+    return Contents;
+}
+
+std::vector<std::uint8_t> serialize(const packets::Error &Packet) {
+    std::vector<std::uint8_t> Bytes;
+    Packet.serialize(std::back_inserter(Bytes));
+    return Bytes;
+}
+
+} // namespace
+
+/// Test that filenames are made relative to the root and those which may escape it are rejected
+TEST(PathCache, Sanitize) {
+    ASSERT_EQ(sanitizeFilename("pxelinux.0"), "pxelinux.0");
+    ASSERT_EQ(sanitizeFilename("/pxelinux.cfg//default"), "pxelinux.cfg/default");
+    ASSERT_EQ(sanitizeFilename("boot\\x86\\.\\bootmgr.exe/"), "boot/x86/bootmgr.exe");
+    ASSERT_EQ(sanitizeFilename("./a/./b"), "a/b");
+    ASSERT_EQ(sanitizeFilename("a..b/..c"), "a..b/..c");
+    ASSERT_EQ(sanitizeFilename("../etc/passwd"), std::nullopt);
+    ASSERT_EQ(sanitizeFilename("a/../../b"), std::nullopt);
+    ASSERT_EQ(sanitizeFilename("a\\..\\b"), std::nullopt);
+    ASSERT_EQ(sanitizeFilename("a\nb"), std::nullopt);
+    ASSERT_EQ(sanitizeFilename(""), std::nullopt);
+    ASSERT_EQ(sanitizeFilename("//./"), std::nullopt);
+}
+
+/// Test that an existing file is opened once and then served from the cache with its metadata
+TEST(PathCache, Hit) {
+    ServedTree Tree;
+    Tree.write("pxelinux.0", "bootloader");
+    PathCache Cache;
+    ASSERT_FALSE(Cache.open(Tree.Root));
+
+    auto First = Cache.resolve("/pxelinux.0");
+    ASSERT_TRUE(First.File);
+    ASSERT_FALSE(First.Error);
+    ASSERT_FALSE(First.ErrorPacket);
+    ASSERT_FALSE(First.Cached);
+    ASSERT_EQ(First.File->getSize(), 10);
+    ASSERT_EQ(read(*First.File), "bootloader");
+
+    auto Second = Cache.resolve("pxelinux.0");
+    ASSERT_TRUE(Second.Cached);
+    ASSERT_EQ(Second.File, First.File);
+    ASSERT_EQ(Cache.getHits(), 1);
+    ASSERT_EQ(Cache.getLookups(), 1);
+}
+
+/// Test that misses are cached with the serialized Error packet until they expire
+TEST(PathCache, Negative) {
+    ServedTree Tree;
+    Tree.makeDirectory("pxelinux.cfg");
+    PathCache Cache;
+    ASSERT_FALSE(Cache.open(Tree.Root));
+
+    auto Now = PathCache::Clock::now();
+    auto Missing = Cache.resolve("pxelinux.cfg/01-52-54-00-12-34-56", Now);
+    ASSERT_FALSE(Missing.File);
+    ASSERT_EQ(Missing.Error, std::errc::no_such_file_or_directory);
+    ASSERT_EQ(*Missing.ErrorPacket,
+              serialize(packets::Error(packets::errors::FileNotFound, std::string_view("File not found"))));
+
+    auto Cached = Cache.resolve("pxelinux.cfg/01-52-54-00-12-34-56", Now + std::chrono::seconds(1));
+    ASSERT_TRUE(Cached.Cached);
+    ASSERT_EQ(Cached.ErrorPacket, Missing.ErrorPacket);
+    ASSERT_EQ(Cache.getNegativeHits(), 1);
+
+    auto Expired = Cache.resolve("pxelinux.cfg/01-52-54-00-12-34-56", Now + std::chrono::seconds(5));
+    ASSERT_FALSE(Expired.Cached);
+    ASSERT_EQ(Cache.getLookups(), 2);
+
+    // Directories and rejected filenames can't be served either
+    auto Directory = Cache.resolve("pxelinux.cfg");
+    ASSERT_EQ(Directory.Error, std::errc::is_a_directory);
+    ASSERT_TRUE(Directory.ErrorPacket);
+    auto Rejected = Cache.resolve("../secret");
+    ASSERT_EQ(Rejected.Error, std::errc::permission_denied);
+    ASSERT_EQ(*Rejected.ErrorPacket,
+              serialize(packets::Error(packets::errors::AccessViolation, std::string_view("Access violation"))));
+}
+
+/// Test that changes of the served tree invalidate the cached hits and misses
+TEST(PathCache, Invalidation) {
+    ServedTree Tree;
+    Tree.write("default", "old");
+    PathCache Cache;
+    ASSERT_FALSE(Cache.open(Tree.Root));
+
+    ASSERT_FALSE(Cache.resolve("menu").File);
+    ASSERT_FALSE(Cache.resolve("pxelinux.cfg/default").File);
+    ASSERT_EQ(read(*Cache.resolve("default").File), "old");
+
+    // Created file
+    Tree.write("menu", "menu");
+    ASSERT_GT(Cache.poll(), 0);
+    ASSERT_TRUE(Cache.resolve("menu").File);
+
+    // Modified file
+    Tree.write("default", "new contents");
+    Cache.poll();
+    auto Modified = Cache.resolve("default");
+    ASSERT_FALSE(Modified.Cached);
+    ASSERT_EQ(read(*Modified.File), "new contents");
+
+    // Replaced file
+    Tree.write("default.tmp", "replaced");
+    ::rename((Tree.Root + "/default.tmp").c_str(), (Tree.Root + "/default").c_str());
+    Cache.poll();
+    ASSERT_EQ(read(*Cache.resolve("default").File), "replaced");
+
+    // Created directory, which is watched too
+    Tree.makeDirectory("pxelinux.cfg");
+    Tree.write("pxelinux.cfg/default", "config");
+    Cache.poll();
+    ASSERT_EQ(read(*Cache.resolve("pxelinux.cfg/default").File), "config");
+    Tree.write("pxelinux.cfg/default", "changed");
+    Cache.poll();
+    ASSERT_EQ(read(*Cache.resolve("pxelinux.cfg/default").File), "changed");
+
+    // Removed file
+    ::unlink((Tree.Root + "/menu").c_str());
+    Cache.poll();
+    ASSERT_FALSE(Cache.resolve("menu").File);
+    ASSERT_EQ(Cache.poll(), 0);
+}
+
+/// Test that the number of cached paths is bounded
+TEST(PathCache, Capacity) {
+    ServedTree Tree;
+    PathCacheSettings Settings;
+    Settings.MaxEntries = 64;
+    Settings.ShardsCount = 4;
+    PathCache Cache(Settings);
+    ASSERT_FALSE(Cache.open(Tree.Root));
+    for (int Idx = 0; Idx != 1000; ++Idx) {
+        Cache.resolve("missing" + std::to_string(Idx));
+    }
+    ASSERT_LE(Cache.size(), 64);
+}
+
+/// Test that entries hit since they were last considered for eviction stay cached
+TEST(PathCache, Eviction) {
+    ServedTree Tree;
+    Tree.write("pxelinux.0", "loader");
+    PathCacheSettings Settings;
+    Settings.MaxEntries = 8;
+    Settings.ShardsCount = 1;
+    PathCache Cache(Settings);
+    ASSERT_FALSE(Cache.open(Tree.Root));
+    Cache.resolve("pxelinux.0");
+    for (int Idx = 0; Idx != 100; ++Idx) {
+        Cache.resolve("missing" + std::to_string(Idx));
+        ASSERT_TRUE(Cache.resolve("pxelinux.0").Cached);
+    }
+    ASSERT_EQ(Cache.size(), 8);
+    ASSERT_FALSE(Cache.resolve("missing0").Cached);
+}
+
+/// Test that symbolic links don't lead out of the served tree
+TEST(PathCache, SymbolicLinks) {
+    ServedTree Outside;
+    Outside.write("secret", "secret");
+    ServedTree Tree;
+    Tree.makeDirectory("images");
+    ASSERT_EQ(::symlink((Outside.Root + "/secret").c_str(), (Tree.Root + "/absolute").c_str()), 0);
+    ASSERT_EQ(::symlink(("../" + Outside.Root.substr(Outside.Root.rfind('/') + 1) + "/secret").c_str(),
+                        (Tree.Root + "/relative").c_str()),
+              0);
+    ASSERT_EQ(::symlink(Outside.Root.c_str(), (Tree.Root + "/images/outside").c_str()), 0);
+    PathCache Cache;
+    ASSERT_FALSE(Cache.open(Tree.Root));
+    for (const auto *Filename : {"absolute", "relative", "images/outside/secret"}) {
+        auto Resolved = Cache.resolve(Filename);
+        ASSERT_FALSE(Resolved.File) << Filename;
+        ASSERT_EQ(Resolved.Error, std::errc::permission_denied) << Filename;
+        ASSERT_EQ(*Resolved.ErrorPacket,
+                  serialize(packets::Error(packets::errors::AccessViolation, std::string_view("Access violation"))));
+    }
+}
+
+/// Test that concurrent resolutions and invalidations agree with the served tree
+TEST(PathCache, Concurrent) {
+    ServedTree Tree;
+    for (int Idx = 0; Idx != 8; ++Idx) {
+        Tree.write("file" + std::to_string(Idx), std::string(static_cast<std::size_t>(Idx), 'x'));
+    }
+    PathCache Cache;
+    ASSERT_FALSE(Cache.open(Tree.Root));
+
+    std::atomic<bool> Failed{false};
+    std::vector<std::thread> Threads;
+    for (int Thread = 0; Thread != 8; ++Thread) {
+        Threads.emplace_back([&, Thread] {
+            for (int Idx = 0; Idx != 20000; ++Idx) {
+                auto Number = (Thread + Idx) % 16;
+                auto Resolved = Cache.resolve("file" + std::to_string(Number));
+                // Files 0-7 always exist, 8-15 never do
+                if ((Number < 8) != static_cast<bool>(Resolved.File) ||
+                    (Resolved.File && Resolved.File->getSize() != static_cast<std::uint64_t>(Number))) {
+                    Failed = true;
+                }
+            }
+        });
+    }
+    // Files are replaced atomically, so that their sizes never change
+    for (int Idx = 0; Idx != 200; ++Idx) {
+        auto Name = "file" + std::to_string(Idx % 8);
+        Tree.write("replacement", std::string(static_cast<std::size_t>(Idx % 8), 'x'));
+        ::rename((Tree.Root + "/replacement").c_str(), (Tree.Root + "/" + Name).c_str());
+        Cache.poll();
+    }
+    for (auto &Thread : Threads) {
+        Thread.join();
+    }
+    ASSERT_FALSE(Failed);
+    ASSERT_GT(Cache.getHits() + Cache.getNegativeHits(), Cache.getLookups());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
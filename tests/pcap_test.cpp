@@ -0,0 +1,313 @@
+#include "../tftp_common/details/pcap.hpp"
+#include <gtest/gtest.h>
+
+using namespace tftp_common;
+using namespace tftp_common::capture;
+
+namespace {
+
+using Bytes = std::vector<std::uint8_t>;
+
+transfer::TransferID makeEndpoint(std::uint32_t Address, std::uint16_t Port) {
+    std::uint8_t Octets[4] = {static_cast<std::uint8_t>(Address >> 24), static_cast<std::uint8_t>(Address >> 16),
+                              static_cast<std::uint8_t>(Address >> 8), static_cast<std::uint8_t>(Address)};
+    return details::makeIPv4Endpoint(Octets, Port);
+}
+
+template <class Packet> Bytes serialize(const Packet &Value) {
+    Bytes Serialized;
+    Value.serialize(std::back_inserter(Serialized));
+    return Serialized;
+}
+
+/// IPv4 packet carrying the UDP datagram, as written by CaptureWriter
+Bytes makeIPv4(std::uint16_t SourcePort, std::uint16_t DestinationPort, const Bytes &Payload) {
+    CaptureWriter Writer;
+    Writer.write(0, makeEndpoint(0x0a000001, SourcePort), makeEndpoint(0x0a000002, DestinationPort), Payload.data(),
+                 Payload.size());
+    return Bytes(Writer.getBuffer().begin() + 24 + 16, Writer.getBuffer().end());
+}
+
+Bytes makeIPv6(std::uint16_t SourcePort, std::uint16_t DestinationPort, const Bytes &Payload) {
+    auto Length = static_cast<std::uint16_t>(Payload.size() + 8 + 8);
+    // Destination options extension header before the UDP header
+    Bytes Packet = {0x60, 0, 0, 0, static_cast<std::uint8_t>(Length >> 8), static_cast<std::uint8_t>(Length), 60, 64};
+    for (int Idx = 0; Idx != 32; ++Idx) {
+        Packet.push_back(static_cast<std::uint8_t>(Idx < 16 ? 0x20 : 0x30));
+    }
+    Bytes Options = {17, 0, 1, 4, 0, 0, 0, 0};
+    Packet.insert(Packet.end(), Options.begin(), Options.end());
+    Bytes Udp = {static_cast<std::uint8_t>(SourcePort >> 8), static_cast<std::uint8_t>(SourcePort),
+                 static_cast<std::uint8_t>(DestinationPort >> 8), static_cast<std::uint8_t>(DestinationPort),
+                 static_cast<std::uint8_t>((Payload.size() + 8) >> 8), static_cast<std::uint8_t>(Payload.size() + 8),
+                 0, 0};
+    Packet.insert(Packet.end(), Udp.begin(), Udp.end());
+    Packet.insert(Packet.end(), Payload.begin(), Payload.end());
+    return Packet;
+}
+
+Bytes makeEthernet(const Bytes &Packet, bool Tagged) {
+    Bytes Frame(12, 0x02);
+    if (Tagged) {
+        Frame.insert(Frame.end(), {0x81, 0x00, 0x00, 0x07});
+    }
+    bool IPv6 = Packet[0] >> 4 == 6;
+    Frame.push_back(static_cast<std::uint8_t>(IPv6 ? 0x86 : 0x08));
+    Frame.push_back(static_cast<std::uint8_t>(IPv6 ? 0xdd : 0x00));
+    Frame.insert(Frame.end(), Packet.begin(), Packet.end());
+    // Ethernet padding
+    Frame.resize(std::max<std::size_t>(Frame.size(), 60));
+    return Frame;
+}
+
+/// Builder of pcapng captures in either byte order
+class PcapNGBuilder {
+  public:
+    explicit PcapNGBuilder(bool BigEndian) : BigEndian(BigEndian) {
+        Bytes Body;
+        put32(Body, 0x1a2b3c4d);
+        put16(Body, 1);
+        put16(Body, 0);
+        put32(Body, 0xffffffff);
+        put32(Body, 0xffffffff);
+        block(0x0a0d0d0a, Body);
+    }
+
+    void addInterface(std::uint16_t Link, std::optional<std::uint8_t> Resolution) {
+        Bytes Body;
+        put16(Body, Link);
+        put16(Body, 0);
+        put32(Body, 65535);
+        if (Resolution) {
+            put16(Body, 9);
+            put16(Body, 1);
+            Body.insert(Body.end(), {*Resolution, 0, 0, 0});
+            put32(Body, 0);
+        }
+        block(1, Body);
+    }
+
+    void addPacket(std::uint32_t Interface, std::uint64_t Units, const Bytes &Frame) {
+        Bytes Body;
+        put32(Body, Interface);
+        put32(Body, static_cast<std::uint32_t>(Units >> 32));
+        put32(Body, static_cast<std::uint32_t>(Units));
+        put32(Body, static_cast<std::uint32_t>(Frame.size()));
+        put32(Body, static_cast<std::uint32_t>(Frame.size()));
+        Body.insert(Body.end(), Frame.begin(), Frame.end());
+        block(6, Body);
+    }
+
+    void addSimplePacket(const Bytes &Frame) {
+        Bytes Body;
+        put32(Body, static_cast<std::uint32_t>(Frame.size()));
+        Body.insert(Body.end(), Frame.begin(), Frame.end());
+        block(3, Body);
+    }
+
+    Bytes Capture;
+
+  private:
+    void put16(Bytes &Buffer, std::uint16_t Value) {
+        Bytes Field = {static_cast<std::uint8_t>(Value), static_cast<std::uint8_t>(Value >> 8)};
+        if (BigEndian) {
+            std::swap(Field[0], Field[1]);
+        }
+        Buffer.insert(Buffer.end(), Field.begin(), Field.end());
+    }
+
+    void put32(Bytes &Buffer, std::uint32_t Value) {
+        if (BigEndian) {
+            put16(Buffer, static_cast<std::uint16_t>(Value >> 16));
+            put16(Buffer, static_cast<std::uint16_t>(Value));
+        } else {
+            put16(Buffer, static_cast<std::uint16_t>(Value));
+            put16(Buffer, static_cast<std::uint16_t>(Value >> 16));
+        }
+    }
+
+    void block(std::uint32_t Type_, Bytes Body) {
+        Body.resize((Body.size() + 3) / 4 * 4);
+        auto Length = static_cast<std::uint32_t>(Body.size() + 12);
+        put32(Capture, Type_);
+        put32(Capture, Length);
+        Capture.insert(Capture.end(), Body.begin(), Body.end());
+        put32(Capture, Length);
+    }
+
+    bool BigEndian;
+};
+
+std::vector<Datagram> readAll(CaptureReader &Reader) {
+    std::vector<Datagram> Datagrams;
+    while (auto Next = Reader.next()) {
+        Datagrams.push_back(*Next);
+    }
+    return Datagrams;
+}
+
+} // namespace
+
+/// Test that datagrams written by CaptureWriter are read back with their endpoints, timestamps and payloads
+TEST(CaptureReader, Pcap) {
+    auto Client = makeEndpoint(0x0a000102, 40000);
+    auto Server = makeEndpoint(0x0a000001, 69);
+    auto Request = serialize(
+        packets::Request(packets::types::ReadRequest, std::string_view("pxelinux.0"), std::string_view("octet")));
+    CaptureWriter Writer;
+    Writer.write(1700000000123456789, Client, Server, Request.data(), Request.size());
+    Writer.write(1700000000200000000, Server, Client, nullptr, 0);
+
+    CaptureReader Reader;
+    ASSERT_FALSE(Reader.open(Writer.getBuffer().data(), Writer.getBuffer().size()));
+    ASSERT_EQ(Reader.getFormat(), CaptureReader::Format::Pcap);
+    auto Datagrams = readAll(Reader);
+    ASSERT_EQ(Datagrams.size(), 2);
+    ASSERT_EQ(Datagrams[0].Timestamp, 1700000000123456789);
+    ASSERT_EQ(Datagrams[0].Source, Client);
+    ASSERT_EQ(Datagrams[0].Destination, Server);
+    ASSERT_EQ(Bytes(Datagrams[0].Payload, Datagrams[0].Payload + Datagrams[0].Size), Request);
+    ASSERT_EQ(Datagrams[1].Size, 0);
+    ASSERT_FALSE(Reader.isTruncated());
+
+    // Truncated capture
+    Reader.open(Writer.getBuffer().data(), Writer.getBuffer().size() - 1);
+    ASSERT_EQ(readAll(Reader).size(), 1);
+    ASSERT_TRUE(Reader.isTruncated());
+
+    Bytes Garbage(100, 0x55);
+    ASSERT_EQ(Reader.open(Garbage.data(), Garbage.size()), std::errc::invalid_argument);
+}
+
+/// Test that big-endian microsecond captures of Linux cooked frames are read
+TEST(CaptureReader, PcapBigEndian) {
+    auto Packet = makeIPv4(40000, 69, Bytes{0, 1, 'a', 0, 'o', 'c', 't', 'e', 't', 0});
+    Bytes Capture = {0xa1, 0xb2, 0xc3, 0xd4, 0, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 113};
+    auto Frame = Bytes(16, 0);
+    Frame.insert(Frame.end(), Packet.begin(), Packet.end());
+    auto Size = static_cast<std::uint8_t>(Frame.size());
+    Capture.insert(Capture.end(), {0, 0, 0, 5, 0, 0x0f, 0x42, 0x3f, 0, 0, 0, Size, 0, 0, 0, Size});
+    Capture.insert(Capture.end(), Frame.begin(), Frame.end());
+
+    CaptureReader Reader;
+    ASSERT_FALSE(Reader.open(Capture.data(), Capture.size()));
+    auto Datagrams = readAll(Reader);
+    ASSERT_EQ(Datagrams.size(), 1);
+    ASSERT_EQ(Datagrams[0].Timestamp, 5999999000);
+    ASSERT_EQ(Datagrams[0].Destination.Port, 69);
+    ASSERT_EQ(Datagrams[0].Size, 10);
+}
+
+/// Test that pcapng captures in both byte orders are read, with Ethernet (VLAN tagged) and IPv6 frames and the
+/// timestamp resolution of every interface
+TEST(CaptureReader, PcapNG) {
+    for (bool BigEndian : {false, true}) {
+        PcapNGBuilder Builder(BigEndian);
+        Builder.addInterface(links::Ethernet, std::nullopt);
+        Builder.addInterface(links::Raw, 9);
+        Builder.addInterface(links::Raw, 0x80 | 10);
+        Builder.addPacket(0, 5000001, makeEthernet(makeIPv4(40000, 69, Bytes{0, 1}), true));
+        Builder.addPacket(1, 7000000001, makeIPv6(69, 40000, Bytes{0, 5, 0, 1, 'x', 0}));
+        Builder.addPacket(2, 3 * 1024 + 512, makeIPv4(1, 2, Bytes(3, 0)));
+        Builder.addSimplePacket(makeEthernet(makeIPv4(3, 4, Bytes{}), false));
+        // Not UDP
+        auto Tcp = makeIPv4(5, 6, Bytes{});
+        Tcp[9] = 6;
+        Builder.addPacket(1, 0, Tcp);
+
+        CaptureReader Reader;
+        ASSERT_FALSE(Reader.open(Builder.Capture.data(), Builder.Capture.size()));
+        ASSERT_EQ(Reader.getFormat(), CaptureReader::Format::PcapNG);
+        auto Datagrams = readAll(Reader);
+        ASSERT_EQ(Datagrams.size(), 4);
+        ASSERT_EQ(Datagrams[0].Timestamp, 5000001000);
+        ASSERT_EQ(Datagrams[0].Size, 2);
+        ASSERT_EQ(Datagrams[1].Timestamp, 7000000001);
+        ASSERT_EQ(Datagrams[1].Source.Port, 69);
+        ASSERT_EQ(Datagrams[1].Source.Address[0], 0x20);
+        ASSERT_EQ(Datagrams[1].Destination.Address[15], 0x30);
+        ASSERT_EQ(Datagrams[1].Size, 6);
+        ASSERT_EQ(Datagrams[2].Timestamp, 3500000000);
+        ASSERT_EQ(Datagrams[3].Destination.Port, 4);
+        ASSERT_EQ(Datagrams[3].Size, 0);
+        ASSERT_EQ(Reader.getFramesCount(), 5);
+        ASSERT_EQ(Reader.getSkippedCount(), 1);
+        ASSERT_FALSE(Reader.isTruncated());
+    }
+}
+
+/// Test that the packets of an interface with a binary timestamp resolution finer than 2^-30 seconds are skipped
+/// rather than converted with an overflow, the packets of the other interfaces are still read
+TEST(CaptureReader, PcapNGResolution) {
+    PcapNGBuilder Builder(false);
+    Builder.addInterface(links::Raw, 0x80 | 30);
+    Builder.addInterface(links::Raw, 0x80 | 31);
+    Builder.addInterface(links::Raw, 0x80 | 127);
+    Builder.addPacket(0, (std::uint64_t(5) << 30) + (std::uint64_t(1) << 29), makeIPv4(1, 2, Bytes{}));
+    Builder.addPacket(1, 1, makeIPv4(3, 4, Bytes{}));
+    Builder.addPacket(2, 1, makeIPv4(5, 6, Bytes{}));
+
+    CaptureReader Reader;
+    ASSERT_FALSE(Reader.open(Builder.Capture.data(), Builder.Capture.size()));
+    auto Datagrams = readAll(Reader);
+    ASSERT_EQ(Datagrams.size(), 1);
+    ASSERT_EQ(Datagrams[0].Timestamp, 5500000000);
+    ASSERT_EQ(Reader.getSkippedCount(), 2);
+    ASSERT_FALSE(Reader.isTruncated());
+}
+
+/// Test that fragments and frames cut by the snapshot length are skipped
+TEST(CaptureReader, Skip) {
+    Datagram Decoded;
+    auto Packet = makeIPv4(1, 2, Bytes(100, 0));
+    ASSERT_TRUE(details::decodeFrame(links::Raw, Packet.data(), Packet.size(), Decoded));
+    ASSERT_FALSE(details::decodeFrame(links::Raw, Packet.data(), Packet.size() - 1, Decoded));
+    auto Fragment = Packet;
+    Fragment[6] |= 0x20;
+    ASSERT_FALSE(details::decodeFrame(links::Raw, Fragment.data(), Fragment.size(), Decoded));
+    Fragment = Packet;
+    Fragment[7] = 1;
+    ASSERT_FALSE(details::decodeFrame(links::Raw, Fragment.data(), Fragment.size(), Decoded));
+
+    Bytes Loopback = {2, 0, 0, 0};
+    Loopback.insert(Loopback.end(), Packet.begin(), Packet.end());
+    ASSERT_TRUE(details::decodeFrame(links::Null, Loopback.data(), Loopback.size(), Decoded));
+    ASSERT_FALSE(details::decodeFrame(links::Ethernet + 1000, Packet.data(), Packet.size(), Decoded));
+}
+
+/// Test that the transfers started by requests are followed to the ports they use, other traffic is left out
+TEST(TftpFilter, Transfers) {
+    auto Client = makeEndpoint(0x0a000102, 40000);
+    auto Server = makeEndpoint(0x0a000001, 69);
+    auto Transfer = makeEndpoint(0x0a000001, 50123);
+    auto Request = serialize(
+        packets::Request(packets::types::ReadRequest, std::string_view("pxelinux.0"), std::string_view("octet")));
+    auto Data = serialize(packets::Data(1, Bytes(512, 0)));
+    auto Ack = serialize(packets::Acknowledgment(1));
+
+    auto make = [](const transfer::TransferID &Source, const transfer::TransferID &Destination, const Bytes &Payload) {
+        Datagram Captured;
+        Captured.Source = Source;
+        Captured.Destination = Destination;
+        Captured.Payload = Payload.data();
+        Captured.Size = Payload.size();
+        return Captured;
+    };
+
+    TftpFilter Filter;
+    // Data before the request isn't recognized
+    ASSERT_FALSE(Filter.accept(make(Transfer, Client, Data)));
+    ASSERT_TRUE(Filter.accept(make(Client, Server, Request)));
+    ASSERT_TRUE(Filter.accept(make(Transfer, Client, Data)));
+    ASSERT_TRUE(Filter.accept(make(Client, Transfer, Ack)));
+    // DNS
+    ASSERT_FALSE(Filter.accept(make(makeEndpoint(0x0a000102, 5353), makeEndpoint(0x0a000001, 53), Data)));
+    // Not a request, the client isn't followed
+    ASSERT_FALSE(Filter.accept(make(makeEndpoint(0x0a000103, 40000), Server, Ack)));
+    ASSERT_FALSE(Filter.accept(make(Transfer, makeEndpoint(0x0a000103, 40000), Data)));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,202 @@
+#include "../tftp_common/details/prefetch.hpp"
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+/// Advisor recording the prefetched files instead of touching the storage
+class RecordingAdvisor final : public PrefetchAdvisor {
+  public:
+    std::optional<std::uint64_t> getSize(const std::string &Filename) override {
+        auto It = Sizes.find(Filename);
+        if (It == Sizes.end()) {
+            return std::nullopt;
+        }
+        return It->second;
+    }
+
+    void advise(const std::string &Filename, std::uint64_t Bytes) override { Advised.emplace_back(Filename, Bytes); }
+
+    std::map<std::string, std::uint64_t> Sizes;
+    std::vector<std::pair<std::string, std::uint64_t>> Advised;
+};
+
+TransferID makeClient(std::uint8_t Host, std::uint16_t Port = 2000) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(0x0a000000u | Host);
+    Endpoint.sin_port = htons(Port);
+    return TransferID::fromIPv4(Endpoint);
+}
+
+const std::vector<std::string> BiosSequence = {"pxelinux.0", "ldlinux.c32", "pxelinux.cfg/01-52-54-00-12-34-56",
+                                               "pxelinux.cfg/default", "vmlinuz", "initrd.img"};
+
+} // namespace
+
+/// Test that the successors of each file are learned per client class and prefetched on the following boots
+TEST(Prefetcher, Sequence) {
+    RecordingAdvisor Advisor;
+    for (const auto &Filename : BiosSequence) {
+        Advisor.Sizes[Filename] = 1000;
+    }
+    // The configuration probe of a client is missing, it's never prefetched
+    Advisor.Sizes.erase("pxelinux.cfg/01-52-54-00-12-34-56");
+    PrefetchSettings Settings;
+    Settings.Cooldown = std::chrono::seconds(0);
+    Prefetcher Learner(Advisor, Settings);
+
+    auto Now = Prefetcher::Clock::now();
+    // Two clients boot concurrently, requests of each come from new ports
+    for (std::size_t Idx = 0; Idx != BiosSequence.size(); ++Idx) {
+        for (std::uint8_t Host = 1; Host <= 2; ++Host) {
+            ASSERT_EQ(Learner.observe(makeClient(Host, static_cast<std::uint16_t>(2000 + Idx)), "bios",
+                                      BiosSequence[Idx], Now),
+                      0);
+        }
+    }
+    ASSERT_TRUE(Advisor.Advised.empty());
+    ASSERT_EQ(Learner.predict("bios", "pxelinux.0"), std::vector<std::string>{"ldlinux.c32"});
+    ASSERT_TRUE(Learner.predict("efi", "pxelinux.0").empty());
+    ASSERT_TRUE(Learner.predict("bios", "initrd.img").empty());
+
+    // Retransmitted requests aren't transitions
+    Learner.observe(makeClient(3), "bios", "pxelinux.0", Now);
+    Learner.observe(makeClient(3), "bios", "pxelinux.0", Now);
+    ASSERT_EQ(Advisor.Advised.size(), 2);
+    for (std::size_t Idx = 1; Idx != BiosSequence.size(); ++Idx) {
+        Learner.observe(makeClient(3), "bios", BiosSequence[Idx], Now);
+    }
+    std::vector<std::pair<std::string, std::uint64_t>> Expected = {
+        {"ldlinux.c32", 1000}, {"ldlinux.c32", 1000}, {"pxelinux.cfg/default", 1000},
+        {"vmlinuz", 1000},     {"initrd.img", 1000}};
+    ASSERT_EQ(Advisor.Advised, Expected);
+    ASSERT_EQ(Learner.predict("bios", "pxelinux.cfg/01-52-54-00-12-34-56"),
+              std::vector<std::string>{"pxelinux.cfg/default"});
+
+    // Requests long after the previous ones start new sequences
+    for (std::uint8_t Host = 1; Host <= 3; ++Host) {
+        Learner.observe(makeClient(Host), "bios", "pxelinux.0", Now + std::chrono::hours(1));
+    }
+    ASSERT_TRUE(Learner.predict("bios", "initrd.img").empty());
+}
+
+/// Test that prefetching is limited by the cooldown, the size limit and the budget
+TEST(Prefetcher, Budget) {
+    RecordingAdvisor Advisor;
+    Advisor.Sizes = {{"a", 100}, {"b", 600}, {"c", 600}, {"d", 5000}};
+    PrefetchSettings Settings;
+    Settings.MinObservations = 1;
+    Settings.MinShare = 0.1;
+    Settings.MaxFileBytes = 800;
+    Settings.BudgetRate = 1000;
+    Settings.BudgetBurst = 1000;
+    Settings.Cooldown = std::chrono::seconds(10);
+    Prefetcher Learner(Advisor, Settings);
+
+    auto Now = Prefetcher::Clock::now();
+    Learner.observe(makeClient(1), "", "a", Now);
+    Learner.observe(makeClient(1), "", "b", Now);
+    Learner.observe(makeClient(2), "", "a", Now);
+    Learner.observe(makeClient(2), "", "c", Now);
+    Learner.observe(makeClient(3), "", "c", Now);
+    Learner.observe(makeClient(3), "", "d", Now);
+    ASSERT_EQ(Advisor.Advised.size(), 1);
+
+    // Both successors are predicted, the second one doesn't fit into the budget
+    Now += std::chrono::seconds(20);
+    ASSERT_EQ(Learner.observe(makeClient(4), "", "a", Now), 1);
+    ASSERT_EQ(Advisor.Advised.back(), std::make_pair(std::string("b"), std::uint64_t(600)));
+    ASSERT_EQ(Learner.getThrottledCount(), 1);
+
+    // The budget is refilled, but the prefetched file is cooling down
+    Now += std::chrono::seconds(1);
+    ASSERT_EQ(Learner.observe(makeClient(5), "", "a", Now), 1);
+    ASSERT_EQ(Advisor.Advised.back().first, "c");
+
+    // Only the beginning of a large file is prefetched
+    Now += std::chrono::seconds(1);
+    ASSERT_EQ(Learner.observe(makeClient(6), "", "c", Now), 1);
+    ASSERT_EQ(Advisor.Advised.back(), std::make_pair(std::string("d"), std::uint64_t(800)));
+    ASSERT_EQ(Learner.getPrefetchedCount(), 4);
+    ASSERT_EQ(Learner.getPrefetchedBytes(), 2600);
+}
+
+/// Test that memory is bounded and the model follows changes of the sequence
+TEST(Prefetcher, Bounds) {
+    RecordingAdvisor Advisor;
+    PrefetchSettings Settings;
+    Settings.MaxFiles = 16;
+    Settings.MaxClients = 8;
+    Settings.MaxSuccessors = 2;
+    Prefetcher Learner(Advisor, Settings);
+
+    auto Now = Prefetcher::Clock::now();
+    for (int Idx = 0; Idx != 1000; ++Idx) {
+        Learner.observe(makeClient(static_cast<std::uint8_t>(Idx % 37)), "", "file" + std::to_string(Idx % 101),
+                        Now);
+        ASSERT_LE(Learner.getFilesCount(), 16);
+        ASSERT_LE(Learner.getClientsCount(), 8);
+    }
+
+    Prefetcher Adaptive(Advisor, Settings);
+    std::uint8_t Host = 0;
+    auto boot = [&](const std::string &Next) {
+        Adaptive.observe(makeClient(++Host), "", "kernel", Now);
+        Adaptive.observe(makeClient(Host), "", Next, Now);
+    };
+    for (int Idx = 0; Idx != 10; ++Idx) {
+        boot("initrd-old.img");
+    }
+    ASSERT_EQ(Adaptive.predict("", "kernel"), std::vector<std::string>{"initrd-old.img"});
+    for (int Idx = 0; Idx != 40; ++Idx) {
+        boot("initrd-new.img");
+    }
+    ASSERT_EQ(Adaptive.predict("", "kernel"), std::vector<std::string>{"initrd-new.img"});
+    // Rare successors replace each other without being predicted
+    boot("rare1");
+    boot("rare2");
+    ASSERT_EQ(Adaptive.predict("", "kernel"), std::vector<std::string>{"initrd-new.img"});
+}
+
+/// Test that the file advisor resolves the files under the root, symbolic links don't lead out of it
+TEST(FileAdvisor, Files) {
+    char Template[] = "/tmp/tftp_prefetch_XXXXXX";
+    std::string Root = ::mkdtemp(Template);
+    auto *File = std::fopen((Root + "/vmlinuz").c_str(), "wb");
+    std::fwrite("kernel", 1, 6, File);
+    std::fclose(File);
+    ::mkdir((Root + "/pxelinux.cfg").c_str(), 0755);
+    ASSERT_EQ(::symlink("vmlinuz", (Root + "/linux").c_str()), 0);
+    ASSERT_EQ(::symlink("/etc/passwd", (Root + "/passwd").c_str()), 0);
+    ASSERT_EQ(::symlink("/etc", (Root + "/etc").c_str()), 0);
+
+    FileAdvisor Advisor;
+    ASSERT_FALSE(Advisor.open(Root));
+    ASSERT_EQ(Advisor.getSize("/vmlinuz"), 6);
+    ASSERT_EQ(Advisor.getSize("missing"), std::nullopt);
+    ASSERT_EQ(Advisor.getSize("pxelinux.cfg"), std::nullopt);
+    ASSERT_EQ(Advisor.getSize("../" + Root.substr(5) + "/vmlinuz"), std::nullopt);
+    ASSERT_EQ(Advisor.getSize("linux"), 6);
+    // Symbolic links out of the root aren't followed
+    ASSERT_EQ(Advisor.getSize("passwd"), std::nullopt);
+    ASSERT_EQ(Advisor.getSize("etc/passwd"), std::nullopt);
+    Advisor.advise("vmlinuz", 6);
+    Advisor.advise("missing", 6);
+    Advisor.advise("passwd", 6);
+
+    FileAdvisor Missing;
+    ASSERT_EQ(Missing.open(Root + "/nonexistent"), std::errc::no_such_file_or_directory);
+    std::system(("rm -rf " + Root).c_str());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,148 @@
+#include "../tftp_common/details/producer.hpp"
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+/// Producer of the given contents counting calls, at most \p Chunk bytes per call
+class CountingProducer final : public Producer {
+  public:
+    CountingProducer(std::vector<std::uint8_t> Contents, std::size_t Chunk = SIZE_MAX)
+        : Contents(std::move(Contents)), Chunk(Chunk) {}
+
+    std::size_t produce(std::uint8_t *Buffer, std::size_t Size) override {
+        ++Calls;
+        auto Count = std::min({Size, Chunk, Contents.size() - Offset});
+        std::copy_n(Contents.begin() + Offset, Count, Buffer);
+        Offset += Count;
+        return Count;
+    }
+
+    std::vector<std::uint8_t> Contents;
+    std::size_t Chunk;
+    std::size_t Offset = 0;
+    std::size_t Calls = 0;
+};
+
+std::vector<std::uint8_t> makeContents(std::size_t Size) {
+    std::vector<std::uint8_t> Contents(Size);
+    std::mt19937 Random{static_cast<unsigned>(Size)};
+    for (auto &Byte : Contents) {
+        Byte = static_cast<std::uint8_t>(Random());
+    }
+    return Contents;
+}
+
+/// Transfer the contents window by window, acknowledgments are lost with the given probability
+std::vector<std::uint8_t> stream(StreamingSource &Source, std::uint16_t WindowSize, double Loss) {
+    std::vector<std::uint8_t> Received;
+    std::uint16_t Expected = 1;
+    std::mt19937 Random{7};
+    std::bernoulli_distribution Lost{Loss};
+    while (!Source.isComplete()) {
+        auto First = Source.getFirstUnacknowledged();
+        std::optional<std::uint16_t> Acknowledgment;
+        for (std::uint16_t Idx = 0; Idx != WindowSize; ++Idx) {
+            auto Block = static_cast<std::uint16_t>(First + Idx);
+            auto View = Source.getBlock(Block);
+            if (!View) {
+                break;
+            }
+            if (Block == Expected) {
+                Received.insert(Received.end(), View->Data, View->Data + View->Size);
+                ++Expected;
+            }
+            Acknowledgment = static_cast<std::uint16_t>(Expected - 1);
+        }
+        if (Acknowledgment && !Lost(Random)) {
+            Source.onAcknowledgment(*Acknowledgment);
+        }
+    }
+    return Received;
+}
+
+} // namespace
+
+/// Test that only the first block is produced before it is sent
+TEST(StreamingSource, Lazy) {
+    CountingProducer Generator(makeContents(100000));
+    StreamingSource Source(Generator, 512, 16);
+    auto View = Source.getBlock(1);
+    ASSERT_TRUE(View.has_value());
+    ASSERT_EQ(View->Size, 512);
+    ASSERT_TRUE(std::equal(View->Data, View->Data + 512, Generator.Contents.begin()));
+    ASSERT_EQ(Generator.Calls, 1);
+    ASSERT_EQ(Source.getBytesProduced(), 512);
+}
+
+/// Test that the producer is held back until blocks of the window are acknowledged
+TEST(StreamingSource, Backpressure) {
+    CountingProducer Generator(makeContents(100000));
+    StreamingSource Source(Generator, 512, 4);
+    for (std::uint16_t Block = 1; Block <= 4; ++Block) {
+        ASSERT_TRUE(Source.getBlock(Block).has_value());
+    }
+    ASSERT_FALSE(Source.getBlock(5).has_value());
+    ASSERT_EQ(Source.getBytesProduced(), 4 * 512);
+
+    // Retransmission is served from the buffer
+    auto Calls = Generator.Calls;
+    auto View = Source.getBlock(2);
+    ASSERT_TRUE(std::equal(View->Data, View->Data + 512, Generator.Contents.begin() + 512));
+    ASSERT_EQ(Generator.Calls, Calls);
+
+    ASSERT_EQ(Source.onAcknowledgment(2), 2);
+    ASSERT_EQ(Source.onAcknowledgment(2), 0);
+    ASSERT_EQ(Source.onAcknowledgment(9), 0);
+    ASSERT_EQ(Source.getFirstUnacknowledged(), 3);
+    ASSERT_FALSE(Source.getBlock(2).has_value());
+    ASSERT_TRUE(Source.getBlock(6).has_value());
+    ASSERT_FALSE(Source.getBlock(7).has_value());
+    ASSERT_EQ(Source.getBytesProduced(), 6 * 512);
+}
+
+/// Test that the contents end with a short block, which is empty if the size is a multiple of the block size
+TEST(StreamingSource, End) {
+    for (std::size_t Size : {0, 100, 512, 1024, 1500}) {
+        CountingProducer Generator(makeContents(Size), 100);
+        StreamingSource Source(Generator, 512, 2);
+        auto Received = stream(Source, 2, 0);
+        ASSERT_EQ(Received, Generator.Contents);
+        ASSERT_FALSE(Source.getBlock(static_cast<std::uint16_t>(Size / 512 + 2)).has_value());
+    }
+}
+
+/// Test that contents of more than 65535 blocks are streamed with block numbers rolling over, memory stays bounded
+TEST(StreamingSource, Rollover) {
+    CountingProducer Generator(makeContents(8 * 70000 + 3));
+    StreamingSource Source(Generator, 8, 8);
+    auto Received = stream(Source, 8, 0.1);
+    ASSERT_EQ(Received, Generator.Contents);
+    ASSERT_EQ(Source.getBufferSize(), 64);
+}
+
+/// Test that the function producer passes its size on, which is unknown by default
+TEST(FunctionProducer, Size) {
+    std::size_t Remaining = 1000;
+    FunctionProducer Generator([&Remaining](std::uint8_t *Buffer, std::size_t Size) {
+        auto Count = std::min(Size, Remaining);
+        std::fill_n(Buffer, Count, 'x');
+        Remaining -= Count;
+        return Count;
+    });
+    ASSERT_EQ(Generator.getSize(), std::nullopt);
+    StreamingSource Source(Generator, 512);
+    ASSERT_EQ(stream(Source, 1, 0), std::vector<std::uint8_t>(1000, 'x'));
+
+    FunctionProducer Sized([](std::uint8_t *, std::size_t) { return std::size_t(0); }, 0);
+    ASSERT_EQ(Sized.getSize(), 0);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,205 @@
+#include "../tftp_common/details/relay.hpp"
+#include "loopback_server.hpp"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <optional>
+#include <thread>
+
+#include <dirent.h>
+
+using namespace tftp_common;
+using namespace tftp_common::async;
+using namespace tftp_common::tests;
+
+namespace {
+
+/// @return Names of the entries of the directory, `.` and `..` excluded
+std::vector<std::string> listDirectory(const std::string &Path) {
+    std::vector<std::string> Names;
+    auto *Directory = ::opendir(Path.c_str());
+    if (Directory == nullptr) {
+        return Names;
+    }
+    while (auto *Entry = ::readdir(Directory)) {
+        std::string Name = Entry->d_name;
+        if (Name != "." && Name != "..") {
+            Names.push_back(Name);
+        }
+    }
+    ::closedir(Directory);
+    std::sort(Names.begin(), Names.end());
+    return Names;
+}
+
+/// Branch relay running on its own thread
+class BranchRelay {
+  public:
+    BranchRelay(const sockaddr_in &Upstream, const std::string &CacheRoot, RelaySettings Settings = {})
+        : Relay(Engine, makeLoopback(), Upstream, std::move(Settings)) {
+        EXPECT_FALSE(Relay.open(CacheRoot));
+        Relay.start();
+        Thread = std::thread([this] { Engine.run(); });
+    }
+    ~BranchRelay() {
+        Relay.stop();
+        Thread.join();
+    }
+
+    Executor Engine;
+    CachingRelay Relay;
+    std::thread Thread;
+};
+
+/// Local client transfer and the moment its first block has arrived
+struct Fetched {
+    TransferResult Result;
+    std::string Contents;
+    std::optional<std::chrono::steady_clock::time_point> FirstBlock;
+};
+
+/// Read the files from the server concurrently
+std::vector<Fetched> fetchFiles(const sockaddr_in &Server, const std::vector<std::string> &Names,
+                                ClientOptions Options = {}) {
+    Options.WindowSize = 1;
+    std::vector<Fetched> Transfers(Names.size());
+    Executor Engine;
+    for (std::size_t Idx = 0; Idx != Names.size(); ++Idx) {
+        Engine.spawn([](Executor &Engine, sockaddr_in Server, std::string Name, Fetched &Transfer,
+                        ClientOptions Options) -> Task<void> {
+            UdpSocket Socket(Engine, makeLoopback());
+            Transfer.Result = co_await readFile(
+                Socket, Server, Name,
+                [&Transfer](std::uint64_t Offset, const std::uint8_t *Buffer, std::size_t Size) {
+                    if (!Transfer.FirstBlock) {
+                        Transfer.FirstBlock = std::chrono::steady_clock::now();
+                    }
+                    Transfer.Contents.resize(Offset);
+                    Transfer.Contents.append(reinterpret_cast<const char *>(Buffer), Size);
+                    return std::error_code{};
+                },
+                Options);
+        }(Engine, Server, Names[Idx], Transfers[Idx], Options));
+    }
+    Engine.run();
+    return Transfers;
+}
+
+} // namespace
+
+/// Test that a file requested by several local clients at once is fetched once and streamed to them while the fetch
+/// is running, then served from the cache
+TEST(CachingRelay, Streaming) {
+    auto Image = makeContents(2 << 20, 1);
+    LoopbackServer Central({{"images/initrd.img", Image}}, std::chrono::milliseconds(0),
+                           std::chrono::microseconds(1000));
+    TemporaryDirectory Cache;
+    BranchRelay Branch(Central.getAddress(), Cache.Root);
+
+    auto Transfers = fetchFiles(Branch.Relay.getAddress(), std::vector<std::string>(4, "images/initrd.img"));
+    for (const auto &Transfer : Transfers) {
+        ASSERT_FALSE(Transfer.Result.Error) << Transfer.Result.Message;
+        ASSERT_EQ(Transfer.Result.BlockSize, 1428);
+        ASSERT_EQ(Transfer.Result.TransferSize, Image.size());
+        ASSERT_TRUE(Transfer.Contents == Image);
+        // 256 blocks of 8 KiB take the central server at least 256 ms
+        ASSERT_LT(*Transfer.FirstBlock, Central.getLastCompletion() - std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(Central.getRequests("images/initrd.img"), 1);
+    ASSERT_EQ(Branch.Relay.getFetchesCount(), 1);
+    ASSERT_EQ(Branch.Relay.getJoinedCount(), 3);
+    ASSERT_TRUE(readLocal(Cache.Root + "/images/initrd.img") == Image);
+    // Temporary files don't stay behind
+    ASSERT_EQ(listDirectory(Cache.Root + "/images"), std::vector<std::string>{"initrd.img"});
+
+    auto Again = fetchFiles(Branch.Relay.getAddress(), {"/images/initrd.img", "images//initrd.img"});
+    for (const auto &Transfer : Again) {
+        ASSERT_FALSE(Transfer.Result.Error);
+        ASSERT_TRUE(Transfer.Contents == Image);
+    }
+    ASSERT_EQ(Central.getRequests("images/initrd.img"), 1);
+    ASSERT_EQ(Branch.Relay.getHitsCount(), 2);
+}
+
+/// Test that expired files are revalidated by size and fetched again when they have changed upstream
+TEST(CachingRelay, Revalidation) {
+    auto Loader = makeContents(30000, 2);
+    LoopbackServer Central({{"pxelinux.0", Loader}}, std::chrono::milliseconds(0));
+    TemporaryDirectory Cache;
+    {
+        RelaySettings Settings;
+        Settings.MaxAge = std::chrono::seconds(0);
+        BranchRelay Branch(Central.getAddress(), Cache.Root, Settings);
+        ASSERT_TRUE(fetchFiles(Branch.Relay.getAddress(), {"pxelinux.0"})[0].Contents == Loader);
+        ASSERT_TRUE(fetchFiles(Branch.Relay.getAddress(), {"pxelinux.0"})[0].Contents == Loader);
+        ASSERT_EQ(Branch.Relay.getFetchesCount(), 1);
+        ASSERT_EQ(Branch.Relay.getRevalidationsCount(), 1);
+        ASSERT_EQ(Central.getRequests("pxelinux.0"), 2);
+        ASSERT_EQ(Central.getTransfers("pxelinux.0"), 1);
+
+        auto Updated = makeContents(31000, 3);
+        Central.setFile("pxelinux.0", Updated);
+        ASSERT_TRUE(fetchFiles(Branch.Relay.getAddress(), {"pxelinux.0"})[0].Contents == Updated);
+        ASSERT_EQ(Branch.Relay.getFetchesCount(), 2);
+        ASSERT_EQ(Central.getTransfers("pxelinux.0"), 2);
+        ASSERT_EQ(Central.getRequests("pxelinux.0"), 4);
+        ASSERT_TRUE(readLocal(Cache.Root + "/pxelinux.0") == Updated);
+        Loader = Updated;
+    }
+
+    // The cache survives restarts, fresh files are served without contacting the upstream server
+    {
+        BranchRelay Branch(Central.getAddress(), Cache.Root);
+        ASSERT_TRUE(fetchFiles(Branch.Relay.getAddress(), {"pxelinux.0"})[0].Contents == Loader);
+        ASSERT_EQ(Branch.Relay.getHitsCount(), 1);
+        ASSERT_EQ(Central.getRequests("pxelinux.0"), 4);
+    }
+
+    // Expired files are served while the upstream server doesn't respond
+    Executor Unused;
+    UdpSocket Silent(Unused, makeLoopback());
+    RelaySettings Settings;
+    Settings.MaxAge = std::chrono::seconds(0);
+    Settings.Upstream.RetryTimeout = std::chrono::milliseconds(50);
+    Settings.Upstream.MaxRetries = 1;
+    BranchRelay Branch(Silent.getLocalAddress(), Cache.Root, Settings);
+    auto Stale = fetchFiles(Branch.Relay.getAddress(), {"pxelinux.0"})[0];
+    ASSERT_FALSE(Stale.Result.Error);
+    ASSERT_TRUE(Stale.Contents == Loader);
+    ASSERT_EQ(Branch.Relay.getFetchesCount(), 0);
+    ASSERT_EQ(Branch.Relay.getRevalidationsCount(), 0);
+}
+
+/// Test that errors of the upstream server are relayed and invalid requests are refused
+TEST(CachingRelay, Errors) {
+    LoopbackServer Central({{"vmlinuz", makeContents(1000, 4)}}, std::chrono::milliseconds(0));
+    TemporaryDirectory Cache;
+    BranchRelay Branch(Central.getAddress(), Cache.Root);
+
+    auto Missing = fetchFiles(Branch.Relay.getAddress(), {"missing"})[0];
+    ASSERT_EQ(Missing.Result.Error, std::errc::no_such_file_or_directory);
+    ASSERT_EQ(Missing.Result.Message, "File not found");
+    ASSERT_EQ(Central.getRequests("missing"), 1);
+    ASSERT_TRUE(listDirectory(Cache.Root).empty());
+
+    auto Escaping = fetchFiles(Branch.Relay.getAddress(), {"../vmlinuz"})[0];
+    ASSERT_EQ(Escaping.Result.Error, std::errc::permission_denied);
+    ASSERT_EQ(Escaping.Result.Message, "Invalid filename");
+
+    Executor Engine;
+    TransferResult Upload;
+    Engine.spawn([](Executor &Engine, sockaddr_in Server, TransferResult &Upload) -> Task<void> {
+        UdpSocket Socket(Engine, makeLoopback());
+        Upload = co_await writeFile(
+            Socket, Server, "vmlinuz", [](std::uint64_t, std::uint8_t *, std::size_t) { return std::size_t(0); },
+            std::uint64_t(0));
+    }(Engine, Branch.Relay.getAddress(), Upload));
+    Engine.run();
+    ASSERT_EQ(Upload.Error, std::errc::permission_denied);
+    ASSERT_EQ(Central.getRequests("vmlinuz"), 0);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
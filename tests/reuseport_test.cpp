@@ -0,0 +1,177 @@
+#include "../tftp_common/details/reuseport.hpp"
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <map>
+#include <poll.h>
+#include <set>
+#include <string>
+
+using namespace tftp_common;
+using namespace tftp_common::reuseport;
+
+namespace {
+
+sockaddr_in makeLoopback() {
+    sockaddr_in Address{};
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return Address;
+}
+
+/// @return Address 127.0.Subnet.Host in network byte order
+std::uint32_t makeClient(std::uint8_t Subnet, std::uint8_t Host) {
+    return htonl(0x7f000000u | std::uint32_t(Subnet) << 8 | Host);
+}
+
+/// Send a datagram from a new socket of the client (so from a new port, like every new transfer) to the group
+/// @return Descriptor of the worker socket that has received it, or -1
+int sendFrom(const SteeringGroup &Group, std::uint32_t Client) {
+    auto Descriptor = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in Local{};
+    Local.sin_family = AF_INET;
+    Local.sin_addr.s_addr = Client;
+    ::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Local), sizeof(Local));
+    auto Server = Group.getAddress();
+    std::uint8_t Request[] = {0, 1, 'f', 0, 'o', 'c', 't', 'e', 't', 0};
+    ::sendto(Descriptor, Request, sizeof(Request), 0, reinterpret_cast<const sockaddr *>(&Server), sizeof(Server));
+    ::close(Descriptor);
+
+    std::vector<pollfd> Workers;
+    for (auto Worker : Group.getSockets()) {
+        Workers.push_back(pollfd{Worker, POLLIN, 0});
+    }
+    if (::poll(Workers.data(), Workers.size(), 1000) <= 0) {
+        return -1;
+    }
+    for (auto &Worker : Workers) {
+        if (Worker.revents & POLLIN) {
+            std::uint8_t Buffer[64];
+            sockaddr_in From{};
+            socklen_t Length = sizeof(From);
+            ::recvfrom(Worker.fd, Buffer, sizeof(Buffer), 0, reinterpret_cast<sockaddr *>(&From), &Length);
+            EXPECT_EQ(From.sin_addr.s_addr, Client);
+            return Worker.fd;
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+/// Test that clients of one subnet share the bucket and neighbouring clients are spread over the buckets
+TEST(Steering, Buckets) {
+    std::set<std::uint32_t> Buckets;
+    for (unsigned Host = 1; Host != 255; ++Host) {
+        ASSERT_LT(getBucket(makeClient(7, static_cast<std::uint8_t>(Host)), 32), BucketsCount);
+        Buckets.insert(getBucket(makeClient(7, static_cast<std::uint8_t>(Host)), 32));
+        ASSERT_EQ(getBucket(makeClient(7, static_cast<std::uint8_t>(Host)), 24), getBucket(makeClient(7, 0), 24));
+    }
+    ASSERT_GT(Buckets.size(), BucketsCount / 2);
+    ASSERT_EQ(getBucket(makeClient(7, 1), 0), getBucket(makeClient(200, 9), 0));
+}
+
+/// Test that workers get fair shares of the buckets and coming and going workers only move the buckets they take or
+/// release
+TEST(Steering, Rebalance) {
+    SteeringGroup Group(makeLoopback());
+    std::vector<int> Workers(4);
+    for (auto &Worker : Workers) {
+        ASSERT_FALSE(Group.addWorker(Worker));
+    }
+    for (auto Worker : Workers) {
+        ASSERT_EQ(Group.getBucketsCount(Worker), BucketsCount / 4);
+    }
+
+    auto owners = [&Group] {
+        std::map<std::uint32_t, int> Owners;
+        for (unsigned Host = 1; Host != 255; ++Host) {
+            auto Client = makeClient(1, static_cast<std::uint8_t>(Host));
+            Owners[Client] = *Group.getWorker(Client);
+        }
+        return Owners;
+    };
+    auto Before = owners();
+    ASSERT_FALSE(Group.removeWorker(Workers[1]));
+    ASSERT_EQ(Group.size(), 3);
+    for (auto [Client, Owner] : owners()) {
+        if (Before[Client] != Workers[1]) {
+            ASSERT_EQ(Owner, Before[Client]);
+        }
+        ASSERT_NE(Owner, Workers[1]);
+    }
+    for (auto Worker : Group.getSockets()) {
+        ASSERT_GE(Group.getBucketsCount(Worker), BucketsCount / 3);
+        ASSERT_LE(Group.getBucketsCount(Worker), BucketsCount / 3 + 1);
+    }
+
+    Before = owners();
+    int Added = -1;
+    ASSERT_FALSE(Group.addWorker(Added));
+    ASSERT_EQ(Group.getBucketsCount(Added), BucketsCount / 4);
+    for (auto [Client, Owner] : owners()) {
+        if (Owner != Added) {
+            ASSERT_EQ(Owner, Before[Client]);
+        }
+    }
+}
+
+/// Test that datagrams from every port of a client are steered to its worker, also after workers come and go
+TEST(Steering, Loopback) {
+    SteeringGroup Group(makeLoopback());
+    std::vector<int> Workers(3);
+    for (auto &Worker : Workers) {
+        if (auto Error = Group.addWorker(Worker)) {
+            GTEST_SKIP() << "steering program can't be attached: " << Error.message();
+        }
+    }
+    auto check = [&Group] {
+        for (std::uint8_t Host = 1; Host != 40; ++Host) {
+            auto Client = makeClient(0, Host);
+            for (int Transfer = 0; Transfer != 3; ++Transfer) {
+                ASSERT_EQ(sendFrom(Group, Client), *Group.getWorker(Client));
+            }
+        }
+    };
+    check();
+    std::set<int> Used;
+    for (std::uint8_t Host = 1; Host != 40; ++Host) {
+        Used.insert(*Group.getWorker(makeClient(0, Host)));
+    }
+    ASSERT_EQ(Used.size(), 3);
+
+    // The first socket is closed, the last one takes its index in the kernel
+    ASSERT_FALSE(Group.removeWorker(Workers[0]));
+    check();
+    int Added = -1;
+    ASSERT_FALSE(Group.addWorker(Added));
+    check();
+    ASSERT_FALSE(Group.removeWorker(Workers[2]));
+    ASSERT_FALSE(Group.removeWorker(Workers[1]));
+    check();
+}
+
+/// Test that whole subnets are steered to one worker
+TEST(Steering, Subnets) {
+    SteeringConfig Config;
+    Config.PrefixLength = 24;
+    SteeringGroup Group(makeLoopback(), Config);
+    for (int Idx = 0; Idx != 4; ++Idx) {
+        int Worker = -1;
+        if (auto Error = Group.addWorker(Worker)) {
+            GTEST_SKIP() << "steering program can't be attached: " << Error.message();
+        }
+    }
+    for (std::uint8_t Subnet = 0; Subnet != 8; ++Subnet) {
+        auto Worker = sendFrom(Group, makeClient(Subnet, 1));
+        ASSERT_NE(Worker, -1);
+        for (std::uint8_t Host = 2; Host != 20; ++Host) {
+            ASSERT_EQ(sendFrom(Group, makeClient(Subnet, Host)), Worker);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
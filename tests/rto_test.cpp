@@ -0,0 +1,108 @@
+#include "../tftp_common/details/rto.hpp"
+#include <gtest/gtest.h>
+
+using namespace tftp_common::transfer;
+using namespace std::chrono_literals;
+
+using Clock = RetransmissionTimer::Clock;
+
+/// Test that the first sample initializes the estimator according to RFC 6298
+TEST(RetransmissionTimer, FirstSample) {
+    RetransmissionTimer Timer;
+    ASSERT_EQ(Timer.getTimeout(), RetransmissionTimer::InitialTimeout);
+    ASSERT_FALSE(Timer.getEstimate().has_value());
+
+    auto Now = Clock::now();
+    Timer.onTransmit(1, Now);
+    Timer.onAcknowledgment(1, Now + 100ms);
+
+    auto Estimate = Timer.getEstimate();
+    ASSERT_TRUE(Estimate.has_value());
+    ASSERT_EQ(Estimate->SmoothedRTT, 100ms);
+    ASSERT_EQ(Estimate->RTTVariation, 50ms);
+    // SRTT + 4 * RTTVAR
+    ASSERT_EQ(Timer.getTimeout(), 300ms);
+}
+
+/// Test that the estimator converges to a stable round-trip time
+TEST(RetransmissionTimer, Converges) {
+    RetransmissionTimer Timer;
+    Timer.setBounds(1ms, 60s);
+
+    auto Now = Clock::now();
+    for (std::uint16_t Block = 1; Block != 200; ++Block) {
+        Timer.onTransmit(Block, Now);
+        Now += 2ms;
+        Timer.onAcknowledgment(Block, Now);
+    }
+    ASSERT_EQ(Timer.getEstimate()->SmoothedRTT, 2ms);
+    ASSERT_LT(Timer.getTimeout(), 5ms);
+}
+
+/// Test that samples of retransmitted blocks are discarded (Karn's algorithm) and timeouts back off exponentially
+TEST(RetransmissionTimer, KarnAndBackoff) {
+    RetransmissionTimer Timer;
+    auto Now = Clock::now();
+
+    Timer.onTransmit(1, Now);
+    Timer.onTimeout();
+    ASSERT_EQ(Timer.getTimeout(), 2s);
+    Timer.onRetransmit(1);
+    Timer.onTimeout();
+    ASSERT_EQ(Timer.getTimeout(), 4s);
+    ASSERT_EQ(Timer.getBackoffCount(), 2u);
+
+    // The retransmission itself isn't timed either, even though the timeout has discarded the timed block
+    Timer.onTransmit(1, Now + 4s);
+    // Acknowledgment of the retransmitted block is ambiguous and must not be sampled
+    Timer.onAcknowledgment(1, Now + 5s);
+    ASSERT_FALSE(Timer.getEstimate().has_value());
+    ASSERT_EQ(Timer.getTimeout(), 4s);
+
+    // The next fresh block provides a valid sample and resets the backoff
+    Timer.onTransmit(2, Now + 5s);
+    Timer.onAcknowledgment(2, Now + 5s + 100ms);
+    ASSERT_EQ(Timer.getBackoffCount(), 0u);
+    ASSERT_EQ(Timer.getTimeout(), 300ms);
+}
+
+/// Test that acknowledgment of a later block in a window also completes the sample, even across wrap around
+TEST(RetransmissionTimer, WindowWrapAround) {
+    RetransmissionTimer Timer;
+    auto Now = Clock::now();
+
+    Timer.onTransmit(65535, Now);
+    Timer.onTransmit(0, Now);
+    Timer.onTransmit(1, Now);
+    Timer.onAcknowledgment(65534, Now + 10ms);
+    ASSERT_FALSE(Timer.getEstimate().has_value());
+    Timer.onAcknowledgment(1, Now + 250ms);
+    ASSERT_EQ(Timer.getEstimate()->SmoothedRTT, 250ms);
+}
+
+/// Test that the negotiated timeout interval caps the backed off timeout
+TEST(RetransmissionTimer, Ceiling) {
+    RetransmissionTimer Timer;
+    Timer.setCeiling(3s);
+    for (int Idx = 0; Idx != 10; ++Idx) {
+        Timer.onTimeout();
+    }
+    ASSERT_EQ(Timer.getTimeout(), 3s);
+}
+
+/// Test that the estimator can be seeded with the state of a previous transfer
+TEST(RetransmissionTimer, Seed) {
+    RetransmissionTimer Previous;
+    auto Now = Clock::now();
+    Previous.onTransmit(1, Now);
+    Previous.onAcknowledgment(1, Now + 40ms);
+
+    RetransmissionTimer Timer{*Previous.getEstimate()};
+    ASSERT_EQ(Timer.getTimeout(), Previous.getTimeout());
+    ASSERT_EQ(Timer.getEstimate()->SmoothedRTT, 40ms);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
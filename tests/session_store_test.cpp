@@ -0,0 +1,177 @@
+#include "../tftp_common/details/session_store.hpp"
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+TransferID makeClient(std::uint32_t Address, std::uint16_t Port) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(Address);
+    Endpoint.sin_port = htons(Port);
+    return TransferID::fromIPv4(Endpoint);
+}
+
+options::Negotiation makeNegotiation(std::size_t BlockSize, std::uint16_t WindowSize) {
+    options::Negotiation Negotiated;
+    Negotiated.BlockSize = BlockSize;
+    Negotiated.WindowSize = WindowSize;
+    return Negotiated;
+}
+
+/// Block source reading from memory and counting the reads
+struct MemorySource {
+    std::size_t operator()(std::uint32_t File, std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Size) {
+        const auto &Contents = Files[File];
+        auto Read = static_cast<std::size_t>(std::min<std::uint64_t>(Size, Contents.size() - Offset));
+        std::memcpy(Buffer, Contents.data() + Offset, Read);
+        ++Reads;
+        return Read;
+    }
+
+    std::vector<std::string> Files;
+    std::size_t Reads = 0;
+};
+
+} // namespace
+
+/// Test that the hot part of a session takes exactly one cache line
+TEST(SessionStore, Layout) {
+    ASSERT_EQ(sizeof(HotSession), 64);
+    ASSERT_EQ(alignof(HotSession), 64);
+    SessionStore Store;
+    auto [Index, Inserted] = Store.emplace(makeClient(0x0a000001, 1000), 3, "pxelinux.0", 1000);
+    ASSERT_TRUE(Inserted);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(&Store.hot(Index)) % 64, 0);
+}
+
+/// Test that sessions are found by the client transfer identifier and their indices are reused after erasure
+TEST(SessionStore, Index) {
+    SessionStore Store;
+    std::mt19937 Random{7};
+    std::vector<TransferID> Clients;
+    std::vector<SessionIndex> Indices;
+    for (std::uint32_t Idx = 0; Idx != 20000; ++Idx) {
+        Clients.push_back(makeClient(Random(), static_cast<std::uint16_t>(Random())));
+        auto [Index, Inserted] = Store.emplace(Clients.back(), Idx, "file" + std::to_string(Idx), Idx * 10,
+                                               makeNegotiation(512, 1));
+        ASSERT_TRUE(Inserted);
+        Indices.push_back(Index);
+    }
+    ASSERT_EQ(Store.size(), 20000);
+    ASSERT_FALSE(Store.emplace(Clients[5], 0, "other", 0).second);
+    ASSERT_EQ(Store.find(makeClient(1, 1)), std::nullopt);
+
+    for (std::uint32_t Idx = 0; Idx != 20000; Idx += 2) {
+        Store.erase(Indices[Idx]);
+    }
+    ASSERT_EQ(Store.size(), 10000);
+    for (std::uint32_t Idx = 0; Idx != 20000; ++Idx) {
+        auto Found = Store.find(Clients[Idx]);
+        if (Idx % 2 == 0) {
+            ASSERT_EQ(Found, std::nullopt);
+            continue;
+        }
+        ASSERT_EQ(Found, Indices[Idx]);
+        ASSERT_EQ(Store.hot(*Found).File, Idx);
+        ASSERT_EQ(Store.hot(*Found).LastBlock, Idx * 10 / 512 + 1);
+        ASSERT_EQ(Store.cold(*Found).Filename, "file" + std::to_string(Idx));
+        ASSERT_EQ(Store.cold(*Found).FileSize, Idx * 10);
+    }
+
+    // Erased indices are reused, so the arrays don't grow
+    auto Usage = Store.getMemoryUsage();
+    for (std::uint32_t Idx = 0; Idx != 10000; ++Idx) {
+        ASSERT_TRUE(Store.emplace(makeClient(Idx, 69), Idx, "", 0).second);
+    }
+    ASSERT_EQ(Store.getMemoryUsage(), Usage);
+    ASSERT_EQ(Store.find(Clients[1]), Indices[1]);
+}
+
+/// Test that windows are acknowledged across the block number wrap around and retransmissions read the blocks again
+TEST(SessionStore, Transfer) {
+    MemorySource Source;
+    Source.Files.resize(1);
+    std::mt19937 Random{3};
+    for (std::size_t Idx = 0; Idx != 70000 * 8 + 5; ++Idx) {
+        Source.Files[0].push_back(static_cast<char>(Random()));
+    }
+    SessionStore Store;
+    auto Client = makeClient(0x0a000001, 2000);
+    auto Index = Store.emplace(Client, 0, "initrd.img", Source.Files[0].size(), makeNegotiation(8, 4)).first;
+    auto &Session = Store.hot(Index);
+    ASSERT_EQ(Session.LastBlock, 70001);
+
+    std::string Received;
+    std::uint8_t Packet[12];
+    bool Lost = false;
+    while (!Session.isComplete()) {
+        auto End = Session.getWindowEnd();
+        ASSERT_LE(End - Session.Acknowledged, 4);
+        std::uint32_t LastInOrder = Session.Acknowledged;
+        for (auto Block = Session.Acknowledged + 1; Block <= End; ++Block) {
+            auto Size = makeDataPacket(Session, Block, Packet, Source);
+            ASSERT_EQ(Packet[1], packets::types::DataPacket);
+            ASSERT_EQ(Packet[2] << 8 | Packet[3], Block & 0xFFFF);
+            // Block 65540 is lost once, the client acknowledges the blocks before it
+            if (Block == 65540 && !Lost) {
+                Lost = true;
+                break;
+            }
+            Received.append(reinterpret_cast<const char *>(Packet + 4), Size - 4);
+            LastInOrder = Block;
+        }
+        if (LastInOrder == Session.Acknowledged) {
+            // Timeout, the window is sent again
+            ++Session.Retries;
+            ++Store.cold(Index).Retransmissions;
+            continue;
+        }
+        ASSERT_TRUE(Session.acknowledge(static_cast<std::uint16_t>(LastInOrder)));
+        // Duplicates and acknowledgments of blocks that weren't sent are ignored
+        ASSERT_FALSE(Session.acknowledge(static_cast<std::uint16_t>(LastInOrder)));
+        ASSERT_FALSE(Session.acknowledge(static_cast<std::uint16_t>(LastInOrder + 5)));
+    }
+    ASSERT_TRUE(Lost);
+    ASSERT_TRUE(Received == Source.Files[0]);
+    ASSERT_EQ(Session.Retries, 0);
+    // Every block is read once, the blocks of the window following the lost one are read again
+    ASSERT_EQ(Source.Reads, 70001 + 1);
+}
+
+/// Test that retransmission timers are armed in the hot parts and lead back to their sessions
+TEST(SessionStore, Timers) {
+    SessionStore Store;
+    auto Start = TimerWheel::Clock::now();
+    TimerWheel Wheel(std::chrono::milliseconds(1), Start);
+    for (std::uint16_t Port = 1; Port <= 100; ++Port) {
+        auto Index = Store.emplace(makeClient(0x0a000001, Port), Port, "", 5000).first;
+        Wheel.arm(Store.hot(Index), Start + std::chrono::milliseconds(Port));
+    }
+
+    std::vector<std::uint32_t> Expired;
+    Wheel.advance(Start + std::chrono::milliseconds(50), [&](TimerNode &Node) {
+        auto Index = Store.getIndex(Node);
+        Expired.push_back(Store.hot(Index).File);
+        Store.erase(Index);
+    });
+    ASSERT_EQ(Expired.size(), 50);
+    ASSERT_EQ(Store.size(), 50);
+    for (std::uint16_t Port = 51; Port <= 100; ++Port) {
+        auto Index = Store.find(makeClient(0x0a000001, Port));
+        ASSERT_TRUE(Index);
+        Wheel.cancel(Store.hot(*Index));
+        Store.erase(*Index);
+    }
+    ASSERT_TRUE(Store.empty());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
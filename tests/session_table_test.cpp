@@ -0,0 +1,122 @@
+#include "../tftp_common/details/session_table.hpp"
+#include "../tftp_common/details/timer_wheel.hpp"
+#include <gtest/gtest.h>
+
+#include <random>
+#include <unordered_map>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+TransferID makeID(std::uint32_t Address, std::uint16_t Port) {
+    sockaddr_in Endpoint{};
+    Endpoint.sin_family = AF_INET;
+    Endpoint.sin_addr.s_addr = htonl(Address);
+    Endpoint.sin_port = htons(Port);
+    return TransferID::fromIPv4(Endpoint);
+}
+
+/// Non-movable session stub, the table must never relocate sessions
+struct Session {
+    explicit Session(std::size_t Id) : Id(Id) {}
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    std::size_t Id;
+    TimerNode Retransmit;
+};
+
+} // namespace
+
+/// Test that transfer identifiers are built from socket addresses
+TEST(TransferID, FromEndpoint) {
+    auto ID = makeID(0x7F000001, 69);
+    ASSERT_EQ(ID.Port, 69);
+    ASSERT_EQ(ID.Address[10], 0xFF);
+    ASSERT_EQ(ID.Address[15], 0x01);
+
+    sockaddr_in6 Endpoint{};
+    Endpoint.sin6_family = AF_INET6;
+    Endpoint.sin6_port = htons(69);
+    Endpoint.sin6_addr.s6_addr[15] = 1;
+    ASSERT_NE(TransferID::fromIPv6(Endpoint), ID);
+    ASSERT_EQ(TransferID::fromIPv6(Endpoint), TransferID::fromIPv6(Endpoint));
+}
+
+/// Test that sessions are inserted, found and erased
+TEST(SessionTable, Basic) {
+    SessionTable<Session> Table;
+    auto [Handle, Inserted] = Table.emplace(makeID(0x0A000001, 1024), 1);
+    ASSERT_TRUE(Inserted);
+    ASSERT_FALSE(Table.emplace(makeID(0x0A000001, 1024), 2).second);
+    ASSERT_EQ(Table.size(), 1u);
+
+    auto *Found = Table.find(makeID(0x0A000001, 1024));
+    ASSERT_NE(Found, nullptr);
+    ASSERT_EQ(Found->Id, 1u);
+    ASSERT_EQ(Table.get(Handle), Found);
+    ASSERT_EQ(Table.find(makeID(0x0A000001, 1025)), nullptr);
+
+    ASSERT_TRUE(Table.erase(Handle));
+    ASSERT_EQ(Table.get(Handle), nullptr);
+    ASSERT_FALSE(Table.erase(Handle));
+    ASSERT_TRUE(Table.empty());
+
+    // Slab entry is reused, the stale handle must not resolve to the new session
+    auto Reused = Table.emplace(makeID(0x0A000002, 1024), 3).first;
+    ASSERT_EQ(Reused.Index, Handle.Index);
+    ASSERT_EQ(Table.get(Handle), nullptr);
+    ASSERT_EQ(Table.get(Reused)->Id, 3u);
+}
+
+/// Test that datagrams of unknown transfers produce an UnknownTransferID error packet
+TEST(SessionTable, UnknownTransferID) {
+    SessionTable<Session> Table;
+    Table.emplace(makeID(0x0A000001, 1024), 1);
+
+    std::size_t Visited = 0;
+    ASSERT_EQ(Table.dispatch(makeID(0x0A000001, 1024), [&](Session &) { ++Visited; }), std::nullopt);
+    auto Reply = Table.dispatch(makeID(0x0A000001, 4096), [&](Session &) { ++Visited; });
+    ASSERT_EQ(Visited, 1u);
+    ASSERT_TRUE(Reply.has_value());
+    ASSERT_EQ(Reply->getErrorCode(), packets::errors::UnknownTransferID);
+}
+
+/// Test that the table stays consistent with a reference map under random churn and keeps sessions in place
+TEST(SessionTable, Randomized) {
+    SessionTable<Session> Table;
+    std::unordered_map<std::uint64_t, std::pair<Session *, std::size_t>> Reference;
+    std::mt19937 Random{7};
+    // Narrow key space so that inserts and erases collide often
+    std::uniform_int_distribution<std::uint32_t> Address{0, 4000};
+
+    for (std::size_t Step = 0; Step != 200000; ++Step) {
+        auto Key = Address(Random);
+        auto ID = makeID(Key, static_cast<std::uint16_t>(Key * 7));
+        auto It = Reference.find(Key);
+        if (Step % 3 == 0) {
+            ASSERT_EQ(Table.erase(ID), It != Reference.end());
+            if (It != Reference.end()) {
+                Reference.erase(It);
+            }
+        } else if (It == Reference.end()) {
+            auto Handle = Table.emplace(ID, Step).first;
+            Reference.emplace(Key, std::make_pair(Table.get(Handle), Step));
+        } else {
+            auto *Found = Table.find(ID);
+            ASSERT_EQ(Found, It->second.first);
+            ASSERT_EQ(Found->Id, It->second.second);
+        }
+    }
+    ASSERT_EQ(Table.size(), Reference.size());
+    for (const auto &[Key, Value] : Reference) {
+        ASSERT_EQ(Table.find(makeID(Key, static_cast<std::uint16_t>(Key * 7))), Value.first);
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
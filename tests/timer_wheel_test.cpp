@@ -0,0 +1,146 @@
+#include "../tftp_common/details/timer_wheel.hpp"
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace tftp_common::transfer;
+using namespace std::chrono_literals;
+
+using Clock = TimerWheel::Clock;
+
+namespace {
+
+struct RetransmitTimer : TimerNode {};
+struct IdleTimer : TimerNode {};
+
+/// Transfer session stub embedding two timers
+struct Session : RetransmitTimer, IdleTimer {
+    std::size_t Id = 0;
+    std::size_t Retransmits = 0;
+    std::size_t IdleExpirations = 0;
+};
+
+} // namespace
+
+/// Test that timers expire no earlier than their deadlines and in the right order
+TEST(TimerWheel, Expiry) {
+    auto Start = Clock::now();
+    TimerWheel Wheel{1ms, Start};
+    Session First, Second;
+    Wheel.arm(static_cast<RetransmitTimer &>(First), Start + 10ms);
+    Wheel.arm(static_cast<RetransmitTimer &>(Second), Start + 5ms);
+    ASSERT_EQ(Wheel.size(), 2u);
+
+    std::vector<TimerNode *> Expired;
+    auto Collect = [&](TimerNode &Node) { Expired.push_back(&Node); };
+
+    ASSERT_EQ(Wheel.advance(Start + 4ms, Collect), 0u);
+    ASSERT_EQ(Wheel.advance(Start + 5ms, Collect), 1u);
+    ASSERT_EQ(Expired.back(), static_cast<RetransmitTimer *>(&Second));
+    ASSERT_EQ(Wheel.advance(Start + 100ms, Collect), 1u);
+    ASSERT_EQ(Expired.back(), static_cast<RetransmitTimer *>(&First));
+    ASSERT_TRUE(Wheel.empty());
+    ASSERT_FALSE(static_cast<RetransmitTimer &>(First).isArmed());
+}
+
+/// Test that timers can be re-armed and cancelled, including from the expiry callback
+TEST(TimerWheel, RearmAndCancel) {
+    auto Start = Clock::now();
+    TimerWheel Wheel{1ms, Start};
+    Session Client;
+    auto &Retransmit = static_cast<RetransmitTimer &>(Client);
+    auto &Idle = static_cast<IdleTimer &>(Client);
+
+    Wheel.arm(Retransmit, Start + 10ms);
+    Wheel.arm(Idle, Start + 1s);
+    Wheel.arm(Retransmit, Start + 20ms);
+    ASSERT_EQ(Wheel.size(), 2u);
+
+    auto OnExpired = [&](TimerNode &Node) {
+        if (&Node == &static_cast<TimerNode &>(Retransmit)) {
+            if (++Client.Retransmits == 3) {
+                Wheel.cancel(Idle);
+            } else {
+                Wheel.arm(Retransmit, Start + 20ms * static_cast<int>(Client.Retransmits + 1));
+            }
+        } else {
+            ++Client.IdleExpirations;
+        }
+    };
+    ASSERT_EQ(Wheel.advance(Start + 19ms, OnExpired), 0u);
+    ASSERT_EQ(Wheel.advance(Start + 2s, OnExpired), 3u);
+    ASSERT_EQ(Client.Retransmits, 3u);
+    ASSERT_EQ(Client.IdleExpirations, 0u);
+    ASSERT_TRUE(Wheel.empty());
+}
+
+/// Test that deadlines in the past expire on the next tick and far deadlines cascade through all levels
+TEST(TimerWheel, Extremes) {
+    auto Start = Clock::now();
+    TimerWheel Wheel{1ms, Start};
+    Session Past, Far;
+    Wheel.arm(static_cast<RetransmitTimer &>(Past), Start - 1s);
+    Wheel.arm(static_cast<RetransmitTimer &>(Far), Start + 24h * 60);
+
+    std::size_t Expired = 0;
+    auto Count = [&](TimerNode &) { ++Expired; };
+    ASSERT_EQ(Wheel.advance(Start + 1ms, Count), 1u);
+    ASSERT_EQ(Wheel.advance(Start + 24h * 60 - 1ms, Count), 0u);
+    ASSERT_EQ(Wheel.advance(Start + 24h * 60, Count), 1u);
+    ASSERT_EQ(Expired, 2u);
+}
+
+/// Test that randomly armed, re-armed and cancelled timers expire exactly on their ticks
+TEST(TimerWheel, Randomized) {
+    auto Start = Clock::now();
+    TimerWheel Wheel{1ms, Start};
+    std::vector<std::unique_ptr<Session>> Sessions;
+    std::vector<std::int64_t> Deadlines;
+    for (std::size_t Idx = 0; Idx != 2000; ++Idx) {
+        Sessions.push_back(std::make_unique<Session>());
+        Sessions.back()->Id = Idx;
+        Deadlines.push_back(-1);
+    }
+
+    std::mt19937 Random{42};
+    std::uniform_int_distribution<std::int64_t> Delay{1, 200000};
+    std::uniform_int_distribution<std::size_t> Pick{0, Sessions.size() - 1};
+    std::int64_t Now = 0;
+    std::size_t Fired = 0;
+    for (std::size_t Step = 0; Step != 20000; ++Step) {
+        auto &Target = *Sessions[Pick(Random)];
+        auto &Node = static_cast<RetransmitTimer &>(Target);
+        if (Step % 7 == 0) {
+            Wheel.cancel(Node);
+            Deadlines[Target.Id] = -1;
+        } else {
+            auto Deadline = Now + Delay(Random);
+            Wheel.arm(Node, Start + std::chrono::milliseconds(Deadline));
+            Deadlines[Target.Id] = Deadline;
+        }
+
+        Now += Delay(Random) / 100;
+        Fired += Wheel.advance(Start + std::chrono::milliseconds(Now), [&](TimerNode &Expired) {
+            auto &Owner = static_cast<Session &>(static_cast<RetransmitTimer &>(Expired));
+            ASSERT_NE(Deadlines[Owner.Id], -1);
+            ASSERT_LE(Deadlines[Owner.Id], Now);
+            Deadlines[Owner.Id] = -1;
+        });
+        for (std::size_t Idx = 0; Idx < Deadlines.size(); Idx += 97) {
+            if (Deadlines[Idx] != -1) {
+                ASSERT_GT(Deadlines[Idx], Now);
+            }
+        }
+    }
+    ASSERT_GT(Fired, 0u);
+    for (auto &Owner : Sessions) {
+        Wheel.cancel(static_cast<RetransmitTimer &>(*Owner));
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
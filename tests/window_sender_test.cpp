@@ -0,0 +1,135 @@
+#include "../tftp_common/details/window_sender.hpp"
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace tftp_common;
+using namespace tftp_common::transfer;
+
+namespace {
+
+/// Pair of loopback sockets, the receiving one has a generous buffer and a receive timeout
+class Loopback {
+  public:
+    Loopback() {
+        Sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+        Receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+        Address.sin_family = AF_INET;
+        Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(Receiver, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address));
+        socklen_t Length = sizeof(Address);
+        ::getsockname(Receiver, reinterpret_cast<sockaddr *>(&Address), &Length);
+        int BufferSize = 8 * 1024 * 1024;
+        ::setsockopt(Receiver, SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+        timeval Timeout{1, 0};
+        ::setsockopt(Receiver, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    }
+    ~Loopback() {
+        ::close(Sender);
+        ::close(Receiver);
+    }
+
+    std::error_code send(WindowSender &Window) {
+        return Window.send(Sender, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address));
+    }
+
+    /// @return Received datagrams
+    std::vector<std::vector<std::uint8_t>> receive(std::size_t Count) {
+        std::vector<std::vector<std::uint8_t>> Datagrams;
+        std::vector<std::uint8_t> Buffer(65536);
+        for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+            auto Size = ::recv(Receiver, Buffer.data(), Buffer.size(), 0);
+            if (Size < 0) {
+                break;
+            }
+            Datagrams.emplace_back(Buffer.begin(), Buffer.begin() + Size);
+        }
+        return Datagrams;
+    }
+
+  private:
+    int Sender;
+    int Receiver;
+    sockaddr_in Address{};
+};
+
+/// Fill the window with blocks of the file starting with \p FirstBlock, the data of every block is its number
+void fill(WindowSender &Window, std::uint16_t FirstBlock, std::size_t Count, std::size_t BlockSize,
+          std::size_t LastSize) {
+    for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+        auto Block = static_cast<std::uint16_t>(FirstBlock + Idx);
+        auto Size = Idx + 1 == Count ? LastSize : BlockSize;
+        std::memset(Window.append(Block, Size), Block & 0xff, Size);
+    }
+}
+
+void check(const std::vector<std::vector<std::uint8_t>> &Datagrams, std::uint16_t FirstBlock, std::size_t Count,
+           std::size_t BlockSize, std::size_t LastSize) {
+    ASSERT_EQ(Datagrams.size(), Count);
+    for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+        auto Block = static_cast<std::uint16_t>(FirstBlock + Idx);
+        const auto &Datagram = Datagrams[Idx];
+        ASSERT_EQ(Datagram.size(), (Idx + 1 == Count ? LastSize : BlockSize) + 4);
+        ASSERT_EQ(Datagram[0], 0);
+        ASSERT_EQ(Datagram[1], packets::types::DataPacket);
+        ASSERT_EQ(Datagram[2] << 8 | Datagram[3], Block);
+        for (std::size_t Byte = 4; Byte != Datagram.size(); ++Byte) {
+            ASSERT_EQ(Datagram[Byte], Block & 0xff);
+        }
+    }
+}
+
+} // namespace
+
+/// Test that every packet of the window arrives as a separate datagram, with and without segmentation offload
+TEST(WindowSender, Window) {
+    for (bool Segmentation : {true, false}) {
+        for (std::size_t BlockSize : {512, 1428, 8192}) {
+            for (std::size_t LastSize : {BlockSize, BlockSize - 1, std::size_t(0)}) {
+                Loopback Sockets;
+                WindowSender Window(BlockSize, 16);
+                Window.setSegmentation(Segmentation);
+                fill(Window, 65530, 16, BlockSize, LastSize);
+                ASSERT_FALSE(Sockets.send(Window));
+                ASSERT_EQ(Window.getSent(), 16);
+                check(Sockets.receive(16), 65530, 16, BlockSize, LastSize);
+            }
+        }
+    }
+}
+
+/// Test that the window is sent with fewer system calls when segmentation offload is available
+TEST(WindowSender, SystemCalls) {
+    Loopback Sockets;
+    WindowSender Window(1428, 64);
+    fill(Window, 1, 64, 1428, 1428);
+    ASSERT_FALSE(Sockets.send(Window));
+    check(Sockets.receive(64), 1, 64, 1428, 1428);
+    if (Window.isSegmentationEnabled()) {
+        // 64 segments of 1432 bytes exceed the greatest UDP payload
+        ASSERT_EQ(Window.getSystemCallsCount(), 2);
+    } else {
+        ASSERT_EQ(Window.getSystemCallsCount(), 1);
+    }
+}
+
+/// Test that the window can be refilled and blocks too large to be segmented are still sent
+TEST(WindowSender, Refill) {
+    Loopback Sockets;
+    WindowSender Window(40000, 4);
+    fill(Window, 1, 4, 40000, 40000);
+    ASSERT_FALSE(Sockets.send(Window));
+    check(Sockets.receive(4), 1, 4, 40000, 40000);
+
+    Window.clear();
+    ASSERT_EQ(Window.size(), 0);
+    fill(Window, 5, 2, 40000, 100);
+    ASSERT_FALSE(Sockets.send(Window));
+    check(Sockets.receive(2), 5, 2, 40000, 100);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,250 @@
+#include "../tftp_common/details/xdp.hpp"
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <poll.h>
+
+using namespace tftp_common;
+using namespace tftp_common::xdp;
+
+namespace {
+
+Route makeRoute() {
+    Route Path;
+    Path.SourceMac = {0x02, 0, 0, 0, 0, 0x01};
+    Path.DestinationMac = {0x02, 0, 0, 0, 0, 0x02};
+    Path.SourceAddress = htonl(0x0a000001);
+    Path.DestinationAddress = htonl(0x0a000002);
+    Path.SourcePort = 40000;
+    Path.DestinationPort = 50000;
+    return Path;
+}
+
+/// Build the frame carrying the Data packet with the given data field
+std::vector<std::uint8_t> makeDataFrame(const Route &Path, std::uint16_t Block, std::size_t Size) {
+    std::vector<std::uint8_t> Frame(HeadersSize + 4 + Size);
+    for (std::size_t Idx = 0; Idx != Size; ++Idx) {
+        Frame[HeadersSize + 4 + Idx] = static_cast<std::uint8_t>(Idx);
+    }
+    Frame.resize(buildDataFrame(Frame.data(), Path, Block, Size));
+    return Frame;
+}
+
+/// Pair of veth interfaces, the AF_XDP socket is bound to the second one and frames are injected into the first one
+class VethPair {
+  public:
+    VethPair()
+        : First("tftpx" + std::to_string(::getpid() % 100000) + "a"),
+          Second(First.substr(0, First.size() - 1) + "b") {
+        auto Command = "ip link add " + First + " type veth peer name " + Second + " >/dev/null 2>&1 && ip link set " +
+                       First + " up && ip link set " + Second + " up";
+        Created = std::system(Command.c_str()) == 0;
+    }
+    ~VethPair() {
+        if (Created) {
+            std::system(("ip link del " + First + " >/dev/null 2>&1").c_str());
+        }
+    }
+
+    std::string First;
+    std::string Second;
+    bool Created = false;
+};
+
+/// Raw socket sending and receiving frames on the interface
+class PacketSocket {
+  public:
+    explicit PacketSocket(const std::string &Interface) {
+        Descriptor = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        Address.sll_family = AF_PACKET;
+        Address.sll_protocol = htons(ETH_P_ALL);
+        Address.sll_ifindex = static_cast<int>(::if_nametoindex(Interface.c_str()));
+        ::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address));
+    }
+    ~PacketSocket() { ::close(Descriptor); }
+
+    void send(const std::vector<std::uint8_t> &Frame) {
+        ::sendto(Descriptor, Frame.data(), Frame.size(), 0, reinterpret_cast<const sockaddr *>(&Address),
+                 sizeof(Address));
+    }
+
+    /// @return Incoming UDP frame sent to the port or std::nullopt if there's none for a second
+    std::optional<std::vector<std::uint8_t>> receive(std::uint16_t Port) {
+        auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        std::vector<std::uint8_t> Frame(65536);
+        while (std::chrono::steady_clock::now() < Deadline) {
+            pollfd Poll{Descriptor, POLLIN, 0};
+            if (::poll(&Poll, 1, 100) <= 0) {
+                continue;
+            }
+            sockaddr_ll From{};
+            socklen_t Length = sizeof(From);
+            auto Size = ::recvfrom(Descriptor, Frame.data(), Frame.size(), 0, reinterpret_cast<sockaddr *>(&From),
+                                   &Length);
+            if (Size <= 0 || From.sll_pkttype == PACKET_OUTGOING) {
+                continue;
+            }
+            auto View = parseFrame(Frame.data(), static_cast<std::size_t>(Size));
+            if (View && View->getDestinationPort() == Port) {
+                Frame.resize(static_cast<std::size_t>(Size));
+                return Frame;
+            }
+        }
+        return std::nullopt;
+    }
+
+  private:
+    int Descriptor;
+    sockaddr_ll Address{};
+};
+
+/// Poll the AF_XDP socket for a second, collecting payloads of the received frames
+std::vector<std::vector<std::uint8_t>> receive(XskSocket &Socket, std::size_t Count, Route &Reply) {
+    std::vector<std::vector<std::uint8_t>> Payloads;
+    auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (Payloads.size() < Count && std::chrono::steady_clock::now() < Deadline) {
+        pollfd Poll{Socket.getDescriptor(), POLLIN, 0};
+        ::poll(&Poll, 1, 100);
+        Socket.receive([&](FrameView &View) {
+            Payloads.emplace_back(View.Payload, View.Payload + View.PayloadSize);
+            Reply = Route::reply(View);
+        });
+    }
+    return Payloads;
+}
+
+} // namespace
+
+/// Test that the built frames are parsed back in place with valid checksums
+TEST(Frame, BuildParse) {
+    auto Path = makeRoute();
+    for (std::size_t Size : {0, 1, 511, 512, 1428}) {
+        auto Frame = makeDataFrame(Path, 7, Size);
+        ASSERT_EQ(Frame.size(), HeadersSize + 4 + Size);
+        auto View = parseFrame(Frame.data(), Frame.size());
+        ASSERT_TRUE(View.has_value());
+        ASSERT_TRUE(verifyChecksums(*View));
+        ASSERT_EQ(View->Payload, Frame.data() + HeadersSize);
+        ASSERT_EQ(View->PayloadSize, Size + 4);
+        ASSERT_EQ(View->getSourceMac(), Path.SourceMac);
+        ASSERT_EQ(View->getDestinationMac(), Path.DestinationMac);
+        ASSERT_EQ(View->getSourceAddress(), Path.SourceAddress);
+        ASSERT_EQ(View->getDestinationAddress(), Path.DestinationAddress);
+        ASSERT_EQ(View->getSourcePort(), Path.SourcePort);
+        ASSERT_EQ(View->getDestinationPort(), Path.DestinationPort);
+
+        auto Reply = Route::reply(*View);
+        ASSERT_EQ(Reply.DestinationMac, Path.SourceMac);
+        ASSERT_EQ(Reply.SourceAddress, Path.DestinationAddress);
+        ASSERT_EQ(Reply.DestinationPort, Path.SourcePort);
+    }
+
+    std::vector<std::uint8_t> Frame(HeadersSize + 4);
+    Frame.resize(buildAcknowledgmentFrame(Frame.data(), Path, 513));
+    auto View = parseFrame(Frame.data(), Frame.size());
+    ASSERT_TRUE(View.has_value());
+    ASSERT_TRUE(verifyChecksums(*View));
+    ASSERT_EQ(View->PayloadSize, 4);
+    ASSERT_EQ(View->Payload[1], packets::types::AcknowledgmentPacket);
+    ASSERT_EQ(View->Payload[2] << 8 | View->Payload[3], 513);
+
+    // Corrupted payload
+    Frame.back() ^= 0x55;
+    ASSERT_FALSE(verifyChecksums(*parseFrame(Frame.data(), Frame.size())));
+}
+
+/// Test that frames other than unfragmented IPv4 UDP datagrams are rejected
+TEST(Frame, Reject) {
+    auto Path = makeRoute();
+    auto Frame = makeDataFrame(Path, 1, 100);
+    ASSERT_FALSE(parseFrame(Frame.data(), HeadersSize - 1).has_value());
+    // Truncated frame
+    ASSERT_FALSE(parseFrame(Frame.data(), Frame.size() - 1).has_value());
+    // Ethernet padding is fine
+    Frame.resize(Frame.size() + 10);
+    ASSERT_TRUE(parseFrame(Frame.data(), Frame.size()).has_value());
+
+    auto Modified = Frame;
+    Modified[12] = 0x86, Modified[13] = 0xdd;
+    ASSERT_FALSE(parseFrame(Modified.data(), Modified.size()).has_value());
+    Modified = Frame;
+    Modified[EthernetHeaderSize + 9] = IPPROTO_TCP;
+    ASSERT_FALSE(parseFrame(Modified.data(), Modified.size()).has_value());
+    Modified = Frame;
+    Modified[EthernetHeaderSize + 6] |= 0x20;
+    ASSERT_FALSE(parseFrame(Modified.data(), Modified.size()).has_value());
+    Modified = Frame;
+    Modified[EthernetHeaderSize + IPv4HeaderSize + 4] = 0xff;
+    ASSERT_FALSE(parseFrame(Modified.data(), Modified.size()).has_value());
+}
+
+/// Test that datagrams for the port range reach the AF_XDP socket, replies built in UMEM are transmitted, and the
+/// rest of the traffic is left to the kernel (generic XDP on a veth pair, requires CAP_NET_ADMIN)
+TEST(XskSocket, Veth) {
+    VethPair Pair;
+    if (!Pair.Created) {
+        GTEST_SKIP() << "veth pair can't be created";
+    }
+    Program Steering;
+    if (auto Error = Steering.attach(Pair.Second, 50000, 50099)) {
+        GTEST_SKIP() << "XDP program can't be attached: " << Error.message();
+    }
+    XskSocket Socket;
+    ASSERT_FALSE(Socket.open(Pair.Second, 0)) << "AF_XDP socket can't be bound";
+    ASSERT_FALSE(Steering.addSocket(0, Socket));
+
+    PacketSocket Injector(Pair.First);
+    auto Path = makeRoute();
+    for (std::uint16_t Block = 1; Block <= 8; ++Block) {
+        Injector.send(makeDataFrame(Path, Block, 512));
+    }
+    // Outside of the port range
+    Path.DestinationPort = 69;
+    Injector.send(makeDataFrame(Path, 100, 512));
+
+    Route Reply;
+    auto Payloads = receive(Socket, 9, Reply);
+    ASSERT_EQ(Payloads.size(), 8);
+    for (std::uint16_t Block = 1; Block <= 8; ++Block) {
+        const auto &Payload = Payloads[Block - 1];
+        ASSERT_EQ(Payload.size(), 516);
+        ASSERT_EQ(Payload[2] << 8 | Payload[3], Block);
+    }
+
+    auto *Frame = Socket.allocate();
+    ASSERT_NE(Frame, nullptr);
+    Socket.transmit(Frame, buildAcknowledgmentFrame(Frame, Reply, 8));
+    ASSERT_FALSE(Socket.flush());
+    auto Transmitted = Injector.receive(Reply.DestinationPort);
+    ASSERT_TRUE(Transmitted.has_value());
+    auto View = parseFrame(Transmitted->data(), Transmitted->size());
+    ASSERT_TRUE(verifyChecksums(*View));
+    ASSERT_EQ(View->getSourcePort(), 50000);
+    ASSERT_EQ(View->Payload[1], packets::types::AcknowledgmentPacket);
+    ASSERT_EQ(View->Payload[2] << 8 | View->Payload[3], 8);
+
+    // Copy mode sends at most 32 frames per kick, all of them go out and their frames are reclaimed
+    auto FreeFrames = Socket.getFreeFrames();
+    for (std::uint16_t Block = 1; Block <= 100; ++Block) {
+        Frame = Socket.allocate();
+        ASSERT_NE(Frame, nullptr);
+        Socket.transmit(Frame, buildAcknowledgmentFrame(Frame, Reply, Block));
+    }
+    ASSERT_FALSE(Socket.flush());
+    for (std::uint16_t Block = 1; Block <= 100; ++Block) {
+        Transmitted = Injector.receive(Reply.DestinationPort);
+        ASSERT_TRUE(Transmitted.has_value()) << Block;
+        View = parseFrame(Transmitted->data(), Transmitted->size());
+        ASSERT_EQ(View->Payload[2] << 8 | View->Payload[3], Block);
+    }
+    ASSERT_EQ(Socket.getFreeFrames(), FreeFrames);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,571 @@
+#pragma once
+
+#include "coroutine.hpp"
+#include "options.hpp"
+#include "parsers.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tftp_common::async {
+
+/// Options requested by the client (RFC 2347), the server may lower or ignore them
+struct ClientOptions {
+    /// Requested block size (RFC 2348), the option is omitted if it's 512
+    std::size_t BlockSize = 1428;
+    /// Requested window size (RFC 7440), the option is omitted if it's 1
+    std::uint16_t WindowSize = 8;
+    /// Request the size of the file (read requests) or announce it (write requests) (RFC 2349)
+    bool TransferSize = true;
+    /// Requested timeout interval (RFC 2349)
+    std::optional<std::chrono::seconds> Timeout;
+    /// Retransmission timeout of the client unless the timeout interval is negotiated
+    std::chrono::milliseconds RetryTimeout{1000};
+    /// Number of retransmissions before the transfer is abandoned
+    unsigned MaxRetries = 5;
+};
+
+/// Outcome of a transfer run by the client
+struct TransferResult {
+    std::error_code Error;
+    /// Message of the Error packet if the server has aborted the transfer
+    std::string Message;
+    /// Block size and window size the server has agreed to, 512 and 1 if it has ignored the options
+    std::size_t BlockSize = 512;
+    std::uint16_t WindowSize = 1;
+    /// Size of the file reported by the server (read requests)
+    std::optional<std::uint64_t> TransferSize;
+    /// Number of bytes of the file transferred
+    std::uint64_t Bytes = 0;
+    std::chrono::nanoseconds Duration{0};
+};
+
+namespace details {
+
+/// @return Error code matching the error code of the Error packet sent by the server
+inline std::error_code makeErrorCode(std::uint16_t ErrorCode) noexcept {
+    switch (ErrorCode) {
+    case packets::errors::FileNotFound:
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+    case packets::errors::AccessViolation:
+        return std::make_error_code(std::errc::permission_denied);
+    case packets::errors::DiskFull:
+        return std::make_error_code(std::errc::no_space_on_device);
+    case packets::errors::FileAlreadyExists:
+        return std::make_error_code(std::errc::file_exists);
+    case packets::errors::OptionNegotiation:
+        return std::make_error_code(std::errc::invalid_argument);
+    default:
+        return std::make_error_code(std::errc::connection_aborted);
+    }
+}
+
+/// Fill the result with the code and the message of the received Error packet
+inline void setPeerError(TransferResult &Result, const std::uint8_t *Buffer, std::size_t Size) {
+    Result.Error = makeErrorCode(getBlock(Buffer));
+    auto *Message = reinterpret_cast<const char *>(Buffer + 4);
+    Result.Message.assign(Message, std::find(Message, Message + (Size - 4), '\0'));
+}
+
+inline packets::Request makeRequest(packets::types::Type Type_, std::string_view Filename,
+                                    std::optional<std::uint64_t> FileSize, const ClientOptions &Options) {
+    std::vector<std::string> Names;
+    std::vector<std::string> Values;
+    if (Options.BlockSize != 512) {
+        Names.emplace_back(options::names::BlockSize);
+        Values.push_back(std::to_string(Options.BlockSize));
+    }
+    if (Options.WindowSize != 1) {
+        Names.emplace_back(options::names::WindowSize);
+        Values.push_back(std::to_string(Options.WindowSize));
+    }
+    if (Options.Timeout) {
+        Names.emplace_back(options::names::Timeout);
+        Values.push_back(std::to_string(Options.Timeout->count()));
+    }
+    if (Options.TransferSize && (Type_ == packets::types::ReadRequest || FileSize)) {
+        Names.emplace_back(options::names::TransferSize);
+        Values.push_back(std::to_string(Type_ == packets::types::ReadRequest ? 0 : *FileSize));
+    }
+    return packets::Request(Type_, Filename, std::string_view("octet"), Names, Values);
+}
+
+/// Apply the option acknowledgment to the result
+/// @return false if it's malformed or acknowledges an option that wasn't requested or a greater value than requested
+inline bool acceptOptions(const std::uint8_t *Buffer, std::size_t Size, const ClientOptions &Options,
+                          TransferResult &Result, std::chrono::milliseconds &Timeout) {
+    auto Parsed = packets::Parser<packets::OptionAcknowledgment>::parse(Buffer, Size);
+    if (!Parsed.isSuccess()) {
+        return false;
+    }
+    for (const auto &[Name, Value] : Parsed.get().Packet) {
+        if (options::equalsIgnoreCase(Name, options::names::BlockSize)) {
+            auto BlockSize = options::parseBlockSize(Value);
+            if (!BlockSize || *BlockSize > Options.BlockSize) {
+                return false;
+            }
+            Result.BlockSize = *BlockSize;
+        } else if (options::equalsIgnoreCase(Name, options::names::WindowSize)) {
+            auto WindowSize = options::parseWindowSize(Value);
+            if (!WindowSize || *WindowSize > Options.WindowSize) {
+                return false;
+            }
+            Result.WindowSize = *WindowSize;
+        } else if (options::equalsIgnoreCase(Name, options::names::Timeout)) {
+            auto Interval = options::parseTimeout(Value);
+            if (!Interval || !Options.Timeout) {
+                return false;
+            }
+            Timeout = *Interval;
+        } else if (options::equalsIgnoreCase(Name, options::names::TransferSize)) {
+            if (!Options.TransferSize || !(Result.TransferSize = options::parseTransferSize(Value))) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Callback of the optional notifications that does nothing
+struct IgnoreNotification {
+    template <class... Args> void operator()(const Args &...) const noexcept {}
+};
+
+} // namespace details
+
+/// Read a file from the server (RRQ) with the requested options
+/// @n Blocks are acknowledged once per negotiated window and after the last one. A block received out of order makes
+/// the client acknowledge the last block received in order, so that the server resends the window from the block
+/// that follows it (RFC 7440).
+/// @param[Socket] Socket of the transfer, its port is the client transfer identifier
+/// @param[Write] Requirements: \p Write must be callable as `std::error_code(std::uint64_t Offset, const std::uint8_t
+/// *Buffer, std::size_t Size)`, it's called once for each block in order
+/// @param[OnAccepted] Requirements: \p OnAccepted must be callable as `void(const TransferResult &)`, it's called once
+/// the server has acknowledged the options or has started sending the file without them, before the first block
+template <class Writer, class Notification = details::IgnoreNotification>
+Task<TransferResult> readFile(UdpSocket &Socket, sockaddr_in Server, std::string Filename, Writer Write,
+                              ClientOptions Options = {}, Notification OnAccepted = {}) {
+    TransferResult Result;
+    auto Started = Executor::Clock::now();
+    std::chrono::milliseconds Timeout = Options.RetryTimeout;
+    auto Outgoing =
+        details::serialize(details::makeRequest(packets::types::ReadRequest, Filename, std::nullopt, Options));
+    std::vector<std::uint8_t> Incoming(std::max<std::size_t>(Options.BlockSize, 512) + 4);
+    std::optional<sockaddr_in> Peer;
+    // Number of the expected block, it keeps counting when the block number of the packets wraps around
+    std::uint64_t Expected = 1;
+    std::uint64_t Rewound = 0;
+    std::uint16_t WindowReceived = 0;
+    unsigned Retries = 0;
+    bool Negotiated = false;
+    co_await Socket.send(Outgoing.data(), Outgoing.size(), Server);
+    while (true) {
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timeout);
+        if (!Received) {
+            if (++Retries > Options.MaxRetries) {
+                Result.Error = std::make_error_code(std::errc::timed_out);
+                break;
+            }
+            co_await Socket.send(Outgoing.data(), Outgoing.size(), Peer ? *Peer : Server);
+            continue;
+        }
+        if (!Peer) {
+            // The first reply comes from the server transfer identifier (RFC 1350)
+            if (Received->From.sin_addr.s_addr != Server.sin_addr.s_addr) {
+                continue;
+            }
+            Peer = Received->From;
+            if (details::getType(Incoming.data(), Received->Size) == packets::types::OptionAcknowledgmentPacket) {
+                if (!details::acceptOptions(Incoming.data(), Received->Size, Options, Result, Timeout)) {
+                    auto Reply = details::serialize(
+                        packets::Error(packets::errors::OptionNegotiation, std::string_view("Unexpected options")));
+                    co_await Socket.send(Reply.data(), Reply.size(), *Peer);
+                    Result.Error = std::make_error_code(std::errc::protocol_error);
+                    break;
+                }
+                Incoming.resize(Result.BlockSize + 4);
+                OnAccepted(Result);
+                Outgoing = details::serialize(packets::Acknowledgment{0});
+                co_await Socket.send(Outgoing.data(), Outgoing.size(), *Peer);
+                Negotiated = true;
+                Retries = 0;
+                continue;
+            }
+            if (details::getType(Incoming.data(), Received->Size) == packets::types::DataPacket) {
+                OnAccepted(Result);
+            }
+        } else if (!isSameEndpoint(Received->From, *Peer)) {
+            auto Reply = details::serialize(transfer::makeUnknownTransferIDError());
+            co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+            continue;
+        }
+
+        auto Type_ = details::getType(Incoming.data(), Received->Size);
+        if (Type_ == packets::types::ErrorPacket) {
+            details::setPeerError(Result, Incoming.data(), Received->Size);
+            break;
+        }
+        if (Type_ == packets::types::OptionAcknowledgmentPacket && Negotiated && Expected == 1) {
+            // The server retransmits the option acknowledgment until it receives the acknowledgment 0
+            co_await Socket.send(Outgoing.data(), Outgoing.size(), *Peer);
+            continue;
+        }
+        if (Type_ != packets::types::DataPacket) {
+            continue;
+        }
+        auto Block = details::getBlock(Incoming.data());
+        auto Size = Received->Size - 4;
+        if (Block == static_cast<std::uint16_t>(Expected)) {
+            if (auto Error = Write((Expected - 1) * Result.BlockSize, Incoming.data() + 4, Size)) {
+                auto Reply = details::serialize(transfer::makeFileError(Error));
+                co_await Socket.send(Reply.data(), Reply.size(), *Peer);
+                Result.Error = Error;
+                break;
+            }
+            Result.Bytes += Size;
+            ++Expected;
+            Retries = 0;
+            auto Last = Size < Result.BlockSize;
+            if (Last || ++WindowReceived == Result.WindowSize) {
+                WindowReceived = 0;
+                Outgoing = details::serialize(packets::Acknowledgment{Block});
+                co_await Socket.send(Outgoing.data(), Outgoing.size(), *Peer);
+            }
+            if (Last) {
+                break;
+            }
+        } else if (Rewound != Expected) {
+            // Either a block has been lost or the server hasn't received the last acknowledgment, once per expected
+            // block to avoid the Sorcerer's Apprentice Syndrome
+            Rewound = Expected;
+            WindowReceived = 0;
+            Outgoing = details::serialize(packets::Acknowledgment{static_cast<std::uint16_t>(Expected - 1)});
+            co_await Socket.send(Outgoing.data(), Outgoing.size(), *Peer);
+        }
+    }
+    Result.Duration = Executor::Clock::now() - Started;
+    co_return Result;
+}
+
+/// Ask the server for the size of a file (RFC 2349) without transferring it
+/// @n The read request carries only the transfer size option. The transfer is terminated with an Error packet (error
+/// code 8) as soon as the server replies (RFC 2347), so the file isn't sent even if the server ignores the option.
+/// @param[Options] Only the retransmission settings are used
+/// @return Result with the transfer size if the server has reported it, or the error if the server has refused the
+/// request or hasn't responded
+inline Task<TransferResult> querySize(UdpSocket &Socket, sockaddr_in Server, std::string Filename,
+                                      ClientOptions Options = {}) {
+    TransferResult Result;
+    auto Started = Executor::Clock::now();
+    std::chrono::milliseconds Timeout = Options.RetryTimeout;
+    Options.BlockSize = 512;
+    Options.WindowSize = 1;
+    Options.TransferSize = true;
+    Options.Timeout = std::nullopt;
+    auto Request =
+        details::serialize(details::makeRequest(packets::types::ReadRequest, Filename, std::nullopt, Options));
+    std::vector<std::uint8_t> Incoming(516);
+    unsigned Retries = 0;
+    co_await Socket.send(Request.data(), Request.size(), Server);
+    while (true) {
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timeout);
+        if (!Received) {
+            if (++Retries > Options.MaxRetries) {
+                Result.Error = std::make_error_code(std::errc::timed_out);
+                break;
+            }
+            co_await Socket.send(Request.data(), Request.size(), Server);
+            continue;
+        }
+        if (Received->From.sin_addr.s_addr != Server.sin_addr.s_addr) {
+            continue;
+        }
+        auto Type_ = details::getType(Incoming.data(), Received->Size);
+        if (Type_ == packets::types::ErrorPacket) {
+            details::setPeerError(Result, Incoming.data(), Received->Size);
+            break;
+        }
+        if (Type_ != packets::types::OptionAcknowledgmentPacket && Type_ != packets::types::DataPacket) {
+            continue;
+        }
+        if (Type_ == packets::types::OptionAcknowledgmentPacket &&
+            !details::acceptOptions(Incoming.data(), Received->Size, Options, Result, Timeout)) {
+            Result.Error = std::make_error_code(std::errc::protocol_error);
+        }
+        auto Reply =
+            details::serialize(packets::Error(packets::errors::OptionNegotiation, std::string_view("Size query")));
+        co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+        break;
+    }
+    Result.Duration = Executor::Clock::now() - Started;
+    co_return Result;
+}
+
+/// Write a file to the server (WRQ) with the requested options
+/// @n Blocks are sent a negotiated window at a time and aren't kept for retransmissions: on timeout or on an
+/// acknowledgment of a block in the middle of the window they are read again starting from the first unacknowledged
+/// one.
+/// @param[Read] Requirements: \p Read must be callable as `std::size_t(std::uint64_t Offset, std::uint8_t *Buffer,
+/// std::size_t Size)` and return the number of bytes read, less than \p Size only at the end of the file
+/// @param[FileSize] Size of the file announced with the transfer size option (RFC 2349), if it's known
+template <class Reader>
+Task<TransferResult> writeFile(UdpSocket &Socket, sockaddr_in Server, std::string Filename, Reader Read,
+                               std::optional<std::uint64_t> FileSize = std::nullopt, ClientOptions Options = {}) {
+    TransferResult Result;
+    auto Started = Executor::Clock::now();
+    std::chrono::milliseconds Timeout = Options.RetryTimeout;
+    auto Request = details::serialize(details::makeRequest(packets::types::WriteRequest, Filename, FileSize, Options));
+    std::vector<std::uint8_t> Incoming(516);
+    std::optional<sockaddr_in> Peer;
+    unsigned Retries = 0;
+    co_await Socket.send(Request.data(), Request.size(), Server);
+    while (!Peer) {
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timeout);
+        if (!Received) {
+            if (++Retries > Options.MaxRetries) {
+                Result.Error = std::make_error_code(std::errc::timed_out);
+                Result.Duration = Executor::Clock::now() - Started;
+                co_return Result;
+            }
+            co_await Socket.send(Request.data(), Request.size(), Server);
+            continue;
+        }
+        if (Received->From.sin_addr.s_addr != Server.sin_addr.s_addr) {
+            continue;
+        }
+        auto Type_ = details::getType(Incoming.data(), Received->Size);
+        if (Type_ == packets::types::ErrorPacket) {
+            details::setPeerError(Result, Incoming.data(), Received->Size);
+        } else if (Type_ == packets::types::OptionAcknowledgmentPacket &&
+                   !details::acceptOptions(Incoming.data(), Received->Size, Options, Result, Timeout)) {
+            auto Reply = details::serialize(
+                packets::Error(packets::errors::OptionNegotiation, std::string_view("Unexpected options")));
+            co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+            Result.Error = std::make_error_code(std::errc::protocol_error);
+        } else if (Type_ != packets::types::OptionAcknowledgmentPacket &&
+                   (Type_ != packets::types::AcknowledgmentPacket || details::getBlock(Incoming.data()) != 0)) {
+            continue;
+        }
+        if (Result.Error) {
+            Result.Duration = Executor::Clock::now() - Started;
+            co_return Result;
+        }
+        Peer = Received->From;
+    }
+
+    // The Data packet is built in place, so that the block is read straight into the datagram
+    std::vector<std::uint8_t> Outgoing(Result.BlockSize + 4);
+    std::uint64_t Acknowledged = 0;
+    std::optional<std::uint64_t> LastBlock;
+    std::size_t LastSize = 0;
+    Retries = 0;
+    while (!Result.Error) {
+        for (auto Block = Acknowledged + 1; Block <= Acknowledged + Result.WindowSize; ++Block) {
+            if (LastBlock && Block > *LastBlock) {
+                break;
+            }
+            auto Size = Read((Block - 1) * Result.BlockSize, Outgoing.data() + 4, Result.BlockSize);
+            if (Size < Result.BlockSize) {
+                LastBlock = Block;
+                LastSize = Size;
+            }
+            details::setHeader(Outgoing.data(), packets::types::DataPacket, static_cast<std::uint16_t>(Block));
+            co_await Socket.send(Outgoing.data(), Size + 4, *Peer);
+        }
+
+        while (true) {
+            auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timeout);
+            if (!Received) {
+                if (++Retries > Options.MaxRetries) {
+                    Result.Error = std::make_error_code(std::errc::timed_out);
+                }
+                break;
+            }
+            if (!isSameEndpoint(Received->From, *Peer)) {
+                auto Reply = details::serialize(transfer::makeUnknownTransferIDError());
+                co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+                continue;
+            }
+            auto Type_ = details::getType(Incoming.data(), Received->Size);
+            if (Type_ == packets::types::ErrorPacket) {
+                details::setPeerError(Result, Incoming.data(), Received->Size);
+                break;
+            }
+            if (Type_ != packets::types::AcknowledgmentPacket) {
+                continue;
+            }
+            // Acknowledgments of blocks preceding the window are duplicates, the window isn't resent for them
+            auto Advance = static_cast<std::uint16_t>(details::getBlock(Incoming.data()) -
+                                                      static_cast<std::uint16_t>(Acknowledged));
+            if (Advance == 0 || Advance > Result.WindowSize) {
+                continue;
+            }
+            Acknowledged += Advance;
+            Retries = 0;
+            break;
+        }
+        if (LastBlock && Acknowledged >= *LastBlock) {
+            Result.Bytes = (*LastBlock - 1) * Result.BlockSize + LastSize;
+            break;
+        }
+    }
+    Result.Duration = Executor::Clock::now() - Started;
+    co_return Result;
+}
+
+/// Transfer run by ClientEngine
+struct FileTransfer {
+    /// packets::types::ReadRequest fetches the remote file into the local one, packets::types::WriteRequest uploads
+    /// the local file
+    packets::types::Type Type = packets::types::ReadRequest;
+    std::string RemoteName;
+    std::string LocalPath;
+};
+
+/// Client running many transfers with one server concurrently on an executor
+/// @n Transfers are started in the order they were added, at most MaxConcurrent of them at once, so that the time
+/// to fetch a set of files approaches the time of the slowest one rather than the sum of them. Each transfer has its
+/// own socket and negotiates its options separately. Fetched files are written straight to their destinations,
+/// which are removed if the transfer fails.
+class ClientEngine final {
+  public:
+    /// @param[MaxConcurrent] Assumptions: \p MaxConcurrent is greater than zero
+    ClientEngine(Executor &Owner, const sockaddr_in &Server, std::size_t MaxConcurrent = 8, ClientOptions Options = {})
+        : Owner(Owner), Server(Server), MaxConcurrent(MaxConcurrent), Options(Options) {
+        assert(MaxConcurrent > 0);
+    }
+    ClientEngine(const ClientEngine &) = delete;
+    ClientEngine &operator=(const ClientEngine &) = delete;
+
+    /// Queue the transfer, it's started by ClientEngine::start
+    /// @return Index of the transfer result
+    std::size_t add(FileTransfer Transfer) {
+        Transfers.push_back(std::move(Transfer));
+        Results.emplace_back();
+        return Transfers.size() - 1;
+    }
+
+    /// Start the queued transfers on the executor, they complete within Executor::run
+    void start() {
+        while (Workers < MaxConcurrent && NextTransfer + Workers < Transfers.size()) {
+            ++Workers;
+            Owner.spawn(work());
+        }
+    }
+
+    const TransferResult &getResult(std::size_t Idx) const noexcept { return Results[Idx]; }
+
+    const std::vector<TransferResult> &getResults() const noexcept { return Results; }
+
+    /// @return Number of transfers that haven't completed yet
+    std::size_t getPending() const noexcept { return Transfers.size() - Completed; }
+
+  private:
+    Task<void> work() {
+        while (NextTransfer != Transfers.size()) {
+            auto Idx = NextTransfer++;
+            auto Result = co_await run(Transfers[Idx]);
+            Results[Idx] = std::move(Result);
+            ++Completed;
+        }
+        --Workers;
+    }
+
+    Task<TransferResult> run(FileTransfer Transfer) {
+        sockaddr_in Local{};
+        Local.sin_family = AF_INET;
+        UdpSocket Socket(Owner, Local);
+        TransferResult Result;
+        if (Transfer.Type == packets::types::ReadRequest) {
+            int Fd = ::open(Transfer.LocalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (Fd == -1) {
+                Result.Error = std::error_code(errno, std::generic_category());
+                co_return Result;
+            }
+            Result = co_await readFile(
+                Socket, Server, Transfer.RemoteName,
+                [Fd](std::uint64_t Offset, const std::uint8_t *Buffer, std::size_t Size) {
+                    while (Size != 0) {
+                        auto Written = ::pwrite(Fd, Buffer, Size, static_cast<off_t>(Offset));
+                        if (Written < 0 && errno != EINTR) {
+                            return std::error_code(errno, std::generic_category());
+                        }
+                        Written = std::max<ssize_t>(Written, 0);
+                        Buffer += Written;
+                        Offset += static_cast<std::uint64_t>(Written);
+                        Size -= static_cast<std::size_t>(Written);
+                    }
+                    return std::error_code{};
+                },
+                Options);
+            ::close(Fd);
+            if (Result.Error) {
+                ::unlink(Transfer.LocalPath.c_str());
+            }
+            co_return Result;
+        }
+
+        int Fd = ::open(Transfer.LocalPath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat Status;
+        if (Fd == -1 || ::fstat(Fd, &Status) != 0) {
+            Result.Error = std::error_code(errno, std::generic_category());
+            if (Fd != -1) {
+                ::close(Fd);
+            }
+            co_return Result;
+        }
+        Result = co_await writeFile(
+            Socket, Server, Transfer.RemoteName,
+            [Fd](std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Size) {
+                std::size_t Total = 0;
+                while (Total != Size) {
+                    auto Read = ::pread(Fd, Buffer + Total, Size - Total, static_cast<off_t>(Offset + Total));
+                    if (Read <= 0 && !(Read < 0 && errno == EINTR)) {
+                        break;
+                    }
+                    Total += static_cast<std::size_t>(std::max<ssize_t>(Read, 0));
+                }
+                return Total;
+            },
+            static_cast<std::uint64_t>(Status.st_size), Options);
+        ::close(Fd);
+        co_return Result;
+    }
+
+    Executor &Owner;
+    sockaddr_in Server;
+    std::size_t MaxConcurrent;
+    ClientOptions Options;
+    std::vector<FileTransfer> Transfers;
+    std::vector<TransferResult> Results;
+    std::size_t NextTransfer = 0;
+    std::size_t Workers = 0;
+    std::size_t Completed = 0;
+};
+
+/// Run the transfers with the server, at most \p MaxConcurrent of them at once
+/// @return Results of the transfers in the same order
+inline std::vector<TransferResult> transferFiles(const sockaddr_in &Server, std::vector<FileTransfer> Transfers,
+                                                 std::size_t MaxConcurrent = 8, ClientOptions Options = {}) {
+    Executor Owner;
+    ClientEngine Engine(Owner, Server, MaxConcurrent, Options);
+    for (auto &Transfer : Transfers) {
+        Engine.add(std::move(Transfer));
+    }
+    Engine.start();
+    Owner.run();
+    return Engine.getResults();
+}
+
+} // namespace tftp_common::async
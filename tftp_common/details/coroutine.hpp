@@ -0,0 +1,709 @@
+#pragma once
+
+#if __cplusplus < 202002L || !__has_include(<coroutine>) || !defined(__linux__)
+#error "tftp_common coroutine layer requires C++20 coroutines and Linux (epoll)"
+#endif
+
+#include "file_sink.hpp"
+#include "packets.hpp"
+#include "rto.hpp"
+#include "session_table.hpp"
+#include "timer_wheel.hpp"
+#include <array>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace tftp_common::async {
+
+/// Per-thread pool of coroutine frames
+/// @n Frames are recycled through free lists of 64-byte size classes, so a steady stream of transfers doesn't hit the
+/// global allocator. Frames greater than FramePool::MaxPooledSize are allocated as usual.
+class FramePool final {
+  public:
+    static constexpr std::size_t Granularity = 64;
+    static constexpr std::size_t MaxPooledSize = 4096;
+
+    static void *allocate(std::size_t Size) {
+        auto Class = sizeClass(Size);
+        if (Class >= ClassesCount) {
+            return ::operator new(Size);
+        }
+        auto &Head = instance().FreeLists[Class];
+        if (Head != nullptr) {
+            auto *Frame = Head;
+            Head = Head->Next;
+            return Frame;
+        }
+        ++instance().Allocations;
+        return ::operator new((Class + 1) * Granularity);
+    }
+
+    static void deallocate(void *Frame, std::size_t Size) noexcept {
+        auto Class = sizeClass(Size);
+        if (Class >= ClassesCount) {
+            ::operator delete(Frame);
+            return;
+        }
+        auto &Head = instance().FreeLists[Class];
+        Head = new (Frame) FreeFrame{Head};
+    }
+
+    /// @return Number of frames that were allocated by the global allocator on this thread
+    static std::size_t getAllocations() noexcept { return instance().Allocations; }
+
+  private:
+    static constexpr std::size_t ClassesCount = MaxPooledSize / Granularity;
+
+    struct FreeFrame {
+        FreeFrame *Next;
+    };
+
+    FramePool() = default;
+    ~FramePool() {
+        for (auto *Head : FreeLists) {
+            while (Head != nullptr) {
+                auto *Next = Head->Next;
+                ::operator delete(Head);
+                Head = Next;
+            }
+        }
+    }
+
+    static FramePool &instance() noexcept {
+        thread_local FramePool Pool;
+        return Pool;
+    }
+
+    static std::size_t sizeClass(std::size_t Size) noexcept { return (Size + Granularity - 1) / Granularity - 1; }
+
+    std::array<FreeFrame *, ClassesCount> FreeLists{};
+    std::size_t Allocations = 0;
+};
+
+/// Base of promise types whose coroutine frames come from FramePool
+struct PooledPromise {
+    static void *operator new(std::size_t Size) { return FramePool::allocate(Size); }
+    static void operator delete(void *Frame, std::size_t Size) noexcept { FramePool::deallocate(Frame, Size); }
+};
+
+template <typename T> class Task;
+
+namespace details {
+
+template <typename T> struct TaskPromiseBase : PooledPromise {
+    std::coroutine_handle<> Continuation = std::noop_coroutine();
+    std::exception_ptr Exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /// Resume the awaiting coroutine (symmetric transfer, so chains of tasks don't grow the stack)
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> Handle) noexcept {
+            return Handle.promise().Continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept { Exception = std::current_exception(); }
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase<T> {
+    std::optional<T> Value;
+
+    Task<T> get_return_object() noexcept;
+
+    template <typename U> void return_value(U &&Result) { Value.emplace(std::forward<U>(Result)); }
+
+    T result() {
+        if (this->Exception) {
+            std::rethrow_exception(this->Exception);
+        }
+        return std::move(*Value);
+    }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase<void> {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        if (this->Exception) {
+            std::rethrow_exception(this->Exception);
+        }
+    }
+};
+
+} // namespace details
+
+/// Lazily started coroutine producing a value of type \p T
+/// @n The task starts when it's awaited (or spawned by Executor::spawn) and resumes the awaiting coroutine when done
+template <typename T = void> class [[nodiscard]] Task final {
+  public:
+    using promise_type = details::TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> Handle) noexcept : Handle(Handle) {}
+    Task(Task &&Other) noexcept : Handle(std::exchange(Other.Handle, nullptr)) {}
+    Task &operator=(Task &&Other) noexcept {
+        if (this != &Other) {
+            if (Handle) {
+                Handle.destroy();
+            }
+            Handle = std::exchange(Other.Handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (Handle) {
+            Handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> Awaiting) noexcept {
+        Handle.promise().Continuation = Awaiting;
+        return Handle;
+    }
+
+    T await_resume() { return Handle.promise().result(); }
+
+  private:
+    std::coroutine_handle<promise_type> Handle;
+};
+
+namespace details {
+
+template <typename T> Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+} // namespace details
+
+/// Single-threaded executor: runs coroutines, waits for socket readiness with epoll and for timeouts with TimerWheel
+class Executor final {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    Executor() : Descriptor(::epoll_create1(EPOLL_CLOEXEC)), Timers(std::chrono::milliseconds(1)) {
+        if (Descriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        }
+    }
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+    ~Executor() { ::close(Descriptor); }
+
+    /// Start the task, it's owned by the executor until it completes
+    /// @n Exceptions escaping spawned tasks terminate the program
+    void spawn(Task<void> Spawned) {
+        ++Running;
+        [](Executor &Owner, Task<void> Body) -> Detached {
+            co_await Body;
+            --Owner.Running;
+        }(*this, std::move(Spawned));
+    }
+
+    /// Run until all spawned tasks complete
+    void run() {
+        std::array<epoll_event, 64> Events;
+        while (Running != 0) {
+            int Timeout = Interrupted.empty() ? -1 : 0;
+            if (Timeout != 0 && !Timers.empty()) {
+                auto Delay = std::chrono::ceil<std::chrono::milliseconds>(Timers.getNextTick() - Clock::now());
+                Timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(Delay.count(), 0));
+            }
+            auto Count = ::epoll_wait(Descriptor, Events.data(), static_cast<int>(Events.size()), Timeout);
+            if (Count < 0 && errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            for (int Idx = 0; Idx < Count; ++Idx) {
+                // Resumed coroutines may close sockets, so the registration is looked up before every wake up
+                auto Fd = Events[Idx].data.fd;
+                auto Ready = Registrations.find(Fd);
+                if (Ready == Registrations.end()) {
+                    continue;
+                }
+                if (Events[Idx].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    Ready->second.Readable = true;
+                    if (Ready->second.Reader) {
+                        wake(Ready->second.Reader);
+                        Ready = Registrations.find(Fd);
+                    }
+                }
+                if (Ready != Registrations.end() && (Events[Idx].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+                    Ready->second.Writer) {
+                    wake(Ready->second.Writer);
+                }
+            }
+            Timers.advance(Clock::now(), [](transfer::TimerNode &Node) {
+                auto &Expired = static_cast<Waiter &>(Node);
+                (Expired.Writing ? Expired.Source->Writer : Expired.Source->Reader) = nullptr;
+                Expired.Handle.resume();
+            });
+            while (!Interrupted.empty()) {
+                auto Resumed = Interrupted.front();
+                Interrupted.pop_front();
+                Resumed.resume();
+            }
+        }
+    }
+
+    struct Waiter;
+
+    /// Descriptor registered with the executor
+    struct Registration {
+        int Descriptor = -1;
+        Waiter *Reader = nullptr;
+        Waiter *Writer = nullptr;
+        /// Readiness is edge-triggered: set when epoll reports the descriptor readable, cleared once it's drained
+        bool Readable = true;
+    };
+
+    /// Suspended coroutine waiting for the descriptor to become ready
+    struct Waiter : transfer::TimerNode {
+        std::coroutine_handle<> Handle;
+        /// Operation retried once the descriptor is ready, false means it would still block
+        bool (*Attempt)(Waiter &) = nullptr;
+        Registration *Source = nullptr;
+        bool Writing = false;
+    };
+
+    /// Register the descriptor with epoll (edge-triggered, both directions)
+    /// @return Registration that stays valid until the descriptor is detached
+    Registration &attach(int Fd) {
+        auto &Added = Registrations[Fd];
+        Added.Descriptor = Fd;
+        epoll_event Event{};
+        Event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        Event.data.fd = Fd;
+        if (::epoll_ctl(Descriptor, EPOLL_CTL_ADD, Fd, &Event) != 0) {
+            Registrations.erase(Fd);
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+        return Added;
+    }
+
+    void detach(int Fd) noexcept {
+        ::epoll_ctl(Descriptor, EPOLL_CTL_DEL, Fd, nullptr);
+        Registrations.erase(Fd);
+    }
+
+    /// Suspend the coroutine until the descriptor is ready or the timeout expires
+    void wait(Waiter &Suspended, std::optional<Clock::duration> Timeout) {
+        (Suspended.Writing ? Suspended.Source->Writer : Suspended.Source->Reader) = &Suspended;
+        if (Timeout) {
+            Timers.arm(Suspended, Clock::now() + *Timeout);
+        }
+    }
+
+    /// Resume the coroutine waiting for the descriptor to become readable as if its timeout has expired, does nothing
+    /// if there's none
+    /// @n The coroutine is resumed by Executor::run later, so coroutines may interrupt each other
+    void interrupt(Registration &Source) {
+        if (!Source.Reader) {
+            return;
+        }
+        Timers.cancel(*Source.Reader);
+        Interrupted.push_back(Source.Reader->Handle);
+        Source.Reader = nullptr;
+    }
+
+  private:
+    /// Fire-and-forget coroutine wrapping spawned tasks
+    struct Detached {
+        struct promise_type : PooledPromise {
+            Detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    /// Complete the operation of the waiter and resume its coroutine
+    /// @n The waiter stays registered if the operation would block again (e.g. the readiness was spurious)
+    void wake(Waiter *&Slot) {
+        auto &Ready = *Slot;
+        if (!Ready.Attempt(Ready)) {
+            return;
+        }
+        Slot = nullptr;
+        Timers.cancel(Ready);
+        Ready.Handle.resume();
+    }
+
+    int Descriptor;
+    transfer::TimerWheel Timers;
+    std::unordered_map<int, Registration> Registrations;
+    /// Coroutines whose reception has been interrupted, in the order of the interruptions
+    std::deque<std::coroutine_handle<>> Interrupted;
+    std::size_t Running = 0;
+};
+
+/// Received datagram
+struct Datagram {
+    std::size_t Size;
+    sockaddr_in From;
+};
+
+/// Non-blocking UDP (IPv4) socket driven by Executor
+class UdpSocket final {
+  public:
+    /// Create the socket bound to the given local address (port zero picks any free port)
+    UdpSocket(Executor &Owner, const sockaddr_in &Local) : Owner(Owner) {
+        Descriptor = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (Descriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "socket");
+        }
+        if (::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Local), sizeof(Local)) != 0) {
+            auto Error = errno;
+            ::close(Descriptor);
+            throw std::system_error(Error, std::generic_category(), "bind");
+        }
+        Source = &Owner.attach(Descriptor);
+    }
+    UdpSocket(const UdpSocket &) = delete;
+    UdpSocket &operator=(const UdpSocket &) = delete;
+    ~UdpSocket() {
+        Owner.detach(Descriptor);
+        ::close(Descriptor);
+    }
+
+    int getDescriptor() const noexcept { return Descriptor; }
+
+    sockaddr_in getLocalAddress() const noexcept {
+        sockaddr_in Local{};
+        socklen_t Length = sizeof(Local);
+        ::getsockname(Descriptor, reinterpret_cast<sockaddr *>(&Local), &Length);
+        return Local;
+    }
+
+    /// Awaitable reception of a datagram
+    /// @n Resumes with std::nullopt if the timeout expires first
+    struct ReceiveAwaiter : Executor::Waiter {
+        ReceiveAwaiter(UdpSocket &Socket, std::uint8_t *Buffer, std::size_t Capacity,
+                       std::optional<Executor::Clock::duration> Timeout)
+            : Socket(Socket), Buffer(Buffer), Capacity(Capacity), Timeout(Timeout) {
+            this->Source = Socket.Source;
+            this->Attempt = [](Executor::Waiter &Self) { return static_cast<ReceiveAwaiter &>(Self).tryReceive(); };
+        }
+
+        /// The datagram is received right away unless the socket is known to be drained
+        bool await_ready() { return Source->Readable && tryReceive(); }
+
+        bool await_suspend(std::coroutine_handle<> Awaiting) {
+            Handle = Awaiting;
+            Socket.Owner.wait(*this, Timeout);
+            return true;
+        }
+
+        std::optional<Datagram> await_resume() noexcept { return Result; }
+
+        bool tryReceive() {
+            sockaddr_in From{};
+            socklen_t Length = sizeof(From);
+            auto Size =
+                ::recvfrom(Socket.Descriptor, Buffer, Capacity, 0, reinterpret_cast<sockaddr *>(&From), &Length);
+            if (Size < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    throw std::system_error(errno, std::generic_category(), "recvfrom");
+                }
+                Source->Readable = errno == EINTR;
+                return false;
+            }
+            Result = Datagram{static_cast<std::size_t>(Size), From};
+            return true;
+        }
+
+        UdpSocket &Socket;
+        std::uint8_t *Buffer;
+        std::size_t Capacity;
+        std::optional<Executor::Clock::duration> Timeout;
+        std::optional<Datagram> Result;
+    };
+
+    /// Awaitable transmission of a datagram, suspends only if the socket send buffer is full
+    struct SendAwaiter : Executor::Waiter {
+        SendAwaiter(UdpSocket &Socket, const std::uint8_t *Buffer, std::size_t Size, const sockaddr_in &To)
+            : Socket(Socket), Buffer(Buffer), Size(Size), To(To) {
+            this->Source = Socket.Source;
+            this->Attempt = [](Executor::Waiter &Self) { return static_cast<SendAwaiter &>(Self).trySend(); };
+            this->Writing = true;
+        }
+
+        bool await_ready() { return trySend(); }
+
+        bool await_suspend(std::coroutine_handle<> Awaiting) {
+            Handle = Awaiting;
+            Socket.Owner.wait(*this, std::nullopt);
+            return true;
+        }
+
+        void await_resume() noexcept {}
+
+        bool trySend() {
+            auto Result = ::sendto(Socket.Descriptor, Buffer, Size, 0, reinterpret_cast<const sockaddr *>(&To),
+                                   sizeof(To));
+            if (Result < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ENOBUFS) {
+                    throw std::system_error(errno, std::generic_category(), "sendto");
+                }
+                return false;
+            }
+            return true;
+        }
+
+        UdpSocket &Socket;
+        const std::uint8_t *Buffer;
+        std::size_t Size;
+        sockaddr_in To;
+    };
+
+    /// Receive a datagram, waiting at most \p Timeout (forever if std::nullopt)
+    ReceiveAwaiter receive(std::uint8_t *Buffer, std::size_t Capacity,
+                           std::optional<Executor::Clock::duration> Timeout = std::nullopt) {
+        return ReceiveAwaiter{*this, Buffer, Capacity, Timeout};
+    }
+
+    SendAwaiter send(const std::uint8_t *Buffer, std::size_t Size, const sockaddr_in &To) {
+        return SendAwaiter{*this, Buffer, Size, To};
+    }
+
+    /// Make the pending reception resume with std::nullopt right away, e.g. once the event it waits for has happened
+    void interrupt() { Owner.interrupt(*Source); }
+
+  private:
+    Executor &Owner;
+    int Descriptor;
+    Executor::Registration *Source;
+};
+
+inline bool isSameEndpoint(const sockaddr_in &Lhs, const sockaddr_in &Rhs) noexcept {
+    return Lhs.sin_addr.s_addr == Rhs.sin_addr.s_addr && Lhs.sin_port == Rhs.sin_port;
+}
+
+/// Parameters of a single transfer
+struct TransferOptions {
+    /// Negotiated block size (RFC 2348)
+    std::size_t BlockSize = 512;
+    /// Number of retransmissions before the transfer is abandoned
+    unsigned MaxRetries = 5;
+    /// Retransmission timeout state of a previous transfer to the same client
+    std::optional<transfer::RetransmissionTimer::Estimate> Seed;
+    /// Negotiated timeout interval (RFC 2349), the ceiling of the adaptive retransmission timeout
+    std::optional<std::chrono::seconds> Timeout;
+    /// Options acknowledged to the client (RFC 2347), if there are any the transfer opens with the option
+    /// acknowledgment instead of the first Data packet (read requests) or the acknowledgment of block 0 (write
+    /// requests)
+    std::unordered_map<std::string, std::string> Acknowledged;
+};
+
+namespace details {
+
+template <class Packet> std::vector<std::uint8_t> serialize(const Packet &Value) {
+    std::vector<std::uint8_t> Buffer;
+    Value.serialize(std::back_inserter(Buffer));
+    return Buffer;
+}
+
+/// @return Opcode of the received packet or zero if it's too short
+inline std::uint16_t getType(const std::uint8_t *Buffer, std::size_t Size) noexcept {
+    return Size < 4 ? 0 : static_cast<std::uint16_t>(Buffer[0] << 8 | Buffer[1]);
+}
+
+/// @return Block number of the received Data or Acknowledgment packet
+inline std::uint16_t getBlock(const std::uint8_t *Buffer) noexcept {
+    return static_cast<std::uint16_t>(Buffer[2] << 8 | Buffer[3]);
+}
+
+inline void setHeader(std::uint8_t *Buffer, std::uint16_t Type_, std::uint16_t Block) noexcept {
+    Buffer[0] = static_cast<std::uint8_t>(Type_ >> 8);
+    Buffer[1] = static_cast<std::uint8_t>(Type_);
+    Buffer[2] = static_cast<std::uint8_t>(Block >> 8);
+    Buffer[3] = static_cast<std::uint8_t>(Block);
+}
+
+inline transfer::RetransmissionTimer makeTimer(const TransferOptions &Options) {
+    transfer::RetransmissionTimer Timer;
+    if (Options.Seed) {
+        Timer.seed(*Options.Seed);
+    }
+    if (Options.Timeout) {
+        Timer.setCeiling(*Options.Timeout);
+    }
+    return Timer;
+}
+
+/// Send the packet until the client acknowledges the block
+/// @n Only the first transmission is timed, acknowledgments of retransmitted packets are ambiguous and aren't sampled
+/// (Karn's algorithm)
+/// @param[Incoming] Assumptions: \p Incoming is large enough for the packets of the client
+/// @return Error if the client has reported an error or stopped responding
+inline Task<std::error_code> sendUntilAcknowledged(UdpSocket &Socket, sockaddr_in Client, const std::uint8_t *Packet,
+                                                   std::size_t Size, std::uint16_t Block,
+                                                   transfer::RetransmissionTimer &Timer,
+                                                   std::vector<std::uint8_t> &Incoming, unsigned MaxRetries) {
+    co_await Socket.send(Packet, Size, Client);
+    Timer.onTransmit(Block, Executor::Clock::now());
+    unsigned Retries = 0;
+    while (true) {
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timer.getTimeout());
+        if (!Received) {
+            Timer.onTimeout();
+            Timer.onRetransmit(Block);
+            if (++Retries > MaxRetries) {
+                co_return std::make_error_code(std::errc::timed_out);
+            }
+            co_await Socket.send(Packet, Size, Client);
+            continue;
+        }
+        if (!isSameEndpoint(Received->From, Client)) {
+            auto Reply = serialize(transfer::makeUnknownTransferIDError());
+            co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+            continue;
+        }
+        auto Type_ = getType(Incoming.data(), Received->Size);
+        if (Type_ == packets::types::ErrorPacket) {
+            co_return std::make_error_code(std::errc::connection_aborted);
+        }
+        if (Type_ == packets::types::AcknowledgmentPacket && getBlock(Incoming.data()) == Block) {
+            Timer.onAcknowledgment(Block, Executor::Clock::now());
+            co_return std::error_code{};
+        }
+        // Duplicate acknowledgment of the previous block, keep waiting (Sorcerer's Apprentice Syndrome)
+    }
+}
+
+} // namespace details
+
+/// Serve a read request (RRQ): send the file to the client block by block
+/// @param[Socket] Socket of the transfer, its port is the server transfer identifier
+/// @param[Read] Requirements: \p Read must be callable as `std::size_t(std::uint64_t Offset, std::uint8_t *Buffer,
+/// std::size_t Size)` and return the number of bytes read, less than \p Size only at the end of the file
+/// @return Error if the client has reported an error or stopped responding
+template <class Reader>
+Task<std::error_code> serveRead(UdpSocket &Socket, sockaddr_in Client, Reader Read, TransferOptions Options = {}) {
+    auto Timer = details::makeTimer(Options);
+    std::vector<std::uint8_t> Incoming(Options.BlockSize + 4);
+    if (!Options.Acknowledged.empty()) {
+        auto Reply = details::serialize(packets::OptionAcknowledgment(Options.Acknowledged));
+        auto Error = co_await details::sendUntilAcknowledged(Socket, Client, Reply.data(), Reply.size(), 0, Timer,
+                                                             Incoming, Options.MaxRetries);
+        if (Error) {
+            co_return Error;
+        }
+    }
+    // The Data packet is built in place, so that the block is read straight into the datagram
+    std::vector<std::uint8_t> Outgoing(Options.BlockSize + 4);
+    std::uint64_t Offset = 0;
+    for (std::uint16_t Block = 1;; ++Block) {
+        auto Size = Read(Offset, Outgoing.data() + 4, Options.BlockSize);
+        details::setHeader(Outgoing.data(), packets::types::DataPacket, Block);
+
+        auto Error = co_await details::sendUntilAcknowledged(Socket, Client, Outgoing.data(), Size + 4, Block, Timer,
+                                                             Incoming, Options.MaxRetries);
+        if (Error) {
+            co_return Error;
+        }
+
+        Offset += Size;
+        if (Size < Options.BlockSize) {
+            co_return std::error_code{};
+        }
+    }
+}
+
+/// Serve a write request (WRQ): receive the file from the client block by block
+/// @param[Write] Requirements: \p Write must be callable as `std::error_code(std::uint16_t Block, const std::uint8_t
+/// *Buffer, std::size_t Size)`, it's called once for each block in order
+/// @return Error if the client has reported an error, stopped responding or \p Write has failed
+template <class Writer>
+Task<std::error_code> serveWrite(UdpSocket &Socket, sockaddr_in Client, Writer Write, TransferOptions Options = {}) {
+    auto Timer = details::makeTimer(Options);
+    std::vector<std::uint8_t> Incoming(Options.BlockSize + 4);
+    std::uint16_t Expected = 1;
+    unsigned Retries = 0;
+    // The opening reply is retransmitted until the first Data packet arrives, then it's replaced by acknowledgments
+    auto Outgoing = Options.Acknowledged.empty()
+                        ? details::serialize(packets::Acknowledgment{0})
+                        : details::serialize(packets::OptionAcknowledgment(Options.Acknowledged));
+    co_await Socket.send(Outgoing.data(), Outgoing.size(), Client);
+    // The round trip from the acknowledgment to the next Data packet is timed by the number of the expected block
+    Timer.onTransmit(Expected, Executor::Clock::now());
+    while (true) {
+        auto Received = co_await Socket.receive(Incoming.data(), Incoming.size(), Timer.getTimeout());
+        if (!Received) {
+            Timer.onTimeout();
+            Timer.onRetransmit(Expected);
+            if (++Retries > Options.MaxRetries) {
+                co_return std::make_error_code(std::errc::timed_out);
+            }
+            co_await Socket.send(Outgoing.data(), Outgoing.size(), Client);
+            continue;
+        }
+        if (!isSameEndpoint(Received->From, Client)) {
+            auto Reply = details::serialize(transfer::makeUnknownTransferIDError());
+            co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+            continue;
+        }
+        auto Type_ = details::getType(Incoming.data(), Received->Size);
+        if (Type_ == packets::types::ErrorPacket) {
+            co_return std::make_error_code(std::errc::connection_aborted);
+        }
+        if (Type_ != packets::types::DataPacket) {
+            continue;
+        }
+        auto Block = details::getBlock(Incoming.data());
+        auto Size = Received->Size - 4;
+        auto Progressed = Block == Expected;
+        if (Progressed) {
+            Timer.onAcknowledgment(Block, Executor::Clock::now());
+            Retries = 0;
+            if (auto Error = Write(Block, Incoming.data() + 4, Size)) {
+                auto Reply = details::serialize(transfer::makeFileError(Error));
+                co_await Socket.send(Reply.data(), Reply.size(), Client);
+                co_return Error;
+            }
+            Outgoing.resize(4);
+            details::setHeader(Outgoing.data(), packets::types::AcknowledgmentPacket, Block);
+            ++Expected;
+        }
+        // Duplicates of the previous block are acknowledged once again, the acknowledgment was probably lost
+        co_await Socket.send(Outgoing.data(), Outgoing.size(), Client);
+        if (Block == static_cast<std::uint16_t>(Expected - 1) && Size < Options.BlockSize) {
+            co_return std::error_code{};
+        }
+        if (Progressed) {
+            Timer.onTransmit(Expected, Executor::Clock::now());
+        }
+    }
+}
+
+} // namespace tftp_common::async
@@ -0,0 +1,391 @@
+#pragma once
+
+#include "packets.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace tftp_common::transfer {
+
+/// @return Error packet describing the file system error to the client
+inline packets::Error makeFileError(std::error_code Error) {
+    if (Error.category() == std::generic_category() || Error.category() == std::system_category()) {
+        switch (Error.value()) {
+        case ENOSPC:
+#ifdef EDQUOT
+        case EDQUOT:
+#endif
+            return packets::Error{packets::errors::DiskFull, std::string_view("Disk full or allocation exceeded")};
+        case EACCES:
+        case EPERM:
+        case EROFS:
+            return packets::Error{packets::errors::AccessViolation, std::string_view("Access violation")};
+        case ENOENT:
+            return packets::Error{packets::errors::FileNotFound, std::string_view("File not found")};
+        case EEXIST:
+            return packets::Error{packets::errors::FileAlreadyExists, std::string_view("File already exists")};
+        default:
+            break;
+        }
+    }
+    return packets::Error{packets::errors::NotDefined, Error.message()};
+}
+
+/// Destination of a write request (WRQ) transfer
+/// @n Incoming Data blocks are collected into large aligned buffers which are written out by a background thread
+/// with `pwritev`, several consecutive buffers at once. Blocks may arrive out of order as long as they fit into the
+/// buffered range, e.g. within a window (RFC 7440). The file is synchronized with the storage only once, by
+/// FileBlockSink::finish. With \p DirectIO the file is opened with `O_DIRECT` (where it's supported), bypassing the
+/// page cache.
+class FileBlockSink final {
+  public:
+    /// @param[BlockSize] Assumptions: \p BlockSize is the negotiated block size (RFC 2348), it is greater than zero
+    /// @param[BufferSize] Assumptions: \p BufferSize is a multiple of 4096
+    /// @param[BuffersCount] Assumptions: \p BuffersCount is greater than one, it bounds the memory used by the sink
+    explicit FileBlockSink(std::size_t BlockSize = 512, std::size_t BufferSize = std::size_t(1) << 20,
+                           std::size_t BuffersCount = 4, bool DirectIO = false)
+        : BlockSize(BlockSize), BufferSize(BufferSize), BuffersCount(BuffersCount), DirectIO(DirectIO) {
+        assert(BlockSize > 0);
+        assert(BufferSize > 0 && BufferSize % Alignment == 0);
+        assert(BuffersCount > 1);
+    }
+    FileBlockSink(const FileBlockSink &) = delete;
+    FileBlockSink &operator=(const FileBlockSink &) = delete;
+    /// Stops the background writer and closes the file, buffered blocks that weren't flushed are lost
+    ~FileBlockSink() {
+        stopWriter();
+        for (auto &[Index, Pending] : Active) {
+            std::free(Pending.Data);
+        }
+        for (auto *Buffer : Free) {
+            std::free(Buffer);
+        }
+        if (Descriptor != -1) {
+            ::close(Descriptor);
+        }
+    }
+
+    /// Open (create) the destination file and start the background writer
+    std::error_code open(const std::string &Path, int Flags = O_WRONLY | O_CREAT | O_TRUNC, mode_t Mode = 0644) {
+        assert(Descriptor == -1);
+#ifdef O_DIRECT
+        if (DirectIO) {
+            Descriptor = ::open(Path.c_str(), Flags | O_DIRECT | O_CLOEXEC, Mode);
+            // Some file systems (e.g. tmpfs) don't support direct I/O
+            if (Descriptor == -1 && errno != EINVAL) {
+                return std::error_code(errno, std::generic_category());
+            }
+        }
+#endif
+        if (Descriptor == -1) {
+            Descriptor = ::open(Path.c_str(), Flags | O_CLOEXEC, Mode);
+            if (Descriptor == -1) {
+                return std::error_code(errno, std::generic_category());
+            }
+        }
+        Writer = std::thread([this] { writerLoop(); });
+        return {};
+    }
+
+    /// Accept a Data block
+    /// @n Duplicates (retransmissions) are ignored, blocks too far ahead of the first missing block are rejected
+    /// @return Error of the background writer if it has failed or std::errc::result_out_of_range if the block can't
+    /// be buffered yet
+    std::error_code write(std::uint16_t Block, const std::uint8_t *Buffer, std::size_t Size) {
+        assert(Descriptor != -1);
+        assert(Size <= BlockSize);
+        if (auto Error = getWriterError()) {
+            return Error;
+        }
+
+        // Block numbers wrap around in long transfers, resolve them relatively to the first missing block
+        auto Distance = static_cast<std::int16_t>(static_cast<std::uint16_t>(Block - std::uint16_t(NextExpected)));
+        auto Absolute = NextExpected + static_cast<std::uint64_t>(Distance);
+        if (Distance < 0 || (LastBlock && Absolute > *LastBlock)) {
+            return {};
+        }
+        auto Offset = (Absolute - 1) * BlockSize;
+        auto LastByte = Offset + (Size != 0 ? Size - 1 : 0);
+        if (LastByte / BufferSize >= FirstBuffer + BuffersCount) {
+            return std::make_error_code(std::errc::result_out_of_range);
+        }
+        auto Slot = static_cast<std::size_t>(Absolute - NextExpected);
+        if (Received.size() <= Slot) {
+            Received.resize(Slot + 1, false);
+        }
+        if (Received[Slot]) {
+            return {};
+        }
+        if (Size < BlockSize) {
+            if (LastBlock && *LastBlock != Absolute) {
+                return std::make_error_code(std::errc::invalid_argument);
+            }
+            LastBlock = Absolute;
+        }
+        Received[Slot] = true;
+        EndOfData = std::max<std::uint64_t>(EndOfData, Offset + Size);
+
+        // The block may straddle two buffers
+        for (std::size_t Copied = 0; Copied != Size;) {
+            auto Position = Offset + Copied;
+            auto &Target = buffer(Position / BufferSize);
+            auto InBuffer = static_cast<std::size_t>(Position % BufferSize);
+            auto Chunk = std::min(Size - Copied, BufferSize - InBuffer);
+            std::memcpy(Target.Data + InBuffer, Buffer + Copied, Chunk);
+            Target.Filled += Chunk;
+            Copied += Chunk;
+        }
+
+        while (!Received.empty() && Received.front()) {
+            Received.pop_front();
+            ++NextExpected;
+        }
+        submitCompleted();
+        return {};
+    }
+
+    std::error_code write(const packets::Data &Packet) {
+        return write(Packet.getBlock(), Packet.getData().data(), Packet.getData().size());
+    }
+
+    /// @return Number of the last block received consecutively, i.e. the block to be acknowledged
+    std::uint16_t getLastConsecutive() const noexcept { return static_cast<std::uint16_t>(NextExpected - 1); }
+
+    /// @return true if the final (short) block and all blocks before it have been received
+    bool isComplete() const noexcept { return LastBlock && NextExpected > *LastBlock; }
+
+    /// Write out everything that is buffered, wait for the background writer and synchronize the file
+    /// @param[Sync] Whether the file has to be synchronized with the storage device (`fdatasync`)
+    std::error_code finish(bool Sync = true) {
+        assert(Descriptor != -1);
+        {
+            std::unique_lock Lock(Mutex);
+            for (auto &[Index, Pending] : Active) {
+                Queue.push_back(Pending);
+            }
+            Active.clear();
+            Condition.notify_all();
+            Condition.wait(Lock, [this] { return Queue.empty() && !Busy; });
+        }
+        if (auto Error = getWriterError()) {
+            return Error;
+        }
+        // Partially filled buffers are padded up to the alignment, cut the padding off
+        if (::ftruncate(Descriptor, static_cast<off_t>(EndOfData)) != 0) {
+            return std::error_code(errno, std::generic_category());
+        }
+#if defined(__linux__)
+        if (Sync && ::fdatasync(Descriptor) != 0) {
+#else
+        if (Sync && ::fsync(Descriptor) != 0) {
+#endif
+            return std::error_code(errno, std::generic_category());
+        }
+        return {};
+    }
+
+  private:
+    static constexpr std::size_t Alignment = 4096;
+
+    struct Buffer {
+        std::uint64_t Index = 0;
+        std::uint8_t *Data = nullptr;
+        std::size_t Filled = 0;
+    };
+
+    Buffer &buffer(std::uint64_t Index) {
+        auto It = Active.find(Index);
+        if (It != Active.end()) {
+            return It->second;
+        }
+        Buffer Created;
+        Created.Index = Index;
+        Created.Data = acquire();
+        return Active.emplace(Index, Created).first->second;
+    }
+
+    /// Take a free buffer, waiting for the background writer if all of them are in use
+    std::uint8_t *acquire() {
+        std::unique_lock Lock(Mutex);
+        Condition.wait(Lock, [this] { return !Free.empty() || Allocated < BuffersCount + 1; });
+        if (!Free.empty()) {
+            auto *Data = Free.back();
+            Free.pop_back();
+            return Data;
+        }
+        ++Allocated;
+        void *Data = nullptr;
+        if (::posix_memalign(&Data, Alignment, BufferSize) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<std::uint8_t *>(Data);
+    }
+
+    /// Hand buffers that have been filled completely over to the background writer
+    void submitCompleted() {
+        std::vector<Buffer> Completed;
+        for (auto It = Active.begin(); It != Active.end();) {
+            if (It->second.Filled == BufferSize) {
+                Completed.push_back(It->second);
+                It = Active.erase(It);
+            } else {
+                ++It;
+            }
+        }
+        FirstBuffer = (NextExpected - 1) * BlockSize / BufferSize;
+        if (Completed.empty()) {
+            return;
+        }
+        std::lock_guard Lock(Mutex);
+        Queue.insert(Queue.end(), Completed.begin(), Completed.end());
+        Condition.notify_all();
+    }
+
+    void writerLoop() {
+        std::unique_lock Lock(Mutex);
+        while (true) {
+            Condition.wait(Lock, [this] { return Stopping || !Queue.empty(); });
+            if (Queue.empty()) {
+                return;
+            }
+            std::vector<Buffer> Batch(Queue.begin(), Queue.end());
+            Queue.clear();
+            Busy = true;
+            Lock.unlock();
+
+            std::sort(Batch.begin(), Batch.end(),
+                      [](const Buffer &Lhs, const Buffer &Rhs) { return Lhs.Index < Rhs.Index; });
+            std::error_code Error;
+            for (std::size_t First = 0; First != Batch.size() && !Error;) {
+                // Consecutive buffers go out in a single system call
+                auto Last = First + 1;
+                while (Last != Batch.size() && Last - First < MaxBatch &&
+                       Batch[Last].Index == Batch[Last - 1].Index + 1) {
+                    ++Last;
+                }
+                Error = writeOut(Batch.data() + First, Last - First);
+                First = Last;
+            }
+
+            Lock.lock();
+            for (auto &Written : Batch) {
+                Free.push_back(Written.Data);
+            }
+            if (Error && !WriterError) {
+                WriterError = Error;
+            }
+            Busy = false;
+            Condition.notify_all();
+        }
+    }
+
+    std::error_code writeOut(const Buffer *Buffers, std::size_t Count) {
+        std::vector<iovec> Vectors(Count);
+        std::size_t Total = 0;
+        for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+            // The last buffer of the file may be filled partially; direct I/O needs the length to stay aligned
+            auto Length = Buffers[Idx].Filled == BufferSize ? BufferSize : usedLength(Buffers[Idx]);
+            Vectors[Idx] = iovec{Buffers[Idx].Data, Length};
+            Total += Length;
+        }
+        auto Offset = static_cast<off_t>(Buffers[0].Index * BufferSize);
+        std::size_t Written = 0;
+        auto *Vector = Vectors.data();
+        auto Remaining = static_cast<int>(Count);
+        while (Written != Total) {
+            auto Result = ::pwritev(Descriptor, Vector, Remaining, Offset + static_cast<off_t>(Written));
+            if (Result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return std::error_code(errno, std::generic_category());
+            }
+            Written += static_cast<std::size_t>(Result);
+            // Skip the vectors that were written completely and adjust the partially written one
+            auto Advance = static_cast<std::size_t>(Result);
+            while (Remaining != 0 && Advance >= Vector->iov_len) {
+                Advance -= Vector->iov_len;
+                ++Vector;
+                --Remaining;
+            }
+            if (Remaining != 0) {
+                Vector->iov_base = static_cast<std::uint8_t *>(Vector->iov_base) + Advance;
+                Vector->iov_len -= Advance;
+            }
+        }
+        return {};
+    }
+
+    /// @return Number of bytes of the partially filled buffer to be written, rounded up to the alignment
+    std::size_t usedLength(const Buffer &Partial) const noexcept {
+        auto Begin = Partial.Index * BufferSize;
+        auto End = std::min<std::uint64_t>(EndOfData, Begin + BufferSize);
+        auto Length = static_cast<std::size_t>(End > Begin ? End - Begin : 0);
+        return (Length + Alignment - 1) / Alignment * Alignment;
+    }
+
+    std::error_code getWriterError() {
+        std::lock_guard Lock(Mutex);
+        return WriterError;
+    }
+
+    void stopWriter() {
+        if (!Writer.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard Lock(Mutex);
+            Stopping = true;
+            Condition.notify_all();
+        }
+        Writer.join();
+    }
+
+    /// Greatest number of buffers written out by a single system call
+    static constexpr std::size_t MaxBatch = 64;
+
+    std::size_t BlockSize;
+    std::size_t BufferSize;
+    std::size_t BuffersCount;
+    bool DirectIO;
+    int Descriptor = -1;
+
+    // State of the receiving side
+    std::uint64_t NextExpected = 1;
+    std::optional<std::uint64_t> LastBlock;
+    std::uint64_t EndOfData = 0;
+    std::deque<bool> Received;
+    std::map<std::uint64_t, Buffer> Active;
+    std::uint64_t FirstBuffer = 0;
+
+    // State shared with the background writer
+    std::mutex Mutex;
+    std::condition_variable Condition;
+    std::deque<Buffer> Queue;
+    std::vector<std::uint8_t *> Free;
+    std::size_t Allocated = 0;
+    bool Busy = false;
+    bool Stopping = false;
+    std::error_code WriterError;
+    std::thread Writer;
+};
+
+} // namespace tftp_common::transfer
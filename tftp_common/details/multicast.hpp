@@ -0,0 +1,238 @@
+#pragma once
+
+#include "options.hpp"
+#include "packets.hpp"
+#include "session_table.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tftp_common::transfer {
+
+/// Server side of the multicast transfer of a single file (RFC 2090)
+/// @n Data blocks are multicast to the group, only the master client acknowledges them. Once the master client
+/// has the whole file, the next client in line is promoted, it acknowledges the last block it has received
+/// consecutively, so the blocks it has missed are multicast once again. The sender doesn't perform any I/O, it
+/// tells which blocks have to be multicast and which option acknowledgments have to be unicast to the clients.
+class MulticastSender final {
+  public:
+    /// What has to be sent in response to an event
+    struct Step {
+        /// Number of the first Data block to be multicast to the group
+        std::uint16_t FirstBlock = 0;
+        /// Number of consecutive Data blocks to be multicast to the group, starting with Step::FirstBlock
+        std::uint16_t BlocksCount = 0;
+        /// Client that has been promoted to master and the option acknowledgment to be unicast to it
+        std::optional<std::pair<TransferID, packets::OptionAcknowledgment>> Promotion;
+    };
+
+    /// @param[BlocksCount] Assumptions: \p BlocksCount is the number of Data blocks of the file including the final
+    /// (short) one, it is greater than zero
+    /// @param[WindowSize] Assumptions: \p WindowSize is greater than zero
+    MulticastSender(std::string GroupAddress, std::uint16_t GroupPort, std::uint16_t BlocksCount,
+                    std::uint16_t WindowSize = 1, unsigned MaxRetries = 5)
+        : GroupAddress(std::move(GroupAddress)), GroupPort(GroupPort), BlocksCount(BlocksCount),
+          WindowSize(WindowSize), MaxRetries(MaxRetries) {
+        assert(BlocksCount > 0);
+        assert(WindowSize > 0);
+    }
+
+    /// Register the client that has requested the file with the multicast option
+    /// @param[Options] Other negotiated options to be included into the option acknowledgment
+    /// @return Option acknowledgment to be unicast to the client, the first client becomes the master client
+    packets::OptionAcknowledgment addClient(const TransferID &ID,
+                                            std::unordered_map<std::string, std::string> Options = {}) {
+        auto Master = Clients.empty();
+        if (std::find(Clients.begin(), Clients.end(), ID) == Clients.end()) {
+            Clients.push_back(ID);
+        } else {
+            Master = Clients.front() == ID;
+        }
+        Options[std::string(options::names::Multicast)] =
+            options::formatMulticast(options::MulticastOption{GroupAddress, GroupPort, Master});
+        return packets::OptionAcknowledgment{std::move(Options)};
+    }
+
+    /// Handle acknowledgment of the client
+    /// @n Acknowledgments of clients other than the master client are ignored
+    Step onAcknowledgment(const TransferID &ID, std::uint16_t Block) {
+        if (Clients.empty() || Clients.front() != ID || Block > BlocksCount) {
+            return Step{};
+        }
+        Retries = 0;
+        if (Block == BlocksCount) {
+            // The master client has the whole file
+            return promote();
+        }
+        LastAcknowledged = Block;
+        return window();
+    }
+
+    /// Handle expiration of the master client retransmission timer
+    /// @n The current window is multicast again, the master client is replaced once it runs out of retries
+    Step onTimeout() {
+        if (Clients.empty()) {
+            return Step{};
+        }
+        if (++Retries > MaxRetries) {
+            Retries = 0;
+            return promote();
+        }
+        return window();
+    }
+
+    /// Remove the client (e.g. if it has sent an Error packet), the next client is promoted if it was the master
+    Step removeClient(const TransferID &ID) {
+        auto It = std::find(Clients.begin(), Clients.end(), ID);
+        if (It == Clients.end()) {
+            return Step{};
+        }
+        if (It == Clients.begin()) {
+            Retries = 0;
+            return promote();
+        }
+        Clients.erase(It);
+        return Step{};
+    }
+
+    /// @return Current master client or std::nullopt if there are no clients
+    std::optional<TransferID> getMaster() const noexcept {
+        if (Clients.empty()) {
+            return std::nullopt;
+        }
+        return Clients.front();
+    }
+
+    std::size_t getClientsCount() const noexcept { return Clients.size(); }
+
+    /// @return Number of Data blocks multicast for the first time
+    std::size_t getBlocksSent() const noexcept { return HighestSent; }
+
+    /// @return Number of Data blocks multicast once again (to fill in blocks missed by some clients)
+    std::size_t getBlocksResent() const noexcept { return BlocksResent; }
+
+  private:
+    Step window() noexcept {
+        Step Result;
+        Result.FirstBlock = static_cast<std::uint16_t>(LastAcknowledged + 1);
+        Result.BlocksCount = static_cast<std::uint16_t>(
+            std::min<std::uint32_t>(WindowSize, std::uint32_t(BlocksCount) - LastAcknowledged));
+        auto Last = std::uint32_t(Result.FirstBlock) + Result.BlocksCount - 1;
+        if (Last > HighestSent) {
+            BlocksResent += HighestSent >= Result.FirstBlock ? HighestSent - Result.FirstBlock + 1 : 0;
+            HighestSent = Last;
+        } else {
+            BlocksResent += Result.BlocksCount;
+        }
+        return Result;
+    }
+
+    /// Drop the current master client and promote the next one
+    Step promote() {
+        Clients.pop_front();
+        LastAcknowledged = 0;
+        Step Result;
+        if (!Clients.empty()) {
+            // Address and port are omitted, the client already knows them
+            std::unordered_map<std::string, std::string> Options = {
+                {std::string(options::names::Multicast),
+                 options::formatMulticast(options::MulticastOption{"", std::nullopt, true})}};
+            Result.Promotion.emplace(Clients.front(), packets::OptionAcknowledgment{std::move(Options)});
+        }
+        return Result;
+    }
+
+    std::string GroupAddress;
+    std::uint16_t GroupPort;
+    std::uint16_t BlocksCount;
+    std::uint16_t WindowSize;
+    unsigned MaxRetries;
+    unsigned Retries = 0;
+    std::deque<TransferID> Clients;
+    std::uint32_t LastAcknowledged = 0;
+    std::uint32_t HighestSent = 0;
+    std::size_t BlocksResent = 0;
+};
+
+/// Client side of the multicast transfer (RFC 2090)
+/// @n Keeps track of the received blocks, so that once promoted to master the client acknowledges the last block it
+/// has received consecutively and the server fills in the missed ones.
+class MulticastReceiver final {
+  public:
+    /// @param[BlockSize] Assumptions: \p BlockSize is the negotiated block size, it is greater than zero
+    explicit MulticastReceiver(std::size_t BlockSize = 512) : BlockSize(BlockSize) { assert(BlockSize > 0); }
+
+    /// Handle the multicast option of the option acknowledgment
+    /// @return false if the group is different from the one that was announced before
+    bool onOptionAcknowledgment(const options::MulticastOption &Option) {
+        if (!Option.Address.empty()) {
+            if (!GroupAddress.empty() && Option.Address != GroupAddress) {
+                return false;
+            }
+            GroupAddress = Option.Address;
+        }
+        if (Option.Port) {
+            if (GroupPort && *Option.Port != *GroupPort) {
+                return false;
+            }
+            GroupPort = Option.Port;
+        }
+        MasterClient = Option.MasterClient;
+        return true;
+    }
+
+    /// Register the received Data block
+    /// @return false if the block is a duplicate or lies beyond the end of the file
+    bool onData(std::uint16_t Block, std::size_t Size) {
+        if (Block == 0 || (LastBlock && Block > *LastBlock)) {
+            return false;
+        }
+        if (Received.size() < Block) {
+            Received.resize(Block, false);
+        }
+        if (Received[Block - 1]) {
+            return false;
+        }
+        Received[Block - 1] = true;
+        if (Size < BlockSize) {
+            LastBlock = Block;
+        }
+        while (Consecutive < Received.size() && Received[Consecutive]) {
+            ++Consecutive;
+        }
+        return true;
+    }
+
+    /// @return Acknowledgment to be sent to the server or std::nullopt if the client isn't the master client
+    std::optional<packets::Acknowledgment> getAcknowledgment() const noexcept {
+        if (!MasterClient) {
+            return std::nullopt;
+        }
+        return packets::Acknowledgment{static_cast<std::uint16_t>(Consecutive)};
+    }
+
+    bool isMasterClient() const noexcept { return MasterClient; }
+
+    /// @return true if all blocks up to the final one have been received
+    bool isComplete() const noexcept { return LastBlock && Consecutive == *LastBlock; }
+
+    const std::string &getGroupAddress() const noexcept { return GroupAddress; }
+
+    std::optional<std::uint16_t> getGroupPort() const noexcept { return GroupPort; }
+
+  private:
+    std::size_t BlockSize;
+    std::string GroupAddress;
+    std::optional<std::uint16_t> GroupPort;
+    bool MasterClient = false;
+    std::vector<bool> Received;
+    std::size_t Consecutive = 0;
+    std::optional<std::uint16_t> LastBlock;
+};
+
+} // namespace tftp_common::transfer
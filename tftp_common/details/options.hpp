@@ -0,0 +1,238 @@
+#pragma once
+
+#include "packets.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace tftp_common::options {
+
+namespace names {
+
+/// Block size option name (RFC 2348)
+inline constexpr std::string_view BlockSize = "blksize";
+/// Timeout interval option name (RFC 2349)
+inline constexpr std::string_view Timeout = "timeout";
+/// Transfer size option name (RFC 2349)
+inline constexpr std::string_view TransferSize = "tsize";
+/// Window size option name (RFC 7440)
+inline constexpr std::string_view WindowSize = "windowsize";
+/// Multicast option name (RFC 2090)
+inline constexpr std::string_view Multicast = "multicast";
+
+} // namespace names
+
+/// Compare two option names ignoring case, as required by RFC 2347
+inline bool equalsIgnoreCase(std::string_view Lhs, std::string_view Rhs) noexcept {
+    if (Lhs.size() != Rhs.size()) {
+        return false;
+    }
+    for (std::size_t Idx = 0; Idx != Lhs.size(); ++Idx) {
+        auto LhsChar = Lhs[Idx] >= 'A' && Lhs[Idx] <= 'Z' ? Lhs[Idx] - 'A' + 'a' : Lhs[Idx];
+        auto RhsChar = Rhs[Idx] >= 'A' && Rhs[Idx] <= 'Z' ? Rhs[Idx] - 'A' + 'a' : Rhs[Idx];
+        if (LhsChar != RhsChar) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Parse an option value as a decimal unsigned number
+/// @return std::nullopt if the value is empty, contains anything but digits or exceeds \p Max
+inline std::optional<std::uint64_t> parseNumber(std::string_view Value, std::uint64_t Max) noexcept {
+    if (Value.empty()) {
+        return std::nullopt;
+    }
+    std::uint64_t Result = 0;
+    for (auto Char : Value) {
+        if (Char < '0' || Char > '9') {
+            return std::nullopt;
+        }
+        auto Digit = static_cast<std::uint64_t>(Char - '0');
+        // Checked before the multiplication, which would wrap around for values close to UINT64_MAX
+        if (Digit > Max || Result > (Max - Digit) / 10) {
+            return std::nullopt;
+        }
+        Result = Result * 10 + Digit;
+    }
+    return Result;
+}
+
+/// Find option value in the read/write request by its (case-insensitive) name
+/// @return std::nullopt if the request doesn't contain such option
+inline std::optional<std::string_view> find(const packets::Request &Packet, std::string_view Name) noexcept {
+    for (std::size_t Idx = 0; Idx != Packet.getOptionsCount(); ++Idx) {
+        if (equalsIgnoreCase(Packet.getOptionName(Idx), Name)) {
+            return Packet.getOptionValue(Idx);
+        }
+    }
+    return std::nullopt;
+}
+
+/// Find option value in the option acknowledgment by its (case-insensitive) name
+/// @return std::nullopt if the option acknowledgment doesn't contain such option
+inline std::optional<std::string_view> find(const packets::OptionAcknowledgment &Packet,
+                                            std::string_view Name) noexcept {
+    for (const auto &[Key, Value] : Packet) {
+        if (equalsIgnoreCase(Key, Name)) {
+            return std::string_view(Value.data(), Value.size());
+        }
+    }
+    return std::nullopt;
+}
+
+/// Parse timeout interval option value (RFC 2349)
+/// @return std::nullopt if the value isn't a number of seconds between 1 and 255 inclusive
+inline std::optional<std::chrono::seconds> parseTimeout(std::string_view Value) noexcept {
+    auto Seconds = parseNumber(Value, 255);
+    if (!Seconds || *Seconds < 1) {
+        return std::nullopt;
+    }
+    return std::chrono::seconds(*Seconds);
+}
+
+/// Parse block size option value (RFC 2348)
+/// @return std::nullopt if the value isn't a number of octets between 8 and 65464 inclusive
+inline std::optional<std::size_t> parseBlockSize(std::string_view Value) noexcept {
+    auto Octets = parseNumber(Value, packets::Data::MaxBlockSize);
+    if (!Octets || *Octets < 8) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(*Octets);
+}
+
+/// Parse window size option value (RFC 7440)
+/// @return std::nullopt if the value isn't a number of blocks between 1 and 65535 inclusive
+inline std::optional<std::uint16_t> parseWindowSize(std::string_view Value) noexcept {
+    auto Blocks = parseNumber(Value, 65535);
+    if (!Blocks || *Blocks < 1) {
+        return std::nullopt;
+    }
+    return static_cast<std::uint16_t>(*Blocks);
+}
+
+/// Parse transfer size option value (RFC 2349)
+/// @return std::nullopt if the value isn't a number of octets
+inline std::optional<std::uint64_t> parseTransferSize(std::string_view Value) noexcept {
+    return parseNumber(Value, UINT64_MAX);
+}
+
+/// Parameters of the transfer negotiated by the server
+struct Negotiation {
+    std::size_t BlockSize = 512;
+    std::uint16_t WindowSize = 1;
+    std::optional<std::chrono::seconds> Timeout;
+    /// Size of the file (RFC 2349): the server's for read requests, the client's for write requests
+    std::optional<std::uint64_t> TransferSize;
+    /// Options to be acknowledged, the option acknowledgment isn't sent if it's empty
+    std::unordered_map<std::string, std::string> Acknowledged;
+};
+
+/// Negotiate block size, window size, timeout interval and transfer size options of the request (RFC 2347)
+/// @n Unknown and malformed options are ignored. Requested block and window sizes are lowered to the server limits.
+/// @param[FileSize] Size of the requested file, std::nullopt if it's unknown (e.g. the file is generated on the fly),
+/// then the transfer size option is omitted from the option acknowledgment of the read request
+inline Negotiation negotiate(const packets::Request &Packet, std::optional<std::uint64_t> FileSize = std::nullopt,
+                             std::size_t MaxBlockSize = packets::Data::MaxBlockSize,
+                             std::uint16_t MaxWindowSize = 65535) {
+    Negotiation Result;
+    if (auto Value = find(Packet, names::BlockSize)) {
+        if (auto BlockSize = parseBlockSize(*Value)) {
+            Result.BlockSize = std::min(*BlockSize, MaxBlockSize);
+            Result.Acknowledged[std::string(names::BlockSize)] = std::to_string(Result.BlockSize);
+        }
+    }
+    if (auto Value = find(Packet, names::WindowSize)) {
+        if (auto WindowSize = parseWindowSize(*Value)) {
+            Result.WindowSize = std::min(*WindowSize, MaxWindowSize);
+            Result.Acknowledged[std::string(names::WindowSize)] = std::to_string(Result.WindowSize);
+        }
+    }
+    if (auto Value = find(Packet, names::Timeout)) {
+        if ((Result.Timeout = parseTimeout(*Value))) {
+            Result.Acknowledged[std::string(names::Timeout)] = std::to_string(Result.Timeout->count());
+        }
+    }
+    if (auto Value = find(Packet, names::TransferSize)) {
+        auto TransferSize = parseTransferSize(*Value);
+        if (Packet.getType() == packets::types::ReadRequest) {
+            // The client sends zero, the server replies with the size of the file if it knows it
+            if (TransferSize && FileSize) {
+                Result.TransferSize = FileSize;
+                Result.Acknowledged[std::string(names::TransferSize)] = std::to_string(*FileSize);
+            }
+        } else if (TransferSize) {
+            Result.TransferSize = TransferSize;
+            Result.Acknowledged[std::string(names::TransferSize)] = std::to_string(*TransferSize);
+        }
+    }
+    return Result;
+}
+
+/// Value of the multicast option sent by the server in the option acknowledgment (RFC 2090)
+/// @n Address and port may be omitted in the subsequent option acknowledgments sent to the same client
+struct MulticastOption {
+    std::string Address;
+    std::optional<std::uint16_t> Port;
+    bool MasterClient = false;
+};
+
+/// Parse multicast option value in the `addr,port,mc` form (RFC 2090)
+/// @return std::nullopt if the value is malformed
+inline std::optional<MulticastOption> parseMulticast(std::string_view Value) {
+    auto FirstComma = Value.find(',');
+    if (FirstComma == std::string_view::npos) {
+        return std::nullopt;
+    }
+    auto SecondComma = Value.find(',', FirstComma + 1);
+    if (SecondComma == std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    MulticastOption Option;
+    Option.Address = std::string(Value.substr(0, FirstComma));
+    auto Port = Value.substr(FirstComma + 1, SecondComma - FirstComma - 1);
+    if (!Port.empty()) {
+        auto Number = parseNumber(Port, 65535);
+        if (!Number || *Number == 0) {
+            return std::nullopt;
+        }
+        Option.Port = static_cast<std::uint16_t>(*Number);
+    }
+    auto MasterClient = Value.substr(SecondComma + 1);
+    if (MasterClient != "0" && MasterClient != "1") {
+        return std::nullopt;
+    }
+    Option.MasterClient = MasterClient == "1";
+    return Option;
+}
+
+/// Format multicast option value in the `addr,port,mc` form (RFC 2090)
+inline std::string formatMulticast(const MulticastOption &Option) {
+    auto Value = Option.Address + ',';
+    if (Option.Port) {
+        Value += std::to_string(*Option.Port);
+    }
+    Value += Option.MasterClient ? ",1" : ",0";
+    return Value;
+}
+
+/// @return Multicast option of the option acknowledgment or std::nullopt if it's absent or malformed
+inline std::optional<MulticastOption> getMulticast(const packets::OptionAcknowledgment &Packet) {
+    auto Value = find(Packet, names::Multicast);
+    if (!Value) {
+        return std::nullopt;
+    }
+    return parseMulticast(*Value);
+}
+
+/// @return true if the read request asks for the multicast transfer (RFC 2090)
+inline bool requestsMulticast(const packets::Request &Packet) noexcept {
+    return Packet.getType() == packets::types::ReadRequest && find(Packet, names::Multicast).has_value();
+}
+
+} // namespace tftp_common::options
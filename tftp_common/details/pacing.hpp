@@ -0,0 +1,341 @@
+#pragma once
+
+#include "session_table.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace tftp_common::transfer {
+
+/// Token bucket with nanosecond resolution, implemented as the generic cell rate algorithm
+/// @n Instead of a token count the bucket keeps the theoretical arrival time of the next packet: sending advances it
+/// by the transmission time of the packet at the rate, and a packet conforms if that doesn't put it further into the
+/// future than the burst allows. All arithmetic is integer nanoseconds.
+class TokenBucket final {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /// @param[Rate] Bytes per second, zero means unlimited
+    /// @param[Burst] Bytes that may be sent back to back
+    explicit TokenBucket(std::uint64_t Rate = 0, std::uint64_t Burst = 0) noexcept { setRate(Rate, Burst); }
+
+    /// Change the rate at runtime, the bucket keeps its state
+    void setRate(std::uint64_t Rate_, std::uint64_t Burst_) noexcept {
+        Rate = Rate_;
+        Burst = Burst_;
+        Tolerance = Rate == 0 ? std::chrono::nanoseconds(0) : getCost(Burst);
+    }
+
+    std::uint64_t getRate() const noexcept { return Rate; }
+    std::uint64_t getBurst() const noexcept { return Burst; }
+
+    /// @return Time when \p Bytes can be sent, \p Now if they can be sent right away
+    Clock::time_point getAvailableAt(std::size_t Bytes, Clock::time_point Now) const noexcept {
+        if (Rate == 0) {
+            return Now;
+        }
+        auto Next = std::max(Arrival, Now) + getCost(Bytes);
+        return std::max(Now, Next - Tolerance);
+    }
+
+    bool conforms(std::size_t Bytes, Clock::time_point Now) const noexcept { return getAvailableAt(Bytes, Now) <= Now; }
+
+    /// Account for \p Bytes sent at \p Now, the bucket goes into debt if they didn't conform
+    void consume(std::size_t Bytes, Clock::time_point Now) noexcept {
+        if (Rate != 0) {
+            Arrival = std::max(Arrival, Now) + getCost(Bytes);
+        }
+    }
+
+    /// Consume \p Bytes if they conform
+    bool tryConsume(std::size_t Bytes, Clock::time_point Now) noexcept {
+        if (!conforms(Bytes, Now)) {
+            return false;
+        }
+        consume(Bytes, Now);
+        return true;
+    }
+
+  private:
+    std::chrono::nanoseconds getCost(std::uint64_t Bytes) const noexcept {
+        // Rounded up, so that the rate is never exceeded
+        return std::chrono::nanoseconds((Bytes * 1000000000ull + Rate - 1) / Rate);
+    }
+
+    std::uint64_t Rate = 0;
+    std::uint64_t Burst = 0;
+    std::chrono::nanoseconds Tolerance{0};
+    Clock::time_point Arrival{};
+};
+
+/// Rates of the pacer, may be changed at runtime
+struct PacingLimits {
+    /// Rates in bytes per second (zero means unlimited) and bursts in bytes
+    std::uint64_t GlobalRate = 0;
+    std::uint64_t GlobalBurst = 64 * 1024;
+    std::uint64_t ClientRate = 0;
+    std::uint64_t ClientBurst = 64 * 1024;
+    std::uint64_t SubnetRate = 0;
+    std::uint64_t SubnetBurst = 64 * 1024;
+    /// Prefix length of IPv4 subnets, IPv6 subnets are /64
+    unsigned SubnetPrefix = 24;
+    /// Bytes added to the deficit of a flow on each round, not less than the greatest packet size
+    std::size_t Quantum = 1500;
+};
+
+/// Scheduler deciding which transfer sends its next Data packet
+/// @n Transfers (flows) are served by deficit round robin, so each backlogged flow gets an equal share of bytes
+/// regardless of its block or window size. Every packet also has to conform to the global bucket (the uplink), the
+/// bucket of its client (address) and the bucket of its client's subnet. A flow held back by its client or subnet
+/// bucket loses its turn without delaying the others. Packets are granted in batches suitable for `sendmmsg`.
+class Pacer final {
+  public:
+    using Clock = TokenBucket::Clock;
+    using FlowID = std::size_t;
+
+    /// Packet of the flow allowed to be sent
+    struct Grant {
+        FlowID Flow;
+        std::size_t Bytes;
+    };
+
+    explicit Pacer(const PacingLimits &Settings = PacingLimits{}) : Settings(Settings) {
+        Global.setRate(Settings.GlobalRate, Settings.GlobalBurst);
+    }
+
+    /// Register the transfer with the client
+    FlowID addFlow(const TransferID &Client) {
+        FlowID ID;
+        if (!FreeFlows.empty()) {
+            ID = FreeFlows.back();
+            FreeFlows.pop_back();
+        } else {
+            ID = Flows.size();
+            Flows.emplace_back();
+        }
+        auto &Added = Flows[ID];
+        Added.ClientKey = getClientKey(Client);
+        Added.SubnetKey = getSubnetKey(Client);
+        Added.Client = &acquire(Clients, Added.ClientKey, Settings.ClientRate, Settings.ClientBurst);
+        Added.Subnet = &acquire(Subnets, Added.SubnetKey, Settings.SubnetRate, Settings.SubnetBurst);
+        Added.InUse = true;
+        return ID;
+    }
+
+    /// Unregister the transfer, its queued packets are dropped
+    void removeFlow(FlowID ID) {
+        auto &Removed = Flows[ID];
+        assert(Removed.InUse);
+        if (Removed.Active) {
+            Active.erase(std::find(Active.begin(), Active.end(), ID));
+        }
+        release(Clients, Removed.ClientKey);
+        release(Subnets, Removed.SubnetKey);
+        Removed = Flow{};
+        FreeFlows.push_back(ID);
+    }
+
+    /// Queue the next packet of the flow
+    /// @param[Bytes] Assumptions: \p Bytes is not greater than the quantum
+    void enqueue(FlowID ID, std::size_t Bytes) {
+        auto &Queued = Flows[ID];
+        assert(Queued.InUse);
+        assert(Bytes <= Settings.Quantum);
+        Queued.Packets.push_back(static_cast<std::uint32_t>(Bytes));
+        if (!Queued.Active) {
+            Queued.Active = true;
+            Active.push_back(ID);
+        }
+    }
+
+    /// Drop the queued packets of the flow, e.g. when its window is sent again after a timeout
+    void clear(FlowID ID) {
+        auto &Cleared = Flows[ID];
+        Cleared.Packets.clear();
+        Cleared.Deficit = 0;
+        Cleared.InRound = false;
+        if (Cleared.Active) {
+            Cleared.Active = false;
+            Active.erase(std::find(Active.begin(), Active.end(), ID));
+        }
+    }
+
+    /// Grant the packets that may be sent at \p Now, in the order they should be sent
+    /// @return Number of grants appended to \p Granted, at most \p MaxBatch
+    std::size_t schedule(Clock::time_point Now, std::vector<Grant> &Granted, std::size_t MaxBatch = 64) {
+        std::size_t Count = 0;
+        // Number of flows in a row that lost their turn, the round is over once all of them have
+        std::size_t Skipped = 0;
+        while (Count < MaxBatch && !Active.empty() && Skipped < Active.size()) {
+            auto ID = Active.front();
+            auto &Current = Flows[ID];
+            auto Head = Current.Packets.front();
+            if (!Global.conforms(Head, Now)) {
+                return Count;
+            }
+            if (!Current.Client->conforms(Head, Now) || !Current.Subnet->conforms(Head, Now)) {
+                Current.InRound = false;
+                rotate();
+                ++Skipped;
+                continue;
+            }
+            Skipped = 0;
+            if (!Current.InRound) {
+                Current.InRound = true;
+                Current.Deficit += Settings.Quantum;
+            }
+            while (!Current.Packets.empty() && Count < MaxBatch) {
+                Head = Current.Packets.front();
+                if (Current.Deficit < Head) {
+                    break;
+                }
+                if (!Global.conforms(Head, Now)) {
+                    return Count;
+                }
+                if (!Current.Client->conforms(Head, Now) || !Current.Subnet->conforms(Head, Now)) {
+                    break;
+                }
+                Global.consume(Head, Now);
+                Current.Client->consume(Head, Now);
+                Current.Subnet->consume(Head, Now);
+                Current.Deficit -= Head;
+                Current.Packets.pop_front();
+                Granted.push_back(Grant{ID, Head});
+                ++Count;
+            }
+            if (Count == MaxBatch && !Current.Packets.empty() && Current.Deficit >= Current.Packets.front()) {
+                // The flow keeps its turn for the next batch
+                return Count;
+            }
+            Current.InRound = false;
+            if (Current.Packets.empty()) {
+                Current.Deficit = 0;
+                Current.Active = false;
+                Active.pop_front();
+            } else {
+                rotate();
+            }
+        }
+        return Count;
+    }
+
+    /// @return Time when the next packet can be granted or std::nullopt if no packets are queued
+    std::optional<Clock::time_point> getNextDeadline(Clock::time_point Now) const noexcept {
+        std::optional<Clock::time_point> Deadline;
+        for (auto ID : Active) {
+            const auto &Current = Flows[ID];
+            auto Head = Current.Packets.front();
+            auto Available = std::max({Global.getAvailableAt(Head, Now), Current.Client->getAvailableAt(Head, Now),
+                                       Current.Subnet->getAvailableAt(Head, Now)});
+            if (!Deadline || Available < *Deadline) {
+                Deadline = Available;
+            }
+        }
+        return Deadline;
+    }
+
+    /// @return Number of packets queued by the flow
+    std::size_t getQueued(FlowID ID) const noexcept { return Flows[ID].Packets.size(); }
+
+    void setGlobalRate(std::uint64_t Rate, std::uint64_t Burst) noexcept {
+        Settings.GlobalRate = Rate;
+        Settings.GlobalBurst = Burst;
+        Global.setRate(Rate, Burst);
+    }
+
+    /// Change the rate of every client, present and future
+    void setClientRate(std::uint64_t Rate, std::uint64_t Burst) noexcept {
+        Settings.ClientRate = Rate;
+        Settings.ClientBurst = Burst;
+        for (auto &[Key, Shared] : Clients) {
+            Shared.Bucket.setRate(Rate, Burst);
+        }
+    }
+
+    /// Change the rate of every subnet, present and future
+    void setSubnetRate(std::uint64_t Rate, std::uint64_t Burst) noexcept {
+        Settings.SubnetRate = Rate;
+        Settings.SubnetBurst = Burst;
+        for (auto &[Key, Shared] : Subnets) {
+            Shared.Bucket.setRate(Rate, Burst);
+        }
+    }
+
+  private:
+    /// Bucket shared by the flows of one client or subnet
+    struct SharedBucket {
+        TokenBucket Bucket;
+        std::size_t Users = 0;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const TransferID &Key) const noexcept { return static_cast<std::size_t>(Key.hash()); }
+    };
+
+    using Buckets = std::unordered_map<TransferID, SharedBucket, KeyHash>;
+
+    struct Flow {
+        std::deque<std::uint32_t> Packets;
+        std::size_t Deficit = 0;
+        TransferID ClientKey;
+        TransferID SubnetKey;
+        TokenBucket *Client = nullptr;
+        TokenBucket *Subnet = nullptr;
+        bool Active = false;
+        bool InRound = false;
+        bool InUse = false;
+    };
+
+    static TransferID getClientKey(const TransferID &Client) noexcept {
+        TransferID Key;
+        Key.Address = Client.Address;
+        return Key;
+    }
+
+    TransferID getSubnetKey(const TransferID &Client) const noexcept {
+        static constexpr std::uint8_t Mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+        auto IPv4 = std::equal(Mapped, Mapped + 12, Client.Address.begin());
+        auto Prefix = IPv4 ? 96 + std::min(Settings.SubnetPrefix, 32u) : 64u;
+        TransferID Key;
+        for (unsigned Bit = 0; Bit != Prefix; ++Bit) {
+            Key.Address[Bit / 8] |= Client.Address[Bit / 8] & (0x80 >> (Bit % 8));
+        }
+        return Key;
+    }
+
+    static TokenBucket &acquire(Buckets &Map, const TransferID &Key, std::uint64_t Rate, std::uint64_t Burst) {
+        auto [It, Inserted] = Map.try_emplace(Key);
+        if (Inserted) {
+            It->second.Bucket.setRate(Rate, Burst);
+        }
+        ++It->second.Users;
+        return It->second.Bucket;
+    }
+
+    static void release(Buckets &Map, const TransferID &Key) {
+        auto It = Map.find(Key);
+        if (--It->second.Users == 0) {
+            Map.erase(It);
+        }
+    }
+
+    void rotate() {
+        Active.push_back(Active.front());
+        Active.pop_front();
+    }
+
+    PacingLimits Settings;
+    TokenBucket Global;
+    Buckets Clients;
+    Buckets Subnets;
+    std::vector<Flow> Flows;
+    std::vector<FlowID> FreeFlows;
+    std::deque<FlowID> Active;
+};
+
+} // namespace tftp_common::transfer
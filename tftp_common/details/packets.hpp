@@ -54,7 +54,9 @@ enum Error : std::uint16_t {
     /// File already exists error code
     FileAlreadyExists = 6,
     /// No such user error code
-    NoSuchUser = 7
+    NoSuchUser = 7,
+    /// Option negotiation failed error code (RFC 2347)
+    OptionNegotiation = 8
 };
 
 } // namespace errors
@@ -142,6 +144,8 @@ class Request final {
 
     std::string_view getMode() const noexcept { return std::string_view(Mode.data(), Mode.size()); }
 
+    std::size_t getOptionsCount() const noexcept { return OptionsNames.size(); }
+
     std::string_view getOptionName(std::size_t Idx) const noexcept {
         return std::string_view(OptionsNames[Idx].data(), OptionsNames[Idx].size());
     }
@@ -163,22 +167,25 @@ class Data final {
   public:
     /// Use with parsing functions only
     Data() = default;
+    /// Greatest size of the data field, the block size can be negotiated up to this value (RFC 2348)
+    static constexpr std::size_t MaxBlockSize = 65464;
+
     /// @param[Block] Assumptions: The \p Block value is greater than one
-    /// @param[Buffer] Assumptions: The \p Buffer size is greater or equal than 0 and less or equal than 512
+    /// @param[Buffer] Assumptions: The \p Buffer size is less or equal than the negotiated block size
     Data(std::uint16_t Block, const std::vector<std::uint8_t> &Buffer)
         : Block(Block), DataBuffer(Buffer.begin(), Buffer.end()) {
         // The block numbers on data packets begin with one and increase by one for each new block of data
         assert(Block >= 1);
-        // The data field is from zero to 512 bytes long
-        assert(Buffer.size() >= 0 && Buffer.size() <= 512);
+        // The data field is from zero to 512 bytes long, unless a greater block size was negotiated
+        assert(Buffer.size() <= MaxBlockSize);
     }
     /// @param[Block] Assumptions: The \p Block value is greater than one
-    /// @param[Buffer] Assumptions: The \p Buffer size is greater or equal than 0 and less or equal than 512
+    /// @param[Buffer] Assumptions: The \p Buffer size is less or equal than the negotiated block size
     Data(std::uint16_t Block, std::vector<std::uint8_t> &&Buffer) noexcept : Block(Block) {
         // The block numbers on data packets begin with one and increase by one for each new block of data
         assert(Block >= 1);
-        // The data field is from zero to 512 bytes long
-        assert(Buffer.size() >= 0 && Buffer.size() <= 512);
+        // The data field is from zero to 512 bytes long, unless a greater block size was negotiated
+        assert(Buffer.size() <= MaxBlockSize);
         this->DataBuffer = std::move(Buffer);
     }
 
@@ -214,11 +221,8 @@ class Acknowledgment final {
   public:
     /// Use with parsing functions only
     Acknowledgment() = default;
-    /// @param[Block] Assumptions: the \p Block is equal or greater than one
-    explicit Acknowledgment(std::uint16_t Block) noexcept : Block(Block) {
-        // The block numbers on data packets begin with one and increase by one for each new block of data
-        assert(Block >= 1);
-    }
+    /// @param[Block] Block number zero acknowledges the option acknowledgment (RFC 2347)
+    explicit Acknowledgment(std::uint16_t Block) noexcept : Block(Block) {}
 
     std::uint16_t getType() const noexcept { return Type_; }
 
@@ -0,0 +1,484 @@
+#pragma once
+
+#include "file_sink.hpp"
+#include "packets.hpp"
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#endif
+
+namespace tftp_common::transfer {
+
+/// Make the filename of a request (`Request::getFilename`) a path relative to the served root
+/// @n Backslashes are taken for separators (some clients send them), leading, repeated and trailing separators and
+/// `.` components are dropped. `..` components and control characters are rejected rather than resolved.
+/// @return Relative path or std::nullopt if the filename is rejected
+inline std::optional<std::string> sanitizeFilename(std::string_view Filename) {
+    std::string Path;
+    Path.reserve(Filename.size());
+    std::size_t Begin = 0;
+    while (Begin <= Filename.size()) {
+        auto End = Filename.find_first_of("/\\", Begin);
+        if (End == std::string_view::npos) {
+            End = Filename.size();
+        }
+        auto Component = Filename.substr(Begin, End - Begin);
+        if (Component == "..") {
+            return std::nullopt;
+        }
+        if (!Component.empty() && Component != ".") {
+            for (auto Char : Component) {
+                if (static_cast<unsigned char>(Char) < 0x20 || Char == 0x7f) {
+                    return std::nullopt;
+                }
+            }
+            if (!Path.empty()) {
+                Path += '/';
+            }
+            Path += Component;
+        }
+        Begin = End + 1;
+    }
+    if (Path.empty()) {
+        return std::nullopt;
+    }
+    return Path;
+}
+
+/// Open the file at the relative path (see sanitizeFilename) without leaving the root directory through symbolic links
+/// @n openat2 (Linux 5.6) resolves the path beneath the root, so links within the served tree keep working. Older
+/// kernels walk the path component by component and refuse every link on it.
+/// @return Descriptor or -1 with errno set, ELOOP or EXDEV for the refused links
+inline int openBeneath(int RootDescriptor, const std::string &Path) {
+    // Non-blocking, so that a FIFO in the served tree doesn't hang the request
+    constexpr int Flags = O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC;
+#if defined(SYS_openat2) && defined(RESOLVE_BENEATH)
+    open_how How{};
+    How.flags = Flags;
+    How.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    auto Opened = static_cast<int>(::syscall(SYS_openat2, RootDescriptor, Path.c_str(), &How, sizeof(How)));
+    if (Opened != -1 || errno != ENOSYS) {
+        return Opened;
+    }
+#endif
+    int Directory = RootDescriptor;
+    for (std::size_t Begin = 0;;) {
+        auto End = Path.find('/', Begin);
+        auto Last = End == std::string::npos;
+        auto Component = Path.substr(Begin, Last ? std::string::npos : End - Begin);
+        auto Next = ::openat(Directory, Component.c_str(),
+                             (Last ? Flags : O_RDONLY | O_DIRECTORY | O_CLOEXEC) | O_NOFOLLOW);
+        if (Directory != RootDescriptor) {
+            auto Error = errno;
+            ::close(Directory);
+            errno = Error;
+        }
+        if (Next == -1 || Last) {
+            return Next;
+        }
+        Directory = Next;
+        Begin = End + 1;
+    }
+}
+
+/// Regular file opened by PathCache with its metadata
+/// @n The descriptor is shared by concurrent transfers (read it with `pread`) and stays open as long as the file is
+/// referenced, even after the cache entry has been invalidated.
+class CachedFile final {
+  public:
+    CachedFile(int Descriptor, const struct stat &Status) noexcept : Descriptor(Descriptor), Status(Status) {}
+    CachedFile(const CachedFile &) = delete;
+    CachedFile &operator=(const CachedFile &) = delete;
+    ~CachedFile() { ::close(Descriptor); }
+
+    int getDescriptor() const noexcept { return Descriptor; }
+
+    /// @return Size of the file, e.g. for the transfer size option (RFC 2349)
+    std::uint64_t getSize() const noexcept { return static_cast<std::uint64_t>(Status.st_size); }
+
+    const struct stat &getStatus() const noexcept { return Status; }
+
+  private:
+    int Descriptor;
+    struct stat Status;
+};
+
+/// Outcome of resolving the filename of a read request
+struct PathResolution {
+    /// Opened file, null if the file can't be served
+    std::shared_ptr<const CachedFile> File;
+    /// Serialized Error packet to be sent to the client instead, null if the file has been opened
+    std::shared_ptr<const std::vector<std::uint8_t>> ErrorPacket;
+    std::error_code Error;
+    /// Whether the resolution came from the cache, without touching the file system
+    bool Cached = false;
+};
+
+struct PathCacheSettings {
+    /// How long a file is remembered as missing, a safety net for changes inotify can't see (e.g. NFS)
+    std::chrono::steady_clock::duration NegativeTTL = std::chrono::seconds(5);
+    /// Greatest number of cached paths
+    std::size_t MaxEntries = 65536;
+    /// Number of independently locked parts of the cache
+    std::size_t ShardsCount = 16;
+};
+
+/// Cache resolving filenames of read requests (RRQ) against the served root
+/// @n Files that exist are kept open along with their `fstat` result, so a hit costs no system calls. Files that
+/// don't exist (e.g. the configuration files probed by PXE clients on every boot) are cached for a while too,
+/// together with the serialized Error packet to be sent back. The served tree is watched with inotify: PathCache::poll
+/// drops the entries of the changed paths and has to be called when PathCache::getDescriptor becomes readable. The
+/// cache is split into shards guarded by reader-writer locks, PathCache::resolve may be called from many threads.
+class PathCache final {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PathCache(const PathCacheSettings &Settings = PathCacheSettings{})
+        : Settings(Settings), Shards(new Shard[Settings.ShardsCount]),
+          ShardCapacity(std::max<std::size_t>(1, Settings.MaxEntries / Settings.ShardsCount)) {
+        assert(Settings.ShardsCount > 0);
+    }
+    PathCache(const PathCache &) = delete;
+    PathCache &operator=(const PathCache &) = delete;
+    ~PathCache() {
+        if (RootDescriptor != -1) {
+            ::close(RootDescriptor);
+        }
+        if (Notifier != -1) {
+            ::close(Notifier);
+        }
+    }
+
+    /// Open the served root and start watching the tree below it
+    std::error_code open(const std::string &Root_) {
+        assert(RootDescriptor == -1);
+        Root = Root_;
+        RootDescriptor = ::open(Root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (RootDescriptor == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        Notifier = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (Notifier == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        return watch("");
+    }
+
+    /// Resolve the filename of the read request, opening the file on a miss
+    PathResolution resolve(std::string_view Filename, Clock::time_point Now = Clock::now()) {
+        assert(RootDescriptor != -1);
+        auto Path = sanitizeFilename(Filename);
+        if (!Path) {
+            // Rejected without touching the file system, there's nothing to save by caching
+            auto Error = std::make_error_code(std::errc::permission_denied);
+            return PathResolution{nullptr, serialize(Error), Error, false};
+        }
+
+        auto &Part = getShard(*Path);
+        std::uint64_t Generation;
+        {
+            std::shared_lock Lock(Part.Mutex);
+            auto It = Part.Entries.find(*Path);
+            if (It != Part.Entries.end() && (It->second.Value.File || Now < It->second.Value.Expires)) {
+                const auto &Found = It->second.Value;
+                (Found.File ? Part.Hits : Part.NegativeHits).fetch_add(1, std::memory_order_relaxed);
+                if (!It->second.Referenced.load(std::memory_order_relaxed)) {
+                    It->second.Referenced.store(true, std::memory_order_relaxed);
+                }
+                return PathResolution{Found.File, Found.ErrorPacket, Found.Error, true};
+            }
+            Generation = Part.Generation;
+        }
+
+        Part.Lookups.fetch_add(1, std::memory_order_relaxed);
+        Entry Resolved = lookup(*Path);
+        Resolved.Expires = Now + Settings.NegativeTTL;
+        PathResolution Result{Resolved.File, Resolved.ErrorPacket, Resolved.Error, false};
+        std::unique_lock Lock(Part.Mutex);
+        // The path may have changed while it was being looked up, the result mustn't be cached then
+        if (Part.Generation == Generation) {
+            if (auto It = Part.Entries.find(*Path); It != Part.Entries.end()) {
+                It->second.Value = std::move(Resolved);
+            } else {
+                if (Part.Entries.size() >= ShardCapacity) {
+                    evict(Part, Now);
+                }
+                auto Inserted = Part.Entries.try_emplace(std::move(*Path), std::move(Resolved)).first;
+                Inserted->second.Position = Part.Order.insert(Part.Order.end(), &Inserted->first);
+            }
+        }
+        return Result;
+    }
+
+    /// Process the pending inotify events, invalidating the entries of the changed paths
+    /// @n Must not be called by several threads at once
+    /// @return Number of the processed events
+    std::size_t poll() {
+        alignas(inotify_event) char Buffer[16384];
+        std::size_t Count = 0;
+        while (true) {
+            auto Size = ::read(Notifier, Buffer, sizeof(Buffer));
+            if (Size <= 0) {
+                return Count;
+            }
+            for (char *Position = Buffer; Position < Buffer + Size;) {
+                const auto *Event = reinterpret_cast<const inotify_event *>(Position);
+                Position += sizeof(inotify_event) + Event->len;
+                ++Count;
+                process(*Event);
+            }
+        }
+    }
+
+    /// Drop all entries
+    void clear() {
+        for (std::size_t Idx = 0; Idx != Settings.ShardsCount; ++Idx) {
+            std::unique_lock Lock(Shards[Idx].Mutex);
+            Shards[Idx].Entries.clear();
+            Shards[Idx].Order.clear();
+            ++Shards[Idx].Generation;
+        }
+    }
+
+    /// @return inotify descriptor, PathCache::poll has to be called when it becomes readable
+    int getDescriptor() const noexcept { return Notifier; }
+
+    /// @return Number of cached paths, including expired misses
+    std::size_t size() const {
+        std::size_t Size = 0;
+        for (std::size_t Idx = 0; Idx != Settings.ShardsCount; ++Idx) {
+            std::shared_lock Lock(Shards[Idx].Mutex);
+            Size += Shards[Idx].Entries.size();
+        }
+        return Size;
+    }
+
+    /// @return Number of requests for existing files served from the cache
+    std::uint64_t getHits() const noexcept { return sum(&Shard::Hits); }
+
+    /// @return Number of requests for missing files served from the cache
+    std::uint64_t getNegativeHits() const noexcept { return sum(&Shard::NegativeHits); }
+
+    /// @return Number of requests that went to the file system
+    std::uint64_t getLookups() const noexcept { return sum(&Shard::Lookups); }
+
+  private:
+    static constexpr std::uint32_t WatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM |
+                                               IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+    struct Entry {
+        std::shared_ptr<const CachedFile> File;
+        std::shared_ptr<const std::vector<std::uint8_t>> ErrorPacket;
+        std::error_code Error;
+        Clock::time_point Expires;
+    };
+
+    /// Cached entry with its place in the eviction order
+    struct Slot {
+        explicit Slot(Entry Value) : Value(std::move(Value)) {}
+
+        Entry Value;
+        std::list<const std::string *>::iterator Position;
+        /// Set by hits (under the shared lock), gives the entry a second chance on eviction
+        std::atomic<bool> Referenced{false};
+    };
+
+    struct Shard {
+        mutable std::shared_mutex Mutex;
+        std::unordered_map<std::string, Slot> Entries;
+        /// Paths of the entries in the order they are considered for eviction
+        std::list<const std::string *> Order;
+        /// Incremented on every invalidation
+        std::uint64_t Generation = 0;
+        std::atomic<std::uint64_t> Hits{0};
+        std::atomic<std::uint64_t> NegativeHits{0};
+        std::atomic<std::uint64_t> Lookups{0};
+    };
+
+    Shard &getShard(const std::string &Path) const noexcept {
+        return Shards[std::hash<std::string>{}(Path) % Settings.ShardsCount];
+    }
+
+    std::uint64_t sum(std::atomic<std::uint64_t> Shard::*Counter) const noexcept {
+        std::uint64_t Sum = 0;
+        for (std::size_t Idx = 0; Idx != Settings.ShardsCount; ++Idx) {
+            Sum += (Shards[Idx].*Counter).load(std::memory_order_relaxed);
+        }
+        return Sum;
+    }
+
+    static std::shared_ptr<const std::vector<std::uint8_t>> serialize(std::error_code Error) {
+        auto Bytes = std::make_shared<std::vector<std::uint8_t>>();
+        makeFileError(Error).serialize(std::back_inserter(*Bytes));
+        return Bytes;
+    }
+
+    Entry lookup(const std::string &Path) const {
+        Entry Resolved;
+        int Descriptor = openBeneath(RootDescriptor, Path);
+        if (Descriptor == -1) {
+            // Symbolic links leading out of the root (or any links, see openBeneath)
+            Resolved.Error = errno == ELOOP || errno == EXDEV ? std::make_error_code(std::errc::permission_denied)
+                                                              : std::error_code(errno, std::generic_category());
+        } else {
+            struct stat Status;
+            if (::fstat(Descriptor, &Status) != 0) {
+                Resolved.Error = std::error_code(errno, std::generic_category());
+            } else if (S_ISDIR(Status.st_mode)) {
+                Resolved.Error = std::make_error_code(std::errc::is_a_directory);
+            } else if (!S_ISREG(Status.st_mode)) {
+                Resolved.Error = std::make_error_code(std::errc::permission_denied);
+            } else {
+                Resolved.File = std::make_shared<const CachedFile>(Descriptor, Status);
+                return Resolved;
+            }
+            ::close(Descriptor);
+        }
+        Resolved.ErrorPacket = serialize(Resolved.Error);
+        return Resolved;
+    }
+
+    /// Make room in the full shard: the first entry in the order that is an expired miss or hasn't been hit since it
+    /// was last considered is dropped, hit entries are moved to the end (the CLOCK approximation of LRU, hits only
+    /// take the shared lock)
+    void evict(Shard &Part, Clock::time_point Now) const {
+        while (true) {
+            auto It = Part.Entries.find(*Part.Order.front());
+            auto &Candidate = It->second;
+            if (Candidate.Referenced.exchange(false, std::memory_order_relaxed) &&
+                (Candidate.Value.File || Now < Candidate.Value.Expires)) {
+                Part.Order.splice(Part.Order.end(), Part.Order, Candidate.Position);
+                continue;
+            }
+            Part.Order.erase(Candidate.Position);
+            Part.Entries.erase(It);
+            return;
+        }
+    }
+
+    void invalidate(const std::string &Path) {
+        auto &Part = getShard(Path);
+        std::unique_lock Lock(Part.Mutex);
+        if (auto It = Part.Entries.find(Path); It != Part.Entries.end()) {
+            Part.Order.erase(It->second.Position);
+            Part.Entries.erase(It);
+        }
+        ++Part.Generation;
+    }
+
+    /// Watch the directory (relative to the root) and the directories below it
+    std::error_code watch(const std::string &Directory) {
+        auto FullPath = Directory.empty() ? Root : Root + "/" + Directory;
+        auto Descriptor = ::inotify_add_watch(Notifier, FullPath.c_str(), WatchMask);
+        if (Descriptor == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        Watches[Descriptor] = Directory;
+        // The watch is added before listing, so that directories created meanwhile aren't missed
+        auto *Listing = ::opendir(FullPath.c_str());
+        if (Listing == nullptr) {
+            return std::error_code(errno, std::generic_category());
+        }
+        std::error_code Error;
+        while (auto *Child = ::readdir(Listing)) {
+            std::string_view Name(Child->d_name);
+            if (Name == "." || Name == "..") {
+                continue;
+            }
+            auto ChildPath = Directory.empty() ? std::string(Name) : Directory + "/" + std::string(Name);
+            bool IsDirectory = Child->d_type == DT_DIR;
+            if (Child->d_type == DT_UNKNOWN) {
+                struct stat Status;
+                IsDirectory = ::fstatat(RootDescriptor, ChildPath.c_str(), &Status, AT_SYMLINK_NOFOLLOW) == 0 &&
+                              S_ISDIR(Status.st_mode);
+            }
+            if (IsDirectory && !Error) {
+                Error = watch(ChildPath);
+            }
+        }
+        ::closedir(Listing);
+        return Error;
+    }
+
+    /// Stop watching the directory and the directories below it, e.g. when it's moved away
+    void unwatch(const std::string &Directory) {
+        for (auto It = Watches.begin(); It != Watches.end();) {
+            const auto &Watched = It->second;
+            if (Watched == Directory ||
+                (Watched.size() > Directory.size() && Watched.compare(0, Directory.size(), Directory) == 0 &&
+                 Watched[Directory.size()] == '/')) {
+                ::inotify_rm_watch(Notifier, It->first);
+                It = Watches.erase(It);
+            } else {
+                ++It;
+            }
+        }
+    }
+
+    void process(const inotify_event &Event) {
+        if (Event.mask & IN_Q_OVERFLOW) {
+            // Events have been lost, nothing cached can be trusted
+            clear();
+            return;
+        }
+        auto It = Watches.find(Event.wd);
+        if (It == Watches.end()) {
+            return;
+        }
+        if (Event.mask & IN_IGNORED) {
+            Watches.erase(It);
+            return;
+        }
+        if (Event.len == 0) {
+            return;
+        }
+        std::string Name(Event.name);
+        auto Path = It->second.empty() ? Name : It->second + "/" + Name;
+        if (Event.mask & IN_ISDIR) {
+            if (Event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                watch(Path);
+            } else if (Event.mask & IN_MOVED_FROM) {
+                unwatch(Path);
+            }
+            // Misses below the directory are cached under many paths, drop everything
+            clear();
+        } else {
+            invalidate(Path);
+        }
+    }
+
+    PathCacheSettings Settings;
+    std::unique_ptr<Shard[]> Shards;
+    std::size_t ShardCapacity;
+    std::string Root;
+    int RootDescriptor = -1;
+    int Notifier = -1;
+    /// Watched directories relative to the root by watch descriptors
+    std::unordered_map<int, std::string> Watches;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,504 @@
+#pragma once
+
+#include "packets.hpp"
+#include "session_table.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+namespace tftp_common::capture {
+
+/// Link-layer header types of captured frames (`LINKTYPE_*` values)
+namespace links {
+
+enum Link : std::uint32_t {
+    /// BSD loopback, a 4-byte address family in the byte order of the capturing host
+    Null = 0,
+    Ethernet = 1,
+    /// IPv4 or IPv6 packets without a link-layer header
+    Raw = 101,
+    /// Linux "cooked" capture (`any` interface)
+    LinuxCooked = 113,
+    LinuxCooked2 = 276,
+};
+
+} // namespace links
+
+/// UDP datagram found in a capture
+struct Datagram {
+    /// Capture time in nanoseconds since the epoch
+    std::uint64_t Timestamp = 0;
+    transfer::TransferID Source;
+    transfer::TransferID Destination;
+    /// Points into the capture buffer
+    const std::uint8_t *Payload = nullptr;
+    std::size_t Size = 0;
+};
+
+namespace details {
+
+inline std::uint16_t getBigEndian16(const std::uint8_t *Bytes) noexcept {
+    return static_cast<std::uint16_t>(Bytes[0] << 8 | Bytes[1]);
+}
+
+inline std::uint32_t getBigEndian32(const std::uint8_t *Bytes) noexcept {
+    return std::uint32_t(Bytes[0]) << 24 | std::uint32_t(Bytes[1]) << 16 | std::uint32_t(Bytes[2]) << 8 | Bytes[3];
+}
+
+inline std::uint32_t getLittleEndian32(const std::uint8_t *Bytes) noexcept {
+    return std::uint32_t(Bytes[3]) << 24 | std::uint32_t(Bytes[2]) << 16 | std::uint32_t(Bytes[1]) << 8 | Bytes[0];
+}
+
+inline void putLittleEndian32(std::vector<std::uint8_t> &Buffer, std::uint32_t Value) {
+    for (int Shift = 0; Shift != 32; Shift += 8) {
+        Buffer.push_back(static_cast<std::uint8_t>(Value >> Shift));
+    }
+}
+
+inline transfer::TransferID makeIPv4Endpoint(const std::uint8_t *Address, std::uint16_t Port) noexcept {
+    transfer::TransferID Endpoint;
+    Endpoint.Address[10] = Endpoint.Address[11] = 0xFF;
+    std::memcpy(Endpoint.Address.data() + 12, Address, 4);
+    Endpoint.Port = Port;
+    return Endpoint;
+}
+
+inline transfer::TransferID makeIPv6Endpoint(const std::uint8_t *Address, std::uint16_t Port) noexcept {
+    transfer::TransferID Endpoint;
+    std::memcpy(Endpoint.Address.data(), Address, 16);
+    Endpoint.Port = Port;
+    return Endpoint;
+}
+
+/// Decode the UDP header of the IP packet
+/// @return false if the packet isn't an unfragmented UDP datagram captured in full
+inline bool decodeIP(const std::uint8_t *Packet, std::size_t Size, Datagram &Decoded) noexcept {
+    if (Size < 1) {
+        return false;
+    }
+    const std::uint8_t *Segment;
+    std::size_t SegmentSize;
+    if (Packet[0] >> 4 == 4) {
+        if (Size < 20) {
+            return false;
+        }
+        std::size_t HeaderSize = (Packet[0] & 0x0f) * 4u;
+        std::size_t TotalSize = getBigEndian16(Packet + 2);
+        // More fragments flag or fragment offset
+        bool Fragment = (getBigEndian16(Packet + 6) & 0x3fff) != 0;
+        if (HeaderSize < 20 || TotalSize < HeaderSize || TotalSize > Size || Fragment || Packet[9] != 17) {
+            return false;
+        }
+        Decoded.Source = makeIPv4Endpoint(Packet + 12, 0);
+        Decoded.Destination = makeIPv4Endpoint(Packet + 16, 0);
+        Segment = Packet + HeaderSize;
+        SegmentSize = TotalSize - HeaderSize;
+    } else if (Packet[0] >> 4 == 6) {
+        if (Size < 40) {
+            return false;
+        }
+        std::size_t TotalSize = 40u + getBigEndian16(Packet + 4);
+        if (TotalSize > Size) {
+            return false;
+        }
+        Decoded.Source = makeIPv6Endpoint(Packet + 8, 0);
+        Decoded.Destination = makeIPv6Endpoint(Packet + 24, 0);
+        auto Next = Packet[6];
+        std::size_t Offset = 40;
+        // Hop-by-hop, routing and destination options extension headers
+        while (Next == 0 || Next == 43 || Next == 60) {
+            if (Offset + 8 > TotalSize) {
+                return false;
+            }
+            Next = Packet[Offset];
+            Offset += (Packet[Offset + 1] + 1u) * 8;
+        }
+        if (Next != 17 || Offset > TotalSize) {
+            return false;
+        }
+        Segment = Packet + Offset;
+        SegmentSize = TotalSize - Offset;
+    } else {
+        return false;
+    }
+    if (SegmentSize < 8) {
+        return false;
+    }
+    std::size_t Length = getBigEndian16(Segment + 4);
+    if (Length < 8 || Length > SegmentSize) {
+        return false;
+    }
+    Decoded.Source.Port = getBigEndian16(Segment);
+    Decoded.Destination.Port = getBigEndian16(Segment + 2);
+    Decoded.Payload = Segment + 8;
+    Decoded.Size = Length - 8;
+    return true;
+}
+
+/// Decode the link-layer header of the captured frame
+inline bool decodeFrame(std::uint32_t Link, const std::uint8_t *Frame, std::size_t Size, Datagram &Decoded) noexcept {
+    switch (Link) {
+    case links::Null: {
+        if (Size < 4) {
+            return false;
+        }
+        // AF_INET is 2 everywhere, AF_INET6 differs between systems, either way it fits into one byte
+        auto Family = Frame[0] != 0 ? Frame[0] : Frame[3];
+        if (Family != 2 && Family != 10 && Family != 24 && Family != 28 && Family != 30) {
+            return false;
+        }
+        return decodeIP(Frame + 4, Size - 4, Decoded);
+    }
+    case links::Ethernet: {
+        std::size_t Offset = 12;
+        while (Offset + 2 <= Size) {
+            auto EtherType = getBigEndian16(Frame + Offset);
+            // 802.1Q and 802.1ad tags
+            if (EtherType == 0x8100 || EtherType == 0x88a8) {
+                Offset += 4;
+                continue;
+            }
+            if (EtherType != 0x0800 && EtherType != 0x86dd) {
+                return false;
+            }
+            return decodeIP(Frame + Offset + 2, Size - Offset - 2, Decoded);
+        }
+        return false;
+    }
+    case links::Raw:
+    // DLT_RAW values of some systems
+    case 12:
+    case 14:
+        return decodeIP(Frame, Size, Decoded);
+    case links::LinuxCooked:
+        return Size >= 16 && decodeIP(Frame + 16, Size - 16, Decoded);
+    case links::LinuxCooked2:
+        return Size >= 20 && decodeIP(Frame + 20, Size - 20, Decoded);
+    default:
+        return false;
+    }
+}
+
+} // namespace details
+
+/// Reader of UDP datagrams from pcap and pcapng captures
+/// @n The whole capture is expected to be in memory (see loadCapture), datagrams point into it. Frames other than
+/// unfragmented UDP over IPv4 or IPv6 on Ethernet (with VLAN tags), raw IP, Linux cooked and BSD loopback links are
+/// skipped, so are frames cut by the snapshot length. Both byte orders and nanosecond resolution are supported.
+class CaptureReader final {
+  public:
+    enum class Format { Pcap, PcapNG };
+
+    /// Start reading the capture
+    /// @param[Buffer] Assumptions: \p Buffer stays valid while the datagrams are used
+    /// @return std::errc::invalid_argument if the buffer doesn't start with a pcap or pcapng header
+    std::error_code open(const std::uint8_t *Buffer_, std::size_t Size_) {
+        Buffer = Buffer_;
+        Size = Size_;
+        Offset = 0;
+        Interfaces.clear();
+        if (Size >= 24) {
+            auto Magic = details::getLittleEndian32(Buffer);
+            auto SwappedMagic = details::getBigEndian32(Buffer);
+            if (Magic == 0xa1b2c3d4 || Magic == 0xa1b23c4d || SwappedMagic == 0xa1b2c3d4 ||
+                SwappedMagic == 0xa1b23c4d) {
+                Type = Format::Pcap;
+                BigEndian = SwappedMagic == 0xa1b2c3d4 || SwappedMagic == 0xa1b23c4d;
+                auto Nanoseconds = (BigEndian ? SwappedMagic : Magic) == 0xa1b23c4d;
+                // The upper bits of the link type field carry the frame check sequence length
+                Interfaces.push_back(Interface{getInteger(Buffer + 20) & 0xffff, false, Nanoseconds ? 9u : 6u});
+                Offset = 24;
+                return {};
+            }
+        }
+        if (Size >= 12 && details::getBigEndian32(Buffer) == SectionHeaderBlock) {
+            Type = Format::PcapNG;
+            return {};
+        }
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    /// @return Next UDP datagram or std::nullopt at the end of the capture
+    std::optional<Datagram> next() {
+        while (Offset < Size) {
+            Datagram Decoded;
+            std::uint32_t Link;
+            const std::uint8_t *Frame;
+            std::size_t FrameSize;
+            bool Found = Type == Format::Pcap ? nextRecord(Decoded.Timestamp, Link, Frame, FrameSize)
+                                              : nextBlock(Decoded.Timestamp, Link, Frame, FrameSize);
+            if (!Found) {
+                continue;
+            }
+            ++FramesCount;
+            if (details::decodeFrame(Link, Frame, FrameSize, Decoded)) {
+                return Decoded;
+            }
+            ++SkippedCount;
+        }
+        return std::nullopt;
+    }
+
+    Format getFormat() const noexcept { return Type; }
+
+    /// @return Number of the frames read so far
+    std::size_t getFramesCount() const noexcept { return FramesCount; }
+
+    /// @return Number of the frames which weren't UDP datagrams, were cut or had timestamps finer than 2^-30 seconds
+    std::size_t getSkippedCount() const noexcept { return SkippedCount; }
+
+    /// @return true if the capture ends in the middle of a record
+    bool isTruncated() const noexcept { return Truncated; }
+
+  private:
+    static constexpr std::uint32_t SectionHeaderBlock = 0x0a0d0d0a;
+    static constexpr std::uint32_t InterfaceDescriptionBlock = 1;
+    static constexpr std::uint32_t SimplePacketBlock = 3;
+    static constexpr std::uint32_t EnhancedPacketBlock = 6;
+
+    struct Interface {
+        std::uint32_t Link;
+        /// Timestamps are in units of 2^-Exponent seconds if true, 10^-Exponent otherwise
+        bool Binary;
+        unsigned Exponent;
+    };
+
+    /// Finest binary resolution converted to nanoseconds without overflow, the finer ones are rejected
+    static constexpr unsigned MaxBinaryExponent = 30;
+
+    std::uint32_t getInteger(const std::uint8_t *Bytes) const noexcept {
+        return BigEndian ? details::getBigEndian32(Bytes) : details::getLittleEndian32(Bytes);
+    }
+
+    std::uint16_t getShort(const std::uint8_t *Bytes) const noexcept {
+        return BigEndian ? details::getBigEndian16(Bytes) : static_cast<std::uint16_t>(Bytes[1] << 8 | Bytes[0]);
+    }
+
+    static std::uint64_t toNanoseconds(const Interface &Source, std::uint64_t Units) noexcept {
+        if (Source.Binary) {
+            assert(Source.Exponent <= MaxBinaryExponent);
+            auto Mask = (std::uint64_t(1) << Source.Exponent) - 1;
+            return (Units >> Source.Exponent) * 1000000000 + ((Units & Mask) * 1000000000 >> Source.Exponent);
+        }
+        std::uint64_t Scale = 1;
+        for (auto Exponent = Source.Exponent; Exponent < 9; ++Exponent) {
+            Scale *= 10;
+        }
+        for (auto Exponent = Source.Exponent; Exponent > 9; --Exponent) {
+            Units /= 10;
+        }
+        return Units * Scale;
+    }
+
+    void stop() noexcept {
+        Truncated = Offset != Size;
+        Offset = Size;
+    }
+
+    bool nextRecord(std::uint64_t &Timestamp, std::uint32_t &Link, const std::uint8_t *&Frame,
+                    std::size_t &FrameSize) {
+        if (Size - Offset < 16) {
+            stop();
+            return false;
+        }
+        const auto *Record = Buffer + Offset;
+        auto Captured = getInteger(Record + 8);
+        if (Size - Offset - 16 < Captured) {
+            stop();
+            return false;
+        }
+        Timestamp = std::uint64_t(getInteger(Record)) * 1000000000 +
+                    toNanoseconds(Interface{0, false, Interfaces[0].Exponent}, getInteger(Record + 4));
+        Link = Interfaces[0].Link;
+        Frame = Record + 16;
+        FrameSize = Captured;
+        Offset += 16 + Captured;
+        return true;
+    }
+
+    bool nextBlock(std::uint64_t &Timestamp, std::uint32_t &Link, const std::uint8_t *&Frame,
+                   std::size_t &FrameSize) {
+        if (Size - Offset < 12) {
+            stop();
+            return false;
+        }
+        const auto *Block = Buffer + Offset;
+        if (details::getBigEndian32(Block) == SectionHeaderBlock) {
+            // Every section may have its own byte order and interfaces
+            BigEndian = details::getBigEndian32(Block + 8) == 0x1a2b3c4d;
+            Interfaces.clear();
+        }
+        auto Type_ = getInteger(Block);
+        auto Length = getInteger(Block + 4);
+        if (Length < 12 || Length % 4 != 0 || Size - Offset < Length) {
+            stop();
+            return false;
+        }
+        Offset += Length;
+        const auto *Body = Block + 8;
+        std::size_t BodySize = Length - 12;
+
+        if (Type_ == InterfaceDescriptionBlock && BodySize >= 8) {
+            Interface Described{getShort(Body), false, 6};
+            // Options, looking for the timestamp resolution (if_tsresol)
+            for (std::size_t Option = 8; Option + 4 <= BodySize;) {
+                auto Code = getShort(Body + Option);
+                auto OptionSize = getShort(Body + Option + 2);
+                if (Code == 0 || Option + 4 + OptionSize > BodySize) {
+                    break;
+                }
+                if (Code == 9 && OptionSize == 1) {
+                    Described.Binary = (Body[Option + 4] & 0x80) != 0;
+                    Described.Exponent = Body[Option + 4] & 0x7f;
+                }
+                Option += 4 + (OptionSize + 3u) / 4 * 4;
+            }
+            Interfaces.push_back(Described);
+        } else if (Type_ == EnhancedPacketBlock && BodySize >= 20) {
+            auto Index = getInteger(Body);
+            auto Captured = getInteger(Body + 12);
+            if (Index >= Interfaces.size() || Captured > BodySize - 20 ||
+                (Interfaces[Index].Binary && Interfaces[Index].Exponent > MaxBinaryExponent)) {
+                ++SkippedCount;
+                return false;
+            }
+            auto Units = std::uint64_t(getInteger(Body + 4)) << 32 | getInteger(Body + 8);
+            Timestamp = toNanoseconds(Interfaces[Index], Units);
+            Link = Interfaces[Index].Link;
+            Frame = Body + 20;
+            FrameSize = Captured;
+            return true;
+        } else if (Type_ == SimplePacketBlock && BodySize >= 4 && !Interfaces.empty()) {
+            // No timestamp, the frame may be followed by padding
+            Timestamp = 0;
+            Link = Interfaces[0].Link;
+            Frame = Body + 4;
+            FrameSize = std::min<std::size_t>(getInteger(Body), BodySize - 4);
+            return true;
+        }
+        return false;
+    }
+
+    const std::uint8_t *Buffer = nullptr;
+    std::size_t Size = 0;
+    std::size_t Offset = 0;
+    Format Type = Format::Pcap;
+    bool BigEndian = false;
+    bool Truncated = false;
+    std::vector<Interface> Interfaces;
+    std::size_t FramesCount = 0;
+    std::size_t SkippedCount = 0;
+};
+
+/// Load the whole capture file into memory
+inline std::error_code loadCapture(const std::string &Path, std::vector<std::uint8_t> &Buffer) {
+    std::ifstream File(Path, std::ios::binary);
+    if (!File) {
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    Buffer.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+    if (File.bad()) {
+        return std::make_error_code(std::errc::io_error);
+    }
+    return {};
+}
+
+/// Filter picking TFTP datagrams out of the captured UDP traffic
+/// @n Requests are recognized by the server port. The transfers they start use other ports on the server side, so the
+/// client endpoints of the requests are remembered and the datagrams from or to them are taken for TFTP as well.
+class TftpFilter final {
+  public:
+    explicit TftpFilter(std::uint16_t ServerPort = 69) : ServerPort(ServerPort) {}
+
+    bool accept(const Datagram &Captured) {
+        auto Request = Captured.Size >= 2 && Captured.Payload[0] == 0 &&
+                       (Captured.Payload[1] == packets::types::ReadRequest ||
+                        Captured.Payload[1] == packets::types::WriteRequest);
+        if (Captured.Destination.Port == ServerPort && Request) {
+            Clients.insert(Captured.Source);
+            return true;
+        }
+        return Captured.Source.Port == ServerPort || Clients.count(Captured.Source) != 0 ||
+               Clients.count(Captured.Destination) != 0;
+    }
+
+  private:
+    struct EndpointHash {
+        std::size_t operator()(const transfer::TransferID &ID) const noexcept {
+            return static_cast<std::size_t>(ID.hash());
+        }
+    };
+
+    std::uint16_t ServerPort;
+    std::unordered_set<transfer::TransferID, EndpointHash> Clients;
+};
+
+/// Writer of pcap captures of IPv4 UDP datagrams (without a link-layer header), e.g. to record synthetic traffic
+class CaptureWriter final {
+  public:
+    CaptureWriter() {
+        // Nanosecond resolution, version 2.4, snapshot length, link type
+        for (std::uint32_t Field : {0xa1b23c4du, 0x00040002u, 0u, 0u, 65535u, std::uint32_t(links::Raw)}) {
+            details::putLittleEndian32(Buffer, Field);
+        }
+    }
+
+    /// Append the datagram
+    /// @param[Source] Assumptions: \p Source and \p Destination are IPv4 endpoints
+    /// @param[Size] Assumptions: \p Size is not greater than 65507
+    void write(std::uint64_t Timestamp, const transfer::TransferID &Source, const transfer::TransferID &Destination,
+               const std::uint8_t *Payload, std::size_t Size) {
+        assert(Size <= 65507);
+        auto TotalSize = static_cast<std::uint32_t>(Size + 28);
+        details::putLittleEndian32(Buffer, static_cast<std::uint32_t>(Timestamp / 1000000000));
+        details::putLittleEndian32(Buffer, static_cast<std::uint32_t>(Timestamp % 1000000000));
+        details::putLittleEndian32(Buffer, TotalSize);
+        details::putLittleEndian32(Buffer, TotalSize);
+
+        std::uint8_t Header[28] = {0x45, 0, static_cast<std::uint8_t>(TotalSize >> 8),
+                                   static_cast<std::uint8_t>(TotalSize), 0, 0, 0x40, 0, 64, 17};
+        std::memcpy(Header + 12, Source.Address.data() + 12, 4);
+        std::memcpy(Header + 16, Destination.Address.data() + 12, 4);
+        std::uint32_t Sum = 0;
+        for (std::size_t Idx = 0; Idx != 20; Idx += 2) {
+            Sum += details::getBigEndian16(Header + Idx);
+        }
+        Sum = (Sum & 0xffff) + (Sum >> 16);
+        Sum = ~((Sum & 0xffff) + (Sum >> 16));
+        Header[10] = static_cast<std::uint8_t>(Sum >> 8);
+        Header[11] = static_cast<std::uint8_t>(Sum);
+        // The UDP checksum is optional over IPv4
+        Header[20] = static_cast<std::uint8_t>(Source.Port >> 8);
+        Header[21] = static_cast<std::uint8_t>(Source.Port);
+        Header[22] = static_cast<std::uint8_t>(Destination.Port >> 8);
+        Header[23] = static_cast<std::uint8_t>(Destination.Port);
+        Header[24] = static_cast<std::uint8_t>((Size + 8) >> 8);
+        Header[25] = static_cast<std::uint8_t>(Size + 8);
+        Buffer.insert(Buffer.end(), Header, Header + 28);
+        Buffer.insert(Buffer.end(), Payload, Payload + Size);
+    }
+
+    const std::vector<std::uint8_t> &getBuffer() const noexcept { return Buffer; }
+
+    std::error_code save(const std::string &Path) const {
+        std::ofstream File(Path, std::ios::binary);
+        File.write(reinterpret_cast<const char *>(Buffer.data()), static_cast<std::streamsize>(Buffer.size()));
+        if (!File) {
+            return std::make_error_code(std::errc::io_error);
+        }
+        return {};
+    }
+
+  private:
+    std::vector<std::uint8_t> Buffer;
+};
+
+} // namespace tftp_common::capture
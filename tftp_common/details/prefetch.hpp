@@ -0,0 +1,370 @@
+#pragma once
+
+#include "pacing.hpp"
+#include "path_cache.hpp"
+#include "session_table.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tftp_common::transfer {
+
+/// Warms the storage cache for files predicted to be requested soon
+class PrefetchAdvisor {
+  public:
+    virtual ~PrefetchAdvisor() = default;
+
+    /// @return Size of the file or std::nullopt if it can't be served
+    virtual std::optional<std::uint64_t> getSize(const std::string &Filename) = 0;
+
+    /// Start reading the first \p Bytes of the file into the cache without waiting for them
+    virtual void advise(const std::string &Filename, std::uint64_t Bytes) = 0;
+};
+
+/// Advisor for the files of a served root directory
+/// @n `posix_fadvise(POSIX_FADV_WILLNEED)` starts an asynchronous readahead of the file into the page cache, the
+/// request handler finds the blocks there instead of waiting for the disk (or the network storage).
+class FileAdvisor final : public PrefetchAdvisor {
+  public:
+    FileAdvisor() = default;
+    FileAdvisor(const FileAdvisor &) = delete;
+    FileAdvisor &operator=(const FileAdvisor &) = delete;
+    ~FileAdvisor() {
+        if (RootDescriptor != -1) {
+            ::close(RootDescriptor);
+        }
+    }
+
+    /// Open the served root directory, filenames are sanitized by sanitizeFilename and resolved beneath it by
+    /// openBeneath, like by PathCache
+    std::error_code open(const std::string &Root) {
+        assert(RootDescriptor == -1);
+        RootDescriptor = ::open(Root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (RootDescriptor == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        return {};
+    }
+
+    std::optional<std::uint64_t> getSize(const std::string &Filename) override {
+        auto Path = sanitizeFilename(Filename);
+        int Fd = Path ? openBeneath(RootDescriptor, *Path) : -1;
+        if (Fd == -1) {
+            return std::nullopt;
+        }
+        struct stat Status;
+        auto Regular = ::fstat(Fd, &Status) == 0 && S_ISREG(Status.st_mode);
+        ::close(Fd);
+        if (!Regular) {
+            return std::nullopt;
+        }
+        return static_cast<std::uint64_t>(Status.st_size);
+    }
+
+    void advise(const std::string &Filename, std::uint64_t Bytes) override {
+        auto Path = sanitizeFilename(Filename);
+        if (!Path || Bytes == 0) {
+            return;
+        }
+        int Fd = openBeneath(RootDescriptor, *Path);
+        if (Fd == -1) {
+            return;
+        }
+        ::posix_fadvise(Fd, 0, static_cast<off_t>(Bytes), POSIX_FADV_WILLNEED);
+        ::close(Fd);
+    }
+
+  private:
+    int RootDescriptor = -1;
+};
+
+/// Limits of the prefetcher
+struct PrefetchSettings {
+    /// Files whose successors are tracked, over all classes
+    std::size_t MaxFiles = 4096;
+    /// Successors tracked per file, the least frequent one is replaced by a new one
+    std::size_t MaxSuccessors = 4;
+    /// Clients whose last request is remembered
+    std::size_t MaxClients = 65536;
+    /// A request coming later than this after the previous one of the client doesn't continue its sequence
+    std::chrono::seconds ClientTimeout{300};
+    /// Observations and the share of the transitions from the file a successor needs to be predicted
+    std::uint32_t MinObservations = 2;
+    double MinShare = 0.25;
+    /// Files prefetched after each request
+    std::size_t MaxPredictions = 2;
+    /// Bytes of the beginning of a file that are prefetched, not greater than BudgetBurst
+    std::uint64_t MaxFileBytes = 64ull << 20;
+    /// Budget of the prefetched bytes: rate in bytes per second (zero means unlimited) and burst in bytes
+    std::uint64_t BudgetRate = 128ull << 20;
+    std::uint64_t BudgetBurst = 256ull << 20;
+    /// A file isn't prefetched again until this passes
+    std::chrono::seconds Cooldown{30};
+};
+
+/// Predictive prefetcher for the boot sequences of network clients
+/// @n PXE clients request a predictable sequence of files (e.g. `pxelinux.0`, `ldlinux.c32`, the configuration
+/// probes, the kernel, the initrd). The prefetcher learns which file follows which one for each class of clients
+/// (e.g. the client architecture, the vendor class or the subnet) from the read requests, and on each request warms
+/// the cache for its likely successors with PrefetchAdvisor, ahead of the client asking for them.
+/// @n Memory is bounded by PrefetchSettings::MaxFiles, MaxSuccessors and MaxClients; the least recently used files and
+/// clients are forgotten first. Transition counts are halved every 1024 transitions from a file, so that the model
+/// follows changes of the boot sequence. Prefetched bytes are limited by a token bucket. Not thread-safe.
+class Prefetcher final {
+  public:
+    using Clock = TokenBucket::Clock;
+
+    explicit Prefetcher(PrefetchAdvisor &Advisor, const PrefetchSettings &Settings = PrefetchSettings{})
+        : Advisor(Advisor), Settings(Settings), Budget(Settings.BudgetRate, Settings.BudgetBurst) {
+        assert(Settings.MaxFiles > 0 && Settings.MaxSuccessors > 0 && Settings.MaxClients > 0);
+        assert(Settings.BudgetRate == 0 || Settings.MaxFileBytes <= Settings.BudgetBurst);
+    }
+
+    /// Record the read request of the client and prefetch the files likely to follow it
+    /// @param[Class] Class of the client, sequences are learned separately for each class
+    /// @return Number of files prefetched
+    std::size_t observe(const TransferID &Client, std::string_view Class, std::string_view Filename,
+                        Clock::time_point Now = Clock::now()) {
+        auto Key = makeKey(Class, Filename);
+        auto ClientKey = TransferID{Client.Address, 0};
+        auto Known = Clients.find(ClientKey);
+        if (Known != Clients.end() && Now - Known->second.Seen <= Settings.ClientTimeout &&
+            Known->second.Key != Key) {
+            // Retries of the same request aren't transitions
+            record(Known->second.Key, Filename);
+        }
+        if (Known == Clients.end()) {
+            if (Clients.size() >= Settings.MaxClients) {
+                evictClients(Now);
+            }
+            Known = Clients.try_emplace(ClientKey).first;
+        }
+        Known->second.Seen = Now;
+
+        std::size_t Prefetched = 0;
+        auto Current = Nodes.find(Key);
+        if (Current != Nodes.end()) {
+            Current->second.LastUse = ++Tick;
+            for (const auto *Next : getLikely(Current->second)) {
+                Prefetched += prefetch(Next->Filename, Now);
+            }
+        }
+        Known->second.Key = std::move(Key);
+        return Prefetched;
+    }
+
+    /// @return Files likely to be requested after \p Filename by the clients of the class, the most likely first
+    std::vector<std::string> predict(std::string_view Class, std::string_view Filename) const {
+        std::vector<std::string> Predicted;
+        auto Current = Nodes.find(makeKey(Class, Filename));
+        if (Current != Nodes.end()) {
+            for (const auto *Next : getLikely(Current->second)) {
+                Predicted.push_back(Next->Filename);
+            }
+        }
+        return Predicted;
+    }
+
+    /// @return Number of files with tracked successors
+    std::size_t getFilesCount() const noexcept { return Nodes.size(); }
+
+    std::size_t getClientsCount() const noexcept { return Clients.size(); }
+
+    std::uint64_t getPrefetchedCount() const noexcept { return PrefetchedCount; }
+
+    std::uint64_t getPrefetchedBytes() const noexcept { return PrefetchedBytes; }
+
+    /// @return Number of predicted files that weren't prefetched because the budget was exhausted
+    std::uint64_t getThrottledCount() const noexcept { return ThrottledCount; }
+
+  private:
+    struct Successor {
+        std::string Filename;
+        std::uint32_t Count = 0;
+    };
+
+    /// Transitions from a file, successors are sorted by their count in the descending order
+    struct Node {
+        std::vector<Successor> Successors;
+        std::uint32_t Total = 0;
+        std::uint64_t LastUse = 0;
+    };
+
+    struct ClientState {
+        std::string Key;
+        Clock::time_point Seen;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const TransferID &Key) const noexcept { return static_cast<std::size_t>(Key.hash()); }
+    };
+
+    static constexpr std::uint32_t DecayThreshold = 1024;
+
+    static std::string makeKey(std::string_view Class, std::string_view Filename) {
+        std::string Key;
+        Key.reserve(Class.size() + 1 + Filename.size());
+        Key.append(Class).push_back('\0');
+        Key.append(Filename);
+        return Key;
+    }
+
+    std::vector<const Successor *> getLikely(const Node &From) const {
+        std::vector<const Successor *> Likely;
+        for (const auto &Next : From.Successors) {
+            if (Likely.size() == Settings.MaxPredictions || Next.Count < Settings.MinObservations ||
+                Next.Count < Settings.MinShare * From.Total) {
+                break;
+            }
+            Likely.push_back(&Next);
+        }
+        return Likely;
+    }
+
+    void record(const std::string &FromKey, std::string_view Filename) {
+        auto It = Nodes.find(FromKey);
+        if (It == Nodes.end()) {
+            if (Nodes.size() >= Settings.MaxFiles) {
+                evictFiles();
+            }
+            It = Nodes.try_emplace(FromKey).first;
+        }
+        auto &From = It->second;
+        From.LastUse = ++Tick;
+        ++From.Total;
+
+        auto &Successors = From.Successors;
+        auto Next = std::find_if(Successors.begin(), Successors.end(),
+                                 [&](const Successor &Known) { return Known.Filename == Filename; });
+        if (Next != Successors.end()) {
+            ++Next->Count;
+        } else if (Successors.size() < Settings.MaxSuccessors) {
+            Successors.push_back(Successor{std::string(Filename), 1});
+            Next = Successors.end() - 1;
+        } else {
+            // The new successor inherits the count of the least frequent one it replaces (space-saving), so that
+            // a rare successor doesn't keep pushing out another one
+            Next = Successors.end() - 1;
+            Next->Filename = std::string(Filename);
+            ++Next->Count;
+        }
+        for (; Next != Successors.begin() && (Next - 1)->Count < Next->Count; --Next) {
+            std::swap(*Next, *(Next - 1));
+        }
+
+        if (From.Total >= DecayThreshold) {
+            From.Total = 0;
+            for (auto &Known : Successors) {
+                Known.Count /= 2;
+                From.Total += Known.Count;
+            }
+            Successors.erase(std::find_if(Successors.begin(), Successors.end(),
+                                          [](const Successor &Known) { return Known.Count == 0; }),
+                             Successors.end());
+        }
+    }
+
+    bool prefetch(const std::string &Filename, Clock::time_point Now) {
+        auto [It, Inserted] = Advised.try_emplace(Filename, Now);
+        if (!Inserted) {
+            if (Now - It->second < Settings.Cooldown) {
+                return false;
+            }
+            It->second = Now;
+        } else if (Advised.size() > Settings.MaxFiles) {
+            evictAdvised(Now);
+            It = Advised.try_emplace(Filename, Now).first;
+        }
+        auto Size = Advisor.getSize(Filename);
+        auto Bytes = std::min(Size.value_or(0), Settings.MaxFileBytes);
+        if (Bytes == 0) {
+            return false;
+        }
+        if (!Budget.tryConsume(Bytes, Now)) {
+            // It may be prefetched once the budget allows
+            Advised.erase(It);
+            ++ThrottledCount;
+            return false;
+        }
+        Advisor.advise(Filename, Bytes);
+        ++PrefetchedCount;
+        PrefetchedBytes += Bytes;
+        return true;
+    }
+
+    /// Forget the least recently used quarter of the files
+    void evictFiles() {
+        std::vector<std::pair<std::uint64_t, const std::string *>> Uses;
+        Uses.reserve(Nodes.size());
+        for (const auto &[Key, Known] : Nodes) {
+            Uses.emplace_back(Known.LastUse, &Key);
+        }
+        auto Evicted = std::max<std::size_t>(1, Uses.size() / 4);
+        std::nth_element(Uses.begin(), Uses.begin() + static_cast<std::ptrdiff_t>(Evicted - 1), Uses.end());
+        std::vector<std::string> Keys;
+        for (std::size_t Idx = 0; Idx != Evicted; ++Idx) {
+            Keys.push_back(*Uses[Idx].second);
+        }
+        for (const auto &Key : Keys) {
+            Nodes.erase(Key);
+        }
+    }
+
+    /// Forget the clients whose sequences have timed out, or the least recently seen quarter if there are none
+    void evictClients(Clock::time_point Now) {
+        for (auto It = Clients.begin(); It != Clients.end();) {
+            It = Now - It->second.Seen > Settings.ClientTimeout ? Clients.erase(It) : std::next(It);
+        }
+        if (Clients.size() < Settings.MaxClients) {
+            return;
+        }
+        std::vector<Clock::time_point> Seen;
+        Seen.reserve(Clients.size());
+        for (const auto &[Key, State] : Clients) {
+            Seen.push_back(State.Seen);
+        }
+        auto Evicted = std::max<std::size_t>(1, Seen.size() / 4);
+        std::nth_element(Seen.begin(), Seen.begin() + static_cast<std::ptrdiff_t>(Evicted - 1), Seen.end());
+        auto Oldest = Seen[Evicted - 1];
+        for (auto It = Clients.begin(); It != Clients.end();) {
+            It = It->second.Seen <= Oldest ? Clients.erase(It) : std::next(It);
+        }
+    }
+
+    /// Forget the files whose cooldown has passed, or all of them if there are none
+    void evictAdvised(Clock::time_point Now) {
+        for (auto It = Advised.begin(); It != Advised.end();) {
+            It = Now - It->second >= Settings.Cooldown ? Advised.erase(It) : std::next(It);
+        }
+        if (Advised.size() > Settings.MaxFiles) {
+            Advised.clear();
+        }
+    }
+
+    PrefetchAdvisor &Advisor;
+    PrefetchSettings Settings;
+    TokenBucket Budget;
+    std::unordered_map<std::string, Node> Nodes;
+    std::unordered_map<TransferID, ClientState, KeyHash> Clients;
+    /// Prefetched files and when they were prefetched
+    std::unordered_map<std::string, Clock::time_point> Advised;
+    std::uint64_t Tick = 0;
+    std::uint64_t PrefetchedCount = 0;
+    std::uint64_t PrefetchedBytes = 0;
+    std::uint64_t ThrottledCount = 0;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace tftp_common::transfer {
+
+/// Source of the contents of a read request (RRQ) generated on the fly, e.g. a per-client boot menu
+/// @n The contents are pulled sequentially, only when the transfer needs the next block.
+class Producer {
+  public:
+    virtual ~Producer() = default;
+
+    /// Produce the next bytes of the contents
+    /// @return Number of bytes written into \p Buffer, up to \p Size; zero means the end of the contents
+    virtual std::size_t produce(std::uint8_t *Buffer, std::size_t Size) = 0;
+
+    /// @return Size of the contents or std::nullopt if it isn't known in advance (the transfer size option is omitted)
+    virtual std::optional<std::uint64_t> getSize() const { return std::nullopt; }
+};
+
+/// Producer calling a function for the next bytes of the contents
+class FunctionProducer final : public Producer {
+  public:
+    using Function = std::function<std::size_t(std::uint8_t *Buffer, std::size_t Size)>;
+
+    explicit FunctionProducer(Function Generate, std::optional<std::uint64_t> Size = std::nullopt)
+        : Generate(std::move(Generate)), Size(Size) {}
+
+    std::size_t produce(std::uint8_t *Buffer, std::size_t Size_) override { return Generate(Buffer, Size_); }
+
+    std::optional<std::uint64_t> getSize() const override { return Size; }
+
+  private:
+    Function Generate;
+    std::optional<std::uint64_t> Size;
+};
+
+/// Block of the streamed contents, valid until the block is acknowledged
+struct BlockView {
+    const std::uint8_t *Data;
+    std::size_t Size;
+};
+
+/// Window of Data blocks pulled from the producer on demand
+/// @n At most one window of blocks is buffered: blocks are produced when the transfer asks for them and released once
+/// they are acknowledged, so the producer is held back by the client (backpressure) and retransmissions are served
+/// from the buffer. Block numbers roll over from 65535 to 0, so the contents may be of any size.
+class StreamingSource final {
+  public:
+    /// @param[BlockSize] Assumptions: \p BlockSize is the negotiated block size (RFC 2348), it is greater than zero
+    /// @param[WindowSize] Assumptions: \p WindowSize is the negotiated window size (RFC 7440), it is greater than zero
+    StreamingSource(Producer &Source, std::size_t BlockSize, std::uint16_t WindowSize = 1)
+        : Source(Source), BlockSize(BlockSize), WindowSize(WindowSize), Buffer(BlockSize * WindowSize),
+          Sizes(WindowSize, 0) {
+        assert(BlockSize > 0);
+        assert(WindowSize > 0);
+    }
+
+    /// @return Data field of the block or std::nullopt if it lies beyond the window of unacknowledged blocks or beyond
+    /// the end of the contents
+    std::optional<BlockView> getBlock(std::uint16_t Block) {
+        std::uint16_t Offset = static_cast<std::uint16_t>(Block - static_cast<std::uint16_t>(Acknowledged + 1));
+        if (Offset >= WindowSize) {
+            return std::nullopt;
+        }
+        auto Number = Acknowledged + 1 + Offset;
+        while (Produced < Number) {
+            if (LastBlock && Produced == *LastBlock) {
+                return std::nullopt;
+            }
+            produceNext();
+        }
+        auto Slot = (Number - 1) % WindowSize;
+        return BlockView{Buffer.data() + Slot * BlockSize, Sizes[Slot]};
+    }
+
+    /// Release the acknowledged blocks, making room for the next ones
+    /// @return Number of the released blocks, zero for duplicate and unexpected acknowledgments
+    std::size_t onAcknowledgment(std::uint16_t Block) noexcept {
+        std::uint16_t Offset = static_cast<std::uint16_t>(Block - static_cast<std::uint16_t>(Acknowledged));
+        if (Offset == 0 || Offset > Produced - Acknowledged) {
+            return 0;
+        }
+        Acknowledged += Offset;
+        return Offset;
+    }
+
+    /// @return Number of the first block that hasn't been acknowledged yet
+    std::uint16_t getFirstUnacknowledged() const noexcept { return static_cast<std::uint16_t>(Acknowledged + 1); }
+
+    /// @return true if the final (short) block has been acknowledged
+    bool isComplete() const noexcept { return LastBlock && Acknowledged == *LastBlock; }
+
+    /// @return Number of bytes pulled from the producer so far
+    std::uint64_t getBytesProduced() const noexcept { return BytesProduced; }
+
+    /// @return Memory used for buffering, it doesn't depend on the size of the contents
+    std::size_t getBufferSize() const noexcept { return Buffer.size(); }
+
+  private:
+    /// Fill the slot of the next block, the producer is called until the block is full or the contents end
+    void produceNext() {
+        auto Slot = Produced % WindowSize;
+        auto *Data = Buffer.data() + Slot * BlockSize;
+        std::size_t Size = 0;
+        while (Size < BlockSize) {
+            auto Count = Source.produce(Data + Size, BlockSize - Size);
+            assert(Count <= BlockSize - Size);
+            if (Count == 0) {
+                break;
+            }
+            Size += Count;
+        }
+        Sizes[Slot] = Size;
+        BytesProduced += Size;
+        ++Produced;
+        if (Size < BlockSize) {
+            LastBlock = Produced;
+        }
+    }
+
+    Producer &Source;
+    std::size_t BlockSize;
+    std::uint16_t WindowSize;
+    std::vector<std::uint8_t> Buffer;
+    std::vector<std::size_t> Sizes;
+    /// Numbers of blocks counted from one without rolling over
+    std::uint64_t Acknowledged = 0;
+    std::uint64_t Produced = 0;
+    std::optional<std::uint64_t> LastBlock;
+    std::uint64_t BytesProduced = 0;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,437 @@
+#pragma once
+
+#include "client.hpp"
+#include "path_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tftp_common::async {
+
+/// Settings of CachingRelay
+struct RelaySettings {
+    /// Options of the fetches from the upstream server: large blocks and windows make up for the round trip time of
+    /// the WAN link (blocks greater than the path MTU are fragmented)
+    ClientOptions Upstream = [] {
+        ClientOptions Options;
+        Options.BlockSize = 8192;
+        Options.WindowSize = 16;
+        return Options;
+    }();
+    /// Largest block size negotiated with local clients
+    std::size_t MaxBlockSize = packets::Data::MaxBlockSize;
+    /// Number of retransmissions to a local client before its transfer is abandoned
+    unsigned MaxRetries = 5;
+    /// Cached files modified longer ago than this are revalidated with the upstream server before they are served
+    std::chrono::seconds MaxAge{300};
+};
+
+namespace details {
+
+/// File of the relay cache, either complete on disk or being fetched from the upstream server
+struct RelayEntry {
+    RelayEntry() = default;
+    RelayEntry(const RelayEntry &) = delete;
+    RelayEntry &operator=(const RelayEntry &) = delete;
+    ~RelayEntry() {
+        if (Descriptor != -1) {
+            ::close(Descriptor);
+        }
+    }
+
+    /// Cached file or the temporary file the fetch writes to, read with `pread`
+    int Descriptor = -1;
+    /// Number of bytes written from the beginning of the file
+    std::uint64_t Available = 0;
+    /// Size of the file reported by the upstream server, if it has reported it
+    std::optional<std::uint64_t> Size;
+    /// The upstream server has acknowledged the options (so Size is known) or the cached file is valid
+    bool Accepted = false;
+    bool Complete = false;
+    /// Failure of the fetch and the message of the Error packet sent by the upstream server, if any
+    std::error_code Error;
+    std::string Message;
+    /// Sockets of the local transfers waiting for the fetch, their receptions are interrupted once it makes progress
+    std::vector<UdpSocket *> Waiting;
+
+    /// @return Whether the fetch has written \p Needed bytes (once the options are acknowledged), completed or failed
+    bool isAvailable(std::uint64_t Needed) const noexcept {
+        return Error || Complete || (Accepted && Available >= Needed);
+    }
+
+    void notify() {
+        for (auto *Socket : Waiting) {
+            Socket->interrupt();
+        }
+    }
+};
+
+/// @return Error packet relaying the failure of the fetch to a local client
+inline packets::Error makeRelayError(const RelayEntry &Entry) {
+    if (Entry.Error == std::errc::no_such_file_or_directory) {
+        return packets::Error(packets::errors::FileNotFound,
+                              std::string_view(Entry.Message.empty() ? "File not found" : Entry.Message));
+    }
+    if (Entry.Error == std::errc::permission_denied) {
+        return packets::Error(packets::errors::AccessViolation,
+                              std::string_view(Entry.Message.empty() ? "Access violation" : Entry.Message));
+    }
+    return packets::Error(packets::errors::NotDefined, "Upstream transfer failed: " + Entry.Error.message());
+}
+
+} // namespace details
+
+/// Caching relay for branch sites booting from a remote server
+/// @n Read requests of local clients are served by the relay itself. A file missing from the disk cache is fetched
+/// from the upstream server once, with large blocks and windows (RelaySettings::Upstream), however many local clients
+/// request it meanwhile: they join the fetch and are sent each block as soon as it has been written to the cache.
+/// Cached files are revalidated by size: once a file is older than RelaySettings::MaxAge (by its modification time),
+/// the next request asks the upstream server for the size of the file (see querySize). The same size renews the
+/// modification time, a different one makes the relay fetch the file again. If the upstream server doesn't respond,
+/// the stale file is served. A file changed upstream without changing its size is only noticed by the next fetch.
+/// @n Fetched files are written to temporary files next to them and renamed when complete, so files in the cache are
+/// always complete and survive restarts of the relay. Local transfers are lock-step (the window size isn't
+/// negotiated), write requests are refused. All transfers run on the executor of the relay.
+class CachingRelay final {
+  public:
+    /// @param[Local] Address local clients send their requests to
+    /// @param[Upstream] Address of the upstream server
+    CachingRelay(Executor &Owner, const sockaddr_in &Local, const sockaddr_in &Upstream, RelaySettings Settings = {})
+        : Owner(Owner), Listener(Owner, Local), Upstream(Upstream), Settings(std::move(Settings)) {}
+    CachingRelay(const CachingRelay &) = delete;
+    CachingRelay &operator=(const CachingRelay &) = delete;
+    ~CachingRelay() {
+        if (RootDescriptor != -1) {
+            ::close(RootDescriptor);
+        }
+    }
+
+    /// Open the cache directory, files are kept under it by their filenames sanitized with transfer::sanitizeFilename
+    std::error_code open(const std::string &CacheRoot) {
+        assert(RootDescriptor == -1);
+        RootDescriptor = ::open(CacheRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (RootDescriptor == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        Root = CacheRoot;
+        return {};
+    }
+
+    /// Start serving local clients until CachingRelay::stop
+    void start() {
+        assert(RootDescriptor != -1);
+        Owner.spawn(listen());
+    }
+
+    /// Stop accepting requests, transfers and fetches in progress run to completion
+    /// @n May be called from any thread
+    void stop() noexcept { Stopping = true; }
+
+    sockaddr_in getAddress() const noexcept { return Listener.getLocalAddress(); }
+
+    /// @return Number of fetches of files from the upstream server, failed ones included
+    std::size_t getFetchesCount() const noexcept { return Fetches; }
+
+    /// @return Number of requests served from the cache without contacting the upstream server
+    std::size_t getHitsCount() const noexcept { return Hits; }
+
+    /// @return Number of cached files confirmed by the upstream server
+    std::size_t getRevalidationsCount() const noexcept { return Revalidations; }
+
+    /// @return Number of requests that joined a fetch or a revalidation of the file in progress
+    std::size_t getJoinedCount() const noexcept { return Joined; }
+
+  private:
+    /// Interval of checking whether the relay is stopped
+    static constexpr std::chrono::milliseconds StopPoll{20};
+
+    Task<void> listen() {
+        std::vector<std::uint8_t> Incoming(65536);
+        while (!Stopping) {
+            auto Received = co_await Listener.receive(Incoming.data(), Incoming.size(), StopPoll);
+            if (!Received) {
+                continue;
+            }
+            auto Parsed = packets::Parser<packets::Request>::parse(Incoming.data(), Received->Size);
+            if (Parsed.isSuccess()) {
+                Owner.spawn(serve(Parsed.get().Packet, Received->From));
+            }
+        }
+    }
+
+    /// @return Entry of the file: the valid cached file, or the fetch or the revalidation the request joins
+    std::shared_ptr<details::RelayEntry> acquire(const std::string &Path) {
+        if (auto It = Pending.find(Path); It != Pending.end()) {
+            ++Joined;
+            return It->second;
+        }
+        auto Entry = std::make_shared<details::RelayEntry>();
+        int Cached = ::openat(RootDescriptor, Path.c_str(), O_RDONLY | O_NOCTTY | O_CLOEXEC);
+        struct stat Status;
+        if (Cached != -1 && (::fstat(Cached, &Status) != 0 || !S_ISREG(Status.st_mode))) {
+            ::close(Cached);
+            Cached = -1;
+        }
+        if (Cached != -1) {
+            auto Modified = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::seconds(Status.st_mtim.tv_sec) + std::chrono::nanoseconds(Status.st_mtim.tv_nsec)));
+            auto Age = std::chrono::system_clock::now() - Modified;
+            if (Age >= std::chrono::system_clock::duration::zero() && Age < Settings.MaxAge) {
+                ++Hits;
+                complete(*Entry, Cached, static_cast<std::uint64_t>(Status.st_size));
+                return Entry;
+            }
+        }
+        Pending.emplace(Path, Entry);
+        Owner.spawn(fill(Path, Entry, Cached, Cached == -1 ? 0 : static_cast<std::uint64_t>(Status.st_size)));
+        return Entry;
+    }
+
+    static void complete(details::RelayEntry &Entry, int Descriptor, std::uint64_t Size) noexcept {
+        Entry.Descriptor = Descriptor;
+        Entry.Available = Size;
+        Entry.Size = Size;
+        Entry.Accepted = true;
+        Entry.Complete = true;
+    }
+
+    /// Revalidate the cached file (if \p Cached isn't -1) and fetch the file from the upstream server unless it's valid
+    Task<void> fill(std::string Path, std::shared_ptr<details::RelayEntry> Entry, int Cached,
+                    std::uint64_t CachedSize) {
+        sockaddr_in Any{};
+        Any.sin_family = AF_INET;
+        UdpSocket Socket(Owner, Any);
+        if (Cached != -1) {
+            auto Query = co_await querySize(Socket, Upstream, Path, Settings.Upstream);
+            if (!Query.Error && Query.TransferSize == CachedSize) {
+                ::futimens(Cached, nullptr);
+                ++Revalidations;
+            }
+            // The branch keeps booting from the stale file while the upstream server is unreachable
+            if (Query.Error == std::errc::timed_out || (!Query.Error && Query.TransferSize == CachedSize)) {
+                complete(*Entry, Cached, CachedSize);
+                Entry->notify();
+                Pending.erase(Path);
+                co_return;
+            }
+            ::close(Cached);
+        }
+
+        ++Fetches;
+        auto Destination = Root + '/' + Path;
+        auto Temporary = Destination + ".XXXXXX";
+        int Descriptor = -1;
+        if (makeParents(Path)) {
+            Descriptor = ::mkostemp(Temporary.data(), O_CLOEXEC);
+        }
+        if (Descriptor == -1) {
+            Entry->Error = std::error_code(errno, std::generic_category());
+            Entry->Accepted = true;
+            Entry->notify();
+            Pending.erase(Path);
+            co_return;
+        }
+        Entry->Descriptor = Descriptor;
+        // The callbacks are named rather than passed as temporaries: GCC 12 destroys the temporaries of a coroutine
+        // call twice when the call is awaited
+        auto Write = [Entry](std::uint64_t Offset, const std::uint8_t *Buffer, std::size_t Size) {
+            while (Size != 0) {
+                auto Written = ::pwrite(Entry->Descriptor, Buffer, Size, static_cast<off_t>(Offset));
+                if (Written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return std::error_code(errno, std::generic_category());
+                }
+                Buffer += Written;
+                Offset += static_cast<std::uint64_t>(Written);
+                Size -= static_cast<std::size_t>(Written);
+            }
+            Entry->Available = Offset;
+            Entry->notify();
+            return std::error_code{};
+        };
+        auto OnAccepted = [Entry](const TransferResult &Accepted) {
+            Entry->Size = Accepted.TransferSize;
+            Entry->Accepted = true;
+            Entry->notify();
+        };
+        auto Result = co_await readFile(Socket, Upstream, Path, Write, Settings.Upstream, OnAccepted);
+        if (!Result.Error && ::rename(Temporary.c_str(), Destination.c_str()) != 0) {
+            Result.Error = std::error_code(errno, std::generic_category());
+        }
+        if (Result.Error) {
+            ::unlink(Temporary.c_str());
+            if (Result.Error == std::errc::no_such_file_or_directory) {
+                // The file has been removed upstream
+                ::unlink(Destination.c_str());
+            }
+            Entry->Error = Result.Error;
+            Entry->Message = std::move(Result.Message);
+        } else {
+            Entry->Size = Entry->Available;
+            Entry->Complete = true;
+        }
+        Entry->Accepted = true;
+        Entry->notify();
+        Pending.erase(Path);
+    }
+
+    /// Create the missing parent directories of the cached file
+    bool makeParents(const std::string &Path) const {
+        for (auto Separator = Path.find('/'); Separator != std::string::npos;
+             Separator = Path.find('/', Separator + 1)) {
+            auto Directory = Path.substr(0, Separator);
+            if (::mkdirat(RootDescriptor, Directory.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Task<void> serve(packets::Request Request, sockaddr_in Client) {
+        auto Local = Listener.getLocalAddress();
+        Local.sin_port = 0;
+        UdpSocket Socket(Owner, Local);
+        std::vector<std::uint8_t> Incoming(516);
+        auto Path = transfer::sanitizeFilename(Request.getFilename());
+        if (Request.getType() != packets::types::ReadRequest || !Path) {
+            auto Reply = details::serialize(packets::Error(
+                packets::errors::AccessViolation,
+                std::string_view(Path ? "The relay doesn't accept write requests" : "Invalid filename")));
+            co_await Socket.send(Reply.data(), Reply.size(), Client);
+            co_return;
+        }
+
+        auto Entry = acquire(*Path);
+        // The transfer size is known once the upstream server has acknowledged the options
+        auto Aborted = co_await waitFetch(Socket, Client, *Entry, 0, Incoming);
+        if (Aborted) {
+            co_return;
+        }
+        if (Entry->Error) {
+            auto Reply = details::serialize(details::makeRelayError(*Entry));
+            co_await Socket.send(Reply.data(), Reply.size(), Client);
+            co_return;
+        }
+
+        auto Negotiated = options::negotiate(Request, Entry->Size, Settings.MaxBlockSize, 1);
+        TransferOptions Options;
+        Options.BlockSize = Negotiated.BlockSize;
+        Options.MaxRetries = Settings.MaxRetries;
+        Options.Timeout = Negotiated.Timeout;
+        auto Timer = details::makeTimer(Options);
+        if (!Negotiated.Acknowledged.empty()) {
+            auto Reply = details::serialize(packets::OptionAcknowledgment(Negotiated.Acknowledged));
+            auto Error = co_await details::sendUntilAcknowledged(Socket, Client, Reply.data(), Reply.size(), 0, Timer,
+                                                                 Incoming, Options.MaxRetries);
+            if (Error) {
+                co_return;
+            }
+        }
+
+        // The Data packet is built in place, so that the block is read straight into the datagram
+        std::vector<std::uint8_t> Outgoing(Options.BlockSize + 4);
+        for (std::uint64_t Block = 1;; ++Block) {
+            auto Offset = (Block - 1) * Options.BlockSize;
+            auto Aborted = co_await waitFetch(Socket, Client, *Entry, Offset + Options.BlockSize, Incoming);
+            if (Aborted) {
+                co_return;
+            }
+            if (Entry->Error) {
+                auto Reply = details::serialize(details::makeRelayError(*Entry));
+                co_await Socket.send(Reply.data(), Reply.size(), Client);
+                co_return;
+            }
+            auto Size = static_cast<std::size_t>(std::min<std::uint64_t>(Options.BlockSize, Entry->Available - Offset));
+            if (auto Error = readBlock(Entry->Descriptor, Offset, Outgoing.data() + 4, Size)) {
+                auto Reply = details::serialize(transfer::makeFileError(Error));
+                co_await Socket.send(Reply.data(), Reply.size(), Client);
+                co_return;
+            }
+            details::setHeader(Outgoing.data(), packets::types::DataPacket, static_cast<std::uint16_t>(Block));
+            auto Error = co_await details::sendUntilAcknowledged(
+                Socket, Client, Outgoing.data(), Size + 4, static_cast<std::uint16_t>(Block), Timer, Incoming,
+                Options.MaxRetries);
+            if (Error) {
+                co_return;
+            }
+            if (Size < Options.BlockSize) {
+                co_return;
+            }
+        }
+    }
+
+    static std::error_code readBlock(int Descriptor, std::uint64_t Offset, std::uint8_t *Buffer, std::size_t Size) {
+        while (Size != 0) {
+            auto Read = ::pread(Descriptor, Buffer, Size, static_cast<off_t>(Offset));
+            if (Read <= 0) {
+                if (Read < 0 && errno == EINTR) {
+                    continue;
+                }
+                return Read == 0 ? std::make_error_code(std::errc::io_error)
+                                 : std::error_code(errno, std::generic_category());
+            }
+            Buffer += Read;
+            Offset += static_cast<std::uint64_t>(Read);
+            Size -= static_cast<std::size_t>(Read);
+        }
+        return {};
+    }
+
+    /// Wait until the fetch has \p Needed bytes of the file (see RelayEntry::isAvailable), handling the packets the
+    /// client sends meanwhile
+    /// @return Error if the client has reported an error
+    Task<std::error_code> waitFetch(UdpSocket &Socket, sockaddr_in Client, details::RelayEntry &Entry,
+                                    std::uint64_t Needed, std::vector<std::uint8_t> &Incoming) {
+        while (!Entry.isAvailable(Needed)) {
+            Entry.Waiting.push_back(&Socket);
+            auto Received = co_await Socket.receive(Incoming.data(), Incoming.size());
+            Entry.Waiting.erase(std::find(Entry.Waiting.begin(), Entry.Waiting.end(), &Socket));
+            if (!Received) {
+                continue;
+            }
+            if (!isSameEndpoint(Received->From, Client)) {
+                auto Reply = details::serialize(transfer::makeUnknownTransferIDError());
+                co_await Socket.send(Reply.data(), Reply.size(), Received->From);
+                continue;
+            }
+            if (details::getType(Incoming.data(), Received->Size) == packets::types::ErrorPacket) {
+                co_return std::make_error_code(std::errc::connection_aborted);
+            }
+            // Retransmitted acknowledgments of the previous block, the next block is sent once it's fetched
+        }
+        co_return std::error_code{};
+    }
+
+    Executor &Owner;
+    UdpSocket Listener;
+    sockaddr_in Upstream;
+    RelaySettings Settings;
+    std::string Root;
+    int RootDescriptor = -1;
+    /// Fetches and revalidations in progress by the sanitized filenames
+    std::unordered_map<std::string, std::shared_ptr<details::RelayEntry>> Pending;
+    std::atomic<bool> Stopping{false};
+    std::atomic<std::size_t> Fetches{0};
+    std::atomic<std::size_t> Hits{0};
+    std::atomic<std::size_t> Revalidations{0};
+    std::atomic<std::size_t> Joined{0};
+};
+
+} // namespace tftp_common::async
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <system_error>
+#include <vector>
+
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+namespace tftp_common::reuseport {
+
+/// Number of buckets the clients are hashed into, every bucket is steered to one worker
+inline constexpr std::size_t BucketsCount = 128;
+
+/// Settings of SteeringGroup
+struct SteeringConfig {
+    /// Length of the prefix of the client IPv4 address clients are grouped by: 32 keeps every client on its worker,
+    /// shorter prefixes keep whole subnets (e.g. a /24 of a branch site booting the same images) on one worker
+    unsigned PrefixLength = 32;
+};
+
+/// @return Bucket of the client, the steering program computes the same
+/// @param[Address] IPv4 address in network byte order, like in `in_addr`
+/// @param[PrefixLength] Assumptions: \p PrefixLength is not greater than 32
+inline std::uint32_t getBucket(std::uint32_t Address, unsigned PrefixLength) noexcept {
+    assert(PrefixLength <= 32);
+    std::uint32_t Key = PrefixLength == 0 ? 0 : ntohl(Address) >> (32 - PrefixLength);
+    // Fibonacci hashing: the top bits of the product spread neighbouring addresses and subnets over the buckets
+    return static_cast<std::uint32_t>(Key * 0x9E3779B1u) >> 25;
+}
+
+static_assert(BucketsCount == 128, "getBucket takes the top 7 bits of the hash");
+
+/// Sockets of the workers sharing one UDP address with SO_REUSEPORT, with the datagrams steered to the workers by
+/// the client address
+/// @n Without a program the kernel picks the socket by the hash of the 4-tuple, so requests of one client coming from
+/// different ports (every TFTP transfer has a new transfer identifier) and retransmissions land on different workers,
+/// and every worker ends up caching the files and the state of every client. The group attaches a classic BPF program
+/// (SO_ATTACH_REUSEPORT_CBPF, no privileges are needed) hashing the source address (or its prefix) into one of
+/// BucketsCount buckets and returning the index of the socket owning the bucket, so each worker keeps serving the
+/// same clients.
+/// @n The kernel indexes the sockets of the group in the order they were bound and moves the last socket into the
+/// place of a closed one; the group mirrors that order. Workers coming and going only move the buckets they take or
+/// release, the other clients stay on their workers. While the program is replaced the datagrams may still be steered
+/// by the previous one, and datagrams queued on the socket of a removed worker are lost (clients retransmit).
+class SteeringGroup final {
+  public:
+    /// @param[Local] Address of the group, port zero picks a free port when the first worker is added
+    explicit SteeringGroup(const sockaddr_in &Local, SteeringConfig Config = {}) : Address(Local), Config(Config) {
+        assert(Config.PrefixLength <= 32);
+        Owners.fill(-1);
+    }
+    SteeringGroup(const SteeringGroup &) = delete;
+    SteeringGroup &operator=(const SteeringGroup &) = delete;
+    ~SteeringGroup() {
+        for (auto Descriptor : Sockets) {
+            ::close(Descriptor);
+        }
+    }
+
+    /// Open the socket of a new worker bound to the address of the group and move a fair share of the buckets to it
+    /// @param[Descriptor] Receives the descriptor of the (blocking) socket, it's owned by the group
+    std::error_code addWorker(int &Descriptor) {
+        auto Added = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (Added == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        int Enable = 1;
+        if (::setsockopt(Added, SOL_SOCKET, SO_REUSEPORT, &Enable, sizeof(Enable)) != 0 ||
+            ::bind(Added, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address)) != 0) {
+            auto Error = std::error_code(errno, std::generic_category());
+            ::close(Added);
+            return Error;
+        }
+        if (Sockets.empty()) {
+            socklen_t Length = sizeof(Address);
+            ::getsockname(Added, reinterpret_cast<sockaddr *>(&Address), &Length);
+        }
+        Sockets.push_back(Added);
+
+        if (Sockets.size() == 1) {
+            Owners.fill(Added);
+        } else {
+            // The new worker takes buckets from the workers with the most of them, the other buckets stay in place
+            for (std::size_t Taken = 0; Taken != BucketsCount / Sockets.size(); ++Taken) {
+                auto Counts = countBuckets();
+                Counts.back() = 0;
+                auto Donor = Sockets[static_cast<std::size_t>(std::max_element(Counts.begin(), Counts.end()) -
+                                                              Counts.begin())];
+                *std::find(Owners.begin(), Owners.end(), Donor) = Added;
+            }
+        }
+        if (auto Error = attach()) {
+            removeWorker(Added);
+            return Error;
+        }
+        Descriptor = Added;
+        return std::error_code{};
+    }
+
+    /// Move the buckets of the worker to the other workers and close its socket
+    /// @param[Descriptor] Assumptions: \p Descriptor was added by SteeringGroup::addWorker and the worker doesn't
+    /// use it anymore
+    std::error_code removeWorker(int Descriptor) {
+        auto Removed = std::find(Sockets.begin(), Sockets.end(), Descriptor);
+        assert(Removed != Sockets.end());
+        auto Index = static_cast<std::size_t>(Removed - Sockets.begin());
+
+        // The released buckets go to the workers with the fewest of them, they are steered away before the socket
+        // is closed
+        std::error_code Error;
+        if (Sockets.size() != 1) {
+            for (auto &Owner : Owners) {
+                if (Owner != Descriptor) {
+                    continue;
+                }
+                auto Counts = countBuckets();
+                Counts[Index] = BucketsCount + 1;
+                Owner = Sockets[static_cast<std::size_t>(std::min_element(Counts.begin(), Counts.end()) -
+                                                         Counts.begin())];
+            }
+            Error = attach();
+        }
+        ::close(Descriptor);
+        Sockets[Index] = Sockets.back();
+        Sockets.pop_back();
+        if (Sockets.empty()) {
+            Owners.fill(-1);
+            return Error;
+        }
+        // The last socket has taken the index of the closed one
+        auto Reattached = attach();
+        return Error ? Error : Reattached;
+    }
+
+    /// @return Descriptor of the socket of the worker the client is steered to, or std::nullopt without workers
+    /// @param[Client] IPv4 address in network byte order, like in `in_addr`
+    std::optional<int> getWorker(std::uint32_t Client) const noexcept {
+        if (Sockets.empty()) {
+            return std::nullopt;
+        }
+        return Owners[getBucket(Client, Config.PrefixLength)];
+    }
+
+    /// @return Number of buckets steered to the worker
+    std::size_t getBucketsCount(int Descriptor) const noexcept {
+        return static_cast<std::size_t>(std::count(Owners.begin(), Owners.end(), Descriptor));
+    }
+
+    /// @return Descriptors of the sockets in the order of the kernel
+    const std::vector<int> &getSockets() const noexcept { return Sockets; }
+
+    std::size_t size() const noexcept { return Sockets.size(); }
+
+    /// @return Address of the group, with the port picked for port zero once the first worker has been added
+    sockaddr_in getAddress() const noexcept { return Address; }
+
+    /// Hand-assembled program of the current bucket owners:
+    /// @code
+    /// A = Bucket(source address); return Index of the socket owning bucket A
+    /// @endcode
+    /// The bucket is found by a binary search over the runs of buckets owned by the same socket.
+    std::vector<sock_filter> assemble() const {
+        std::vector<sock_filter> Code_;
+        // Classic BPF loads are big-endian, the address is in the host byte order in A
+        Code_.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<std::uint32_t>(SKF_NET_OFF + 12)));
+        if (Config.PrefixLength == 0) {
+            Code_.push_back(BPF_STMT(BPF_LD | BPF_IMM, 0));
+        } else if (Config.PrefixLength != 32) {
+            Code_.push_back(BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 32 - Config.PrefixLength));
+        }
+        Code_.push_back(BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1u));
+        Code_.push_back(BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 25));
+
+        struct Run {
+            std::uint32_t First;
+            std::uint32_t Index;
+        };
+        std::vector<Run> Runs;
+        for (std::uint32_t Bucket = 0; Bucket != BucketsCount; ++Bucket) {
+            auto Index = static_cast<std::uint32_t>(std::find(Sockets.begin(), Sockets.end(), Owners[Bucket]) -
+                                                    Sockets.begin());
+            if (Runs.empty() || Runs.back().Index != Index) {
+                Runs.push_back(Run{Bucket, Index});
+            }
+        }
+        // A subtree of N runs takes 2N - 1 instructions, jumps over the left subtrees stay within the 8-bit offsets
+        auto emit = [&](auto &Self, std::size_t First, std::size_t Last) -> void {
+            if (Last - First == 1) {
+                Code_.push_back(BPF_STMT(BPF_RET | BPF_K, Runs[First].Index));
+                return;
+            }
+            auto Middle = (First + Last) / 2;
+            Code_.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, Runs[Middle].First,
+                                     static_cast<std::uint8_t>(2 * (Middle - First) - 1), 0));
+            Self(Self, First, Middle);
+            Self(Self, Middle, Last);
+        };
+        emit(emit, 0, Runs.size());
+        return Code_;
+    }
+
+  private:
+    /// @return Number of buckets of every socket, in the order of the kernel
+    std::vector<std::size_t> countBuckets() const {
+        std::vector<std::size_t> Counts(Sockets.size());
+        for (auto Owner : Owners) {
+            auto Found = std::find(Sockets.begin(), Sockets.end(), Owner);
+            if (Found != Sockets.end()) {
+                ++Counts[static_cast<std::size_t>(Found - Sockets.begin())];
+            }
+        }
+        return Counts;
+    }
+
+    /// Replace the program of the group (attaching it to any of the sockets replaces it for all of them)
+    std::error_code attach() {
+        auto Code_ = assemble();
+        sock_fprog Program{};
+        Program.len = static_cast<unsigned short>(Code_.size());
+        Program.filter = Code_.data();
+        if (::setsockopt(Sockets.front(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &Program, sizeof(Program)) != 0) {
+            return std::error_code(errno, std::generic_category());
+        }
+        return std::error_code{};
+    }
+
+    sockaddr_in Address;
+    SteeringConfig Config;
+    /// Descriptors of the sockets in the order of the kernel
+    std::vector<int> Sockets;
+    /// Descriptor of the socket owning every bucket
+    std::array<int, BucketsCount> Owners;
+};
+
+} // namespace tftp_common::reuseport
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace tftp_common::transfer {
+
+/// Adaptive retransmission timeout estimator for a single transfer
+/// @n Follows RFC 6298: smoothed round-trip time and its variation are updated from Data/Acknowledgment exchanges,
+/// samples of retransmitted blocks are ignored (Karn's algorithm) and every expiration doubles the timeout until the
+/// next valid sample arrives. The negotiated RFC 2349 `timeout` option acts as a ceiling.
+class RetransmissionTimer final {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Duration = std::chrono::microseconds;
+
+    /// Round-trip time state that can be carried over to the next transfer with the same client
+    struct Estimate {
+        Duration SmoothedRTT;
+        Duration RTTVariation;
+    };
+
+    /// Initial timeout used before the first round-trip time sample (RFC 6298, section 2.1)
+    static constexpr Duration InitialTimeout = std::chrono::seconds(1);
+    /// Default lower bound of the timeout
+    static constexpr Duration DefaultMinTimeout = std::chrono::milliseconds(200);
+    /// Default upper bound of the timeout, the greatest value allowed by RFC 2349
+    static constexpr Duration DefaultMaxTimeout = std::chrono::seconds(255);
+    /// Clock granularity
+    static constexpr Duration Granularity = std::chrono::milliseconds(1);
+
+    RetransmissionTimer() = default;
+    /// Seed the estimator with the state of a previous transfer to the same client
+    explicit RetransmissionTimer(const Estimate &Seed) noexcept { seed(Seed); }
+
+    /// Seed the estimator with the state of a previous transfer to the same client
+    void seed(const Estimate &Seed) noexcept {
+        SmoothedRTT = Seed.SmoothedRTT;
+        RTTVariation = Seed.RTTVariation;
+        HasEstimate = true;
+        recompute();
+    }
+
+    /// @return Round-trip time state or std::nullopt if there were no samples (and no seed) yet
+    std::optional<Estimate> getEstimate() const noexcept {
+        if (!HasEstimate) {
+            return std::nullopt;
+        }
+        return Estimate{SmoothedRTT, RTTVariation};
+    }
+
+    /// Set lower and upper bounds of the timeout
+    /// @param[Min] Assumptions: \p Min is greater than zero and less or equal than \p Max
+    void setBounds(Duration Min, Duration Max) noexcept {
+        assert(Min.count() > 0 && Min <= Max);
+        MinTimeout = Min;
+        MaxTimeout = Max;
+        Timeout = clamp(Timeout);
+    }
+
+    /// Use the negotiated RFC 2349 timeout interval as the upper bound of the timeout
+    void setCeiling(std::chrono::seconds Ceiling) noexcept {
+        setBounds(std::min<Duration>(MinTimeout, Ceiling), Ceiling);
+    }
+
+    /// @return Current retransmission timeout
+    Duration getTimeout() const noexcept { return Timeout; }
+
+    /// @return Number of consecutive expirations since the last valid sample
+    unsigned getBackoffCount() const noexcept { return BackoffCount; }
+
+    /// Register transmission of the Data packet with the given block number
+    /// @n Only one block is timed at once, the timing starts if there's no block being timed already. Blocks that
+    /// aren't newer than every block sent before are retransmissions and are never timed (Karn's algorithm), so
+    /// callers may register every transmission.
+    void onTransmit(std::uint16_t Block, Clock::time_point Now) noexcept {
+        if (HighestSent && !isBefore(*HighestSent, Block)) {
+            return;
+        }
+        HighestSent = Block;
+        if (!TimedBlock) {
+            TimedBlock = Block;
+            TimedSentAt = Now;
+        }
+    }
+
+    /// Register retransmission of the Data packets starting from the given block number
+    /// @n The timed block is discarded if it's retransmitted (Karn's algorithm)
+    void onRetransmit(std::uint16_t Block) noexcept {
+        if (TimedBlock && !isBefore(*TimedBlock, Block)) {
+            TimedBlock.reset();
+        }
+    }
+
+    /// Register reception of the Acknowledgment packet with the given block number
+    void onAcknowledgment(std::uint16_t Block, Clock::time_point Now) noexcept {
+        if (!TimedBlock || isBefore(Block, *TimedBlock)) {
+            return;
+        }
+        TimedBlock.reset();
+        sample(std::chrono::duration_cast<Duration>(Now - TimedSentAt));
+    }
+
+    /// Register expiration of the retransmission timer, doubles the timeout (RFC 6298, section 5.5)
+    void onTimeout() noexcept {
+        TimedBlock.reset();
+        ++BackoffCount;
+        Timeout = clamp(Timeout * 2);
+    }
+
+  private:
+    /// Serial number arithmetic for 16-bit block numbers, which wrap around in long transfers
+    static bool isBefore(std::uint16_t Lhs, std::uint16_t Rhs) noexcept {
+        return static_cast<std::int16_t>(static_cast<std::uint16_t>(Lhs - Rhs)) < 0;
+    }
+
+    void sample(Duration RTT) noexcept {
+        if (!HasEstimate) {
+            SmoothedRTT = RTT;
+            RTTVariation = RTT / 2;
+            HasEstimate = true;
+        } else {
+            auto Delta = SmoothedRTT > RTT ? SmoothedRTT - RTT : RTT - SmoothedRTT;
+            RTTVariation = (RTTVariation * 3 + Delta) / 4;
+            SmoothedRTT = (SmoothedRTT * 7 + RTT) / 8;
+        }
+        recompute();
+    }
+
+    void recompute() noexcept {
+        Timeout = clamp(SmoothedRTT + std::max(Granularity, RTTVariation * 4));
+        BackoffCount = 0;
+    }
+
+    Duration clamp(Duration Value) const noexcept { return std::clamp(Value, MinTimeout, MaxTimeout); }
+
+    Duration MinTimeout = DefaultMinTimeout;
+    Duration MaxTimeout = DefaultMaxTimeout;
+    Duration SmoothedRTT{};
+    Duration RTTVariation{};
+    bool HasEstimate = false;
+    Duration Timeout = InitialTimeout;
+    unsigned BackoffCount = 0;
+    std::optional<std::uint16_t> TimedBlock;
+    Clock::time_point TimedSentAt;
+    /// Greatest block number transmitted so far
+    std::optional<std::uint16_t> HighestSent;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "options.hpp"
+#include "packets.hpp"
+#include "session_table.hpp"
+#include "timer_wheel.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace tftp_common::transfer {
+
+/// Hot part of a read request (RRQ) session: everything an acknowledgment or a timeout touches, in one cache line
+/// @n The session is the intrusive node of its retransmission timer. Data blocks aren't buffered: every block,
+/// retransmissions included, is read from the block source again (see makeDataPacket), so an idle session costs the
+/// same whatever its block and window sizes are.
+struct alignas(64) HotSession : TimerNode {
+    TransferID Client;
+    std::uint16_t BlockSize = 512;
+    std::uint16_t WindowSize = 1;
+    /// Consecutive timeouts without progress
+    std::uint8_t Retries = 0;
+    /// Handle of the file in the block source (e.g. its descriptor)
+    std::uint32_t File = 0;
+    /// Number of blocks acknowledged by the client, block numbers of the packets are its lower 16 bits
+    std::uint32_t Acknowledged = 0;
+    /// Number of the last block of the file, the one shorter than the block size
+    std::uint32_t LastBlock = 1;
+
+    /// @return Number of the last block of the window following the acknowledged blocks
+    std::uint32_t getWindowEnd() const noexcept {
+        return LastBlock - Acknowledged < WindowSize ? LastBlock : Acknowledged + WindowSize;
+    }
+
+    /// Account for the acknowledgment of a block of the window sent last
+    /// @return false if it doesn't acknowledge any block that wasn't acknowledged yet (e.g. it's a duplicate)
+    bool acknowledge(std::uint16_t Block) noexcept {
+        auto Advance = static_cast<std::uint16_t>(Block - static_cast<std::uint16_t>(Acknowledged));
+        if (Advance == 0 || Advance > getWindowEnd() - Acknowledged) {
+            return false;
+        }
+        Acknowledged += Advance;
+        Retries = 0;
+        return true;
+    }
+
+    bool isComplete() const noexcept { return Acknowledged == LastBlock; }
+
+    /// @return Offset of the block in the file
+    std::uint64_t getOffset(std::uint32_t Block) const noexcept {
+        return static_cast<std::uint64_t>(Block - 1) * BlockSize;
+    }
+};
+
+static_assert(sizeof(HotSession) == 64, "HotSession must fit into a cache line");
+
+/// Cold part of a session, touched when the session starts and completes
+struct ColdSession {
+    std::string Filename;
+    std::uint64_t FileSize = 0;
+    /// Negotiated timeout interval (RFC 2349)
+    std::optional<std::chrono::seconds> Timeout;
+    TimerWheel::Clock::time_point Started;
+    std::uint32_t Retransmissions = 0;
+};
+
+/// Build the Data packet of the block, reading the block from the source
+/// @param[Packet] Assumptions: \p Packet has room for the block size and the header (4 bytes)
+/// @param[Read] Requirements: \p Read must be callable as `std::size_t(std::uint32_t File, std::uint64_t Offset,
+/// std::uint8_t *Buffer, std::size_t Size)` and return the number of bytes read
+/// @return Size of the packet
+template <class Reader>
+std::size_t makeDataPacket(const HotSession &Session, std::uint32_t Block, std::uint8_t *Packet, Reader &&Read) {
+    assert(Block > Session.Acknowledged && Block <= Session.LastBlock);
+    auto Size = Read(Session.File, Session.getOffset(Block), Packet + 4, Session.BlockSize);
+    Packet[0] = 0;
+    Packet[1] = static_cast<std::uint8_t>(packets::types::DataPacket);
+    Packet[2] = static_cast<std::uint8_t>(Block >> 8);
+    Packet[3] = static_cast<std::uint8_t>(Block);
+    return Size + 4;
+}
+
+/// Index of a session in SessionStore, valid until the session is erased
+using SessionIndex = std::uint32_t;
+
+/// Store of read request sessions split into hot and cold parts
+/// @n Hot parts (HotSession, 64 bytes) live in a dense array of fixed-size chunks, so they are never moved and may be
+/// armed in a TimerWheel; cold parts (ColdSession) live in a parallel array under the same index. Sessions are looked
+/// up by the client transfer identifier through an open-addressing index of 8-byte buckets (the session index and a
+/// hash tag), the key itself is only kept in the hot part. A million sessions take about 150 MB plus the filenames
+/// that don't fit into the small string buffer.
+class SessionStore final {
+  public:
+    using Clock = TimerWheel::Clock;
+
+    explicit SessionStore(std::size_t ExpectedSessions = 0) {
+        std::size_t Capacity = 16;
+        while (Capacity * 3 < ExpectedSessions * 4) {
+            Capacity *= 2;
+        }
+        rehash(Capacity);
+        Colds.reserve(ExpectedSessions);
+        Chunks.reserve((ExpectedSessions + ChunkSize - 1) / ChunkSize);
+    }
+    SessionStore(const SessionStore &) = delete;
+    SessionStore &operator=(const SessionStore &) = delete;
+
+    /// Add the session of the read request unless the client has one already
+    /// @param[File] Handle of the file in the block source
+    /// @param[Negotiated] Assumptions: the block size of \p Negotiated is not greater than 65464 (RFC 2348)
+    /// @return Index of the session and whether it was inserted
+    std::pair<SessionIndex, bool> emplace(const TransferID &Client, std::uint32_t File, std::string_view Filename,
+                                          std::uint64_t FileSize,
+                                          const options::Negotiation &Negotiated = options::Negotiation{},
+                                          Clock::time_point Now = Clock::now()) {
+        assert(Negotiated.BlockSize > 0 && Negotiated.BlockSize <= packets::Data::MaxBlockSize);
+        assert(FileSize / Negotiated.BlockSize < ~std::uint32_t(0));
+        auto Hash = Client.hash();
+        if (auto Position = lookup(Client, Hash)) {
+            return {static_cast<SessionIndex>(Buckets[*Position]), false};
+        }
+        if ((Size + 1) * 4 > Buckets.size() * 3) {
+            rehash(Buckets.size() * 2);
+        }
+
+        auto Index = allocate();
+        auto &Hot = hot(Index);
+        Hot.Client = Client;
+        Hot.BlockSize = static_cast<std::uint16_t>(Negotiated.BlockSize);
+        Hot.WindowSize = Negotiated.WindowSize;
+        Hot.Retries = 0;
+        Hot.File = File;
+        Hot.Acknowledged = 0;
+        Hot.LastBlock = static_cast<std::uint32_t>(FileSize / Negotiated.BlockSize + 1);
+        auto &Cold = Colds[Index];
+        Cold.Filename = Filename;
+        Cold.FileSize = FileSize;
+        Cold.Timeout = Negotiated.Timeout;
+        Cold.Started = Now;
+        Cold.Retransmissions = 0;
+        place(Hash, Index);
+        ++Size;
+        return {Index, true};
+    }
+
+    /// @return Index of the session of the given transfer or std::nullopt if there's no such transfer
+    std::optional<SessionIndex> find(const TransferID &Client) const noexcept {
+        auto Position = lookup(Client, Client.hash());
+        if (!Position) {
+            return std::nullopt;
+        }
+        return static_cast<SessionIndex>(Buckets[*Position]);
+    }
+
+    /// @return Index of the session whose retransmission timer has expired
+    /// @param[Node] Assumptions: \p Node is the hot part of a session of the store
+    SessionIndex getIndex(const TimerNode &Node) const noexcept {
+        return *find(static_cast<const HotSession &>(Node).Client);
+    }
+
+    HotSession &hot(SessionIndex Index) noexcept { return Chunks[Index >> ChunkBits][Index & (ChunkSize - 1)]; }
+
+    const HotSession &hot(SessionIndex Index) const noexcept {
+        return Chunks[Index >> ChunkBits][Index & (ChunkSize - 1)];
+    }
+
+    ColdSession &cold(SessionIndex Index) noexcept { return Colds[Index]; }
+
+    const ColdSession &cold(SessionIndex Index) const noexcept { return Colds[Index]; }
+
+    /// Remove the session, its index may be reused by the following sessions
+    /// @param[Index] Assumptions: the retransmission timer of the session isn't armed
+    void erase(SessionIndex Index) noexcept {
+        auto &Hot = hot(Index);
+        assert(!Hot.isArmed());
+        unplace(*lookup(Hot.Client, Hot.Client.hash()));
+        Colds[Index] = ColdSession{};
+        Free.push_back(Index);
+        --Size;
+    }
+
+    std::size_t size() const noexcept { return Size; }
+
+    bool empty() const noexcept { return Size == 0; }
+
+    /// @return Bytes allocated by the store, not counting filenames that don't fit into the small string buffer
+    std::size_t getMemoryUsage() const noexcept {
+        return Chunks.size() * ChunkSize * sizeof(HotSession) + Colds.capacity() * sizeof(ColdSession) +
+               Buckets.capacity() * sizeof(std::uint64_t) + Free.capacity() * sizeof(SessionIndex);
+    }
+
+  private:
+    static constexpr std::size_t ChunkBits = 12;
+    static constexpr std::size_t ChunkSize = std::size_t(1) << ChunkBits;
+    static constexpr std::uint64_t EmptyBucket = ~std::uint64_t(0);
+
+    static std::uint64_t makeBucket(std::uint64_t Hash, SessionIndex Index) noexcept {
+        return (Hash & 0xFFFFFFFF00000000ull) | Index;
+    }
+
+    SessionIndex allocate() {
+        if (!Free.empty()) {
+            auto Index = Free.back();
+            Free.pop_back();
+            return Index;
+        }
+        auto Index = static_cast<SessionIndex>(Colds.size());
+        assert(Index != ~SessionIndex(0));
+        if ((Index & (ChunkSize - 1)) == 0) {
+            Chunks.push_back(std::make_unique<HotSession[]>(ChunkSize));
+        }
+        Colds.emplace_back();
+        return Index;
+    }
+
+    std::optional<std::size_t> lookup(const TransferID &Client, std::uint64_t Hash) const noexcept {
+        for (auto Position = static_cast<std::size_t>(Hash) & Mask; Buckets[Position] != EmptyBucket;
+             Position = (Position + 1) & Mask) {
+            auto Bucket = Buckets[Position];
+            // The tag saves touching the hot parts of the colliding sessions
+            if ((Bucket ^ Hash) >> 32 == 0 && hot(static_cast<SessionIndex>(Bucket)).Client == Client) {
+                return Position;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void place(std::uint64_t Hash, SessionIndex Index) noexcept {
+        auto Position = static_cast<std::size_t>(Hash) & Mask;
+        while (Buckets[Position] != EmptyBucket) {
+            Position = (Position + 1) & Mask;
+        }
+        Buckets[Position] = makeBucket(Hash, Index);
+    }
+
+    /// Backward shift deletion: pull the following buckets of the probe run into the hole
+    void unplace(std::size_t Hole) noexcept {
+        for (auto Next = (Hole + 1) & Mask; Buckets[Next] != EmptyBucket; Next = (Next + 1) & Mask) {
+            auto Home = static_cast<std::size_t>(hot(static_cast<SessionIndex>(Buckets[Next])).Client.hash()) & Mask;
+            if (((Next - Home) & Mask) >= ((Next - Hole) & Mask)) {
+                Buckets[Hole] = Buckets[Next];
+                Hole = Next;
+            }
+        }
+        Buckets[Hole] = EmptyBucket;
+    }
+
+    void rehash(std::size_t Capacity) {
+        auto Old = std::move(Buckets);
+        Buckets.assign(Capacity, EmptyBucket);
+        Mask = Capacity - 1;
+        for (auto Bucket : Old) {
+            if (Bucket != EmptyBucket) {
+                auto Index = static_cast<SessionIndex>(Bucket);
+                place(hot(Index).Client.hash(), Index);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<HotSession[]>> Chunks;
+    std::vector<ColdSession> Colds;
+    std::vector<SessionIndex> Free;
+    std::vector<std::uint64_t> Buckets;
+    std::size_t Mask = 0;
+    std::size_t Size = 0;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,350 @@
+#pragma once
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TFTP_COMMON_SESSION_TABLE_SSE2 1
+#endif
+
+#include "packets.hpp"
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace tftp_common::transfer {
+
+/// Transfer identifier (TID): address and port of the remote side of the transfer
+/// @n IPv4 addresses are stored as IPv4-mapped IPv6 addresses, the port is stored in host byte order
+struct TransferID {
+    std::array<std::uint8_t, 16> Address{};
+    std::uint16_t Port = 0;
+
+    static TransferID fromIPv4(const sockaddr_in &Endpoint) noexcept {
+        TransferID ID;
+        ID.Address[10] = ID.Address[11] = 0xFF;
+        std::memcpy(ID.Address.data() + 12, &Endpoint.sin_addr, 4);
+        ID.Port = ntohs(Endpoint.sin_port);
+        return ID;
+    }
+
+    static TransferID fromIPv6(const sockaddr_in6 &Endpoint) noexcept {
+        TransferID ID;
+        std::memcpy(ID.Address.data(), &Endpoint.sin6_addr, 16);
+        ID.Port = ntohs(Endpoint.sin6_port);
+        return ID;
+    }
+
+    bool operator==(const TransferID &Other) const noexcept {
+        return Port == Other.Port && Address == Other.Address;
+    }
+
+    bool operator!=(const TransferID &Other) const noexcept { return !(*this == Other); }
+
+    std::uint64_t hash() const noexcept {
+        std::uint64_t High, Low;
+        std::memcpy(&High, Address.data(), 8);
+        std::memcpy(&Low, Address.data() + 8, 8);
+        auto Hash = (High * 0x9E3779B97F4A7C15ull) ^ (Low + Port) * 0xC2B2AE3D27D4EB4Full;
+        Hash ^= Hash >> 31;
+        Hash *= 0x94D049BB133111EBull;
+        return Hash ^ (Hash >> 29);
+    }
+};
+
+/// Stable handle to a session stored in SessionTable, becomes stale once the session is erased
+struct SessionHandle {
+    std::uint32_t Index = ~std::uint32_t(0);
+    std::uint32_t Generation = 0;
+
+    bool isValid() const noexcept { return Index != ~std::uint32_t(0); }
+};
+
+/// @return Error packet to be sent to the source of a packet that doesn't belong to any known transfer
+inline packets::Error makeUnknownTransferIDError() {
+    return packets::Error{packets::errors::UnknownTransferID, std::string_view("Unknown transfer ID")};
+}
+
+/// Session index keyed by the client transfer identifier
+/// @n Sessions live in a slab of fixed-size chunks, so they are never moved (and may embed intrusive structures such
+/// as TimerNode). The index is a flat open-addressing table with one control byte per slot, probed 16 slots at once
+/// with SSE2 where it's available. Collisions are resolved with linear probing and erasure shifts the following
+/// entries back instead of leaving tombstones, so short-lived transfers don't degrade the lookup.
+template <class Session> class SessionTable final {
+  public:
+    explicit SessionTable(std::size_t ExpectedSessions = 0) { rehash(capacityFor(ExpectedSessions)); }
+    SessionTable(const SessionTable &) = delete;
+    SessionTable &operator=(const SessionTable &) = delete;
+    ~SessionTable() {
+        for (std::size_t Idx = 0; Idx != Slots.size(); ++Idx) {
+            if (Control[Idx] != Empty) {
+                entry(Slots[Idx].SlabIndex).destroy();
+            }
+        }
+    }
+
+    /// Construct a new session for the given transfer identifier unless there's one already
+    /// @return Handle to the session and whether it was inserted
+    template <class... Args> std::pair<SessionHandle, bool> emplace(const TransferID &ID, Args &&...Arguments) {
+        auto Hash = ID.hash();
+        if (auto Position = lookup(ID, Hash)) {
+            auto SlabIndex = Slots[*Position].SlabIndex;
+            return {SessionHandle{SlabIndex, entry(SlabIndex).Generation}, false};
+        }
+        if ((Size + 1) * 4 > Slots.size() * 3) {
+            rehash(Slots.size() * 2);
+        }
+
+        auto SlabIndex = allocate();
+        auto &Entry = entry(SlabIndex);
+        Entry.construct(ID, std::forward<Args>(Arguments)...);
+        place(Hash, Slot{ID, SlabIndex});
+        ++Size;
+        return {SessionHandle{SlabIndex, Entry.Generation}, true};
+    }
+
+    /// @return Session of the given transfer or nullptr if there's no such transfer
+    Session *find(const TransferID &ID) noexcept {
+        auto Position = lookup(ID, ID.hash());
+        return Position ? &entry(Slots[*Position].SlabIndex).session() : nullptr;
+    }
+
+    /// @return Session by its handle or nullptr if the handle is stale
+    Session *get(SessionHandle Handle) noexcept {
+        if (!Handle.isValid() || Handle.Index >= SlabSize) {
+            return nullptr;
+        }
+        auto &Entry = entry(Handle.Index);
+        return Entry.Live && Entry.Generation == Handle.Generation ? &Entry.session() : nullptr;
+    }
+
+    /// @return Handle of the session of the given transfer or an invalid handle if there's no such transfer
+    SessionHandle getHandle(const TransferID &ID) noexcept {
+        auto Position = lookup(ID, ID.hash());
+        if (!Position) {
+            return SessionHandle{};
+        }
+        auto SlabIndex = Slots[*Position].SlabIndex;
+        return SessionHandle{SlabIndex, entry(SlabIndex).Generation};
+    }
+
+    /// Invoke \p OnSession for the session of the given transfer
+    /// @return Error packet for the source of the datagram if there's no such transfer (RFC 1350, section 4), the
+    /// transfer in progress must not be disturbed in this case
+    template <class Callback>
+    std::optional<packets::Error> dispatch(const TransferID &ID, Callback &&OnSession) {
+        if (auto *Found = find(ID)) {
+            OnSession(*Found);
+            return std::nullopt;
+        }
+        return makeUnknownTransferIDError();
+    }
+
+    /// Destroy the session of the given transfer
+    /// @return false if there's no such transfer
+    bool erase(const TransferID &ID) noexcept {
+        auto Position = lookup(ID, ID.hash());
+        if (!Position) {
+            return false;
+        }
+        release(Slots[*Position].SlabIndex);
+        unplace(*Position);
+        --Size;
+        return true;
+    }
+
+    /// Destroy the session by its handle
+    /// @return false if the handle is stale
+    bool erase(SessionHandle Handle) noexcept {
+        if (get(Handle) == nullptr) {
+            return false;
+        }
+        return erase(entry(Handle.Index).ID);
+    }
+
+    std::size_t size() const noexcept { return Size; }
+
+    bool empty() const noexcept { return Size == 0; }
+
+  private:
+    static constexpr std::uint8_t Empty = 0x80;
+    static constexpr std::size_t GroupWidth = 16;
+    static constexpr std::size_t ChunkBits = 10;
+    static constexpr std::size_t ChunkSize = std::size_t(1) << ChunkBits;
+
+    /// Index slot, the key is kept next to the slab index so a hit is confirmed without touching the session
+    struct Slot {
+        TransferID ID;
+        std::uint32_t SlabIndex;
+    };
+
+    struct Entry {
+        TransferID ID;
+        std::uint32_t Generation = 0;
+        std::uint32_t NextFree = 0;
+        bool Live = false;
+        alignas(Session) unsigned char Storage[sizeof(Session)];
+
+        Session &session() noexcept { return *std::launder(reinterpret_cast<Session *>(Storage)); }
+
+        template <class... Args> void construct(const TransferID &Key, Args &&...Arguments) {
+            new (Storage) Session(std::forward<Args>(Arguments)...);
+            ID = Key;
+            Live = true;
+        }
+
+        void destroy() noexcept {
+            session().~Session();
+            Live = false;
+            ++Generation;
+        }
+    };
+
+    using Chunk = std::array<Entry, ChunkSize>;
+
+    static std::size_t capacityFor(std::size_t Sessions) noexcept {
+        std::size_t Capacity = GroupWidth;
+        while (Capacity * 3 < Sessions * 4) {
+            Capacity *= 2;
+        }
+        return Capacity;
+    }
+
+    Entry &entry(std::uint32_t Index) noexcept { return (*Chunks[Index >> ChunkBits])[Index & (ChunkSize - 1)]; }
+
+    std::uint32_t allocate() {
+        if (FreeHead != NoFree) {
+            auto Index = FreeHead;
+            FreeHead = entry(Index).NextFree;
+            return Index;
+        }
+        if ((SlabSize & (ChunkSize - 1)) == 0) {
+            Chunks.push_back(std::make_unique<Chunk>());
+        }
+        return SlabSize++;
+    }
+
+    void release(std::uint32_t Index) noexcept {
+        auto &Entry = entry(Index);
+        Entry.destroy();
+        Entry.NextFree = FreeHead;
+        FreeHead = Index;
+    }
+
+    /// @return Bitmask of group slots (starting at \p Position) whose control bytes are equal to \p Byte
+    std::uint32_t match(std::size_t Position, std::uint8_t Byte) const noexcept {
+#ifdef TFTP_COMMON_SESSION_TABLE_SSE2
+        auto Group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Control.data() + Position));
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(Group, _mm_set1_epi8(char(Byte)))));
+#else
+        std::uint32_t Mask = 0;
+        for (std::size_t Idx = 0; Idx != GroupWidth; ++Idx) {
+            Mask |= std::uint32_t(Control[Position + Idx] == Byte) << Idx;
+        }
+        return Mask;
+#endif
+    }
+
+    static int lowestBit(std::uint32_t Mask) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(Mask);
+#else
+        int Bit = 0;
+        while ((Mask & 1) == 0) {
+            Mask >>= 1;
+            ++Bit;
+        }
+        return Bit;
+#endif
+    }
+
+    std::optional<std::size_t> lookup(const TransferID &ID, std::uint64_t Hash) const noexcept {
+        auto Fingerprint = static_cast<std::uint8_t>(Hash & 0x7F);
+        auto Position = static_cast<std::size_t>(Hash >> 7) & Mask;
+        while (true) {
+            auto Empties = match(Position, Empty);
+            // Keys never live past the first empty slot of their probe sequence
+            auto Candidates = match(Position, Fingerprint) & (Empties ? (Empties & (0u - Empties)) - 1 : ~0u);
+            while (Candidates != 0) {
+                auto Slot = (Position + lowestBit(Candidates)) & Mask;
+                if (Slots[Slot].ID == ID) {
+                    return Slot;
+                }
+                Candidates &= Candidates - 1;
+            }
+            if (Empties != 0) {
+                return std::nullopt;
+            }
+            Position = (Position + GroupWidth) & Mask;
+        }
+    }
+
+    void setControl(std::size_t Position, std::uint8_t Byte) noexcept {
+        Control[Position] = Byte;
+        // The first group is mirrored past the end so any group can be loaded without wrapping around
+        if (Position < GroupWidth - 1) {
+            Control[Slots.size() + Position] = Byte;
+        }
+    }
+
+    void place(std::uint64_t Hash, const Slot &Value) noexcept {
+        auto Position = static_cast<std::size_t>(Hash >> 7) & Mask;
+        std::uint32_t Empties;
+        while ((Empties = match(Position, Empty)) == 0) {
+            Position = (Position + GroupWidth) & Mask;
+        }
+        Position = (Position + lowestBit(Empties)) & Mask;
+        setControl(Position, static_cast<std::uint8_t>(Hash & 0x7F));
+        Slots[Position] = Value;
+    }
+
+    /// Backward shift deletion: pull the following entries of the probe run into the hole
+    void unplace(std::size_t Hole) noexcept {
+        for (auto Next = (Hole + 1) & Mask; Control[Next] != Empty; Next = (Next + 1) & Mask) {
+            auto Home = static_cast<std::size_t>(Slots[Next].ID.hash() >> 7) & Mask;
+            if (((Next - Home) & Mask) >= ((Next - Hole) & Mask)) {
+                setControl(Hole, Control[Next]);
+                Slots[Hole] = Slots[Next];
+                Hole = Next;
+            }
+        }
+        setControl(Hole, Empty);
+    }
+
+    void rehash(std::size_t Capacity) {
+        auto OldControl = std::move(Control);
+        auto OldSlots = std::move(Slots);
+        Control.assign(Capacity + GroupWidth - 1, Empty);
+        Slots.assign(Capacity, Slot{});
+        Mask = Capacity - 1;
+        for (std::size_t Idx = 0; Idx != OldSlots.size(); ++Idx) {
+            if (OldControl[Idx] != Empty) {
+                place(OldSlots[Idx].ID.hash(), OldSlots[Idx]);
+            }
+        }
+    }
+
+    static constexpr std::uint32_t NoFree = ~std::uint32_t(0);
+
+    std::vector<std::uint8_t> Control;
+    std::vector<Slot> Slots;
+    std::size_t Mask = 0;
+    std::size_t Size = 0;
+    std::vector<std::unique_ptr<Chunk>> Chunks;
+    std::uint32_t SlabSize = 0;
+    std::uint32_t FreeHead = NoFree;
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace tftp_common::transfer {
+
+/// Intrusive timer node, embed it into the object owning the timer (e.g. a transfer session)
+/// @n A node may be armed in at most one TimerWheel at once and must be disarmed before its destruction
+class TimerNode {
+  public:
+    TimerNode() = default;
+    TimerNode(const TimerNode &) = delete;
+    TimerNode &operator=(const TimerNode &) = delete;
+    ~TimerNode() { assert(!isArmed()); }
+
+    bool isArmed() const noexcept { return Next != nullptr; }
+
+  private:
+    friend class TimerWheel;
+
+    void unlink() noexcept {
+        Prev->Next = Next;
+        Next->Prev = Prev;
+        Prev = Next = nullptr;
+    }
+
+    void linkBefore(TimerNode &Head) noexcept {
+        Prev = Head.Prev;
+        Next = &Head;
+        Head.Prev->Next = this;
+        Head.Prev = this;
+    }
+
+    TimerNode *Prev = nullptr;
+    TimerNode *Next = nullptr;
+    std::uint64_t Expiry = 0;
+};
+
+/// Hierarchical timing wheel
+/// @n Arming, re-arming and cancelling are O(1) and don't allocate, expired timers are processed in batches by
+/// TimerWheel::advance. Deadlines are rounded up to the tick, so timers never fire early.
+class TimerWheel final {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /// @param[Tick] Assumptions: \p Tick is greater than zero
+    explicit TimerWheel(Clock::duration Tick = std::chrono::milliseconds(1), Clock::time_point Start = Clock::now())
+        : Tick(Tick), Start(Start) {
+        assert(Tick.count() > 0);
+        for (auto &Level : Slots) {
+            for (auto &Head : Level) {
+                Head.Prev = Head.Next = &Head;
+            }
+        }
+    }
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+    /// Disarms all timers that are still armed
+    ~TimerWheel() {
+        for (auto &Level : Slots) {
+            for (auto &Head : Level) {
+                while (Head.Next != &Head) {
+                    Head.Next->unlink();
+                }
+                Head.Prev = Head.Next = nullptr;
+            }
+        }
+    }
+
+    /// Arm the timer or move the already armed timer to the new deadline
+    void arm(TimerNode &Node, Clock::time_point Deadline) noexcept {
+        if (Node.isArmed()) {
+            Node.unlink();
+        } else {
+            ++Armed;
+        }
+        auto Ticks = Deadline > Start ? (Deadline - Start + Tick - Clock::duration(1)) / Tick : 0;
+        Node.Expiry = std::max<std::uint64_t>(static_cast<std::uint64_t>(Ticks), CurrentTick + 1);
+        insert(Node);
+    }
+
+    /// Disarm the timer, does nothing if the timer isn't armed
+    void cancel(TimerNode &Node) noexcept {
+        if (Node.isArmed()) {
+            Node.unlink();
+            --Armed;
+        }
+    }
+
+    /// Expire all timers with deadlines up to \p Now
+    /// @param[OnExpired] Requirements: \p OnExpired must be callable with \p TimerNode&, it may arm and cancel timers
+    /// @return Number of expired timers
+    template <class Callback> std::size_t advance(Clock::time_point Now, Callback &&OnExpired) {
+        if (Now <= Start) {
+            return 0;
+        }
+        auto Target = static_cast<std::uint64_t>((Now - Start) / Tick);
+        std::size_t Expired = 0;
+        while (CurrentTick < Target) {
+            if (Armed == 0) {
+                CurrentTick = Target;
+                break;
+            }
+
+            ++CurrentTick;
+            auto Index = CurrentTick & SlotMask;
+            if (Index == 0) {
+                cascade(1);
+            }
+
+            TimerNode Pending;
+            if (splice(0, Index, Pending)) {
+                while (Pending.Next != &Pending) {
+                    auto &Node = *Pending.Next;
+                    Node.unlink();
+                    --Armed;
+                    ++Expired;
+                    OnExpired(Node);
+                }
+                Pending.Prev = Pending.Next = nullptr;
+            }
+
+            skipIdle(Target);
+        }
+        return Expired;
+    }
+
+    /// @return Number of armed timers
+    std::size_t size() const noexcept { return Armed; }
+
+    bool empty() const noexcept { return Armed == 0; }
+
+    /// @return Time point of the next tick, i.e. the earliest moment TimerWheel::advance may expire anything
+    Clock::time_point getNextTick() const noexcept { return Start + Tick * static_cast<Clock::rep>(CurrentTick + 1); }
+
+  private:
+    static constexpr std::size_t LevelBits = 8;
+    static constexpr std::size_t SlotsCount = std::size_t(1) << LevelBits;
+    static constexpr std::uint64_t SlotMask = SlotsCount - 1;
+    static constexpr std::size_t LevelsCount = 4;
+    /// Timers further away than the wheel span are parked in the top level and cascaded again
+    static constexpr std::uint64_t MaxDelta = (std::uint64_t(1) << (LevelBits * LevelsCount)) - 1;
+
+    void insert(TimerNode &Node) noexcept {
+        auto Delta = std::min(Node.Expiry - CurrentTick, MaxDelta);
+        auto Position = CurrentTick + Delta;
+        std::size_t Level = 0;
+        while (Level + 1 != LevelsCount && Delta >= (std::uint64_t(1) << (LevelBits * (Level + 1)))) {
+            ++Level;
+        }
+        auto Index = (Position >> (LevelBits * Level)) & SlotMask;
+        Occupied[Level][Index / 64] |= std::uint64_t(1) << (Index % 64);
+        Node.linkBefore(Slots[Level][Index]);
+    }
+
+    /// Move timers of the current slot of the given level down to the lower levels
+    void cascade(std::size_t Level) noexcept {
+        if (Level == LevelsCount) {
+            return;
+        }
+        auto Index = (CurrentTick >> (LevelBits * Level)) & SlotMask;
+        if (Index == 0) {
+            cascade(Level + 1);
+        }
+        TimerNode Pending;
+        if (splice(Level, Index, Pending)) {
+            while (Pending.Next != &Pending) {
+                auto &Node = *Pending.Next;
+                Node.unlink();
+                insert(Node);
+            }
+            Pending.Prev = Pending.Next = nullptr;
+        }
+    }
+
+    /// Move all nodes of the slot into the (unlinked) \p Target list
+    /// @return false if the slot is empty
+    bool splice(std::size_t Level, std::uint64_t Index, TimerNode &Target) noexcept {
+        Occupied[Level][Index / 64] &= ~(std::uint64_t(1) << (Index % 64));
+        auto &Head = Slots[Level][Index];
+        if (Head.Next == &Head) {
+            return false;
+        }
+        Target.Next = Head.Next;
+        Target.Prev = Head.Prev;
+        Target.Next->Prev = &Target;
+        Target.Prev->Next = &Target;
+        Head.Prev = Head.Next = &Head;
+        return true;
+    }
+
+    /// Jump over ticks that can neither expire nor cascade anything
+    void skipIdle(std::uint64_t Target) noexcept {
+        for (std::size_t Level = 0; Level != LevelsCount && CurrentTick < Target; ++Level) {
+            auto Index = (CurrentTick >> (LevelBits * Level)) & SlotMask;
+            if (hasOccupiedAfter(Level, Index)) {
+                return;
+            }
+            // Stop right before the wrap around of this level, the next tick cascades the level above
+            auto LevelMask = (std::uint64_t(1) << (LevelBits * (Level + 1))) - 1;
+            CurrentTick = std::min(Target, CurrentTick | LevelMask);
+            // Slots of this level that were already passed belong to its next rotation
+            if (hasOccupied(Level)) {
+                return;
+            }
+        }
+    }
+
+    bool hasOccupiedAfter(std::size_t Level, std::uint64_t Index) const noexcept {
+        const auto &Bitmap = Occupied[Level];
+        auto Word = Index / 64;
+        auto Bit = Index % 64;
+        if (Bit != 63 && (Bitmap[Word] >> (Bit + 1)) != 0) {
+            return true;
+        }
+        for (++Word; Word != Bitmap.size(); ++Word) {
+            if (Bitmap[Word] != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool hasOccupied(std::size_t Level) const noexcept {
+        for (auto Word : Occupied[Level]) {
+            if (Word != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Clock::duration Tick;
+    Clock::time_point Start;
+    std::uint64_t CurrentTick = 0;
+    std::size_t Armed = 0;
+    std::array<std::array<TimerNode, SlotsCount>, LevelsCount> Slots;
+    /// Occupancy bitmaps of the slots, let TimerWheel::advance skip idle ticks
+    std::array<std::array<std::uint64_t, SlotsCount / 64>, LevelsCount> Occupied{};
+};
+
+} // namespace tftp_common::transfer
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "packets.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace tftp_common::transfer {
+
+/// Sender of a window of Data packets (RFC 7440) to a single client
+/// @n Packets are serialized back to back into one buffer. The whole buffer is handed to the kernel by a single
+/// `sendmsg` with the `UDP_SEGMENT` option (UDP generic segmentation offload), which cuts it into datagrams of the
+/// block size; the final short block of the file, if any, is the last (shorter) segment. Where the segmentation
+/// offload isn't available, the packets are sent with `sendmmsg` instead.
+class WindowSender final {
+  public:
+    /// Greatest number of segments the kernel accepts in a single send (`UDP_MAX_SEGMENTS`)
+    static constexpr std::size_t MaxSegments = 64;
+    /// Greatest size of the UDP payload of a single send
+    static constexpr std::size_t MaxPayloadSize = 65535 - 8 - 40;
+
+    /// @param[BlockSize] Assumptions: \p BlockSize is the negotiated block size (RFC 2348), it is greater than zero
+    /// @param[WindowSize] Assumptions: \p WindowSize is the negotiated window size (RFC 7440), it is greater than zero
+    WindowSender(std::size_t BlockSize, std::size_t WindowSize)
+        : BlockSize(BlockSize), WindowSize(WindowSize), Buffer(WindowSize * (BlockSize + 4)) {
+        assert(BlockSize > 0 && BlockSize <= packets::Data::MaxBlockSize);
+        assert(WindowSize > 0);
+        Sizes.reserve(WindowSize);
+    }
+
+    /// Append the Data packet to the window
+    /// @param[Size] Assumptions: \p Size is less or equal than the block size, only the last packet of the window may
+    /// be shorter than the block size
+    /// @return Pointer to \p Size bytes of the data field to be filled by the caller
+    std::uint8_t *append(std::uint16_t Block, std::size_t Size) noexcept {
+        assert(Sizes.size() < WindowSize);
+        assert(Size <= BlockSize);
+        assert(Sizes.empty() || Sizes.back() == BlockSize + 4);
+        auto *Packet = Buffer.data() + Sizes.size() * (BlockSize + 4);
+        Packet[0] = 0;
+        Packet[1] = static_cast<std::uint8_t>(packets::types::DataPacket);
+        Packet[2] = static_cast<std::uint8_t>(Block >> 8);
+        Packet[3] = static_cast<std::uint8_t>(Block);
+        Sizes.push_back(Size + 4);
+        return Packet + 4;
+    }
+
+    /// Append the Data packet to the window copying its data field
+    void append(std::uint16_t Block, const std::uint8_t *Data, std::size_t Size) noexcept {
+        std::memcpy(append(Block, Size), Data, Size);
+    }
+
+    /// Drop all packets of the window, e.g. to build the next one
+    void clear() noexcept {
+        Sizes.clear();
+        Sent = 0;
+    }
+
+    /// Send the packets that haven't been sent yet
+    /// @n On a non-blocking socket the error is `std::errc::resource_unavailable_try_again` if the socket send buffer
+    /// is full, the next call continues with the first packet that wasn't sent
+    /// @return Error of the last system call or an empty error code if all packets of the window have been sent
+    std::error_code send(int Descriptor, const sockaddr *To, socklen_t Length) {
+        while (Sent < Sizes.size()) {
+            auto Result = Segmentation ? sendSegmented(Descriptor, To, Length) : sendMultiple(Descriptor, To, Length);
+            if (Result < 0) {
+                if (Segmentation && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                    // The kernel or the outgoing device doesn't support segmentation (or the segment exceeds MTU)
+                    Segmentation = false;
+                    continue;
+                }
+                return std::error_code(errno, std::generic_category());
+            }
+            Sent += static_cast<std::size_t>(Result);
+        }
+        return std::error_code{};
+    }
+
+    /// @return Number of packets in the window
+    std::size_t size() const noexcept { return Sizes.size(); }
+
+    /// @return Number of packets of the window that have been sent
+    std::size_t getSent() const noexcept { return Sent; }
+
+    /// @return Number of system calls made to send the packets
+    std::size_t getSystemCallsCount() const noexcept { return SystemCalls; }
+
+    /// @return true if the packets are sent with UDP generic segmentation offload
+    bool isSegmentationEnabled() const noexcept { return Segmentation; }
+
+    /// Enable or disable UDP generic segmentation offload, it's disabled automatically if the kernel rejects it
+    void setSegmentation(bool Enabled) noexcept { Segmentation = Enabled; }
+
+  private:
+    /// @return Number of packets sent or -1
+    ssize_t sendSegmented(int Descriptor, const sockaddr *To, socklen_t Length) {
+        auto Stride = BlockSize + 4;
+        auto Count = std::min({Sizes.size() - Sent, MaxSegments, std::max<std::size_t>(MaxPayloadSize / Stride, 1)});
+        auto Size = (Count - 1) * Stride + Sizes[Sent + Count - 1];
+
+        iovec Vector{Buffer.data() + Sent * Stride, Size};
+        msghdr Message{};
+        Message.msg_name = const_cast<sockaddr *>(To);
+        Message.msg_namelen = Length;
+        Message.msg_iov = &Vector;
+        Message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(std::uint16_t))] = {};
+        if (Count > 1) {
+            Message.msg_control = Control;
+            Message.msg_controllen = sizeof(Control);
+            auto *Header = CMSG_FIRSTHDR(&Message);
+            Header->cmsg_level = SOL_UDP;
+            Header->cmsg_type = UDP_SEGMENT;
+            Header->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+            auto SegmentSize = static_cast<std::uint16_t>(Stride);
+            std::memcpy(CMSG_DATA(Header), &SegmentSize, sizeof(SegmentSize));
+        }
+
+        ++SystemCalls;
+        if (::sendmsg(Descriptor, &Message, 0) < 0) {
+            return -1;
+        }
+        return static_cast<ssize_t>(Count);
+    }
+
+    /// @return Number of packets sent or -1
+    ssize_t sendMultiple(int Descriptor, const sockaddr *To, socklen_t Length) {
+        auto Stride = BlockSize + 4;
+        auto Count = std::min(Sizes.size() - Sent, MaxSegments);
+        iovec Vectors[MaxSegments];
+        mmsghdr Messages[MaxSegments] = {};
+        for (std::size_t Idx = 0; Idx != Count; ++Idx) {
+            Vectors[Idx] = iovec{Buffer.data() + (Sent + Idx) * Stride, Sizes[Sent + Idx]};
+            Messages[Idx].msg_hdr.msg_name = const_cast<sockaddr *>(To);
+            Messages[Idx].msg_hdr.msg_namelen = Length;
+            Messages[Idx].msg_hdr.msg_iov = &Vectors[Idx];
+            Messages[Idx].msg_hdr.msg_iovlen = 1;
+        }
+        ++SystemCalls;
+        return ::sendmmsg(Descriptor, Messages, static_cast<unsigned>(Count), 0);
+    }
+
+    std::size_t BlockSize;
+    std::size_t WindowSize;
+    std::vector<std::uint8_t> Buffer;
+    /// Sizes of the packets of the window
+    std::vector<std::size_t> Sizes;
+    std::size_t Sent = 0;
+    std::size_t SystemCalls = 0;
+    bool Segmentation = true;
+};
+
+} // namespace tftp_common::transfer
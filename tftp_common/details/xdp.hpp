@@ -0,0 +1,670 @@
+#pragma once
+
+#include "packets.hpp"
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace tftp_common::xdp {
+
+/// Sizes of the Ethernet, IPv4 (without options) and UDP headers in front of the UDP payload of the built frames
+inline constexpr std::size_t EthernetHeaderSize = 14;
+inline constexpr std::size_t IPv4HeaderSize = 20;
+inline constexpr std::size_t UdpHeaderSize = 8;
+inline constexpr std::size_t HeadersSize = EthernetHeaderSize + IPv4HeaderSize + UdpHeaderSize;
+/// Well-known port of read and write requests
+inline constexpr std::uint16_t RequestPort = 69;
+
+using MacAddress = std::array<std::uint8_t, 6>;
+
+namespace details {
+
+inline std::uint16_t load16(const std::uint8_t *Buffer) noexcept {
+    return static_cast<std::uint16_t>(Buffer[0] << 8 | Buffer[1]);
+}
+
+inline void store16(std::uint8_t *Buffer, std::uint16_t Value) noexcept {
+    Buffer[0] = static_cast<std::uint8_t>(Value >> 8);
+    Buffer[1] = static_cast<std::uint8_t>(Value);
+}
+
+/// Accumulate the buffer into the one's complement sum of 16-bit words (RFC 1071)
+inline std::uint64_t accumulate(std::uint64_t Sum, const std::uint8_t *Buffer, std::size_t Size) noexcept {
+    for (; Size >= 2; Buffer += 2, Size -= 2) {
+        Sum += load16(Buffer);
+    }
+    if (Size != 0) {
+        Sum += std::uint16_t(Buffer[0]) << 8;
+    }
+    return Sum;
+}
+
+inline std::uint16_t fold(std::uint64_t Sum) noexcept {
+    while (Sum >> 16) {
+        Sum = (Sum & 0xffff) + (Sum >> 16);
+    }
+    return static_cast<std::uint16_t>(~Sum);
+}
+
+} // namespace details
+
+/// Zero-copy view of a received Ethernet/IPv4/UDP frame, it points into the frame buffer (e.g. UMEM)
+struct FrameView {
+    std::uint8_t *Frame;
+    std::uint8_t *IPv4Header;
+    std::uint8_t *UdpHeader;
+    std::uint8_t *Payload;
+    std::size_t PayloadSize;
+
+    MacAddress getSourceMac() const noexcept {
+        MacAddress Address;
+        std::memcpy(Address.data(), Frame + 6, Address.size());
+        return Address;
+    }
+    MacAddress getDestinationMac() const noexcept {
+        MacAddress Address;
+        std::memcpy(Address.data(), Frame, Address.size());
+        return Address;
+    }
+    /// @return IPv4 addresses in network byte order, like in `in_addr`
+    std::uint32_t getSourceAddress() const noexcept {
+        std::uint32_t Address;
+        std::memcpy(&Address, IPv4Header + 12, sizeof(Address));
+        return Address;
+    }
+    std::uint32_t getDestinationAddress() const noexcept {
+        std::uint32_t Address;
+        std::memcpy(&Address, IPv4Header + 16, sizeof(Address));
+        return Address;
+    }
+    /// @return Ports in host byte order
+    std::uint16_t getSourcePort() const noexcept { return details::load16(UdpHeader); }
+    std::uint16_t getDestinationPort() const noexcept { return details::load16(UdpHeader + 2); }
+};
+
+/// Parse the Ethernet frame carrying an unfragmented IPv4 UDP datagram in place
+/// @return std::nullopt if it's anything else or the headers are inconsistent with the frame size
+inline std::optional<FrameView> parseFrame(std::uint8_t *Frame, std::size_t Size) noexcept {
+    if (Size < HeadersSize || details::load16(Frame + 12) != 0x0800) {
+        return std::nullopt;
+    }
+    auto *IPv4Header = Frame + EthernetHeaderSize;
+    std::size_t IPv4Size = (IPv4Header[0] & 0x0f) * 4u;
+    std::size_t TotalSize = details::load16(IPv4Header + 2);
+    if ((IPv4Header[0] >> 4) != 4 || IPv4Size < IPv4HeaderSize || TotalSize < IPv4Size + UdpHeaderSize ||
+        EthernetHeaderSize + TotalSize > Size) {
+        return std::nullopt;
+    }
+    // Fragments are left to the kernel, it reassembles them
+    if ((details::load16(IPv4Header + 6) & 0x3fff) != 0 || IPv4Header[9] != IPPROTO_UDP) {
+        return std::nullopt;
+    }
+    auto *UdpHeader = IPv4Header + IPv4Size;
+    std::size_t UdpSize = details::load16(UdpHeader + 4);
+    if (UdpSize < UdpHeaderSize || UdpSize > TotalSize - IPv4Size) {
+        return std::nullopt;
+    }
+    return FrameView{Frame, IPv4Header, UdpHeader, UdpHeader + UdpHeaderSize, UdpSize - UdpHeaderSize};
+}
+
+/// Addresses of the frames sent to one peer
+struct Route {
+    MacAddress SourceMac{};
+    MacAddress DestinationMac{};
+    /// IPv4 addresses in network byte order, like in `in_addr`
+    std::uint32_t SourceAddress = 0;
+    std::uint32_t DestinationAddress = 0;
+    /// Ports in host byte order
+    std::uint16_t SourcePort = 0;
+    std::uint16_t DestinationPort = 0;
+
+    /// @return Route of the replies to the received frame
+    static Route reply(const FrameView &Received) noexcept {
+        return Route{Received.getDestinationMac(),     Received.getSourceMac(),
+                     Received.getDestinationAddress(), Received.getSourceAddress(),
+                     Received.getDestinationPort(),    Received.getSourcePort()};
+    }
+};
+
+/// Write Ethernet, IPv4 and UDP headers (with checksums) in front of the UDP payload
+/// @param[Frame] Assumptions: \p PayloadSize bytes of the UDP payload are already at \p Frame + HeadersSize
+/// @return Size of the frame
+inline std::size_t buildFrame(std::uint8_t *Frame, const Route &Path, std::size_t PayloadSize) noexcept {
+    assert(PayloadSize <= 65535 - IPv4HeaderSize - UdpHeaderSize);
+    std::memcpy(Frame, Path.DestinationMac.data(), 6);
+    std::memcpy(Frame + 6, Path.SourceMac.data(), 6);
+    details::store16(Frame + 12, 0x0800);
+
+    auto *IPv4Header = Frame + EthernetHeaderSize;
+    IPv4Header[0] = 0x45;
+    IPv4Header[1] = 0;
+    details::store16(IPv4Header + 2, static_cast<std::uint16_t>(IPv4HeaderSize + UdpHeaderSize + PayloadSize));
+    // Identification is meaningless with Don't Fragment set (RFC 6864)
+    details::store16(IPv4Header + 4, 0);
+    details::store16(IPv4Header + 6, 0x4000);
+    IPv4Header[8] = 64;
+    IPv4Header[9] = IPPROTO_UDP;
+    details::store16(IPv4Header + 10, 0);
+    std::memcpy(IPv4Header + 12, &Path.SourceAddress, 4);
+    std::memcpy(IPv4Header + 16, &Path.DestinationAddress, 4);
+    details::store16(IPv4Header + 10, details::fold(details::accumulate(0, IPv4Header, IPv4HeaderSize)));
+
+    auto *UdpHeader = IPv4Header + IPv4HeaderSize;
+    auto UdpSize = static_cast<std::uint16_t>(UdpHeaderSize + PayloadSize);
+    details::store16(UdpHeader, Path.SourcePort);
+    details::store16(UdpHeader + 2, Path.DestinationPort);
+    details::store16(UdpHeader + 4, UdpSize);
+    details::store16(UdpHeader + 6, 0);
+    // Pseudo header: addresses, protocol and UDP length
+    auto Sum = details::accumulate(0, IPv4Header + 12, 8) + IPPROTO_UDP + UdpSize;
+    auto Checksum = details::fold(details::accumulate(Sum, UdpHeader, UdpSize));
+    // Zero means there's no checksum, it's transmitted as all ones (RFC 768)
+    details::store16(UdpHeader + 6, Checksum == 0 ? 0xffff : Checksum);
+    return HeadersSize + UdpSize - UdpHeaderSize;
+}
+
+/// Build the frame carrying the Data packet
+/// @param[Frame] Assumptions: \p Size bytes of the data field are already at \p Frame + HeadersSize + 4, so that the
+/// file can be read straight into the frame
+/// @return Size of the frame
+inline std::size_t buildDataFrame(std::uint8_t *Frame, const Route &Path, std::uint16_t Block,
+                                  std::size_t Size) noexcept {
+    assert(Size <= packets::Data::MaxBlockSize);
+    details::store16(Frame + HeadersSize, packets::types::DataPacket);
+    details::store16(Frame + HeadersSize + 2, Block);
+    return buildFrame(Frame, Path, Size + 4);
+}
+
+/// Build the frame carrying the Acknowledgment packet
+/// @return Size of the frame
+inline std::size_t buildAcknowledgmentFrame(std::uint8_t *Frame, const Route &Path, std::uint16_t Block) noexcept {
+    details::store16(Frame + HeadersSize, packets::types::AcknowledgmentPacket);
+    details::store16(Frame + HeadersSize + 2, Block);
+    return buildFrame(Frame, Path, 4);
+}
+
+/// @return true if the IPv4 header checksum and the UDP checksum (if present) of the frame are valid
+inline bool verifyChecksums(const FrameView &View) noexcept {
+    std::size_t IPv4Size = (View.IPv4Header[0] & 0x0f) * 4u;
+    if (details::fold(details::accumulate(0, View.IPv4Header, IPv4Size)) != 0) {
+        return false;
+    }
+    if (details::load16(View.UdpHeader + 6) == 0) {
+        return true;
+    }
+    auto UdpSize = static_cast<std::uint16_t>(UdpHeaderSize + View.PayloadSize);
+    auto Sum = details::accumulate(0, View.IPv4Header + 12, 8) + IPPROTO_UDP + UdpSize;
+    return details::fold(details::accumulate(Sum, View.UdpHeader, UdpSize)) == 0;
+}
+
+namespace details {
+
+/// Producer/consumer ring shared with the kernel
+template <typename T> struct Ring {
+    std::uint32_t *Producer = nullptr;
+    std::uint32_t *Consumer = nullptr;
+    std::uint32_t *Flags = nullptr;
+    T *Entries = nullptr;
+    std::uint32_t Size = 0;
+    void *Mapping = nullptr;
+    std::size_t MappingSize = 0;
+
+    std::error_code map(int Descriptor, const xdp_ring_offset &Offsets, std::uint32_t EntriesCount, off_t Offset) {
+        Size = EntriesCount;
+        MappingSize = Offsets.desc + EntriesCount * sizeof(T);
+        Mapping = ::mmap(nullptr, MappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Descriptor, Offset);
+        if (Mapping == MAP_FAILED) {
+            Mapping = nullptr;
+            return std::error_code(errno, std::generic_category());
+        }
+        auto *Base = static_cast<std::uint8_t *>(Mapping);
+        Producer = reinterpret_cast<std::uint32_t *>(Base + Offsets.producer);
+        Consumer = reinterpret_cast<std::uint32_t *>(Base + Offsets.consumer);
+        Flags = reinterpret_cast<std::uint32_t *>(Base + Offsets.flags);
+        Entries = reinterpret_cast<T *>(Base + Offsets.desc);
+        return std::error_code{};
+    }
+
+    void unmap() noexcept {
+        if (Mapping != nullptr) {
+            ::munmap(Mapping, MappingSize);
+            Mapping = nullptr;
+        }
+    }
+
+    T &operator[](std::uint32_t Index) noexcept { return Entries[Index & (Size - 1)]; }
+
+    /// @return Number of entries that can be produced
+    std::uint32_t getFree() const noexcept {
+        return Size - (*Producer - __atomic_load_n(Consumer, __ATOMIC_ACQUIRE));
+    }
+    /// @return Number of produced entries the consumer hasn't taken yet
+    std::uint32_t getQueued() const noexcept { return Size - getFree(); }
+    /// @return Number of entries that can be consumed
+    std::uint32_t getAvailable() const noexcept { return __atomic_load_n(Producer, __ATOMIC_ACQUIRE) - *Consumer; }
+
+    void produce(std::uint32_t Count) noexcept { __atomic_store_n(Producer, *Producer + Count, __ATOMIC_RELEASE); }
+    void consume(std::uint32_t Count) noexcept { __atomic_store_n(Consumer, *Consumer + Count, __ATOMIC_RELEASE); }
+};
+
+} // namespace details
+
+/// Settings of the AF_XDP socket and its UMEM
+struct XskConfig {
+    /// Number of UMEM frames, a power of two
+    std::uint32_t FramesCount = 4096;
+    /// Size of a UMEM frame, a power of two between 2048 and the page size
+    std::uint32_t FrameSize = 2048;
+    /// Number of entries of each ring, a power of two
+    std::uint32_t RingSize = 2048;
+    /// Copy mode works everywhere including generic (SKB) XDP on veth, zero-copy mode needs driver support
+    bool Copy = true;
+};
+
+/// AF_XDP socket with its own UMEM, bound to a single queue of the network interface
+/// @n Half of the UMEM frames is given to the kernel for reception, the other half is used for transmission. Received
+/// frames are handed out as zero-copy views and given back to the kernel once the callback returns; frames to be
+/// transmitted are built in place by the caller (see buildDataFrame) and queued by XskSocket::transmit.
+class XskSocket final {
+  public:
+    XskSocket() = default;
+    XskSocket(const XskSocket &) = delete;
+    XskSocket &operator=(const XskSocket &) = delete;
+    ~XskSocket() { close(); }
+
+    /// Create the socket with its UMEM and rings and bind it to the queue of the interface
+    std::error_code open(const std::string &Interface, std::uint32_t Queue, const XskConfig &Settings = {}) {
+        assert(Descriptor == -1);
+        auto Index = ::if_nametoindex(Interface.c_str());
+        if (Index == 0) {
+            return std::error_code(errno, std::generic_category());
+        }
+        Settings_ = Settings;
+        auto Error = setup(Index, Queue);
+        if (Error) {
+            close();
+        }
+        return Error;
+    }
+
+    void close() noexcept {
+        for (auto *Ring : {&Fill, &Completion}) {
+            Ring->unmap();
+        }
+        Receive.unmap();
+        Transmit.unmap();
+        if (Descriptor != -1) {
+            ::close(Descriptor);
+            Descriptor = -1;
+        }
+        if (Umem != nullptr) {
+            ::munmap(Umem, std::size_t(Settings_.FramesCount) * Settings_.FrameSize);
+            Umem = nullptr;
+        }
+        FreeFrames.clear();
+    }
+
+    int getDescriptor() const noexcept { return Descriptor; }
+
+    /// Handle the received frames that carry UDP datagrams, other frames are dropped
+    /// @param[OnFrame] Requirements: \p OnFrame must be callable with \p FrameView&, the view is valid until it returns
+    /// @return Number of the received frames
+    template <class Callback> std::size_t receive(Callback &&OnFrame) {
+        auto Available = Receive.getAvailable();
+        if (Available == 0) {
+            return 0;
+        }
+        auto Consumer = *Receive.Consumer;
+        for (std::uint32_t Idx = 0; Idx != Available; ++Idx) {
+            const auto &Entry = Receive[Consumer + Idx];
+            if (auto View = parseFrame(getFrame(Entry.addr), Entry.len)) {
+                OnFrame(*View);
+            }
+        }
+        // The fill ring has room for all frames given to the kernel, the frames are returned right away
+        auto Producer = *Fill.Producer;
+        for (std::uint32_t Idx = 0; Idx != Available; ++Idx) {
+            Fill[Producer + Idx] = Receive[Consumer + Idx].addr & ~std::uint64_t(Settings_.FrameSize - 1);
+        }
+        Receive.consume(Available);
+        Fill.produce(Available);
+        return Available;
+    }
+
+    /// @return Frame for transmission or nullptr if all of them are in flight (call XskSocket::flush)
+    std::uint8_t *allocate() noexcept {
+        reclaim();
+        if (FreeFrames.empty()) {
+            return nullptr;
+        }
+        auto Address = FreeFrames.back();
+        FreeFrames.pop_back();
+        return getFrame(Address);
+    }
+
+    /// Queue the frame built in place for transmission
+    /// @param[Frame] Assumptions: \p Frame has been returned by XskSocket::allocate
+    void transmit(std::uint8_t *Frame, std::size_t Size) noexcept {
+        assert(Size <= Settings_.FrameSize);
+        // The transmit ring is as large as the number of frames for transmission, there's always room for one
+        assert(Transmit.getFree() > 0);
+        auto &Entry = Transmit[*Transmit.Producer];
+        Entry.addr = static_cast<std::uint64_t>(Frame - static_cast<std::uint8_t *>(Umem));
+        Entry.len = static_cast<std::uint32_t>(Size);
+        Entry.options = 0;
+        Transmit.produce(1);
+    }
+
+    /// Kick the kernel to transmit the queued frames and reclaim the transmitted ones
+    /// @n Copy mode sends at most 32 frames per kick (and fails it with EAGAIN if there are more), so the kernel is
+    /// kicked until it has taken all queued frames. Frames it doesn't make progress on are kicked by the next call.
+    std::error_code flush() {
+        while (auto Queued = Transmit.getQueued()) {
+            if (::sendto(Descriptor, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && errno != EAGAIN &&
+                errno != EBUSY && errno != ENOBUFS) {
+                return std::error_code(errno, std::generic_category());
+            }
+            reclaim();
+            if (Transmit.getQueued() >= Queued) {
+                break;
+            }
+        }
+        reclaim();
+        return std::error_code{};
+    }
+
+    /// @return Number of frames available for transmission
+    std::size_t getFreeFrames() noexcept {
+        reclaim();
+        return FreeFrames.size();
+    }
+
+  private:
+    std::uint8_t *getFrame(std::uint64_t Address) noexcept { return static_cast<std::uint8_t *>(Umem) + Address; }
+
+    void reclaim() noexcept {
+        auto Available = Completion.getAvailable();
+        auto Consumer = *Completion.Consumer;
+        for (std::uint32_t Idx = 0; Idx != Available; ++Idx) {
+            FreeFrames.push_back(Completion[Consumer + Idx]);
+        }
+        Completion.consume(Available);
+    }
+
+    std::error_code setup(unsigned Index, std::uint32_t Queue) {
+        auto Error = [] { return std::error_code(errno, std::generic_category()); };
+        auto UmemSize = std::size_t(Settings_.FramesCount) * Settings_.FrameSize;
+        Umem = ::mmap(nullptr, UmemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (Umem == MAP_FAILED) {
+            Umem = nullptr;
+            return Error();
+        }
+        Descriptor = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+        if (Descriptor == -1) {
+            return Error();
+        }
+
+        xdp_umem_reg Registration{};
+        Registration.addr = reinterpret_cast<std::uint64_t>(Umem);
+        Registration.len = UmemSize;
+        Registration.chunk_size = Settings_.FrameSize;
+        if (::setsockopt(Descriptor, SOL_XDP, XDP_UMEM_REG, &Registration, sizeof(Registration)) != 0) {
+            return Error();
+        }
+        auto RxFrames = Settings_.FramesCount / 2;
+        auto TxFrames = Settings_.FramesCount - RxFrames;
+        // Fill and completion rings hold every frame of their half, so that they never overflow
+        std::uint32_t FillSize = RxFrames, CompletionSize = TxFrames, RingSize = Settings_.RingSize;
+        if (::setsockopt(Descriptor, SOL_XDP, XDP_UMEM_FILL_RING, &FillSize, sizeof(FillSize)) != 0 ||
+            ::setsockopt(Descriptor, SOL_XDP, XDP_UMEM_COMPLETION_RING, &CompletionSize, sizeof(CompletionSize)) != 0 ||
+            ::setsockopt(Descriptor, SOL_XDP, XDP_RX_RING, &RingSize, sizeof(RingSize)) != 0 ||
+            ::setsockopt(Descriptor, SOL_XDP, XDP_TX_RING, &TxFrames, sizeof(TxFrames)) != 0) {
+            return Error();
+        }
+
+        xdp_mmap_offsets Offsets{};
+        socklen_t Length = sizeof(Offsets);
+        if (::getsockopt(Descriptor, SOL_XDP, XDP_MMAP_OFFSETS, &Offsets, &Length) != 0) {
+            return Error();
+        }
+        if (auto Failure = Fill.map(Descriptor, Offsets.fr, FillSize, XDP_UMEM_PGOFF_FILL_RING)) {
+            return Failure;
+        }
+        if (auto Failure = Completion.map(Descriptor, Offsets.cr, CompletionSize, XDP_UMEM_PGOFF_COMPLETION_RING)) {
+            return Failure;
+        }
+        if (auto Failure = Receive.map(Descriptor, Offsets.rx, RingSize, XDP_PGOFF_RX_RING)) {
+            return Failure;
+        }
+        if (auto Failure = Transmit.map(Descriptor, Offsets.tx, TxFrames, XDP_PGOFF_TX_RING)) {
+            return Failure;
+        }
+
+        for (std::uint32_t Idx = 0; Idx != RxFrames; ++Idx) {
+            Fill[*Fill.Producer + Idx] = std::uint64_t(Idx) * Settings_.FrameSize;
+        }
+        Fill.produce(RxFrames);
+        FreeFrames.reserve(TxFrames);
+        for (std::uint32_t Idx = RxFrames; Idx != Settings_.FramesCount; ++Idx) {
+            FreeFrames.push_back(std::uint64_t(Idx) * Settings_.FrameSize);
+        }
+
+        sockaddr_xdp Address{};
+        Address.sxdp_family = AF_XDP;
+        Address.sxdp_ifindex = Index;
+        Address.sxdp_queue_id = Queue;
+        Address.sxdp_flags = Settings_.Copy ? XDP_COPY : XDP_ZEROCOPY;
+        if (::bind(Descriptor, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address)) != 0) {
+            return Error();
+        }
+        return std::error_code{};
+    }
+
+    XskConfig Settings_;
+    int Descriptor = -1;
+    void *Umem = nullptr;
+    details::Ring<std::uint64_t> Fill;
+    details::Ring<std::uint64_t> Completion;
+    details::Ring<xdp_desc> Receive;
+    details::Ring<xdp_desc> Transmit;
+    std::vector<std::uint64_t> FreeFrames;
+};
+
+/// XDP program steering UDP datagrams for the given range of destination ports to the AF_XDP sockets
+/// @n Everything else (ARP, read/write requests to port 69 even if the range includes it, fragmented datagrams, other
+/// traffic) is passed on to the kernel network stack, so the regular sockets keep working. The program is attached in
+/// generic (SKB) mode by default, which works on any interface including veth pairs. It's detached when the object
+/// is destroyed.
+class Program final {
+  public:
+    Program() = default;
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+    ~Program() { detach(); }
+
+    /// Load the program and attach it to the interface
+    /// @param[QueuesCount] Number of queues of the interface that may have AF_XDP sockets
+    std::error_code attach(const std::string &Interface, std::uint16_t LowPort, std::uint16_t HighPort,
+                           std::uint32_t QueuesCount = 1, std::uint32_t Flags = XDP_FLAGS_SKB_MODE) {
+        assert(Link == -1);
+        auto Index = ::if_nametoindex(Interface.c_str());
+        if (Index == 0) {
+            return std::error_code(errno, std::generic_category());
+        }
+
+        bpf_attr Attributes{};
+        Attributes.map_type = BPF_MAP_TYPE_XSKMAP;
+        Attributes.key_size = sizeof(std::uint32_t);
+        Attributes.value_size = sizeof(std::uint32_t);
+        Attributes.max_entries = QueuesCount;
+        Map = system(BPF_MAP_CREATE, Attributes);
+        if (Map < 0) {
+            return fail();
+        }
+
+        auto Instructions = assemble(LowPort, HighPort);
+        static constexpr char License[] = "Dual BSD/GPL";
+        Attributes = bpf_attr{};
+        Attributes.prog_type = BPF_PROG_TYPE_XDP;
+        Attributes.insns = reinterpret_cast<std::uint64_t>(Instructions.data());
+        Attributes.insn_cnt = static_cast<std::uint32_t>(Instructions.size());
+        Attributes.license = reinterpret_cast<std::uint64_t>(License);
+        Code = system(BPF_PROG_LOAD, Attributes);
+        if (Code < 0) {
+            return fail();
+        }
+
+        Attributes = bpf_attr{};
+        Attributes.link_create.prog_fd = static_cast<std::uint32_t>(Code);
+        Attributes.link_create.target_ifindex = Index;
+        Attributes.link_create.attach_type = BPF_XDP;
+        Attributes.link_create.flags = Flags;
+        Link = system(BPF_LINK_CREATE, Attributes);
+        if (Link < 0) {
+            return fail();
+        }
+        return std::error_code{};
+    }
+
+    /// Steer the datagrams received by the queue to the socket
+    std::error_code addSocket(std::uint32_t Queue, const XskSocket &Socket) {
+        assert(Map != -1);
+        std::uint32_t Value = static_cast<std::uint32_t>(Socket.getDescriptor());
+        bpf_attr Attributes{};
+        Attributes.map_fd = static_cast<std::uint32_t>(Map);
+        Attributes.key = reinterpret_cast<std::uint64_t>(&Queue);
+        Attributes.value = reinterpret_cast<std::uint64_t>(&Value);
+        if (system(BPF_MAP_UPDATE_ELEM, Attributes) < 0) {
+            return std::error_code(errno, std::generic_category());
+        }
+        return std::error_code{};
+    }
+
+    void detach() noexcept {
+        for (auto *Descriptor : {&Link, &Code, &Map}) {
+            if (*Descriptor != -1) {
+                ::close(*Descriptor);
+                *Descriptor = -1;
+            }
+        }
+    }
+
+  private:
+    static int system(int Command, bpf_attr &Attributes) noexcept {
+        return static_cast<int>(::syscall(__NR_bpf, Command, &Attributes, sizeof(Attributes)));
+    }
+
+    std::error_code fail() noexcept {
+        std::error_code Error(errno, std::generic_category());
+        detach();
+        return Error;
+    }
+
+    static bpf_insn instruction(std::uint8_t Opcode, std::uint8_t Destination, std::uint8_t Source,
+                                std::int16_t Offset, std::int32_t Immediate) noexcept {
+        bpf_insn Result{};
+        Result.code = Opcode;
+        Result.dst_reg = Destination & 0x0f;
+        Result.src_reg = Source & 0x0f;
+        Result.off = Offset;
+        Result.imm = Immediate;
+        return Result;
+    }
+
+    /// Hand-assembled equivalent of:
+    /// @code
+    /// if (Ethernet type is IPv4 && IHL == 5 && not a fragment && protocol is UDP &&
+    ///     UDP destination port != 69 && LowPort <= UDP destination port <= HighPort)
+    ///     return bpf_redirect_map(&Sockets, ctx->rx_queue_index, XDP_PASS);
+    /// return XDP_PASS;
+    /// @endcode
+    std::vector<bpf_insn> assemble(std::uint16_t LowPort, std::uint16_t HighPort) const {
+        std::vector<bpf_insn> Code_;
+        std::vector<std::size_t> ToPass;
+        auto passIf = [&](std::uint8_t Condition, std::uint8_t Register, std::int32_t Immediate) {
+            ToPass.push_back(Code_.size());
+            Code_.push_back(instruction(BPF_JMP | Condition | BPF_K, Register, 0, 0, Immediate));
+        };
+        auto load = [&](std::uint8_t Size, std::uint8_t Destination, std::uint8_t Source, std::int16_t Offset) {
+            Code_.push_back(instruction(BPF_LDX | Size | BPF_MEM, Destination, Source, Offset, 0));
+        };
+        auto toHost16 = [&](std::uint8_t Register) {
+            Code_.push_back(instruction(BPF_ALU | BPF_END | BPF_TO_BE, Register, 0, 0, 16));
+        };
+
+        // r6 = ctx, r2 = data, r3 = data_end
+        Code_.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+        load(BPF_W, 2, 6, offsetof(xdp_md, data));
+        load(BPF_W, 3, 6, offsetof(xdp_md, data_end));
+        // if (data + headers > data_end) pass
+        Code_.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+        Code_.push_back(instruction(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, HeadersSize));
+        ToPass.push_back(Code_.size());
+        Code_.push_back(instruction(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0));
+
+        load(BPF_H, 5, 2, 12);
+        toHost16(5);
+        passIf(BPF_JNE, 5, 0x0800);
+        load(BPF_B, 5, 2, EthernetHeaderSize);
+        passIf(BPF_JNE, 5, 0x45);
+        load(BPF_H, 5, 2, EthernetHeaderSize + 6);
+        toHost16(5);
+        Code_.push_back(instruction(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, 0x3fff));
+        passIf(BPF_JNE, 5, 0);
+        load(BPF_B, 5, 2, EthernetHeaderSize + 9);
+        passIf(BPF_JNE, 5, IPPROTO_UDP);
+        load(BPF_H, 5, 2, EthernetHeaderSize + IPv4HeaderSize + 2);
+        toHost16(5);
+        // Requests are left to the listening socket of the regular server
+        passIf(BPF_JEQ, 5, RequestPort);
+        passIf(BPF_JLT, 5, LowPort);
+        passIf(BPF_JGT, 5, HighPort);
+
+        // return bpf_redirect_map(map, ctx->rx_queue_index, XDP_PASS)
+        load(BPF_W, 2, 6, offsetof(xdp_md, rx_queue_index));
+        Code_.push_back(instruction(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, Map));
+        Code_.push_back(instruction(0, 0, 0, 0, 0));
+        Code_.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS));
+        Code_.push_back(instruction(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+        Code_.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+        // pass: return XDP_PASS
+        auto Pass = Code_.size();
+        Code_.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS));
+        Code_.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+        for (auto Jump : ToPass) {
+            Code_[Jump].off = static_cast<std::int16_t>(Pass - Jump - 1);
+        }
+        return Code_;
+    }
+
+    int Map = -1;
+    int Code = -1;
+    int Link = -1;
+};
+
+} // namespace tftp_common::xdp
@@ -1,4 +1,13 @@
 #pragma once
 
+#include "details/multicast.hpp"
+#include "details/options.hpp"
+#include "details/pacing.hpp"
 #include "details/packets.hpp"
 #include "details/parsers.hpp"
+#include "details/pcap.hpp"
+#include "details/producer.hpp"
+#include "details/rto.hpp"
+#include "details/session_store.hpp"
+#include "details/session_table.hpp"
+#include "details/timer_wheel.hpp"